@@ -0,0 +1,1769 @@
+/*
+ * TinyEMU micro-benchmarks
+ *
+ * Copyright (c) 2026 Fernando Lemos
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * The results are printed one per line as "name value unit" so that
+ * they can be compared between two builds. The lines starting with '#'
+ * are comments. The inputs are fixed, so each benchmark executes the
+ * same instructions at every run.
+ *
+ * The guest benchmarks are small bare metal programs generated at run
+ * time. They run in M mode (S mode with paging for "tlb") and stop
+ * with wfi. Any exception stops the guest with an error.
+ *
+ * With -c, regression checks are run instead and reported as
+ * "name ok" or "name FAILED". The exit code is non zero if a check
+ * failed. The "diff" checks run every guest with the interpreter and
+ * with the dynamic translator and compare the number of executed
+ * instructions, the final CPU state and the RAM.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef CONFIG_RISCV_SMP
+#include <pthread.h>
+#endif
+
+#include "cutils.h"
+#include "iomem.h"
+#include "softfp.h"
+#include "snapshot.h"
+#include "riscv_cpu.h"
+
+static void help(void)
+{
+    printf("TinyEMU benchmarks version " CONFIG_VERSION "\n"
+           "usage: bench [options] [name...]\n"
+           "Run the benchmarks whose name contains one of the arguments (all\n"
+           "of them by default).\n"
+           "\n"
+           "Options:\n"
+           "-h      this help\n"
+           "-x xlen XLEN of the RISC-V guests (32, 64 or 128, default: 64)\n"
+           "-m xlen maximum XLEN of the RISC-V CPU (default: the guest XLEN)\n"
+           "-j      also run the RISC-V guests with the dynamic translator\n"
+           "-c      run the correctness checks instead of the benchmarks\n"
+           "-r n    number of runs, the best one is reported (default: 3)\n"
+           "-s f    multiply the iteration counts by 'f' (default: 1)\n");
+    exit(1);
+}
+
+static int64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint64_t bench_rand_state = 0x2545f4914f6cdd1d;
+
+/* xorshift64*, always the same sequence */
+static uint64_t bench_rand(void)
+{
+    uint64_t x = bench_rand_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    bench_rand_state = x;
+    return x * 0x2545f4914f6cdd1d;
+}
+
+static int bench_runs = 3;
+static double bench_scale = 1;
+static int bench_filter_count;
+static char **bench_filter;
+static volatile uint64_t bench_sink;
+
+static BOOL bench_selected(const char *name)
+{
+    int i;
+    if (bench_filter_count == 0)
+        return TRUE;
+    for(i = 0; i < bench_filter_count; i++) {
+        if (strstr(name, bench_filter[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static int bench_count(int n)
+{
+    n = (int)(n * bench_scale);
+    return max_int(n, 1);
+}
+
+static void bench_result(const char *name, double val, const char *unit)
+{
+    printf("%-24s %10.2f %s\n", name, val, unit);
+    fflush(stdout);
+}
+
+static void check_result(const char *name, BOOL ok)
+{
+    printf("%-24s %s\n", name, ok ? "ok" : "FAILED");
+    fflush(stdout);
+}
+
+/* soft float operations */
+
+#define SF_TAB_SIZE 1024 /* must be a power of two */
+#define SF_OP_COUNT 2000000
+
+enum {
+    SF_OP_ADD,
+    SF_OP_SUB,
+    SF_OP_MUL,
+    SF_OP_DIV,
+    SF_OP_SQRT,
+    SF_OP_FMA,
+    SF_OP_TO_I64,
+    SF_OP_FROM_I64,
+    SF_OP_NB,
+};
+
+static const char *sf_op_names[SF_OP_NB] = {
+    "add_sf%d",
+    "sub_sf%d",
+    "mul_sf%d",
+    "div_sf%d",
+    "sqrt_sf%d",
+    "fma_sf%d",
+    "cvt_sf%d_i64",
+    "cvt_i64_sf%d",
+};
+
+#define F_SIZE 32
+#include "bench_softfp_template.h"
+
+#define F_SIZE 64
+#include "bench_softfp_template.h"
+
+#ifdef HAVE_INT128
+#define F_SIZE 128
+#include "bench_softfp_template.h"
+#endif
+
+static uint64_t sf_run(int f_size, int op, int n)
+{
+    switch(f_size) {
+    case 32:
+        return sf_run32(op, n);
+    case 64:
+        return sf_run64(op, n);
+#ifdef HAVE_INT128
+    case 128:
+        return sf_run128(op, n);
+#endif
+    default:
+        abort();
+    }
+}
+
+static void bench_softfp(void)
+{
+    static const int f_sizes[] = { 32, 64,
+#ifdef HAVE_INT128
+                                   128,
+#endif
+    };
+    char op_name[32], name[64];
+    int i, op, run, n;
+    int64_t ti, best;
+
+    sf_init32();
+    sf_init64();
+#ifdef HAVE_INT128
+    sf_init128();
+#endif
+    for(i = 0; i < countof(f_sizes); i++) {
+        for(op = 0; op < SF_OP_NB; op++) {
+            /* the 128 bit division and square root compute one bit
+               per iteration */
+            if (f_sizes[i] == 128 && (op == SF_OP_DIV || op == SF_OP_SQRT))
+                n = bench_count(SF_OP_COUNT / 64);
+            else
+                n = bench_count(SF_OP_COUNT);
+            snprintf(op_name, sizeof(op_name), sf_op_names[op], f_sizes[i]);
+            snprintf(name, sizeof(name), "softfp/%s", op_name);
+            if (!bench_selected(name))
+                continue;
+            best = INT64_MAX;
+            for(run = 0; run < bench_runs; run++) {
+                ti = get_time_ns();
+                bench_sink += sf_run(f_sizes[i], op, n);
+                ti = get_time_ns() - ti;
+                if (ti < best)
+                    best = ti;
+            }
+            if (best < 1)
+                best = 1;
+            bench_result(name, (double)n * 1e3 / best, "Mops/s");
+        }
+    }
+}
+
+#define SF_CHECK_COUNT 1000000
+
+/* compare the host FPU path of the 32 and 64 bit operations with the
+   soft float path */
+static int check_softfp(void)
+{
+    static const int f_sizes[] = { 32, 64 };
+    char op_name[32], name[64];
+    int i, op, n_err, ret;
+
+    ret = 0;
+    for(i = 0; i < countof(f_sizes); i++) {
+        for(op = SF_OP_ADD; op <= SF_OP_FMA; op++) {
+            snprintf(op_name, sizeof(op_name), sf_op_names[op], f_sizes[i]);
+            snprintf(name, sizeof(name), "softfp/%s", op_name);
+            if (!bench_selected(name))
+                continue;
+            if (f_sizes[i] == 32)
+                n_err = sf_check32(op, name, SF_CHECK_COUNT);
+            else
+                n_err = sf_check64(op, name, SF_CHECK_COUNT);
+            if (n_err != 0) {
+                fprintf(stderr, "%s: %d mismatches\n", name, n_err);
+                ret = -1;
+            }
+            check_result(name, n_err == 0);
+        }
+    }
+    return ret;
+}
+
+/* RISC-V guests */
+
+#define BOOT_ADDR   0x1000 /* reset address */
+#define RAM_BASE    0x80000000
+#define RAM_SIZE    (4 << 20)
+#define TRAP_OFFSET 0x0 /* M mode trap handler */
+#define TRAP_CAUSE_OFFSET 0x10 /* mcause is stored here by the handler */
+#define CODE_OFFSET 0x100
+#define DATA_OFFSET 0x100000
+#define PT_OFFSET   0x200000 /* page tables of the "tlb" guest */
+#define MMIO_ADDR   0x10000000
+#define MMIO_SIZE   0x1000
+
+#define GUEST_EXEC_CYCLE 1000000
+#define GUEST_CYCLES_PER_ITER_MAX 64 /* limit to detect runaway guests */
+/* the differential checks run fewer iterations than the benchmarks */
+#define DIFF_ITER_DIV 16
+
+/* "tlb" guest: TLB_PAGES virtual pages, accessed in an order defeating
+   the TLB, are mapped to TLB_PHYS_PAGES physical pages */
+#define TLB_VADDR 0x40000000
+#define TLB_PAGES 16384
+#define TLB_PHYS_PAGES 64
+#define TLB_STRIDE 97
+
+enum {
+    ZERO = 0, RA = 1, SP = 2, T0 = 5, T1 = 6, T2 = 7, S0 = 8, S1 = 9,
+    A0 = 10, A1 = 11, A2 = 12, A3 = 13, A4 = 14, A5 = 15, S2 = 18,
+    T5 = 30, T6 = 31,
+};
+
+/* code generation in guest memory. The branch targets are offsets from
+   the start of the code. */
+typedef struct {
+    uint8_t *buf;
+    uint32_t pc; /* offset of the next instruction */
+    int xlen;
+} Asm;
+
+static void emit32(Asm *a, uint32_t insn)
+{
+    memcpy(a->buf + a->pc, &insn, 4);
+    a->pc += 4;
+}
+
+static void emit16(Asm *a, uint16_t insn)
+{
+    memcpy(a->buf + a->pc, &insn, 2);
+    a->pc += 2;
+}
+
+static uint32_t enc_r(int opcode, int funct3, int funct7,
+                      int rd, int rs1, int rs2)
+{
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+        (rd << 7) | opcode;
+}
+
+static uint32_t enc_i(int opcode, int funct3, int rd, int rs1, int imm)
+{
+    return ((uint32_t)(imm & 0xfff) << 20) | (rs1 << 15) |
+        (funct3 << 12) | (rd << 7) | opcode;
+}
+
+static uint32_t enc_s(int opcode, int funct3, int rs2, int rs1, int imm)
+{
+    return ((uint32_t)((imm >> 5) & 0x7f) << 25) | (rs2 << 20) |
+        (rs1 << 15) | (funct3 << 12) | ((imm & 0x1f) << 7) | opcode;
+}
+
+static uint32_t enc_b(int funct3, int rs1, int rs2, uint32_t imm)
+{
+    return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3f) << 25) |
+        (rs2 << 20) | (rs1 << 15) | (funct3 << 12) |
+        (((imm >> 1) & 0xf) << 8) | (((imm >> 11) & 1) << 7) | 0x63;
+}
+
+static uint32_t enc_j(int rd, uint32_t imm)
+{
+    return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3ff) << 21) |
+        (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xff) << 12) |
+        (rd << 7) | 0x6f;
+}
+
+static void asm_r(Asm *a, int opcode, int funct3, int funct7,
+                  int rd, int rs1, int rs2)
+{
+    emit32(a, enc_r(opcode, funct3, funct7, rd, rs1, rs2));
+}
+
+static void asm_i(Asm *a, int opcode, int funct3, int rd, int rs1, int imm)
+{
+    emit32(a, enc_i(opcode, funct3, rd, rs1, imm));
+}
+
+static void asm_s(Asm *a, int opcode, int funct3, int rs2, int rs1, int imm)
+{
+    emit32(a, enc_s(opcode, funct3, rs2, rs1, imm));
+}
+
+static void asm_b(Asm *a, int funct3, int rs1, int rs2, uint32_t target)
+{
+    emit32(a, enc_b(funct3, rs1, rs2, target - a->pc));
+}
+
+static void asm_jal(Asm *a, int rd, uint32_t target)
+{
+    emit32(a, enc_j(rd, target - a->pc));
+}
+
+static void asm_fma(Asm *a, int fmt, int rd, int rs1, int rs2, int rs3)
+{
+    emit32(a, (rs3 << 27) | (fmt << 25) | (rs2 << 20) | (rs1 << 15) |
+           (7 << 12) | (rd << 7) | 0x43);
+}
+
+/* CA format: rd and rs2 are in x8-x15 */
+static void asm_ca(Asm *a, int funct2, int rd, int rs2)
+{
+    emit16(a, 0x8c01 | ((rd - 8) << 7) | (funct2 << 5) | ((rs2 - 8) << 2));
+}
+
+/* CL and CS formats: the offset is a multiple of 4 below 128 */
+static void asm_cls(Asm *a, int funct3, int rd, int rs1, int imm)
+{
+    emit16(a, (funct3 << 13) | (((imm >> 3) & 7) << 10) | ((rs1 - 8) << 7) |
+           (((imm >> 2) & 1) << 6) | (((imm >> 6) & 1) << 5) |
+           ((rd - 8) << 2));
+}
+
+static void asm_cbnez(Asm *a, int rs1, uint32_t target)
+{
+    uint32_t imm = target - a->pc;
+    emit16(a, 0xe001 | (((imm >> 8) & 1) << 12) | (((imm >> 3) & 3) << 10) |
+           ((rs1 - 8) << 7) | (((imm >> 6) & 3) << 5) |
+           (((imm >> 1) & 3) << 3) | (((imm >> 5) & 1) << 2));
+}
+
+static void asm_cj(Asm *a, uint32_t target)
+{
+    uint32_t imm = target - a->pc;
+    emit16(a, 0xa001 | (((imm >> 11) & 1) << 12) | (((imm >> 4) & 1) << 11) |
+           (((imm >> 8) & 3) << 9) | (((imm >> 10) & 1) << 8) |
+           (((imm >> 6) & 1) << 7) | (((imm >> 7) & 1) << 6) |
+           (((imm >> 1) & 7) << 3) | (((imm >> 5) & 1) << 2));
+}
+
+#define ADDI(rd, rs1, imm)  asm_i(a, 0x13, 0, rd, rs1, imm)
+#define SLLI(rd, rs1, sh)   asm_i(a, 0x13, 1, rd, rs1, sh)
+#define SRLI(rd, rs1, sh)   asm_i(a, 0x13, 5, rd, rs1, sh)
+#define ANDI(rd, rs1, imm)  asm_i(a, 0x13, 7, rd, rs1, imm)
+#define ADD(rd, rs1, rs2)   asm_r(a, 0x33, 0, 0x00, rd, rs1, rs2)
+#define SUB(rd, rs1, rs2)   asm_r(a, 0x33, 0, 0x20, rd, rs1, rs2)
+#define SLTU(rd, rs1, rs2)  asm_r(a, 0x33, 3, 0x00, rd, rs1, rs2)
+#define XOR(rd, rs1, rs2)   asm_r(a, 0x33, 4, 0x00, rd, rs1, rs2)
+#define OR(rd, rs1, rs2)    asm_r(a, 0x33, 6, 0x00, rd, rs1, rs2)
+#define AND(rd, rs1, rs2)   asm_r(a, 0x33, 7, 0x00, rd, rs1, rs2)
+#define MUL(rd, rs1, rs2)   asm_r(a, 0x33, 0, 0x01, rd, rs1, rs2)
+#define LUI(rd, imm20)      emit32(a, ((uint32_t)(imm20) << 12) | ((rd) << 7) | 0x37)
+#define AUIPC(rd, imm20)    emit32(a, ((uint32_t)(imm20) << 12) | ((rd) << 7) | 0x17)
+#define JAL(rd, target)     asm_jal(a, rd, target)
+#define JALR(rd, rs1, imm)  asm_i(a, 0x67, 0, rd, rs1, imm)
+#define BEQ(rs1, rs2, target)  asm_b(a, 0, rs1, rs2, target)
+#define BNE(rs1, rs2, target)  asm_b(a, 1, rs1, rs2, target)
+#define BLTU(rs1, rs2, target) asm_b(a, 6, rs1, rs2, target)
+#define LBU(rd, rs1, imm)   asm_i(a, 0x03, 4, rd, rs1, imm)
+#define LW(rd, rs1, imm)    asm_i(a, 0x03, 2, rd, rs1, imm)
+#define SB(rs2, rs1, imm)   asm_s(a, 0x23, 0, rs2, rs1, imm)
+#define SW(rs2, rs1, imm)   asm_s(a, 0x23, 2, rs2, rs1, imm)
+/* XLEN sized loads and stores (64 bit for RV128) */
+#define LX(rd, rs1, imm)    asm_i(a, 0x03, a->xlen == 32 ? 2 : 3, rd, rs1, imm)
+#define SX(rs2, rs1, imm)   asm_s(a, 0x23, a->xlen == 32 ? 2 : 3, rs2, rs1, imm)
+#define CSRRW(rd, csr, rs1) asm_i(a, 0x73, 1, rd, rs1, csr)
+#define CSRRS(rd, csr, rs1) asm_i(a, 0x73, 2, rd, rs1, csr)
+#define CSRRC(rd, csr, rs1) asm_i(a, 0x73, 3, rd, rs1, csr)
+#define MRET()              emit32(a, 0x30200073)
+#define WFI()               emit32(a, 0x10500073)
+#define CBO_ZERO(rs1)       asm_i(a, 0x0f, 2, 0, rs1, 4)
+#define AMO_W(funct5, rd, rs2, rs1) asm_r(a, 0x2f, 2, (funct5) << 2, rd, rs1, rs2)
+#define AMOADD_W(rd, rs2, rs1)  AMO_W(0x00, rd, rs2, rs1)
+#define AMOSWAP_W(rd, rs2, rs1) AMO_W(0x01, rd, rs2, rs1)
+#define LR_W(rd, rs1)           AMO_W(0x02, rd, 0, rs1)
+#define SC_W(rd, rs2, rs1)      AMO_W(0x03, rd, rs2, rs1)
+#define AMOOR_W(rd, rs2, rs1)   AMO_W(0x08, rd, rs2, rs1)
+/* floating point, dynamic rounding mode */
+#define FLD(rd, rs1, imm)   asm_i(a, 0x07, 3, rd, rs1, imm)
+#define FSD(rs2, rs1, imm)  asm_s(a, 0x27, 3, rs2, rs1, imm)
+#define FOP(funct7, rd, rs1, rs2) asm_r(a, 0x53, 7, funct7, rd, rs1, rs2)
+#define FADD_S(rd, rs1, rs2)  FOP(0x00, rd, rs1, rs2)
+#define FMUL_S(rd, rs1, rs2)  FOP(0x08, rd, rs1, rs2)
+#define FADD_D(rd, rs1, rs2)  FOP(0x01, rd, rs1, rs2)
+#define FSUB_D(rd, rs1, rs2)  FOP(0x05, rd, rs1, rs2)
+#define FMUL_D(rd, rs1, rs2)  FOP(0x09, rd, rs1, rs2)
+#define FDIV_D(rd, rs1, rs2)  FOP(0x0d, rd, rs1, rs2)
+#define FSQRT_D(rd, rs1)      FOP(0x2d, rd, rs1, 0)
+#define FCVT_S_D(rd, rs1)     FOP(0x20, rd, rs1, 1)
+#define FCVT_D_W(rd, rs1)     asm_r(a, 0x53, 0, 0x69, rd, rs1, 0) /* exact */
+#define FMADD_D(rd, rs1, rs2, rs3) asm_fma(a, 1, rd, rs1, rs2, rs3)
+/* compressed instructions */
+#define C_ADDI(rd, imm)     emit16(a, ((((imm) >> 5) & 1) << 12) | ((rd) << 7) | (((imm) & 0x1f) << 2) | 1)
+#define C_SLLI(rd, sh)      emit16(a, 0x0002 | ((rd) << 7) | ((sh) << 2))
+#define C_SRLI(rd, sh)      emit16(a, 0x8001 | (((rd) - 8) << 7) | ((sh) << 2))
+#define C_MV(rd, rs2)       emit16(a, 0x8002 | ((rd) << 7) | ((rs2) << 2))
+#define C_ADD(rd, rs2)      emit16(a, 0x9002 | ((rd) << 7) | ((rs2) << 2))
+#define C_XOR(rd, rs2)      asm_ca(a, 1, rd, rs2)
+#define C_OR(rd, rs2)       asm_ca(a, 2, rd, rs2)
+#define C_AND(rd, rs2)      asm_ca(a, 3, rd, rs2)
+#define C_LW(rd, rs1, imm)  asm_cls(a, 2, rd, rs1, imm)
+#define C_SW(rs2, rs1, imm) asm_cls(a, 6, rs2, rs1, imm)
+#define C_BNEZ(rs1, target) asm_cbnez(a, rs1, target)
+#define C_J(target)         asm_cj(a, target)
+
+#define CSR_MSTATUS 0x300
+#define CSR_MISA    0x301
+#define CSR_MTVEC   0x305
+#define CSR_MEPC    0x341
+#define CSR_MCAUSE  0x342
+#define CSR_SATP    0x180
+
+/* load a positive 31 bit constant */
+static void asm_li(Asm *a, int rd, int32_t val)
+{
+    if (val >= -2048 && val < 2048) {
+        ADDI(rd, ZERO, val);
+    } else {
+        LUI(rd, ((val + 0x800) >> 12) & 0xfffff);
+        if (val & 0xfff)
+            ADDI(rd, rd, ((val & 0xfff) ^ 0x800) - 0x800);
+    }
+}
+
+/* load RAM_BASE + offset */
+static void asm_la(Asm *a, int rd, int32_t offset)
+{
+    ADDI(rd, ZERO, 1);
+    SLLI(rd, rd, 31);
+    if (offset != 0) {
+        asm_li(a, T6, offset);
+        ADD(rd, rd, T6);
+    }
+}
+
+typedef struct {
+    uint8_t *ram;
+    int xlen;
+    int n_iter; /* loop iterations */
+} GuestContext;
+
+static void guest_alu(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    ADDI(A0, ZERO, 1);
+    ADDI(A1, ZERO, 3);
+    ADDI(A2, ZERO, 5);
+    loop = a->pc;
+    ADD(A0, A0, A1);
+    XOR(A1, A1, A2);
+    SLLI(A3, A0, 3);
+    SRLI(A4, A1, 2);
+    SUB(A2, A3, A4);
+    MUL(A5, A0, A1);
+    OR(A0, A0, A5);
+    AND(A1, A1, A3);
+    ADDI(A2, A2, 7);
+    SLTU(A4, A0, A1);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+static void guest_mem(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    asm_li(a, S2, 0xffe0);
+    ADDI(T0, ZERO, 0);
+    loop = a->pc;
+    ADD(T2, S1, T0);
+    LX(A0, T2, 0);
+    LX(A1, T2, 8);
+    ADD(A0, A0, A1);
+    SX(A0, T2, 16);
+    LW(A2, T2, 24);
+    XOR(A2, A2, A0);
+    SW(A2, T2, 28);
+    LBU(A3, T2, 5);
+    SB(A3, T2, 30);
+    ADDI(T0, T0, 32);
+    AND(T0, T0, S2);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* data dependent branches and calls */
+static void guest_branch(Asm *a, GuestContext *g)
+{
+    uint32_t func, loop;
+
+    JAL(ZERO, a->pc + 12);
+    func = a->pc;
+    ADDI(A4, A4, 1);
+    JALR(ZERO, RA, 0);
+
+    asm_li(a, S0, g->n_iter);
+    asm_li(a, A0, 0x1234567);
+    loop = a->pc;
+    /* xorshift */
+    SLLI(T1, A0, 13);
+    XOR(A0, A0, T1);
+    SRLI(T1, A0, g->xlen == 32 ? 17 : 7);
+    XOR(A0, A0, T1);
+    SLLI(T1, A0, g->xlen == 32 ? 5 : 17);
+    XOR(A0, A0, T1);
+
+    ANDI(T2, A0, 1);
+    BEQ(T2, ZERO, a->pc + 8);
+    ADDI(A1, A1, 1);
+    ANDI(T2, A0, 2);
+    BNE(T2, ZERO, a->pc + 8);
+    ADDI(A2, A2, 1);
+    BLTU(A0, A3, a->pc + 8);
+    ADDI(A5, A5, 1);
+    ADDI(A3, A0, 0);
+    JAL(RA, func);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* loop made of compressed instructions */
+static void guest_rvc(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    ADDI(A0, ZERO, 1);
+    loop = a->pc;
+    C_ADDI(A0, 1);
+    C_ADD(A1, A0);
+    C_XOR(A2, A1);
+    C_MV(A3, A2);
+    C_SLLI(A3, 3);
+    C_SRLI(A3, 2);
+    C_AND(A3, A1);
+    C_SW(A1, S1, 0);
+    C_LW(A4, S1, 4);
+    C_SW(A3, S1, 4);
+    C_OR(A5, A4);
+    C_ADDI(S0, -1);
+    C_BNEZ(S0, loop);
+    WFI();
+}
+
+static void guest_amo(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    ADDI(S2, S1, 8);
+    ADDI(A1, ZERO, 1);
+    loop = a->pc;
+    AMOADD_W(A0, A1, S1);
+    AMOSWAP_W(A2, A0, S2);
+    LR_W(A3, S1);
+    ADDI(A3, A3, 1);
+    SC_W(A4, A3, S1);
+    AMOOR_W(A5, A4, S2);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* double precision loop converging to 0.5 with inexact results, and a
+   few single precision operations */
+static void guest_fp(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, T0, 1 << 13); /* mstatus.FS = initial */
+    CSRRS(ZERO, CSR_MSTATUS, T0);
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    ADDI(A0, ZERO, 1);
+    ADDI(A1, ZERO, 3);
+    ADDI(A2, ZERO, 4);
+    FCVT_D_W(1, A0);
+    FCVT_D_W(2, A1);
+    FCVT_D_W(3, A2);
+    FDIV_D(2, 1, 2); /* f2 = 1/3 */
+    FDIV_D(3, 1, 3); /* f3 = 1/4 */
+    FCVT_D_W(0, A2);
+    loop = a->pc;
+    FMADD_D(5, 0, 2, 3);
+    FADD_D(6, 5, 2);
+    FMUL_D(7, 6, 6);
+    FDIV_D(8, 7, 6);
+    FSQRT_D(9, 7);
+    FSUB_D(0, 9, 3);
+    FCVT_S_D(10, 8);
+    FMUL_S(11, 10, 10);
+    FADD_S(12, 11, 10);
+    FSD(8, S1, 0);
+    FLD(13, S1, 0);
+    FADD_D(14, 13, 8);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+static void tlb_set_pte(GuestContext *g, uint32_t pt_offset, int idx,
+                        uint64_t paddr, int flags)
+{
+    uint64_t pte = ((paddr >> 12) << 10) | flags;
+    if (g->xlen == 32) {
+        uint32_t pte32 = pte;
+        memcpy(g->ram + pt_offset + idx * 4, &pte32, 4);
+    } else {
+        memcpy(g->ram + pt_offset + idx * 8, &pte, 8);
+    }
+}
+
+#define PTE_V (1 << 0)
+#define PTE_R (1 << 1)
+#define PTE_W (1 << 2)
+#define PTE_X (1 << 3)
+#define PTE_A (1 << 6)
+#define PTE_D (1 << 7)
+
+/* Sv32 or Sv39 page tables at PT_OFFSET: the RAM is identity mapped
+   with a single superpage, TLB_VADDR with 4 KB pages */
+static void tlb_build_page_tables(GuestContext *g)
+{
+    int i, pte_per_table, l0_offset;
+    uint64_t paddr;
+
+    if (g->xlen == 32) {
+        pte_per_table = 1024;
+        tlb_set_pte(g, PT_OFFSET, RAM_BASE >> 22, RAM_BASE,
+                    PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D);
+        l0_offset = PT_OFFSET + 0x1000;
+        for(i = 0; i < TLB_PAGES / pte_per_table; i++) {
+            tlb_set_pte(g, PT_OFFSET, (TLB_VADDR >> 22) + i,
+                        RAM_BASE + l0_offset + i * 0x1000, PTE_V);
+        }
+    } else {
+        pte_per_table = 512;
+        tlb_set_pte(g, PT_OFFSET, RAM_BASE >> 30, RAM_BASE,
+                    PTE_V | PTE_R | PTE_W | PTE_X | PTE_A | PTE_D);
+        tlb_set_pte(g, PT_OFFSET, TLB_VADDR >> 30,
+                    RAM_BASE + PT_OFFSET + 0x1000, PTE_V);
+        l0_offset = PT_OFFSET + 0x2000;
+        for(i = 0; i < TLB_PAGES / pte_per_table; i++) {
+            tlb_set_pte(g, PT_OFFSET + 0x1000, i,
+                        RAM_BASE + l0_offset + i * 0x1000, PTE_V);
+        }
+    }
+    for(i = 0; i < TLB_PAGES; i++) {
+        paddr = RAM_BASE + DATA_OFFSET + (i % TLB_PHYS_PAGES) * 0x1000;
+        tlb_set_pte(g, l0_offset + (i / pte_per_table) * 0x1000,
+                    i % pte_per_table, paddr,
+                    PTE_V | PTE_R | PTE_W | PTE_A | PTE_D);
+    }
+}
+
+/* every access is done on a different page */
+static void guest_tlb(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    tlb_build_page_tables(g);
+    /* satp = Sv32 or Sv39 mode | root page table PPN */
+    if (g->xlen == 32) {
+        ADDI(T0, ZERO, 1);
+        SLLI(T0, T0, 31);
+    } else {
+        ADDI(T0, ZERO, 8);
+        SLLI(T0, T0, 60);
+    }
+    asm_li(a, T1, (RAM_BASE + PT_OFFSET) >> 12);
+    OR(T0, T0, T1);
+    CSRRW(ZERO, CSR_SATP, T0);
+    /* go to S mode */
+    asm_li(a, T0, 3 << 11);
+    CSRRC(ZERO, CSR_MSTATUS, T0);
+    asm_li(a, T0, 1 << 11);
+    CSRRS(ZERO, CSR_MSTATUS, T0);
+    AUIPC(T0, 0);
+    ADDI(T0, T0, 16);
+    CSRRW(ZERO, CSR_MEPC, T0);
+    MRET();
+
+    asm_li(a, S0, g->n_iter);
+    LUI(S1, TLB_VADDR >> 12);
+    asm_li(a, S2, TLB_PAGES - 1);
+    ADDI(T0, ZERO, 0);
+    loop = a->pc;
+    SLLI(T1, T0, 12);
+    ADD(T1, T1, S1);
+    LW(A0, T1, 0);
+    ADDI(A0, A0, 1);
+    SW(A0, T1, 64);
+    ADDI(T0, T0, TLB_STRIDE);
+    AND(T0, T0, S2);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* store and load to a device register */
+static void guest_mmio(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    LUI(S1, MMIO_ADDR >> 12);
+    loop = a->pc;
+    SW(S0, S1, 0);
+    LW(A0, S1, 4);
+    ADD(A1, A1, A0);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* cache block zeroing of a 2 KB buffer */
+static void guest_cbo(Asm *a, GuestContext *g)
+{
+    uint32_t loop;
+
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    ADDI(T0, ZERO, 0);
+    loop = a->pc;
+    ADD(T1, S1, T0);
+    CBO_ZERO(T1);
+    ADDI(T0, T0, 64);
+    ANDI(T0, T0, 0x7c0);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+}
+
+/* checks: the guests store the number of iterations at DATA_OFFSET
+   if they ran correctly */
+
+/* a block starting with a compressed instruction in the last two
+   bytes of a page and jumping back into the same page */
+static void guest_page_end(Asm *a, GuestContext *g)
+{
+    uint32_t loop, page_end, func;
+
+    /* the code starts at CODE_OFFSET in the first RAM page */
+    page_end = 0x2000 - 2 - CODE_OFFSET;
+    func = 0x1f00 - CODE_OFFSET;
+
+    asm_li(a, S0, g->n_iter);
+    asm_la(a, S1, DATA_OFFSET);
+    ADDI(A0, ZERO, 0);
+    loop = a->pc;
+    JAL(RA, page_end);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    SW(A0, S1, 0);
+    WFI();
+
+    a->pc = func;
+    ADDI(A0, A0, 1);
+    JALR(ZERO, RA, 0);
+
+    a->pc = page_end;
+    C_J(func);
+}
+
+typedef struct {
+    const char *name;
+    void (*gen)(Asm *a, GuestContext *g);
+    int n_iter;
+    /* the MMU (only Sv32 and Sv39 are supported) or the cache block
+       operations are used */
+    BOOL no_rv128;
+} GuestBench;
+
+static const GuestBench guest_benchs[] = {
+    { "alu", guest_alu, 2000000 },
+    { "mem", guest_mem, 2000000 },
+    { "branch", guest_branch, 1500000 },
+    { "rvc", guest_rvc, 2000000 },
+    { "amo", guest_amo, 2000000 },
+    { "fp", guest_fp, 1000000 },
+    { "tlb", guest_tlb, 1000000, TRUE },
+    { "mmio", guest_mmio, 1000000 },
+    { "cbo", guest_cbo, 2000000, TRUE },
+};
+
+static const GuestBench guest_checks[] = {
+    { "page_end", guest_page_end, 1000 },
+};
+
+typedef struct {
+    uint32_t reg;
+    uint64_t access_count;
+} BenchDevice;
+
+static uint32_t bench_dev_read(void *opaque, uint32_t offset, int size_log2)
+{
+    BenchDevice *d = opaque;
+    d->access_count++;
+    return d->reg + offset;
+}
+
+static void bench_dev_write(void *opaque, uint32_t offset, uint32_t val,
+                            int size_log2)
+{
+    BenchDevice *d = opaque;
+    d->access_count++;
+    d->reg = val;
+}
+
+typedef struct {
+    int64_t ti; /* execution time in ns */
+    uint64_t cycles; /* number of executed instructions */
+    uint64_t dev_count; /* number of device accesses */
+    uint32_t data; /* first word at DATA_OFFSET */
+    uint64_t ram_hash;
+} GuestResult;
+
+/* FNV-1a */
+static uint64_t ram_hash(const uint8_t *buf, size_t len)
+{
+    uint64_t h;
+    size_t i;
+
+    h = 0xcbf29ce484222325;
+    for(i = 0; i < len; i++)
+        h = (h ^ buf[i]) * 0x100000001b3;
+    return h;
+}
+
+/* save the CPU state (registers, PC and CSRs) as in a snapshot */
+static int guest_save_state(RISCVCPUState *s, const char *filename)
+{
+    SnapshotFile *sf;
+
+    sf = snapshot_open(filename, FALSE);
+    if (!sf)
+        return -1;
+    riscv_cpu_snapshot(s, sf);
+    return snapshot_close(sf);
+}
+
+/* run 'n_iter' iterations of the guest. If 'state_filename' is not
+   NULL, the final CPU state is saved to it. Return -1 if error. */
+static int guest_run(const GuestBench *b, int xlen, int max_xlen,
+                     BOOL use_jit, int n_iter, const char *state_filename,
+                     GuestResult *r)
+{
+    PhysMemoryMap *mem_map;
+    PhysMemoryRange *boot_pr, *ram_pr;
+    RISCVCPUState *s;
+    BenchDevice dev;
+    GuestContext g;
+    Asm code, *a = &code;
+    uint64_t max_cycles;
+    uint32_t cause;
+    int64_t ti;
+    int ret, mxl, sh;
+
+    mem_map = phys_mem_map_init();
+    boot_pr = cpu_register_ram(mem_map, BOOT_ADDR, 0x1000, 0);
+    ram_pr = cpu_register_ram(mem_map, RAM_BASE, RAM_SIZE, 0);
+    memset(&dev, 0, sizeof(dev));
+    cpu_register_device(mem_map, MMIO_ADDR, MMIO_SIZE, &dev,
+                        bench_dev_read, bench_dev_write, DEVIO_SIZE32);
+
+    /* jump to RAM_BASE + CODE_OFFSET with mtvec = RAM_BASE */
+    a->buf = boot_pr->phys_mem;
+    a->pc = 0;
+    a->xlen = xlen;
+    if (xlen < max_xlen) {
+        /* set UXL, SXL and then MXL to the guest XLEN */
+        mxl = xlen == 32 ? 1 : 2;
+        CSRRS(T1, CSR_MSTATUS, ZERO);
+        ADDI(T2, ZERO, 15);
+        SLLI(T2, T2, 32);
+        OR(T1, T1, T2);
+        ADDI(T2, ZERO, 15 ^ (mxl | (mxl << 2)));
+        SLLI(T2, T2, 32);
+        XOR(T1, T1, T2);
+        CSRRW(ZERO, CSR_MSTATUS, T1);
+        ADDI(T1, ZERO, mxl);
+        for(sh = max_xlen - 2; sh > 0; sh -= 63)
+            SLLI(T1, T1, min_int(sh, 63));
+        CSRRW(ZERO, CSR_MISA, T1);
+    }
+    ADDI(T0, ZERO, 1);
+    SLLI(T0, T0, 31);
+    CSRRW(ZERO, CSR_MTVEC, T0);
+    JALR(ZERO, T0, CODE_OFFSET);
+
+    /* the trap handler stores mcause and stops */
+    a->buf = ram_pr->phys_mem + TRAP_OFFSET;
+    a->pc = 0;
+    CSRRS(T6, CSR_MCAUSE, ZERO);
+    AUIPC(T5, 0);
+    SW(T6, T5, TRAP_CAUSE_OFFSET - 4);
+    WFI();
+    emit32(a, 0xffffffff);
+
+    g.ram = ram_pr->phys_mem;
+    g.xlen = xlen;
+    g.n_iter = n_iter;
+    a->buf = ram_pr->phys_mem + CODE_OFFSET;
+    a->pc = 0;
+    b->gen(a, &g);
+
+    ret = -1;
+    s = riscv_cpu_init(mem_map, max_xlen);
+    if (!s) {
+        fprintf(stderr, "%s: unsupported XLEN %d\n", b->name, max_xlen);
+        goto done;
+    }
+    if (use_jit && riscv_cpu_enable_jit(s) < 0) {
+        fprintf(stderr, "%s: the dynamic translator is not supported\n",
+                b->name);
+        goto done;
+    }
+    max_cycles = (uint64_t)g.n_iter * GUEST_CYCLES_PER_ITER_MAX + 4096;
+    ti = get_time_ns();
+    while (!riscv_cpu_get_power_down(s) &&
+           riscv_cpu_get_cycles(s) < max_cycles) {
+        riscv_cpu_interp(s, GUEST_EXEC_CYCLE);
+    }
+    r->ti = get_time_ns() - ti;
+    r->cycles = riscv_cpu_get_cycles(s);
+    r->dev_count = dev.access_count;
+    memcpy(&r->data, ram_pr->phys_mem + DATA_OFFSET, 4);
+    r->ram_hash = ram_hash(ram_pr->phys_mem, RAM_SIZE);
+
+    memcpy(&cause, ram_pr->phys_mem + TRAP_CAUSE_OFFSET, 4);
+    if (!riscv_cpu_get_power_down(s)) {
+        fprintf(stderr, "%s: the guest did not stop\n", b->name);
+    } else if (cause != 0xffffffff) {
+        fprintf(stderr, "%s: unexpected exception (mcause=0x%x)\n",
+                b->name, cause);
+    } else if (state_filename && guest_save_state(s, state_filename) < 0) {
+        fprintf(stderr, "%s: could not save the CPU state\n", b->name);
+    } else {
+        ret = 0;
+    }
+ done:
+    if (s)
+        riscv_cpu_end(s);
+    phys_mem_map_end(mem_map);
+    return ret;
+}
+
+static BOOL jit_supported(int max_xlen)
+{
+    PhysMemoryMap *mem_map;
+    RISCVCPUState *s;
+    BOOL ret;
+
+    mem_map = phys_mem_map_init();
+    s = riscv_cpu_init(mem_map, max_xlen);
+    ret = s && riscv_cpu_enable_jit(s) == 0;
+    if (s)
+        riscv_cpu_end(s);
+    phys_mem_map_end(mem_map);
+    return ret;
+}
+
+static int bench_guests(int xlen, int max_xlen, BOOL use_jit)
+{
+    const GuestBench *b;
+    char name[64];
+    GuestResult r, best;
+    int i, run, ret;
+
+    ret = 0;
+    for(i = 0; i < countof(guest_benchs); i++) {
+        b = &guest_benchs[i];
+        snprintf(name, sizeof(name), "%s%d/%s",
+                 use_jit ? "jit" : "interp", xlen, b->name);
+        if (!bench_selected(name))
+            continue;
+        if (b->no_rv128 && xlen > 64) {
+            printf("# %s: skipped\n", name);
+            continue;
+        }
+        memset(&best, 0, sizeof(best));
+        best.ti = INT64_MAX;
+        for(run = 0; run < bench_runs; run++) {
+            if (guest_run(b, xlen, max_xlen, use_jit,
+                          bench_count(b->n_iter), NULL, &r) < 0) {
+                ret = -1;
+                break;
+            }
+            if (r.ti < best.ti)
+                best = r;
+        }
+        if (run < bench_runs)
+            continue;
+        if (best.ti < 1)
+            best.ti = 1;
+        if (best.dev_count != 0) {
+            bench_result(name, (double)best.dev_count * 1e3 / best.ti,
+                         "Maccess/s");
+        } else {
+            bench_result(name, (double)best.cycles * 1e3 / best.ti, "MIPS");
+        }
+    }
+    return ret;
+}
+
+static int check_guests(int xlen, int max_xlen, BOOL use_jit)
+{
+    const GuestBench *b;
+    char name[64];
+    GuestResult r;
+    BOOL ok;
+    int i, ret;
+
+    ret = 0;
+    for(i = 0; i < countof(guest_checks); i++) {
+        b = &guest_checks[i];
+        snprintf(name, sizeof(name), "%s%d/%s",
+                 use_jit ? "jit" : "interp", xlen, b->name);
+        if (!bench_selected(name))
+            continue;
+        ok = FALSE;
+        if (guest_run(b, xlen, max_xlen, use_jit, b->n_iter, NULL,
+                      &r) == 0) {
+            if (r.data == b->n_iter)
+                ok = TRUE;
+            else
+                fprintf(stderr, "%s: %u iterations instead of %u\n",
+                        name, r.data, b->n_iter);
+        }
+        check_result(name, ok);
+        if (!ok)
+            ret = -1;
+    }
+    return ret;
+}
+
+/* compressed instructions */
+
+/* bits 'hi' to 'lo' of 'insn' moved to bit 'pos' */
+static uint32_t rvc_bits(uint32_t insn, int hi, int lo, int pos)
+{
+    return ((insn >> lo) & ((1 << (hi - lo + 1)) - 1)) << pos;
+}
+
+static int32_t rvc_sext(uint32_t val, int n)
+{
+    return (int32_t)(val << (32 - n)) >> (32 - n);
+}
+
+/* Reference expansion of the compressed instructions, written from the
+   immediate layouts of the specification. The encodings accepted by
+   the previous decoder are the same: the reserved ones with rd = 0
+   and c.lui with imm = 0 are executed. For RV128, the c.srli and
+   c.srai shift amounts from 32 to 63 are sign extended and c.sqsp
+   uses the uimm[5:4|9:6] layout as specified. Return 0 if illegal. */
+static uint32_t rvc_ref_expand(uint32_t insn, int xlen, int flen)
+{
+    int rd, rs2, rdp, rs1p, rs2p, funct, op;
+    int32_t imm;
+
+    rd = rvc_bits(insn, 11, 7, 0);
+    rs2 = rvc_bits(insn, 6, 2, 0);
+    rdp = rvc_bits(insn, 4, 2, 0) + 8;
+    rs1p = rvc_bits(insn, 9, 7, 0) + 8;
+    rs2p = rdp;
+    switch(((insn & 3) << 3) | ((insn >> 13) & 7)) {
+    case 0x00: /* c.addi4spn */
+        imm = rvc_bits(insn, 12, 11, 4) | rvc_bits(insn, 10, 7, 6) |
+            rvc_bits(insn, 6, 6, 2) | rvc_bits(insn, 5, 5, 3);
+        if (imm == 0)
+            return 0;
+        return enc_i(0x13, 0, rdp, SP, imm);
+    case 0x01: /* c.lq, c.fld */
+        if (xlen == 128) {
+            imm = rvc_bits(insn, 12, 11, 4) | rvc_bits(insn, 10, 10, 8) |
+                rvc_bits(insn, 6, 5, 6);
+            return enc_i(0x0f, 2, rdp, rs1p, imm);
+        }
+        if (flen < 64)
+            return 0;
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 5, 6);
+        return enc_i(0x07, 3, rdp, rs1p, imm);
+    case 0x02: /* c.lw */
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 6, 2) |
+            rvc_bits(insn, 5, 5, 6);
+        return enc_i(0x03, 2, rdp, rs1p, imm);
+    case 0x03: /* c.ld, c.flw */
+        if (xlen == 32) {
+            if (flen < 32)
+                return 0;
+            imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 6, 2) |
+                rvc_bits(insn, 5, 5, 6);
+            return enc_i(0x07, 2, rdp, rs1p, imm);
+        }
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 5, 6);
+        return enc_i(0x03, 3, rdp, rs1p, imm);
+    case 0x05: /* c.sq, c.fsd */
+        if (xlen == 128) {
+            imm = rvc_bits(insn, 12, 11, 4) | rvc_bits(insn, 10, 10, 8) |
+                rvc_bits(insn, 6, 5, 6);
+            return enc_s(0x23, 4, rs2p, rs1p, imm);
+        }
+        if (flen < 64)
+            return 0;
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 5, 6);
+        return enc_s(0x27, 3, rs2p, rs1p, imm);
+    case 0x06: /* c.sw */
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 6, 2) |
+            rvc_bits(insn, 5, 5, 6);
+        return enc_s(0x23, 2, rs2p, rs1p, imm);
+    case 0x07: /* c.sd, c.fsw */
+        if (xlen == 32) {
+            if (flen < 32)
+                return 0;
+            imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 6, 2) |
+                rvc_bits(insn, 5, 5, 6);
+            return enc_s(0x27, 2, rs2p, rs1p, imm);
+        }
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 6, 5, 6);
+        return enc_s(0x23, 3, rs2p, rs1p, imm);
+    case 0x08: /* c.addi */
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 5) | rs2, 6);
+        return enc_i(0x13, 0, rd, rd, imm);
+    case 0x09: /* c.jal, c.addiw */
+        if (xlen == 32)
+            goto c_j;
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 5) | rs2, 6);
+        return enc_i(0x1b, 0, rd, rd, imm);
+    case 0x0a: /* c.li */
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 5) | rs2, 6);
+        return enc_i(0x13, 0, rd, ZERO, imm);
+    case 0x0b: /* c.addi16sp, c.lui */
+        if (rd == SP) {
+            imm = rvc_sext(rvc_bits(insn, 12, 12, 9) |
+                           rvc_bits(insn, 6, 6, 4) |
+                           rvc_bits(insn, 5, 5, 6) |
+                           rvc_bits(insn, 4, 3, 7) |
+                           rvc_bits(insn, 2, 2, 5), 10);
+            if (imm == 0)
+                return 0;
+            return enc_i(0x13, 0, SP, SP, imm);
+        }
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 17) |
+                       rvc_bits(insn, 6, 2, 12), 18);
+        return (imm & 0xfffff000) | (rd << 7) | 0x37;
+    case 0x0c:
+        rd = rs1p;
+        imm = rvc_bits(insn, 12, 12, 5) | rs2;
+        funct = rvc_bits(insn, 11, 10, 0);
+        switch(funct) {
+        case 0: /* c.srli */
+        case 1: /* c.srai */
+            if (xlen == 32 && imm >= 32)
+                return 0;
+            if (xlen == 128) {
+                if (imm == 0)
+                    imm = 64;
+                else if (imm >= 32)
+                    imm |= 64;
+            }
+            return enc_i(0x13, 5, rd, rd, imm | (funct << 10));
+        case 2: /* c.andi */
+            return enc_i(0x13, 7, rd, rd, rvc_sext(imm, 6));
+        default:
+            funct = rvc_bits(insn, 12, 12, 2) | rvc_bits(insn, 6, 5, 0);
+            switch(funct) {
+            case 0: /* c.sub */
+                return enc_r(0x33, 0, 0x20, rd, rd, rs2p);
+            case 1: /* c.xor */
+                return enc_r(0x33, 4, 0, rd, rd, rs2p);
+            case 2: /* c.or */
+                return enc_r(0x33, 6, 0, rd, rd, rs2p);
+            case 3: /* c.and */
+                return enc_r(0x33, 7, 0, rd, rd, rs2p);
+            case 4: /* c.subw */
+                if (xlen == 32)
+                    return 0;
+                return enc_r(0x3b, 0, 0x20, rd, rd, rs2p);
+            case 5: /* c.addw */
+                if (xlen == 32)
+                    return 0;
+                return enc_r(0x3b, 0, 0, rd, rd, rs2p);
+            default:
+                return 0;
+            }
+        }
+    case 0x0d: /* c.j */
+    c_j:
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 11) |
+                       rvc_bits(insn, 11, 11, 4) |
+                       rvc_bits(insn, 10, 9, 8) |
+                       rvc_bits(insn, 8, 8, 10) |
+                       rvc_bits(insn, 7, 7, 6) |
+                       rvc_bits(insn, 6, 6, 7) |
+                       rvc_bits(insn, 5, 3, 1) |
+                       rvc_bits(insn, 2, 2, 5), 12);
+        return enc_j((insn >> 15) & 1 ? ZERO : RA, imm);
+    case 0x0e: /* c.beqz */
+    case 0x0f: /* c.bnez */
+        imm = rvc_sext(rvc_bits(insn, 12, 12, 8) |
+                       rvc_bits(insn, 11, 10, 3) |
+                       rvc_bits(insn, 6, 5, 6) |
+                       rvc_bits(insn, 4, 3, 1) |
+                       rvc_bits(insn, 2, 2, 5), 9);
+        return enc_b((insn >> 13) & 1, rs1p, ZERO, imm);
+    case 0x10: /* c.slli */
+        imm = rvc_bits(insn, 12, 12, 5) | rs2;
+        if (xlen == 32 && imm >= 32)
+            return 0;
+        if (xlen == 128 && imm == 0)
+            imm = 64;
+        return enc_i(0x13, 1, rd, rd, imm);
+    case 0x11: /* c.lqsp, c.fldsp */
+        if (xlen == 128) {
+            imm = rvc_bits(insn, 12, 12, 5) | rvc_bits(insn, 6, 6, 4) |
+                rvc_bits(insn, 5, 2, 6);
+            return enc_i(0x0f, 2, rd, SP, imm);
+        }
+        if (flen < 64)
+            return 0;
+        imm = rvc_bits(insn, 12, 12, 5) | rvc_bits(insn, 6, 5, 3) |
+            rvc_bits(insn, 4, 2, 6);
+        return enc_i(0x07, 3, rd, SP, imm);
+    case 0x12: /* c.lwsp */
+        imm = rvc_bits(insn, 12, 12, 5) | rvc_bits(insn, 6, 4, 2) |
+            rvc_bits(insn, 3, 2, 6);
+        return enc_i(0x03, 2, rd, SP, imm);
+    case 0x13: /* c.ldsp, c.flwsp */
+        if (xlen == 32) {
+            if (flen < 32)
+                return 0;
+            imm = rvc_bits(insn, 12, 12, 5) | rvc_bits(insn, 6, 4, 2) |
+                rvc_bits(insn, 3, 2, 6);
+            return enc_i(0x07, 2, rd, SP, imm);
+        }
+        imm = rvc_bits(insn, 12, 12, 5) | rvc_bits(insn, 6, 5, 3) |
+            rvc_bits(insn, 4, 2, 6);
+        return enc_i(0x03, 3, rd, SP, imm);
+    case 0x14:
+        op = rvc_bits(insn, 12, 12, 0);
+        if (rs2 != 0) {
+            /* c.mv, c.add */
+            return enc_r(0x33, 0, 0, rd, op ? rd : ZERO, rs2);
+        } else if (rd != 0) {
+            /* c.jr, c.jalr */
+            return enc_i(0x67, 0, op ? RA : ZERO, rd, 0);
+        } else if (op) {
+            return 0x00100073; /* c.ebreak */
+        } else {
+            return 0;
+        }
+    case 0x15: /* c.sqsp, c.fsdsp */
+        if (xlen == 128) {
+            imm = rvc_bits(insn, 12, 11, 4) | rvc_bits(insn, 10, 7, 6);
+            return enc_s(0x23, 4, rs2, SP, imm);
+        }
+        if (flen < 64)
+            return 0;
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 9, 7, 6);
+        return enc_s(0x27, 3, rs2, SP, imm);
+    case 0x16: /* c.swsp */
+        imm = rvc_bits(insn, 12, 9, 2) | rvc_bits(insn, 8, 7, 6);
+        return enc_s(0x23, 2, rs2, SP, imm);
+    case 0x17: /* c.sdsp, c.fswsp */
+        if (xlen == 32) {
+            if (flen < 32)
+                return 0;
+            imm = rvc_bits(insn, 12, 9, 2) | rvc_bits(insn, 8, 7, 6);
+            return enc_s(0x27, 2, rs2, SP, imm);
+        }
+        imm = rvc_bits(insn, 12, 10, 3) | rvc_bits(insn, 9, 7, 6);
+        return enc_s(0x23, 3, rs2, SP, imm);
+    default:
+        return 0;
+    }
+}
+
+/* compare the expansion table of the CPU with the reference for all
+   the 16 bit encodings */
+static int check_rvc(int xlen, int max_xlen)
+{
+    PhysMemoryMap *mem_map;
+    RISCVCPUState *s;
+    char name[64];
+    uint32_t insn, misa, r_cpu, r_ref;
+    int flen, n_err;
+
+    snprintf(name, sizeof(name), "rvc%d/expand", xlen);
+    if (!bench_selected(name))
+        return 0;
+    mem_map = phys_mem_map_init();
+    s = riscv_cpu_init(mem_map, max_xlen);
+    if (!s) {
+        fprintf(stderr, "%s: unsupported XLEN %d\n", name, max_xlen);
+        phys_mem_map_end(mem_map);
+        return -1;
+    }
+    misa = riscv_cpu_get_misa(s);
+    if (misa & (1 << ('Q' - 'A')))
+        flen = 128;
+    else if (misa & (1 << ('D' - 'A')))
+        flen = 64;
+    else if (misa & (1 << ('F' - 'A')))
+        flen = 32;
+    else
+        flen = 0;
+    n_err = 0;
+    for(insn = 0; insn < 0x10000; insn++) {
+        if ((insn & 3) == 3)
+            continue;
+        r_cpu = riscv_cpu_expand_compressed(s, xlen, insn);
+        r_ref = rvc_ref_expand(insn, xlen, flen);
+        if (r_cpu != r_ref) {
+            if (n_err < 10) {
+                fprintf(stderr, "%s: 0x%04x: 0x%08x instead of 0x%08x\n",
+                        name, insn, r_cpu, r_ref);
+            }
+            n_err++;
+        }
+    }
+    riscv_cpu_end(s);
+    phys_mem_map_end(mem_map);
+    if (n_err != 0)
+        fprintf(stderr, "%s: %d mismatches\n", name, n_err);
+    check_result(name, n_err == 0);
+    return n_err != 0 ? -1 : 0;
+}
+
+/* return the file contents or NULL if error */
+static uint8_t *read_file(const char *filename, size_t *plen)
+{
+    FILE *f;
+    uint8_t *buf;
+    long len;
+
+    f = fopen(filename, "rb");
+    if (!f) {
+        perror(filename);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(max_int(len, 1));
+    if (fread(buf, 1, len, f) != len) {
+        fprintf(stderr, "%s: read error\n", filename);
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *plen = len;
+    return buf;
+}
+
+/* compare the CPU states saved in two files */
+static int diff_state(const char *name, const char *filename1,
+                      const char *filename2)
+{
+    uint8_t *buf1, *buf2;
+    size_t len1, len2, i;
+    int ret;
+
+    ret = -1;
+    buf1 = read_file(filename1, &len1);
+    buf2 = read_file(filename2, &len2);
+    if (buf1 && buf2) {
+        if (len1 != len2) {
+            fprintf(stderr, "%s: the CPU states have different sizes\n",
+                    name);
+        } else {
+            for(i = 0; i < len1 && buf1[i] == buf2[i]; i++)
+                continue;
+            if (i < len1)
+                fprintf(stderr, "%s: the CPU states differ at offset %zu\n",
+                        name, i);
+            else
+                ret = 0;
+        }
+    }
+    free(buf1);
+    free(buf2);
+    return ret;
+}
+
+/* run 'b' with the interpreter and with the dynamic translator and
+   compare the final CPU state and RAM */
+static int diff_guest(const GuestBench *b, const char *name, int xlen,
+                      int max_xlen, int n_iter)
+{
+    char filename[2][32];
+    GuestResult r[2];
+    int i, fd, ret;
+
+    for(i = 0; i < 2; i++) {
+        snprintf(filename[i], sizeof(filename[i]), "/tmp/benchXXXXXX");
+        fd = mkstemp(filename[i]);
+        if (fd < 0) {
+            perror(filename[i]);
+            if (i > 0)
+                unlink(filename[0]);
+            return -1;
+        }
+        close(fd);
+    }
+    ret = -1;
+    if (guest_run(b, xlen, max_xlen, FALSE, n_iter, filename[0], &r[0]) < 0 ||
+        guest_run(b, xlen, max_xlen, TRUE, n_iter, filename[1], &r[1]) < 0)
+        goto done;
+    if (r[0].cycles != r[1].cycles) {
+        fprintf(stderr, "%s: %" PRIu64 " instructions instead of %" PRIu64
+                "\n", name, r[1].cycles, r[0].cycles);
+    } else if (r[0].ram_hash != r[1].ram_hash) {
+        fprintf(stderr, "%s: the RAM contents differ\n", name);
+    } else {
+        ret = diff_state(name, filename[0], filename[1]);
+    }
+ done:
+    unlink(filename[0]);
+    unlink(filename[1]);
+    return ret;
+}
+
+/* differential check of the dynamic translator against the
+   interpreter with all the guests */
+static int diff_guests(int xlen, int max_xlen)
+{
+    const GuestBench *b;
+    char name[64];
+    int i, n, n_iter, ret, err;
+
+    ret = 0;
+    n = countof(guest_benchs) + countof(guest_checks);
+    for(i = 0; i < n; i++) {
+        if (i < countof(guest_benchs)) {
+            b = &guest_benchs[i];
+            n_iter = bench_count(b->n_iter / DIFF_ITER_DIV);
+        } else {
+            b = &guest_checks[i - countof(guest_benchs)];
+            n_iter = b->n_iter;
+        }
+        snprintf(name, sizeof(name), "diff%d/%s", xlen, b->name);
+        if (!bench_selected(name))
+            continue;
+        if (b->no_rv128 && xlen > 64) {
+            printf("# %s: skipped\n", name);
+            continue;
+        }
+        err = diff_guest(b, name, xlen, max_xlen, n_iter);
+        check_result(name, err == 0);
+        if (err)
+            ret = -1;
+    }
+    return ret;
+}
+
+#ifdef CONFIG_RISCV_SMP
+
+/* "smp" check: two harts write to a RAM range with dirty bits (as a
+   frame buffer) while the main thread reads and resets the dirty bits
+   as the display refresh does. No write may be lost. */
+#define SMP_FB_ADDR   0x40000000
+#define SMP_FB_PAGES  1024
+#define SMP_HART_COUNT 2
+#define SMP_ROUNDS    100
+
+#define CSR_MHARTID 0xf14
+
+typedef struct {
+    pthread_mutex_t io_lock;
+    RISCVCPUState *cpu[SMP_HART_COUNT];
+} SMPContext;
+
+static void smp_io_lock(void *opaque, BOOL lock)
+{
+    SMPContext *c = opaque;
+    if (lock)
+        pthread_mutex_lock(&c->io_lock);
+    else
+        pthread_mutex_unlock(&c->io_lock);
+}
+
+/* with several harts, the TLBs have no writable entries for the RAM
+   with dirty bits */
+static void smp_flush_tlb_write_range(void *opaque, uint8_t *ram_addr,
+                                      size_t ram_size)
+{
+}
+
+static void *smp_hart_thread(void *opaque)
+{
+    RISCVCPUState *s = opaque;
+
+    while (!riscv_cpu_get_power_down(s))
+        riscv_cpu_interp(s, 100000);
+    return NULL;
+}
+
+/* OR the dirty bits of 'pr' to 'tab' and reset them */
+static void smp_get_dirty_bits(PhysMemoryRange *pr, uint32_t *tab)
+{
+    const uint32_t *dirty_bits;
+    int i;
+
+    dirty_bits = phys_mem_get_dirty_bits(pr);
+    for(i = 0; i < SMP_FB_PAGES / 32; i++)
+        tab[i] |= dirty_bits[i];
+}
+
+/* return the number of pages missing in the dirty bits, -1 if error */
+static int smp_dirty_run(int max_xlen)
+{
+    PhysMemoryMap *mem_map;
+    PhysMemoryRange *boot_pr, *fb_pr;
+    SMPContext c;
+    pthread_t tid[SMP_HART_COUNT];
+    uint32_t dirty_bits[SMP_FB_PAGES / 32];
+    Asm code, *a = &code;
+    uint32_t loop;
+    int i, n_missing, n_running;
+
+    mem_map = phys_mem_map_init();
+    mem_map->flush_tlb_write_range = smp_flush_tlb_write_range;
+    boot_pr = cpu_register_ram(mem_map, BOOT_ADDR, 0x1000, 0);
+    fb_pr = cpu_register_ram(mem_map, SMP_FB_ADDR,
+                             SMP_FB_PAGES << DEVRAM_PAGE_SIZE_LOG2,
+                             DEVRAM_FLAG_DIRTY_BITS);
+
+    /* hart N writes once to the pages N, N + 2, ... */
+    a->buf = boot_pr->phys_mem;
+    a->pc = 0;
+    a->xlen = max_xlen;
+    CSRRS(A0, CSR_MHARTID, ZERO);
+    SLLI(A0, A0, DEVRAM_PAGE_SIZE_LOG2);
+    LUI(S1, SMP_FB_ADDR >> 12);
+    ADD(S1, S1, A0);
+    asm_li(a, S0, SMP_FB_PAGES / SMP_HART_COUNT);
+    asm_li(a, T0, SMP_HART_COUNT << DEVRAM_PAGE_SIZE_LOG2);
+    loop = a->pc;
+    SW(S0, S1, 0);
+    ADD(S1, S1, T0);
+    ADDI(S0, S0, -1);
+    BNE(S0, ZERO, loop);
+    WFI();
+
+    memset(&c, 0, sizeof(c));
+    pthread_mutex_init(&c.io_lock, NULL);
+    for(i = 0; i < SMP_HART_COUNT; i++) {
+        c.cpu[i] = riscv_cpu_init(mem_map, max_xlen);
+        if (!c.cpu[i]) {
+            fprintf(stderr, "smp: unsupported XLEN %d\n", max_xlen);
+            abort();
+        }
+        riscv_cpu_set_smp(c.cpu[i], i, smp_io_lock, &c);
+    }
+    memset(dirty_bits, 0, sizeof(dirty_bits));
+    for(i = 0; i < SMP_HART_COUNT; i++)
+        pthread_create(&tid[i], NULL, smp_hart_thread, c.cpu[i]);
+    do {
+        smp_io_lock(&c, TRUE);
+        smp_get_dirty_bits(fb_pr, dirty_bits);
+        smp_io_lock(&c, FALSE);
+        n_running = 0;
+        for(i = 0; i < SMP_HART_COUNT; i++) {
+            if (!riscv_cpu_get_power_down(c.cpu[i]))
+                n_running++;
+        }
+    } while (n_running != 0);
+    for(i = 0; i < SMP_HART_COUNT; i++)
+        pthread_join(tid[i], NULL);
+    smp_get_dirty_bits(fb_pr, dirty_bits);
+
+    n_missing = 0;
+    for(i = 0; i < SMP_FB_PAGES; i++) {
+        if (!((dirty_bits[i >> 5] >> (i & 0x1f)) & 1))
+            n_missing++;
+    }
+    for(i = 0; i < SMP_HART_COUNT; i++)
+        riscv_cpu_end(c.cpu[i]);
+    pthread_mutex_destroy(&c.io_lock);
+    phys_mem_map_end(mem_map);
+    return n_missing;
+}
+
+static int check_smp(int xlen, int max_xlen)
+{
+    char name[64];
+    int round, n_missing;
+
+    snprintf(name, sizeof(name), "smp%d/dirty_bits", xlen);
+    if (!bench_selected(name))
+        return 0;
+    /* the guest does not change the XLEN */
+    if (xlen != max_xlen) {
+        printf("# %s: skipped\n", name);
+        return 0;
+    }
+    n_missing = 0;
+    for(round = 0; round < SMP_ROUNDS && n_missing == 0; round++)
+        n_missing = smp_dirty_run(max_xlen);
+    if (n_missing != 0)
+        fprintf(stderr, "%s: %d pages are not dirty\n", name, n_missing);
+    check_result(name, n_missing == 0);
+    return n_missing != 0 ? -1 : 0;
+}
+
+#endif /* CONFIG_RISCV_SMP */
+
+static int run_checks(int xlen, int max_xlen)
+{
+    int ret;
+
+    ret = check_softfp();
+    if (check_rvc(xlen, max_xlen) < 0)
+        ret = -1;
+    if (check_guests(xlen, max_xlen, FALSE) < 0)
+        ret = -1;
+#ifdef CONFIG_RISCV_SMP
+    if (check_smp(xlen, max_xlen) < 0)
+        ret = -1;
+#endif
+    if (!jit_supported(max_xlen)) {
+        printf("# jit%d: not supported\n", xlen);
+    } else {
+        if (check_guests(xlen, max_xlen, TRUE) < 0)
+            ret = -1;
+        if (diff_guests(xlen, max_xlen) < 0)
+            ret = -1;
+    }
+    return ret;
+}
+
+int main(int argc, char **argv)
+{
+    int c, xlen, max_xlen, ret;
+    BOOL use_jit, do_check;
+
+    xlen = 64;
+    max_xlen = 0;
+    use_jit = FALSE;
+    do_check = FALSE;
+    for(;;) {
+        c = getopt(argc, argv, "hx:m:jcr:s:");
+        if (c == -1)
+            break;
+        switch(c) {
+        case 'h':
+            help();
+        case 'x':
+            xlen = strtol(optarg, NULL, 0);
+            break;
+        case 'm':
+            max_xlen = strtol(optarg, NULL, 0);
+            break;
+        case 'j':
+            use_jit = TRUE;
+            break;
+        case 'c':
+            do_check = TRUE;
+            break;
+        case 'r':
+            bench_runs = max_int(strtol(optarg, NULL, 0), 1);
+            break;
+        case 's':
+            bench_scale = strtod(optarg, NULL);
+            break;
+        default:
+            exit(1);
+        }
+    }
+    bench_filter = argv + optind;
+    bench_filter_count = argc - optind;
+
+    max_xlen = max_int(max_xlen, xlen);
+    if (do_check) {
+        printf("# TinyEMU " CONFIG_VERSION " checks: name result\n");
+        if (max_xlen != xlen)
+            printf("# RISC-V CPU with a maximum XLEN of %d\n", max_xlen);
+        return run_checks(xlen, max_xlen) < 0 ? 1 : 0;
+    }
+    printf("# TinyEMU " CONFIG_VERSION " benchmarks: name value unit\n");
+    if (max_xlen != xlen)
+        printf("# RISC-V CPU with a maximum XLEN of %d\n", max_xlen);
+    bench_softfp();
+    ret = bench_guests(xlen, max_xlen, FALSE);
+    if (use_jit) {
+        if (!jit_supported(max_xlen))
+            printf("# jit%d: not supported\n", xlen);
+        else if (bench_guests(xlen, max_xlen, TRUE) < 0)
+            ret = -1;
+    }
+    return ret < 0 ? 1 : 0;
+}
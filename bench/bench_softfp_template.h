@@ -0,0 +1,252 @@
+/*
+ * TinyEMU micro-benchmarks: soft float operations
+ *
+ * Copyright (c) 2026 Fernando Lemos
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#if F_SIZE == 32
+#define F_UINT uint32_t
+#define EXP_SIZE 8
+#elif F_SIZE == 64
+#define F_UINT uint64_t
+#define EXP_SIZE 11
+#elif F_SIZE == 128
+#define F_UINT uint128_t
+#define EXP_SIZE 15
+#else
+#error unsupported F_SIZE
+#endif
+
+#define MANT_SIZE (F_SIZE - EXP_SIZE - 1)
+#define EXP_BIAS ((1 << (EXP_SIZE - 1)) - 1)
+#define SIGN_MASK ((F_UINT)1 << (F_SIZE - 1))
+
+static F_UINT glue(sf_tab, F_SIZE)[SF_TAB_SIZE];
+
+/* random normal numbers whose magnitude is between 2^-8 and 2^9 */
+static void glue(sf_init, F_SIZE)(void)
+{
+    F_UINT mant;
+    uint32_t a_exp, a_sign;
+    int i;
+
+    for(i = 0; i < SF_TAB_SIZE; i++) {
+        mant = bench_rand();
+#if F_SIZE == 128
+        mant = (mant << 64) | bench_rand();
+#endif
+        mant &= ((F_UINT)1 << MANT_SIZE) - 1;
+        a_exp = EXP_BIAS - 8 + (bench_rand() % 17);
+        a_sign = bench_rand() & 1;
+        glue(sf_tab, F_SIZE)[i] = ((F_UINT)a_sign << (F_SIZE - 1)) |
+            ((F_UINT)a_exp << MANT_SIZE) | mant;
+    }
+}
+
+/* The accrued exceptions are kept between the operations as in the
+   guests. Return a value depending on all the results. */
+static uint64_t glue(sf_run, F_SIZE)(int op, int n)
+{
+    const F_UINT *tab = glue(sf_tab, F_SIZE);
+    F_UINT a, b, c, r;
+    uint32_t fflags;
+    int i;
+
+    r = 0;
+    fflags = 0;
+#define SF_LOOP(expr)                                   \
+    for(i = 0; i < n; i++) {                            \
+        a = tab[i & (SF_TAB_SIZE - 1)];                 \
+        b = tab[(i + 1) & (SF_TAB_SIZE - 1)];           \
+        c = tab[(i + 2) & (SF_TAB_SIZE - 1)];           \
+        r ^= (F_UINT)(expr);                            \
+    }
+    switch(op) {
+    case SF_OP_ADD:
+        SF_LOOP(glue(add_sf, F_SIZE)(a, b, RM_RNE, &fflags));
+        break;
+    case SF_OP_SUB:
+        SF_LOOP(glue(sub_sf, F_SIZE)(a, b, RM_RNE, &fflags));
+        break;
+    case SF_OP_MUL:
+        SF_LOOP(glue(mul_sf, F_SIZE)(a, b, RM_RNE, &fflags));
+        break;
+    case SF_OP_DIV:
+        SF_LOOP(glue(div_sf, F_SIZE)(a, b, RM_RNE, &fflags));
+        break;
+    case SF_OP_SQRT:
+        SF_LOOP(glue(sqrt_sf, F_SIZE)(a & ~SIGN_MASK, RM_RNE, &fflags));
+        break;
+    case SF_OP_FMA:
+        SF_LOOP(glue(fma_sf, F_SIZE)(a, b, c, RM_RNE, &fflags));
+        break;
+    case SF_OP_TO_I64:
+        SF_LOOP(glue(glue(cvt_sf, F_SIZE), _i64)(a, RM_RNE, &fflags));
+        break;
+    case SF_OP_FROM_I64:
+        SF_LOOP(glue(cvt_i64_sf, F_SIZE)((int64_t)a, RM_RNE, &fflags));
+        break;
+    default:
+        abort();
+    }
+#undef SF_LOOP
+    return (uint64_t)r ^ fflags;
+}
+
+#if F_SIZE <= 64
+
+static F_UINT glue(sf_op, F_SIZE)(int op, F_UINT a, F_UINT b, F_UINT c,
+                                  uint32_t *pfflags)
+{
+    switch(op) {
+    case SF_OP_ADD:
+        return glue(add_sf, F_SIZE)(a, b, RM_RNE, pfflags);
+    case SF_OP_SUB:
+        return glue(sub_sf, F_SIZE)(a, b, RM_RNE, pfflags);
+    case SF_OP_MUL:
+        return glue(mul_sf, F_SIZE)(a, b, RM_RNE, pfflags);
+    case SF_OP_DIV:
+        return glue(div_sf, F_SIZE)(a, b, RM_RNE, pfflags);
+    case SF_OP_SQRT:
+        return glue(sqrt_sf, F_SIZE)(a, RM_RNE, pfflags);
+    case SF_OP_FMA:
+        return glue(fma_sf, F_SIZE)(a, b, c, RM_RNE, pfflags);
+    default:
+        abort();
+    }
+}
+
+#define EXP_MASK ((1 << EXP_SIZE) - 1)
+#define MANT_MASK (((F_UINT)1 << MANT_SIZE) - 1)
+
+static F_UINT glue(sf_pack, F_SIZE)(uint32_t a_sign, uint32_t a_exp,
+                                    F_UINT a_mant)
+{
+    return ((F_UINT)a_sign << (F_SIZE - 1)) | ((F_UINT)a_exp << MANT_SIZE) |
+        (a_mant & MANT_MASK);
+}
+
+/* zeros, subnormals, limits of the normal numbers, infinities, NaNs
+   and numbers whose products or quotients overflow or underflow */
+static int glue(sf_special_init, F_SIZE)(F_UINT *tab)
+{
+    static const int exps[] = { 0, 1, 2, EXP_BIAS / 2, EXP_BIAS - 1,
+                                EXP_BIAS, EXP_BIAS + 1, EXP_BIAS + MANT_SIZE,
+                                EXP_BIAS + EXP_BIAS / 2, EXP_MASK - 2,
+                                EXP_MASK - 1 };
+    int i, n, sign;
+
+    n = 0;
+    for(sign = 0; sign < 2; sign++) {
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, 0, 0);
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, 0, 1);
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, 0, MANT_MASK);
+        for(i = 0; i < countof(exps); i++) {
+            tab[n++] = glue(sf_pack, F_SIZE)(sign, exps[i], 0);
+            tab[n++] = glue(sf_pack, F_SIZE)(sign, exps[i], 1);
+            tab[n++] = glue(sf_pack, F_SIZE)(sign, exps[i], MANT_MASK);
+        }
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, EXP_MASK, 0);
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, EXP_MASK,
+                                         (F_UINT)1 << (MANT_SIZE - 1));
+        tab[n++] = glue(sf_pack, F_SIZE)(sign, EXP_MASK, 1);
+    }
+    return n;
+}
+
+/* random operand: special value, any bit pattern, number close to 1 or
+   close to the limits of the exponent range */
+static F_UINT glue(sf_rand_operand, F_SIZE)(const F_UINT *special,
+                                            int n_special)
+{
+    uint32_t a_exp;
+
+    switch(bench_rand() % 4) {
+    case 0:
+        return special[bench_rand() % n_special];
+    case 1:
+        return bench_rand();
+    case 2:
+        a_exp = EXP_BIAS - 32 + bench_rand() % 64;
+        break;
+    default:
+        a_exp = bench_rand() % 64;
+        if (bench_rand() & 1)
+            a_exp = EXP_MASK - a_exp;
+        break;
+    }
+    return glue(sf_pack, F_SIZE)(bench_rand() & 1, a_exp, bench_rand());
+}
+
+/* The host FPU is only used with round to nearest even when the
+   inexact flag is already set, so the soft float result is obtained
+   by clearing it before the operation. Return the number of
+   mismatches. */
+static int glue(sf_check, F_SIZE)(int op, const char *name, int n)
+{
+    F_UINT special[128], a, b, c, r_soft, r_host;
+    uint32_t fflags_soft, fflags_host;
+    int i, n_special, n_err;
+
+    n_special = glue(sf_special_init, F_SIZE)(special);
+    n_err = 0;
+    for(i = 0; i < n; i++) {
+        if (i < n_special * n_special) {
+            /* all the pairs of special values */
+            a = special[i / n_special];
+            b = special[i % n_special];
+            c = special[(i / n_special + i) % n_special];
+        } else {
+            a = glue(sf_rand_operand, F_SIZE)(special, n_special);
+            b = glue(sf_rand_operand, F_SIZE)(special, n_special);
+            c = glue(sf_rand_operand, F_SIZE)(special, n_special);
+        }
+        fflags_soft = 0;
+        r_soft = glue(sf_op, F_SIZE)(op, a, b, c, &fflags_soft);
+        fflags_soft |= FFLAG_INEXACT;
+        fflags_host = FFLAG_INEXACT;
+        r_host = glue(sf_op, F_SIZE)(op, a, b, c, &fflags_host);
+        if (r_soft != r_host || fflags_soft != fflags_host) {
+            if (n_err < 10) {
+                fprintf(stderr, "%s: 0x%0*" PRIx64 " 0x%0*" PRIx64
+                        " 0x%0*" PRIx64 ": 0x%0*" PRIx64 " fflags=0x%02x"
+                        " instead of 0x%0*" PRIx64 " fflags=0x%02x\n",
+                        name, F_SIZE / 4, (uint64_t)a,
+                        F_SIZE / 4, (uint64_t)b, F_SIZE / 4, (uint64_t)c,
+                        F_SIZE / 4, (uint64_t)r_host, fflags_host,
+                        F_SIZE / 4, (uint64_t)r_soft, fflags_soft);
+            }
+            n_err++;
+        }
+    }
+    return n_err;
+}
+
+#undef EXP_MASK
+#undef MANT_MASK
+
+#endif /* F_SIZE <= 64 */
+
+#undef F_SIZE
+#undef F_UINT
+#undef EXP_SIZE
+#undef MANT_SIZE
+#undef EXP_BIAS
+#undef SIGN_MASK
@@ -27,6 +27,11 @@
 #include <string.h>
 #include <inttypes.h>
 #include <assert.h>
+#include <unistd.h>
+#if !defined(_WIN32) && !defined(EMSCRIPTEN)
+#include <sys/mman.h>
+#define USE_MMAP_RAM
+#endif
 
 #include "cutils.h"
 #include "iomem.h"
@@ -42,6 +47,7 @@ PhysMemoryMap *phys_mem_map_init(void)
 {
     PhysMemoryMap *s;
     s = mallocz(sizeof(*s));
+    s->last_segment = &s->segments[0];
     s->register_ram = default_register_ram;
     s->free_ram = default_free_ram;
     s->get_dirty_bits = default_get_dirty_bits;
@@ -64,8 +70,7 @@ void phys_mem_map_end(PhysMemoryMap *s)
 }
 
 /* return NULL if not found */
-/* XXX: optimize */
-PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
+static PhysMemoryRange *find_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
 {
     PhysMemoryRange *pr;
     int i;
@@ -77,6 +82,88 @@ PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
     return NULL;
 }
 
+/* rebuild the segments. Must be called when a range is added, moved,
+   enabled or disabled. The segments are read without lock by
+   get_phys_mem_range(), so the map must not be modified while other
+   threads use it: the harts of the RISC-V machine are only started
+   once all the ranges are registered, and the ranges are only moved
+   by the PC machine which has a single CPU. */
+static void phys_mem_map_update(PhysMemoryMap *s)
+{
+    uint64_t bounds[2 * PHYS_MEM_RANGE_MAX], addr, tmp;
+    PhysMemoryRange *pr;
+    PhysMemorySegment *seg;
+    int i, j, n;
+
+    n = 0;
+    for(i = 0; i < s->n_phys_mem_range; i++) {
+        pr = &s->phys_mem_range[i];
+        if (pr->size != 0) {
+            bounds[n++] = pr->addr;
+            bounds[n++] = pr->addr + pr->size;
+        }
+    }
+    /* insertion sort, n is small */
+    for(i = 1; i < n; i++) {
+        for(j = i; j > 0 && bounds[j - 1] > bounds[j]; j--) {
+            tmp = bounds[j];
+            bounds[j] = bounds[j - 1];
+            bounds[j - 1] = tmp;
+        }
+    }
+    s->n_segments = 0;
+    seg = NULL;
+    for(i = 0; i < n - 1; i++) {
+        addr = bounds[i];
+        if (addr == bounds[i + 1])
+            continue;
+        pr = find_phys_mem_range(s, addr);
+        if (!pr)
+            continue;
+        if (seg && seg->pr == pr && seg->addr + seg->size == addr) {
+            seg->size += bounds[i + 1] - addr;
+        } else {
+            seg = &s->segments[s->n_segments++];
+            seg->addr = addr;
+            seg->size = bounds[i + 1] - addr;
+            seg->pr = pr;
+        }
+    }
+    s->last_segment = &s->segments[0];
+    if (s->n_segments == 0)
+        s->segments[0].size = 0;
+}
+
+/* return NULL if not found */
+PhysMemoryRange *get_phys_mem_range(PhysMemoryMap *s, uint64_t paddr)
+{
+    PhysMemorySegment *seg;
+    int a, b, m;
+
+    /* the harts run in different threads and share 'last_segment',
+       which is only a hint */
+    seg = __atomic_load_n(&s->last_segment, __ATOMIC_RELAXED);
+    if (likely(paddr - seg->addr < seg->size))
+        return seg->pr;
+    /* binary search */
+    if (s->n_segments == 0 || paddr < s->segments[0].addr)
+        return NULL;
+    a = 0;
+    b = s->n_segments - 1;
+    while (a < b) {
+        m = (a + b + 1) >> 1;
+        if (s->segments[m].addr <= paddr)
+            a = m;
+        else
+            b = m - 1;
+    }
+    seg = &s->segments[a];
+    if (paddr - seg->addr >= seg->size)
+        return NULL;
+    __atomic_store_n(&s->last_segment, seg, __ATOMIC_RELAXED);
+    return seg->pr;
+}
+
 PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
                                     uint64_t size, int devram_flags)
 {
@@ -96,9 +183,131 @@ PhysMemoryRange *register_ram_entry(PhysMemoryMap *s, uint64_t addr,
         pr->size = pr->org_size;
     pr->phys_mem = NULL;
     pr->dirty_bits = NULL;
+    phys_mem_map_update(s);
     return pr;
 }
 
+#ifdef USE_MMAP_RAM
+
+#define HUGE_PAGE_SIZE (2 << 20)
+
+/* The RAM is an anonymous mapping: the host pages are allocated and
+   zeroed on the first access, so that the unused guest RAM costs
+   nothing. */
+static uint8_t *alloc_ram(PhysMemoryRange *pr, uint64_t size,
+                          int devram_flags)
+{
+    uint8_t *ptr;
+
+    ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (devram_flags & DEVRAM_FLAG_HUGETLB) {
+        pr->phys_mem_size = (size + HUGE_PAGE_SIZE - 1) &
+            ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+        ptr = mmap(NULL, pr->phys_mem_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            fprintf(stderr, "Could not allocate the VM memory with hugetlbfs, using normal pages\n");
+        }
+    }
+#endif
+    if (ptr == MAP_FAILED) {
+        pr->phys_mem_size = size;
+        ptr = mmap(NULL, pr->phys_mem_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED)
+            return NULL;
+#ifdef MADV_HUGEPAGE
+        if (devram_flags & (DEVRAM_FLAG_HUGE_PAGES | DEVRAM_FLAG_HUGETLB))
+            madvise(ptr, pr->phys_mem_size, MADV_HUGEPAGE);
+#endif
+    }
+    return ptr;
+}
+
+static void free_ram(PhysMemoryRange *pr)
+{
+    munmap(pr->phys_mem, pr->phys_mem_size);
+}
+
+/* return the number of bytes of 'pr' which are in host memory */
+uint64_t phys_mem_get_resident_size(PhysMemoryRange *pr)
+{
+    unsigned char vec[1024];
+    size_t page_size, len, n, i, pos;
+    uint64_t resident;
+
+    page_size = sysconf(_SC_PAGESIZE);
+    resident = 0;
+    for(pos = 0; pos < pr->phys_mem_size; pos += len) {
+        len = pr->phys_mem_size - pos;
+        if (len > sizeof(vec) * page_size)
+            len = sizeof(vec) * page_size;
+        if (mincore(pr->phys_mem + pos, len, (void *)vec) < 0)
+            return pr->org_size;
+        n = (len + page_size - 1) / page_size;
+        for(i = 0; i < n; i++)
+            resident += vec[i] & 1;
+    }
+    resident *= page_size;
+    if (resident > pr->org_size)
+        resident = pr->org_size;
+    return resident;
+}
+
+/* Replace the content of the RAM range allocated by
+   default_register_ram() with a private mapping of 'fd' at 'offset',
+   which must be page aligned. The file is read on demand. Return -1
+   if error. */
+int phys_mem_map_file(PhysMemoryRange *pr, int fd, uint64_t offset)
+{
+    uint8_t *ptr;
+
+    /* a huge page mapping cannot be partially replaced */
+    munmap(pr->phys_mem, pr->phys_mem_size);
+    pr->phys_mem_size = pr->org_size;
+    ptr = mmap(pr->phys_mem, pr->phys_mem_size, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_FIXED, fd, offset);
+    if (ptr == MAP_FAILED)
+        return -1;
+    return 0;
+}
+
+#else
+
+static uint8_t *alloc_ram(PhysMemoryRange *pr, uint64_t size,
+                          int devram_flags)
+{
+    pr->phys_mem_size = size;
+    return mallocz(size);
+}
+
+static void free_ram(PhysMemoryRange *pr)
+{
+    free(pr->phys_mem);
+}
+
+uint64_t phys_mem_get_resident_size(PhysMemoryRange *pr)
+{
+    return pr->org_size;
+}
+
+int phys_mem_map_file(PhysMemoryRange *pr, int fd, uint64_t offset)
+{
+    uint64_t pos;
+    ssize_t ret;
+
+    for(pos = 0; pos < pr->org_size; pos += ret) {
+        ret = pread(fd, pr->phys_mem + pos, pr->org_size - pos,
+                    offset + pos);
+        if (ret <= 0)
+            return -1;
+    }
+    return 0;
+}
+
+#endif /* !USE_MMAP_RAM */
+
 static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
                                              uint64_t size, int devram_flags)
 {
@@ -106,7 +315,7 @@ static PhysMemoryRange *default_register_ram(PhysMemoryMap *s, uint64_t addr,
 
     pr = register_ram_entry(s, addr, size, devram_flags);
 
-    pr->phys_mem = mallocz(size);
+    pr->phys_mem = alloc_ram(pr, size, devram_flags);
     if (!pr->phys_mem) {
         fprintf(stderr, "Could not allocate VM memory\n");
         exit(1);
@@ -178,7 +387,7 @@ void phys_mem_reset_dirty_bit(PhysMemoryRange *pr, size_t offset)
 
 static void default_free_ram(PhysMemoryMap *s, PhysMemoryRange *pr)
 {
-    free(pr->phys_mem);
+    free_ram(pr);
 }
 
 PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
@@ -202,6 +411,7 @@ PhysMemoryRange *cpu_register_device(PhysMemoryMap *s, uint64_t addr,
     pr->read_func = read_func;
     pr->write_func = write_func;
     pr->devio_flags = devio_flags;
+    phys_mem_map_update(s);
     return pr;
 }
 
@@ -237,8 +447,9 @@ void phys_mem_set_addr(PhysMemoryRange *pr, uint64_t addr, BOOL enabled)
     if (!pr->is_ram) {
         default_set_addr(map, pr, addr, enabled);
     } else {
-        return map->set_ram_addr(map, pr, addr, enabled);
+        map->set_ram_addr(map, pr, addr, enabled);
     }
+    phys_mem_map_update(map);
 }
 
 /* return NULL if no valid RAM page. The access can only be done in the page */
@@ -38,6 +38,8 @@ typedef uint32_t DeviceReadFunc(void *opaque, uint32_t offset, int size_log2);
 #define DEVRAM_FLAG_ROM        (1 << 0) /* not writable */
 #define DEVRAM_FLAG_DIRTY_BITS (1 << 1) /* maintain dirty bits */
 #define DEVRAM_FLAG_DISABLED   (1 << 2) /* allocated but not mapped */
+#define DEVRAM_FLAG_HUGE_PAGES (1 << 3) /* transparent huge pages if possible */
+#define DEVRAM_FLAG_HUGETLB    (1 << 4) /* huge pages of the hugetlbfs pool */
 #define DEVRAM_PAGE_SIZE_LOG2 12
 #define DEVRAM_PAGE_SIZE (1 << DEVRAM_PAGE_SIZE_LOG2)
 
@@ -52,6 +54,7 @@ typedef struct {
     /* the following is used for RAM access */
     int devram_flags;
     uint8_t *phys_mem;
+    size_t phys_mem_size; /* size of the host allocation */
     int dirty_bits_size; /* in bytes */
     uint32_t *dirty_bits; /* NULL if not used */
     uint32_t *dirty_bits_tab[2];
@@ -65,9 +68,21 @@ typedef struct {
 
 #define PHYS_MEM_RANGE_MAX 32
 
+/* part of the address space where the same range is visible */
+typedef struct {
+    uint64_t addr;
+    uint64_t size;
+    PhysMemoryRange *pr;
+} PhysMemorySegment;
+
 struct PhysMemoryMap {
     int n_phys_mem_range;
     PhysMemoryRange phys_mem_range[PHYS_MEM_RANGE_MAX];
+    /* enabled ranges sorted by address. When ranges overlap, the first
+       registered one is visible. */
+    int n_segments;
+    PhysMemorySegment segments[2 * PHYS_MEM_RANGE_MAX];
+    PhysMemorySegment *last_segment; /* last segment found */
     PhysMemoryRange *(*register_ram)(PhysMemoryMap *s, uint64_t addr,
                                      uint64_t size, int devram_flags);
     void (*free_ram)(PhysMemoryMap *s, PhysMemoryRange *pr);
@@ -126,6 +141,8 @@ static inline BOOL phys_mem_is_dirty_bit(PhysMemoryRange *pr, size_t offset)
 }
 
 void phys_mem_reset_dirty_bit(PhysMemoryRange *pr, size_t offset);
+uint64_t phys_mem_get_resident_size(PhysMemoryRange *pr);
+int phys_mem_map_file(PhysMemoryRange *pr, int fd, uint64_t offset);
 uint8_t *phys_mem_get_ram_ptr(PhysMemoryMap *map, uint64_t paddr, BOOL is_rw);
 
 /* IRQ support */
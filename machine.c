@@ -261,6 +261,20 @@ static int virt_machine_parse_config(VirtMachineParams *p,
     if (vm_get_int(cfg, tag_name, &val) < 0)
         goto tag_fail;
     p->ram_size = (uint64_t)val << 20;
+
+    tag_name = "memory_hugepages";
+    if (vm_get_str_opt(cfg, tag_name, &str) < 0)
+        goto tag_fail;
+    if (str) {
+        if (!strcmp(str, "thp")) {
+            p->ram_flags = DEVRAM_FLAG_HUGE_PAGES;
+        } else if (!strcmp(str, "hugetlb")) {
+            p->ram_flags = DEVRAM_FLAG_HUGETLB;
+        } else if (strcmp(str, "none") != 0) {
+            vm_error("%s: 'none', 'thp' or 'hugetlb' expected\n", tag_name);
+            goto tag_fail;
+        }
+    }
     
     tag_name = "bios";
     if (vm_get_str_opt(cfg, tag_name, &str) < 0)
@@ -395,6 +409,54 @@ static int virt_machine_parse_config(VirtMachineParams *p,
         }
         p->rtc_local_time = el.u.b;
     }
+
+    tag_name = "rtc_warp";
+    el = json_object_get(cfg, tag_name);
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: boolean expected\n", tag_name);
+            goto tag_fail;
+        }
+        p->rtc_warp = el.u.b;
+    }
+
+    tag_name = "jit";
+    el = json_object_get(cfg, tag_name);
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: boolean expected\n", tag_name);
+            goto tag_fail;
+        }
+        p->jit_enable = el.u.b;
+    }
+
+    if (vm_get_int_opt(cfg, "cpu_count", &p->cpu_count, 1) < 0)
+        goto tag_fail;
+
+    if (vm_get_int_opt(cfg, "tlb_size", &p->tlb_size, 0) < 0)
+        goto tag_fail;
+    if (vm_get_int_opt(cfg, "tlb_ways", &p->tlb_ways, 0) < 0)
+        goto tag_fail;
+
+    tag_name = "tlb_stats";
+    el = json_object_get(cfg, tag_name);
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: boolean expected\n", tag_name);
+            goto tag_fail;
+        }
+        p->tlb_stats = el.u.b;
+    }
+
+    tag_name = "host_sbi";
+    el = json_object_get(cfg, tag_name);
+    if (!json_is_undefined(el)) {
+        if (el.type != JSON_BOOL) {
+            vm_error("%s: boolean expected\n", tag_name);
+            goto tag_fail;
+        }
+        p->host_sbi = el.u.b;
+    }
     
     json_free(cfg);
     return 0;
@@ -638,3 +700,18 @@ void virt_machine_end(VirtMachine *s)
 {
     s->vmc->virt_machine_end(s);
 }
+
+int virt_machine_snapshot(VirtMachine *s, const char *filename, BOOL is_load)
+{
+    SnapshotFile *sf;
+
+    if (!s->vmc->virt_machine_snapshot) {
+        vm_error("snapshots are not supported by this machine\n");
+        return -1;
+    }
+    sf = snapshot_open(filename, is_load);
+    if (!sf)
+        return -1;
+    s->vmc->virt_machine_snapshot(s, sf);
+    return snapshot_close(sf);
+}
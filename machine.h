@@ -87,7 +87,10 @@ typedef struct {
     const VirtMachineClass *vmc;
     char *machine_name;
     uint64_t ram_size;
+    int ram_flags; /* DEVRAM_FLAG_x of the guest RAM (huge pages) */
     BOOL rtc_real_time;
+    BOOL rtc_warp; /* RTC derived from the instruction count, the idle
+                      periods are skipped (RISC-V only) */
     BOOL rtc_local_time;
     char *display_device; /* NULL means no display */
     int width, height; /* graphic width & height */
@@ -101,6 +104,11 @@ typedef struct {
 
     char *cmdline; /* bios or kernel command line */
     BOOL accel_enable; /* enable acceleration (KVM) */
+    BOOL jit_enable; /* enable the dynamic translator (RISC-V machine only) */
+    int tlb_size, tlb_ways; /* TLB geometry, 0 = default (RISC-V only) */
+    BOOL tlb_stats; /* dump the TLB and RAM statistics at power off */
+    BOOL host_sbi; /* SBI in the emulator, no bios (RISC-V only) */
+    int cpu_count; /* number of harts (RISC-V only) */
     char *input_device; /* NULL means no input */
     
     /* kernel, bios and other auxiliary files */
@@ -116,6 +124,9 @@ typedef struct VirtMachine {
     CharacterDevice *console;
     /* graphics */
     FBDevice *fb_dev;
+    /* set by the machine when the guest waits to be cloned by the
+       fork server */
+    BOOL fork_ready;
 } VirtMachine;
 
 struct VirtMachineClass {
@@ -129,6 +140,15 @@ struct VirtMachineClass {
     void (*vm_send_mouse_event)(VirtMachine *s1, int dx, int dy, int dz,
                                 unsigned int buttons);
     void (*vm_send_key_event)(VirtMachine *s1, BOOL is_down, uint16_t key_code);
+    /* NULL if the machine does not run in other threads */
+    void (*virt_machine_io_lock)(VirtMachine *s, BOOL lock);
+    /* NULL if snapshots are not supported */
+    void (*virt_machine_snapshot)(VirtMachine *s, SnapshotFile *sf);
+    /* fork server: NULL if the machine never sets 'fork_ready' */
+    void (*virt_machine_fork_prepare)(VirtMachine *s);
+    void (*virt_machine_fork_resume)(VirtMachine *s, int clone_id);
+    /* NULL if the icount mode is not supported */
+    uint64_t (*virt_machine_get_icount)(VirtMachine *s);
 };
 
 extern const VirtMachineClass riscv_machine_class;
@@ -148,6 +168,11 @@ char *get_file_path(const char *base_filename, const char *filename);
 void virt_machine_free_config(VirtMachineParams *p);
 VirtMachine *virt_machine_init(const VirtMachineParams *p);
 void virt_machine_end(VirtMachine *s);
+/* save the state of the machine to 'filename' or restore it. The
+   machine must have been created from the same configuration. Return
+   -1 if error. */
+int virt_machine_snapshot(VirtMachine *s, const char *filename,
+                          BOOL is_load);
 static inline int virt_machine_get_sleep_duration(VirtMachine *s, int delay)
 {
     return s->vmc->virt_machine_get_sleep_duration(s, delay);
@@ -156,6 +181,32 @@ static inline void virt_machine_interp(VirtMachine *s, int max_exec_cycle)
 {
     s->vmc->virt_machine_interp(s, max_exec_cycle);
 }
+/* The devices are accessed by the CPU threads if the machine has
+   several harts: the main loop releases the lock only while it
+   waits for events. */
+static inline void virt_machine_io_lock(VirtMachine *s, BOOL lock)
+{
+    if (s->vmc->virt_machine_io_lock)
+        s->vmc->virt_machine_io_lock(s, lock);
+}
+/* Called when 'fork_ready' is set: the machine is stopped so that the
+   process can be forked. */
+static inline void virt_machine_fork_prepare(VirtMachine *s)
+{
+    s->vmc->virt_machine_fork_prepare(s);
+}
+/* Called in each clone (numbered from 1) or in the same process if
+   there is no fork server ('clone_id' = 0): the guest continues. */
+static inline void virt_machine_fork_resume(VirtMachine *s, int clone_id)
+{
+    s->vmc->virt_machine_fork_resume(s, clone_id);
+}
+/* number of executed instructions. Only valid between two calls to
+   virt_machine_interp(). */
+static inline uint64_t virt_machine_get_icount(VirtMachine *s)
+{
+    return s->vmc->virt_machine_get_icount(s);
+}
 static inline BOOL vm_mouse_is_absolute(VirtMachine *s)
 {
     return s->vmc->vm_mouse_is_absolute(s);
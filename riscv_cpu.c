@@ -111,6 +111,52 @@ static char *reg_name[32] = {
 "s8", "s9", "s10", "s11", "t3", "t4", "t5", "t6"
 };
 
+/* value of the integer register 'i' for the current XLEN */
+static target_ulong get_reg(RISCVCPUState *s, int i)
+{
+#if MAX_XLEN == 128
+    if (s->cur_xlen <= 64)
+        return (int64_t)s->reg64[i];
+#endif
+    return s->reg[i];
+}
+
+static void set_reg(RISCVCPUState *s, int i, target_ulong val)
+{
+#if MAX_XLEN == 128
+    if (s->cur_xlen <= 64) {
+        s->reg64[i] = val;
+        return;
+    }
+#endif
+    s->reg[i] = val;
+}
+
+#if MAX_XLEN >= 64
+/* With RV128, the integer registers are moved to the register file of
+   the new XLEN. */
+static void set_xlen(RISCVCPUState *s, int xlen)
+{
+#if MAX_XLEN == 128
+    int i;
+
+    if (xlen <= 64 && s->cur_xlen == 128) {
+        for(i = 0; i < 32; i++)
+            s->reg64[i] = s->reg[i];
+    } else if (xlen == 128 && s->cur_xlen <= 64) {
+        /* the results of the RV32 and RV64 code are sign extended.
+           The registers whose low 64 bits did not change keep their
+           upper bits. */
+        for(i = 0; i < 32; i++) {
+            if ((uint64_t)s->reg[i] != s->reg64[i])
+                s->reg[i] = (int64_t)s->reg64[i];
+        }
+    }
+#endif
+    s->cur_xlen = xlen;
+}
+#endif
+
 static void dump_regs(RISCVCPUState *s)
 {
     int i, cols;
@@ -121,7 +167,7 @@ static void dump_regs(RISCVCPUState *s)
     printf(" ");
     for(i = 1; i < 32; i++) {
         printf("%-3s=", reg_name[i]);
-        print_target_ulong(s->reg[i]);
+        print_target_ulong(get_reg(s, i));
         if ((i & (cols - 1)) == (cols - 1))
             printf("\n");
         else
@@ -168,6 +214,19 @@ static __maybe_unused inline uint_type phys_read_u ## size(RISCVCPUState *s, tar
         return 0;\
     return *(uint_type *)(pr->phys_mem + \
                           (uintptr_t)(addr - pr->addr));     \
+}\
+\
+/* return FALSE if the value at 'addr' is no longer 'old' */\
+static __maybe_unused inline BOOL phys_cas_u ## size(RISCVCPUState *s, target_ulong addr, \
+                                              uint_type old, uint_type new) \
+{\
+    PhysMemoryRange *pr = get_phys_mem_range(s->mem_map, addr);\
+    if (!pr || !pr->is_ram)\
+        return TRUE;\
+    return __atomic_compare_exchange_n((uint_type *)(pr->phys_mem + \
+                                       (uintptr_t)(addr - pr->addr)), \
+                                       &old, new, FALSE, __ATOMIC_SEQ_CST, \
+                                       __ATOMIC_SEQ_CST);       \
 }
 
 PHYS_MEM_READ_WRITE(8, uint8_t)
@@ -176,22 +235,99 @@ PHYS_MEM_READ_WRITE(64, uint64_t)
 
 #define PTE_V_MASK (1 << 0)
 #define PTE_U_MASK (1 << 4)
+#define PTE_G_MASK (1 << 5)
 #define PTE_A_MASK (1 << 6)
 #define PTE_D_MASK (1 << 7)
 
-#define ACCESS_READ  0
-#define ACCESS_WRITE 1
-#define ACCESS_CODE  2
+#if MAX_XLEN == 32
+#define SATP_ASID_SHIFT 22
+#define SATP_ASID_BITS  9
+#else
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_BITS  16
+#endif
+#define SATP_ASID_MASK (((target_ulong)1 << SATP_ASID_BITS) - 1)
+
+static inline int get_satp_mode(RISCVCPUState *s)
+{
+#if MAX_XLEN == 32
+    return s->satp >> 31;
+#else
+    return (s->satp >> 60) & 0xf;
+#endif
+}
+
+static inline int get_satp_asid(RISCVCPUState *s)
+{
+    return (s->satp >> SATP_ASID_SHIFT) & SATP_ASID_MASK;
+}
+
+static inline PTWCacheEntry *ptw_cache_entry(RISCVCPUState *s,
+                                             target_ulong vpn, int shift)
+{
+    return &s->ptw_cache[(vpn ^ shift) & (PTW_CACHE_SIZE - 1)];
+}
+
+/* remember that the page table at 'pte_addr' translates the virtual
+   addresses whose upper bits are 'vaddr >> shift' */
+static void ptw_cache_add(RISCVCPUState *s, target_ulong vaddr, int shift,
+                          target_ulong pte_addr, int global)
+{
+    PTWCacheEntry *e;
+    target_ulong vpn;
+
+    vpn = vaddr >> shift;
+    e = ptw_cache_entry(s, vpn, shift);
+    e->vpn = vpn;
+    e->satp = s->satp;
+    e->pte_addr = pte_addr;
+    e->shift = shift;
+    e->global = global;
+}
+
+static void ptw_cache_flush(RISCVCPUState *s)
+{
+    int i;
+    for(i = 0; i < PTW_CACHE_SIZE; i++)
+        s->ptw_cache[i].vpn = -1;
+}
+
+/* flush the page tables used to translate 'vaddr'. The entry of a
+   given 'vpn' and 'shift' can only be at one place, so only one entry
+   per page table level is checked. */
+static void ptw_cache_flush_vaddr(RISCVCPUState *s, target_ulong vaddr)
+{
+    PTWCacheEntry *e;
+    target_ulong vpn;
+    int shift;
+
+#if MAX_XLEN == 32
+    shift = PG_SHIFT + 10; /* sv32 */
+    vpn = vaddr >> shift;
+    e = ptw_cache_entry(s, vpn, shift);
+    if (e->vpn == vpn && e->shift == shift)
+        e->vpn = -1;
+#else
+    for(shift = PG_SHIFT + 9; shift < PG_SHIFT + 9 * 4; shift += 9) {
+        vpn = vaddr >> shift;
+        e = ptw_cache_entry(s, vpn, shift);
+        if (e->vpn == vpn && e->shift == shift)
+            e->vpn = -1;
+    }
+#endif
+}
 
 /* access = 0: read, 1 = write, 2 = code. Set the exception_pending
-   field if necessary. return 0 if OK, -1 if translation error */
+   field if necessary. '*pflags' is set to the TLB_TAG_x flags of the
+   mapping. return 0 if OK, -1 if translation error */
 static int get_phys_addr(RISCVCPUState *s,
-                         target_ulong *ppaddr, target_ulong vaddr,
-                         int access)
+                         target_ulong *ppaddr, int *pflags,
+                         target_ulong vaddr, int access)
 {
     int mode, levels, pte_bits, pte_idx, pte_mask, pte_size_log2, xwr, priv;
-    int need_write, vaddr_shift, i, pte_addr_bits;
-    target_ulong pte_addr, pte, vaddr_mask, paddr;
+    int need_write, vaddr_shift, i, pte_addr_bits, global;
+    target_ulong pte_addr, pte, old_pte, vaddr_mask, paddr, vpn;
+    PTWCacheEntry *e;
 
     if ((s->mstatus & MSTATUS_MPRV) && access != ACCESS_CODE) {
         /* use previous priviledge */
@@ -200,6 +336,7 @@ static int get_phys_addr(RISCVCPUState *s,
         priv = s->priv;
     }
 
+    *pflags = TLB_TAG_GLOBAL | PG_SHIFT;
     if (priv == PRV_M) {
         if (s->cur_xlen < MAX_XLEN) {
             /* truncate virtual address */
@@ -238,10 +375,26 @@ static int get_phys_addr(RISCVCPUState *s,
         pte_addr_bits = 44;
     }
 #endif
-    pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
     pte_bits = 12 - pte_size_log2;
     pte_mask = (1 << pte_bits) - 1;
-    for(i = 0; i < levels; i++) {
+ restart:
+    pte_addr = (s->satp & (((target_ulong)1 << pte_addr_bits) - 1)) << PG_SHIFT;
+    global = 0;
+    /* start from the last page table found in the walk cache */
+    for(i = levels - 1; i > 0; i--) {
+        vaddr_shift = PG_SHIFT + pte_bits * (levels - i);
+        vpn = vaddr >> vaddr_shift;
+        e = ptw_cache_entry(s, vpn, vaddr_shift);
+        if (e->vpn == vpn && e->shift == vaddr_shift && e->satp == s->satp) {
+            pte_addr = e->pte_addr;
+            global = e->global;
+            s->tlb_stats.ptw_hit++;
+            break;
+        }
+    }
+    if (i == 0)
+        s->tlb_stats.ptw_miss++;
+    for(; i < levels; i++) {
         vaddr_shift = PG_SHIFT + pte_bits * (levels - 1 - i);
         pte_idx = (vaddr >> vaddr_shift) & pte_mask;
         pte_addr += pte_idx << pte_size_log2;
@@ -253,6 +406,8 @@ static int get_phys_addr(RISCVCPUState *s,
         if (!(pte & PTE_V_MASK))
             return -1; /* invalid PTE */
         paddr = (pte >> 10) << PG_SHIFT;
+        /* a global non-leaf PTE makes all its mappings global */
+        global |= pte & PTE_G_MASK;
         xwr = (pte >> 1) & 7;
         if (xwr != 0) {
             if (xwr == 2 || xwr == 6)
@@ -274,33 +429,399 @@ static int get_phys_addr(RISCVCPUState *s,
                 return -1;
             need_write = !(pte & PTE_A_MASK) ||
                 (!(pte & PTE_D_MASK) && access == ACCESS_WRITE);
+            old_pte = pte;
             pte |= PTE_A_MASK;
             if (access == ACCESS_WRITE)
                 pte |= PTE_D_MASK;
             if (need_write) {
-                if (pte_size_log2 == 2)
-                    phys_write_u32(s, pte_addr, pte);
-                else
-                    phys_write_u64(s, pte_addr, pte);
+                if (s->io_lock) {
+                    /* another hart may modify the PTE at the same
+                       time: the walk is done again if it changed */
+                    if (pte_size_log2 == 2) {
+                        if (!phys_cas_u32(s, pte_addr, old_pte, pte))
+                            goto restart;
+                    } else {
+                        if (!phys_cas_u64(s, pte_addr, old_pte, pte))
+                            goto restart;
+                    }
+                } else {
+                    if (pte_size_log2 == 2)
+                        phys_write_u32(s, pte_addr, pte);
+                    else
+                        phys_write_u64(s, pte_addr, pte);
+                }
             }
             vaddr_mask = ((target_ulong)1 << vaddr_shift) - 1;
             *ppaddr = (vaddr & vaddr_mask) | (paddr  & ~vaddr_mask);
+            *pflags = (global ? TLB_TAG_GLOBAL : 0) | vaddr_shift;
             return 0;
         } else {
             pte_addr = paddr;
+            if (i < levels - 1)
+                ptw_cache_add(s, vaddr, vaddr_shift, pte_addr, global != 0);
         }
     }
     return -1;
 }
 
+static inline tlb_addr_t tlb_get_key(RISCVCPUState *s, target_ulong addr,
+                                     int access)
+{
+    return ((tlb_addr_t)addr & ~PG_MASK) |
+        (access == ACCESS_CODE ? s->tlb_code_ctx : s->tlb_data_ctx);
+}
+
+/* Same as get_phys_addr() but the superpage translations are kept in
+   a small TLB so that the pages of a superpage missing in the main TLB
+   do not need a page table walk. */
+static int tlb_get_phys_addr(RISCVCPUState *s,
+                             target_ulong *ppaddr, int *pflags,
+                             target_ulong vaddr, int access)
+{
+    TLBLargeEntry *e;
+    target_ulong ctx, vaddr_mask;
+    int i, shift;
+
+    ctx = tlb_get_key(s, vaddr, access) & PG_MASK;
+    for(i = 0; i < TLB_LARGE_SIZE; i++) {
+        e = &s->tlb_large[access][i];
+        shift = e->tag.flags & TLB_TAG_SHIFT_MASK;
+        if ((e->vaddr & PG_MASK) == ctx && ((e->vaddr ^ vaddr) >> shift) == 0) {
+            vaddr_mask = ((target_ulong)1 << shift) - 1;
+            *ppaddr = e->paddr | (vaddr & vaddr_mask);
+            *pflags = e->tag.flags;
+            s->tlb_stats.large_hit++;
+            return 0;
+        }
+    }
+    s->tlb_stats.walk++;
+    if (get_phys_addr(s, ppaddr, pflags, vaddr, access))
+        return -1;
+    shift = *pflags & TLB_TAG_SHIFT_MASK;
+    if (shift > PG_SHIFT) {
+        vaddr_mask = ((target_ulong)1 << shift) - 1;
+        e = &s->tlb_large[access][s->tlb_large_idx];
+        s->tlb_large_idx = (s->tlb_large_idx + 1) & (TLB_LARGE_SIZE - 1);
+        e->vaddr = (vaddr & ~vaddr_mask) | ctx;
+        e->paddr = *ppaddr & ~vaddr_mask;
+        e->tag.asid = s->tlb_asid;
+        e->tag.flags = *pflags;
+    }
+    return 0;
+}
+
+/* Move the entry 'idx' of the TLB 'access' to way 0 of 'set' and
+   shift the other ways (LRU order). If 'idx' is in the victim buffer,
+   it receives the entry of the last way. */
+static void tlb_move_to_front(RISCVCPUState *s, int access, int set, int idx)
+{
+    TLBEntry *tlb = s->tlb[access], e;
+    TLBTag *tag = s->tlb_tag[access], t;
+    int w, n_sets, src;
+
+    n_sets = s->tlb_set_mask + 1;
+    e = tlb[idx];
+    t = tag[idx];
+    if (idx >= s->tlb_ways * n_sets) {
+        w = s->tlb_ways - 1;
+        src = w * n_sets + set;
+        tlb[idx] = tlb[src];
+        tag[idx] = tag[src];
+    } else {
+        w = idx / n_sets;
+    }
+    for(; w > 0; w--) {
+        src = (w - 1) * n_sets + set;
+        tlb[src + n_sets] = tlb[src];
+        tag[src + n_sets] = tag[src];
+    }
+    tlb[set] = e;
+    tag[set] = t;
+}
+
+/* return the index of the entry matching 'key' in the ways of 'set'
+   and in the victim buffer, starting at way 'way0'. Return -1 if not
+   found. */
+static int tlb_find(RISCVCPUState *s, int access, int set, int way0,
+                    tlb_addr_t key)
+{
+    TLBEntry *tlb = s->tlb[access];
+    int idx, n_ways;
+
+    n_ways = s->tlb_ways * (s->tlb_set_mask + 1);
+    for(idx = set + way0 * (s->tlb_set_mask + 1); idx < n_ways;
+        idx += s->tlb_set_mask + 1) {
+        if (tlb[idx].vaddr == key)
+            return idx;
+    }
+    for(idx = n_ways; idx < s->tlb_count; idx++) {
+        if (tlb[idx].vaddr == key)
+            return idx;
+    }
+    return -1;
+}
+
+/* Called when the inline lookup fails. If the page is present in
+   another way or in the victim buffer, it is moved to way 0 and its
+   entry is returned. */
+static TLBEntry *tlb_lookup_slow(RISCVCPUState *s, target_ulong addr,
+                                 int access)
+{
+    int set, idx;
+
+    s->tlb_stats.miss++;
+    if (!TLB_ADDR_OK(addr))
+        return NULL;
+    set = (addr >> PG_SHIFT) & s->tlb_set_mask;
+    idx = tlb_find(s, access, set, 1, tlb_get_key(s, addr, access));
+    if (idx < 0)
+        return NULL;
+    if (idx >= s->tlb_ways * (s->tlb_set_mask + 1))
+        s->tlb_stats.victim_hit++;
+    else
+        s->tlb_stats.way_hit++;
+    tlb_move_to_front(s, access, set, idx);
+    return &s->tlb[access][set];
+}
+
+static void tlb_add_superpage(RISCVCPUState *s, target_ulong addr, int shift)
+{
+    target_ulong v;
+    int i;
+
+    v = ((addr >> shift) << shift) | shift;
+    for(i = 0; i < s->tlb_superpage_count; i++) {
+        if (s->tlb_superpage[i] == v)
+            return;
+    }
+    if (s->tlb_superpage_count < TLB_SUPERPAGE_MAX)
+        s->tlb_superpage[s->tlb_superpage_count] = v;
+    if (s->tlb_superpage_count <= TLB_SUPERPAGE_MAX)
+        s->tlb_superpage_count++;
+}
+
+/* return TRUE if 'vaddr' may be in a superpage having TLB entries */
+static BOOL tlb_in_superpage(RISCVCPUState *s, target_ulong vaddr)
+{
+    target_ulong v;
+    int i, shift;
+
+    if (s->tlb_superpage_count > TLB_SUPERPAGE_MAX)
+        return TRUE;
+    for(i = 0; i < s->tlb_superpage_count; i++) {
+        v = s->tlb_superpage[i];
+        shift = v & PG_MASK;
+        if (((v ^ vaddr) >> shift) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static inline uintptr_t tlb_host_page(TLBEntry *e)
+{
+    return e->mem_addend + (uintptr_t)(e->vaddr & ~PG_MASK);
+}
+
+static inline int *tlb_rmap_bucket(RISCVCPUState *s, uintptr_t host_page)
+{
+    return &s->tlb_rmap_hash[(host_page >> PG_SHIFT) & s->tlb_rmap_hash_mask];
+}
+
+static void tlb_rmap_reset(RISCVCPUState *s)
+{
+    int i;
+
+    for(i = 0; i <= s->tlb_rmap_hash_mask; i++)
+        s->tlb_rmap_hash[i] = -1;
+    for(i = 0; i < PHYS_MEM_RANGE_MAX; i++)
+        s->tlb_rmap_range[i] = -1;
+    for(i = 0; i < s->tlb_count; i++)
+        s->tlb_rmap[i].hash_next = i + 1;
+    s->tlb_rmap[s->tlb_count - 1].hash_next = -1;
+    s->tlb_rmap_free = 0;
+}
+
+/* add the reverse map entry of the new write TLB entry 'e' */
+static void tlb_rmap_add(RISCVCPUState *s, TLBEntry *e, int range)
+{
+    TLBRmapEntry *r;
+    int idx, *phead;
+
+    idx = s->tlb_rmap_free;
+    r = &s->tlb_rmap[idx];
+    s->tlb_rmap_free = r->hash_next;
+    r->key = e->vaddr;
+    r->host_page = tlb_host_page(e);
+    r->range = range;
+    phead = tlb_rmap_bucket(s, r->host_page);
+    r->hash_next = *phead;
+    *phead = idx;
+    r->range_prev = -1;
+    r->range_next = s->tlb_rmap_range[range];
+    if (r->range_next >= 0)
+        s->tlb_rmap[r->range_next].range_prev = idx;
+    s->tlb_rmap_range[range] = idx;
+}
+
+/* remove the reverse map entry of the write TLB entry 'e' */
+static void tlb_rmap_remove(RISCVCPUState *s, TLBEntry *e)
+{
+    TLBRmapEntry *r;
+    uintptr_t host_page;
+    int idx, *pidx;
+
+    host_page = tlb_host_page(e);
+    pidx = tlb_rmap_bucket(s, host_page);
+    for(;;) {
+        idx = *pidx;
+        assert(idx >= 0);
+        r = &s->tlb_rmap[idx];
+        if (r->key == e->vaddr && r->host_page == host_page)
+            break;
+        pidx = &r->hash_next;
+    }
+    *pidx = r->hash_next;
+    if (r->range_prev >= 0)
+        s->tlb_rmap[r->range_prev].range_next = r->range_next;
+    else
+        s->tlb_rmap_range[r->range] = r->range_next;
+    if (r->range_next >= 0)
+        s->tlb_rmap[r->range_next].range_prev = r->range_prev;
+    r->hash_next = s->tlb_rmap_free;
+    s->tlb_rmap_free = idx;
+}
+
+static inline void tlb_invalidate(RISCVCPUState *s, int access, TLBEntry *e)
+{
+    if (access == ACCESS_WRITE)
+        tlb_rmap_remove(s, e);
+    e->vaddr = -1;
+}
+
+/* add the translation of 'addr' to 'ptr' in the TLB 'access'. The
+   page must not already be in the TLB (i.e. tlb_lookup_slow() failed).
+   'pr' is the RAM range containing 'ptr'. */
+static void tlb_fill(RISCVCPUState *s, target_ulong addr, int access,
+                     uint8_t *ptr, int flags, PhysMemoryRange *pr)
+{
+    tlb_addr_t key;
+    TLBEntry *e;
+    TLBTag *t;
+    int set, idx;
+
+    if (!TLB_ADDR_OK(addr))
+        return;
+    key = tlb_get_key(s, addr, access);
+    set = (addr >> PG_SHIFT) & s->tlb_set_mask;
+    /* the last way goes to the victim buffer, replacing its oldest
+       entry */
+    idx = s->tlb_ways * (s->tlb_set_mask + 1) + s->tlb_victim_idx;
+    s->tlb_victim_idx = (s->tlb_victim_idx + 1) & (TLB_VICTIM_SIZE - 1);
+    if (s->tlb[access][idx].vaddr != -1) {
+        s->tlb_stats.evict++;
+        tlb_invalidate(s, access, &s->tlb[access][idx]);
+    }
+    tlb_move_to_front(s, access, set, idx);
+    e = &s->tlb[access][set];
+    t = &s->tlb_tag[access][set];
+    e->vaddr = key;
+    e->mem_addend = (uintptr_t)ptr - addr;
+    t->asid = s->tlb_asid;
+    t->flags = flags;
+    if (access == ACCESS_WRITE)
+        tlb_rmap_add(s, e, pr - s->mem_map->phys_mem_range);
+    if ((flags & TLB_TAG_SHIFT_MASK) > PG_SHIFT)
+        tlb_add_superpage(s, addr, flags & TLB_TAG_SHIFT_MASK);
+}
+
+#ifdef USE_JIT
+#include "riscv_jit_x86_64.h"
+#endif
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+
+static inline uint32_t dc_hash_func(uint8_t *mem_ptr)
+{
+    return ((uintptr_t)mem_ptr >> PG_SHIFT) & (DC_HASH_SIZE - 1);
+}
+
+static DecodedPage *dc_find_page(RISCVCPUState *s, uint8_t *mem_ptr)
+{
+    DecodedPage *p;
+    for(p = s->dc_hash[dc_hash_func(mem_ptr)]; p != NULL; p = p->hash_next) {
+        if (p->mem_ptr == mem_ptr)
+            return p;
+    }
+    return NULL;
+}
+
+static void dc_flush_all(RISCVCPUState *s)
+{
+    memset(s->dc_hash, 0, sizeof(s->dc_hash));
+    s->dc_page_count = 0;
+}
+
+/* Invalidate the decoded instructions overlapping the 'size' bytes
+   written at 'offset' in the page at 'mem_ptr'. Return TRUE if the
+   page is cached, in which case no write TLB entry must be created
+   for it. */
+static BOOL dc_write_invalidate(RISCVCPUState *s, uint8_t *mem_ptr,
+                                int offset, int size)
+{
+    DecodedPage *p;
+    int i, start, end;
+
+    p = dc_find_page(s, mem_ptr);
+    if (!p || p->disabled)
+        return FALSE;
+    if (++p->write_count >= DC_WRITE_COUNT_MAX) {
+        /* probably data: the generic interpreter is used for the
+           whole page so that the writes can use the TLB again */
+        for(i = 0; i < countof(p->insn); i++)
+            p->insn[i].op = DC_OP(DOP_LEGACY, 4);
+        p->disabled = TRUE;
+#ifdef USE_JIT
+        jit_invalidate_page(p);
+#endif
+        return FALSE;
+    }
+    /* a 32 bit instruction may start 2 bytes before the write */
+    start = max_int(offset - 2, 0) >> 1;
+    end = (offset + size - 1) >> 1;
+    for(i = start; i <= end; i++)
+        p->insn[i].op = DOP_NONE;
+#ifdef USE_JIT
+    /* the translated blocks are not tracked individually */
+    jit_invalidate_page(p);
+#endif
+    return TRUE;
+}
+
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+
+static inline void cpu_io_lock(RISCVCPUState *s, BOOL lock)
+{
+    if (s->io_lock)
+        s->io_lock(s->io_lock_opaque, lock);
+}
+
+/* With several harts, the dirty bits are reset by another thread
+   which cannot flush the TLB of this hart, so the writes to RAM with
+   dirty bits always use the slow path. */
+static inline BOOL can_fill_write_tlb(RISCVCPUState *s, PhysMemoryRange *pr)
+{
+    return !s->io_lock || !pr->dirty_bits;
+}
+
 /* return 0 if OK, != 0 if exception */
 int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
                      target_ulong addr, int size_log2)
 {
-    int size, tlb_idx, err, al;
+    int size, err, al, flags;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
+    TLBEntry *e;
     mem_uint_t ret;
 
     /* first handle unaligned accesses */
@@ -367,7 +888,12 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
             abort();
         }
     } else {
-        if (get_phys_addr(s, &paddr, addr, ACCESS_READ)) {
+        e = tlb_lookup_slow(s, addr, ACCESS_READ);
+        if (e) {
+            ptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
+            goto read_ram;
+        }
+        if (tlb_get_phys_addr(s, &paddr, &flags, addr, ACCESS_READ)) {
             s->pending_tval = addr;
             s->pending_exception = CAUSE_LOAD_PAGE_FAULT;
             return -1;
@@ -381,10 +907,9 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 #endif
             return 0;
         } else if (pr->is_ram) {
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-            s->tlb_read[tlb_idx].vaddr = addr & ~PG_MASK;
-            s->tlb_read[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+            tlb_fill(s, addr, ACCESS_READ, ptr, flags, pr);
+        read_ram:
             switch(size_log2) {
             case 0:
                 ret = *(uint8_t *)ptr;
@@ -410,6 +935,7 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
             }
         } else {
             offset = paddr - pr->addr;
+            cpu_io_lock(s, TRUE);
             if (((pr->devio_flags >> size_log2) & 1) != 0) {
                 ret = pr->read_func(pr->opaque, offset, size_log2);
             }
@@ -429,6 +955,7 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 #endif
                 ret = 0;
             }
+            cpu_io_lock(s, FALSE);
         }
     }
     *pval = ret;
@@ -439,13 +966,16 @@ int target_read_slow(RISCVCPUState *s, mem_uint_t *pval,
 int target_write_slow(RISCVCPUState *s, target_ulong addr,
                       mem_uint_t val, int size_log2)
 {
-    int size, i, tlb_idx, err;
+    int size, i, err, flags;
     target_ulong paddr, offset;
     uint8_t *ptr;
     PhysMemoryRange *pr;
+    TLBEntry *e;
+    BOOL dirty_lock;
     
     /* first handle unaligned accesses */
     size = 1 << size_log2;
+    dirty_lock = FALSE;
     if ((addr & (size - 1)) != 0) {
         /* XXX: should avoid modifying the memory in case of exception */
         for(i = 0; i < size; i++) {
@@ -454,7 +984,12 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
                 return err;
         }
     } else {
-        if (get_phys_addr(s, &paddr, addr, ACCESS_WRITE)) {
+        e = tlb_lookup_slow(s, addr, ACCESS_WRITE);
+        if (e) {
+            ptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
+            goto write_ram;
+        }
+        if (tlb_get_phys_addr(s, &paddr, &flags, addr, ACCESS_WRITE)) {
             s->pending_tval = addr;
             s->pending_exception = CAUSE_STORE_PAGE_FAULT;
             return -1;
@@ -467,11 +1002,24 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
             printf("\n");
 #endif
         } else if (pr->is_ram) {
+            /* the dirty bits are read and reset by the main thread
+               with the I/O lock held: the lock is kept until the RAM
+               is written so that the write is seen by the next read
+               of the dirty bits */
+            dirty_lock = (pr->dirty_bits != NULL);
+            if (dirty_lock)
+                cpu_io_lock(s, TRUE);
             phys_mem_set_dirty_bit(pr, paddr - pr->addr);
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
             ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-            s->tlb_write[tlb_idx].vaddr = addr & ~PG_MASK;
-            s->tlb_write[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+#ifdef CONFIG_RISCV_DECODE_CACHE
+            if (!dc_write_invalidate(s, ptr - (paddr & PG_MASK),
+                                     paddr & PG_MASK, size))
+#endif
+            {
+                if (can_fill_write_tlb(s, pr))
+                    tlb_fill(s, addr, ACCESS_WRITE, ptr, flags, pr);
+            }
+        write_ram:
             switch(size_log2) {
             case 0:
                 *(uint8_t *)ptr = val;
@@ -495,8 +1043,11 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
             default:
                 abort();
             }
+            if (dirty_lock)
+                cpu_io_lock(s, FALSE);
         } else {
             offset = paddr - pr->addr;
+            cpu_io_lock(s, TRUE);
             if (((pr->devio_flags >> size_log2) & 1) != 0) {
                 pr->write_func(pr->opaque, offset, val, size_log2);
             }
@@ -516,11 +1067,132 @@ int target_write_slow(RISCVCPUState *s, target_ulong addr,
                 printf(" width=%d bits\n", 1 << (3 + size_log2));
 #endif
             }
+            cpu_io_lock(s, FALSE);
+        }
+    }
+    return 0;
+}
+
+/* Return the host address of the RAM at 'addr' for an atomic
+   read-modify-write access, or NULL if it is a device or if 'addr' is
+   not aligned. Return -1 if exception. */
+static int target_get_atomic_ptr(RISCVCPUState *s, uint8_t **pptr,
+                                 target_ulong addr, int size_log2)
+{
+    int flags;
+    target_ulong paddr;
+    uint8_t *ptr;
+    PhysMemoryRange *pr;
+    TLBEntry *e;
+
+    *pptr = NULL;
+    if ((addr & ((1 << size_log2) - 1)) != 0)
+        return 0;
+    e = &s->tlb[ACCESS_WRITE][(addr >> PG_SHIFT) & s->tlb_set_mask];
+    if (e->vaddr != tlb_get_key(s, addr, ACCESS_WRITE) || !TLB_ADDR_OK(addr))
+        e = tlb_lookup_slow(s, addr, ACCESS_WRITE);
+    if (e) {
+        *pptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
+        return 0;
+    }
+    if (tlb_get_phys_addr(s, &paddr, &flags, addr, ACCESS_WRITE)) {
+        s->pending_tval = addr;
+        s->pending_exception = CAUSE_STORE_PAGE_FAULT;
+        return -1;
+    }
+    pr = get_phys_mem_range(s->mem_map, paddr);
+    if (!pr || !pr->is_ram)
+        return 0;
+    if (pr->dirty_bits) {
+        /* see target_write_slow() */
+        cpu_io_lock(s, TRUE);
+        phys_mem_set_dirty_bit(pr, paddr - pr->addr);
+        cpu_io_lock(s, FALSE);
+    }
+    ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
+#ifdef CONFIG_RISCV_DECODE_CACHE
+    if (!dc_write_invalidate(s, ptr - (paddr & PG_MASK),
+                             paddr & PG_MASK, 1 << size_log2))
+#endif
+    {
+        if (can_fill_write_tlb(s, pr))
+            tlb_fill(s, addr, ACCESS_WRITE, ptr, flags, pr);
+    }
+    *pptr = ptr;
+    return 0;
+}
+
+/* Atomically replace the value 'old' at 'addr' with 'new'. '*pcur'
+   is set to the value which was in memory. Return -1 if exception and
+   1 if the access cannot be done atomically, in which case the caller
+   uses normal accesses. */
+#define TARGET_CAS(size, uint_type, size_log2)                          \
+static inline __exception int target_cas_u ## size(RISCVCPUState *s,   \
+                                                   target_ulong addr,   \
+                                                   uint_type old,       \
+                                                   uint_type new,       \
+                                                   uint_type *pcur)     \
+{                                                                       \
+    uint8_t *ptr;                                                       \
+                                                                        \
+    if (target_get_atomic_ptr(s, &ptr, addr, size_log2))                \
+        return -1;                                                      \
+    if (!ptr)                                                           \
+        return 1;                                                       \
+    __atomic_compare_exchange_n((uint_type *)ptr, &old, new, FALSE,     \
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);    \
+    *pcur = old;                                                        \
+    return 0;                                                           \
+}
+
+TARGET_CAS(32, uint32_t, 2)
+#if MLEN >= 64
+TARGET_CAS(64, uint64_t, 3)
+#endif
+#if MLEN >= 128
+/* no 128 bit host atomics: only used with a single hart */
+static inline __exception int target_cas_u128(RISCVCPUState *s,
+                                              target_ulong addr,
+                                              uint128_t old, uint128_t new,
+                                              uint128_t *pcur)
+{
+    return 1;
+}
+#endif
+
+/* Zero the cache block containing 'addr' (cbo.zero). The RAM blocks
+   are translated once with the write TLB. Return -1 if exception. */
+static __exception int target_zero_block(RISCVCPUState *s, target_ulong addr)
+{
+    uint8_t *ptr;
+    int i;
+
+    addr &= ~(target_ulong)(CBO_BLOCK_SIZE - 1);
+    if (target_get_atomic_ptr(s, &ptr, addr, CBO_BLOCK_SIZE_LOG2))
+        return -1;
+    if (ptr) {
+        memset(ptr, 0, CBO_BLOCK_SIZE);
+    } else {
+        /* device */
+        for(i = 0; i < CBO_BLOCK_SIZE; i += 4) {
+            if (target_write_u32(s, addr + i, 0))
+                return -1;
         }
     }
     return 0;
 }
 
+/* Return TRUE if the cache block operations selected by 'mask' in
+   menvcfg and senvcfg are enabled at the current privilege level. */
+static BOOL cbo_enabled(RISCVCPUState *s, uint32_t mask)
+{
+    if (s->priv < PRV_M && !(s->menvcfg & mask))
+        return FALSE;
+    if (s->priv < PRV_S && !(s->senvcfg & mask))
+        return FALSE;
+    return TRUE;
+}
+
 struct __attribute__((packed)) unaligned_u32 {
     uint32_t u32;
 };
@@ -540,12 +1212,18 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
                                                        uint8_t **pptr,
                                                        target_ulong addr)
 {
-    int tlb_idx;
+    int flags;
     target_ulong paddr;
     uint8_t *ptr;
     PhysMemoryRange *pr;
+    TLBEntry *e;
     
-    if (get_phys_addr(s, &paddr, addr, ACCESS_CODE)) {
+    e = tlb_lookup_slow(s, addr, ACCESS_CODE);
+    if (e) {
+        *pptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
+        return 0;
+    }
+    if (tlb_get_phys_addr(s, &paddr, &flags, addr, ACCESS_CODE)) {
         s->pending_tval = addr;
         s->pending_exception = CAUSE_FETCH_PAGE_FAULT;
         return -1;
@@ -557,10 +1235,8 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
         s->pending_exception = CAUSE_FAULT_FETCH;
         return -1;
     }
-    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
     ptr = pr->phys_mem + (uintptr_t)(paddr - pr->addr);
-    s->tlb_code[tlb_idx].vaddr = addr & ~PG_MASK;
-    s->tlb_code[tlb_idx].mem_addend = (uintptr_t)ptr - addr;
+    tlb_fill(s, addr, ACCESS_CODE, ptr, flags, pr);
     *pptr = ptr;
     return 0;
 }
@@ -569,13 +1245,13 @@ static no_inline __exception int target_read_insn_slow(RISCVCPUState *s,
 static inline __exception int target_read_insn_u16(RISCVCPUState *s, uint16_t *pinsn,
                                                    target_ulong addr)
 {
-    uint32_t tlb_idx;
+    TLBEntry *e;
     uint8_t *ptr;
     
-    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-    if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
-        ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
-                          (uintptr_t)addr);
+    e = &s->tlb[ACCESS_CODE][(addr >> PG_SHIFT) & s->tlb_set_mask];
+    if (likely(e->vaddr == tlb_get_key(s, addr, ACCESS_CODE) &&
+               TLB_ADDR_OK(addr))) {
+        ptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
     } else {
         if (target_read_insn_slow(s, &ptr, addr))
             return -1;
@@ -586,45 +1262,343 @@ static inline __exception int target_read_insn_u16(RISCVCPUState *s, uint16_t *p
 
 static void tlb_init(RISCVCPUState *s)
 {
-    int i;
+    int i, k;
     
-    for(i = 0; i < TLB_SIZE; i++) {
-        s->tlb_read[i].vaddr = -1;
-        s->tlb_write[i].vaddr = -1;
-        s->tlb_code[i].vaddr = -1;
+    for(k = 0; k < 3; k++) {
+        for(i = 0; i < s->tlb_count; i++)
+            s->tlb[k][i].vaddr = -1;
+        for(i = 0; i < TLB_LARGE_SIZE; i++)
+            s->tlb_large[k][i].vaddr = -1;
     }
+    tlb_rmap_reset(s);
+    s->tlb_victim_idx = 0;
+    s->tlb_large_idx = 0;
+    ptw_cache_flush(s);
+    s->tlb_superpage_count = 0;
+    /* the context identifiers can be reused */
+    s->tlb_ctx_count = 0;
+    s->tlb_data_key = -1;
+    s->tlb_code_key = -1;
+}
+
+static void tlb_update_ctx(RISCVCPUState *s);
+
+/* 'size' is the number of entries of each TLB (without the victim
+   buffer). Return -1 if the geometry is not supported. */
+static int tlb_alloc(RISCVCPUState *s, int size, int ways)
+{
+    int count, k, *rmap_hash;
+    void *buf;
+    TLBEntry *tlb;
+    TLBTag *tag;
+    TLBRmapEntry *rmap;
+
+    if (ways != 1 && ways != 2 && ways != 4)
+        return -1;
+    if (size < ways || size > TLB_SIZE_MAX || (size & (size - 1)) != 0)
+        return -1;
+    count = size + TLB_VICTIM_SIZE;
+    buf = malloc(3 * count * sizeof(TLBEntry) + TLB_ENTRY_ALIGN - 1);
+    tag = malloc(3 * count * sizeof(TLBTag));
+    rmap = malloc(count * sizeof(TLBRmapEntry));
+    rmap_hash = malloc(size * sizeof(int));
+    if (!buf || !tag || !rmap || !rmap_hash) {
+        free(buf);
+        free(tag);
+        free(rmap);
+        free(rmap_hash);
+        return -1;
+    }
+    free(s->tlb_buf);
+    free(s->tlb_tag[0]);
+    free(s->tlb_rmap);
+    free(s->tlb_rmap_hash);
+    s->tlb_buf = buf;
+    s->tlb_rmap = rmap;
+    s->tlb_rmap_hash = rmap_hash;
+    s->tlb_rmap_hash_mask = size - 1;
+    tlb = (TLBEntry *)(((uintptr_t)buf + TLB_ENTRY_ALIGN - 1) &
+                       ~(uintptr_t)(TLB_ENTRY_ALIGN - 1));
+    for(k = 0; k < 3; k++) {
+        s->tlb[k] = tlb + k * count;
+        s->tlb_tag[k] = tag + k * count;
+    }
+    s->tlb_set_mask = size / ways - 1;
+    s->tlb_ways = ways;
+    s->tlb_count = count;
+    tlb_init(s);
+    tlb_update_ctx(s);
+    return 0;
 }
 
 static void tlb_flush_all(RISCVCPUState *s)
 {
+    s->tlb_stats.flush++;
     tlb_init(s);
+    tlb_update_ctx(s);
 }
 
-static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr)
+/* return TRUE if the entry must be flushed by a sfence.vma with the
+   given ASID (-1 = all ASIDs) */
+static inline BOOL tlb_match_asid(TLBTag *t, int asid)
 {
-    tlb_flush_all(s);
+    return asid < 0 || (!(t->flags & TLB_TAG_GLOBAL) && t->asid == asid);
+}
+
+/* flush the non global entries of 'asid' */
+static void tlb_flush_asid(RISCVCPUState *s, int asid)
+{
+    int i, k;
+    for(k = 0; k < 3; k++) {
+        for(i = 0; i < s->tlb_count; i++) {
+            if (s->tlb[k][i].vaddr != -1 &&
+                tlb_match_asid(&s->tlb_tag[k][i], asid))
+                tlb_invalidate(s, k, &s->tlb[k][i]);
+        }
+        for(i = 0; i < TLB_LARGE_SIZE; i++) {
+            if (tlb_match_asid(&s->tlb_large[k][i].tag, asid))
+                s->tlb_large[k][i].vaddr = -1;
+        }
+    }
+    ptw_cache_flush(s);
+}
+
+static void tlb_flush_vaddr1(RISCVCPUState *s, int access, int idx,
+                             target_ulong vaddr, int asid)
+{
+    TLBEntry *e = &s->tlb[access][idx];
+    TLBTag *t = &s->tlb_tag[access][idx];
+    int shift;
+
+    if (e->vaddr == -1 || !TLB_ADDR_OK(vaddr))
+        return;
+    shift = t->flags & TLB_TAG_SHIFT_MASK;
+    if (((e->vaddr ^ (tlb_addr_t)vaddr) >> shift) == 0 &&
+        tlb_match_asid(t, asid))
+        tlb_invalidate(s, access, e);
 }
 
-/* XXX: inefficient but not critical as long as it is seldom used */
+/* flush the entries mapping 'vaddr' for 'asid' (-1 = all ASIDs) */
+static void tlb_flush_vaddr(RISCVCPUState *s, target_ulong vaddr, int asid)
+{
+    int i, k, n_sets, n_ways, shift;
+    BOOL in_superpage;
+    TLBLargeEntry *e;
+
+    n_sets = s->tlb_set_mask + 1;
+    n_ways = s->tlb_ways * n_sets;
+    in_superpage = tlb_in_superpage(s, vaddr);
+    ptw_cache_flush_vaddr(s, vaddr);
+    for(k = 0; k < 3; k++) {
+        if (in_superpage) {
+            /* the entries are created for each 4 KB page of a
+               superpage, so all of them must be checked */
+            for(i = 0; i < s->tlb_count; i++)
+                tlb_flush_vaddr1(s, k, i, vaddr, asid);
+        } else {
+            for(i = (vaddr >> PG_SHIFT) & s->tlb_set_mask; i < n_ways;
+                i += n_sets)
+                tlb_flush_vaddr1(s, k, i, vaddr, asid);
+            for(i = n_ways; i < s->tlb_count; i++)
+                tlb_flush_vaddr1(s, k, i, vaddr, asid);
+        }
+        for(i = 0; i < TLB_LARGE_SIZE; i++) {
+            e = &s->tlb_large[k][i];
+            shift = e->tag.flags & TLB_TAG_SHIFT_MASK;
+            if (((e->vaddr ^ vaddr) >> shift) == 0 &&
+                tlb_match_asid(&e->tag, asid))
+                e->vaddr = -1;
+        }
+    }
+}
+
+/* return the MMU context of the accesses of type 'access' */
+static int tlb_get_ctx(RISCVCPUState *s, int access)
+{
+    int priv;
+
+    if ((s->mstatus & MSTATUS_MPRV) && access != ACCESS_CODE) {
+        priv = (s->mstatus >> MSTATUS_MPP_SHIFT) & 3;
+    } else {
+        priv = s->priv;
+    }
+    if (priv == PRV_M || get_satp_mode(s) == 0)
+        return TLB_CTX_PHYS;
+    return priv | ((s->mstatus & MSTATUS_SUM) ? 4 : 0) |
+        ((s->mstatus & MSTATUS_MXR) ? 8 : 0);
+}
+
+/* return the identifier of the context 'key' or -1 if they are all
+   used */
+static int tlb_get_ctx_id(RISCVCPUState *s, uint32_t key)
+{
+    int i;
+
+    for(i = 0; i < s->tlb_ctx_count; i++) {
+        if (s->tlb_ctx_keys[i] == key)
+            return i;
+    }
+    if (s->tlb_ctx_count >= TLB_CTX_MAX)
+        return -1;
+    s->tlb_ctx_keys[s->tlb_ctx_count] = key;
+    return s->tlb_ctx_count++;
+}
+
+/* Must be called when the privilege, the MMU related mstatus bits or
+   the ASID are modified. Instead of flushing the TLB, the new context
+   gets its own identifier so that the entries of the previous ones can
+   be used again when switching back to them. */
+static void tlb_update_ctx(RISCVCPUState *s)
+{
+    uint32_t data_key, code_key;
+    int data_id, code_id, asid;
+
+    asid = get_satp_asid(s);
+    data_key = (asid << 8) | tlb_get_ctx(s, ACCESS_READ);
+    code_key = (asid << 8) | tlb_get_ctx(s, ACCESS_CODE);
+    if (data_key == s->tlb_data_key && code_key == s->tlb_code_key)
+        return;
+    data_id = tlb_get_ctx_id(s, data_key);
+    code_id = tlb_get_ctx_id(s, code_key);
+    if (data_id < 0 || code_id < 0) {
+        /* no more identifiers: restart from an empty TLB */
+        tlb_flush_all(s);
+        return;
+    }
+    s->tlb_data_ctx = (tlb_addr_t)data_id << TLB_CTX_SHIFT;
+    s->tlb_code_ctx = (tlb_addr_t)code_id << TLB_CTX_SHIFT;
+    s->tlb_data_key = data_key;
+    s->tlb_code_key = code_key;
+    s->tlb_asid = asid;
+}
+
+/* invalidate the write TLB entry of the reverse map entry 'idx' */
+static void tlb_rmap_flush(RISCVCPUState *s, int idx)
+{
+    tlb_addr_t key;
+    int i;
+
+    key = s->tlb_rmap[idx].key;
+    i = tlb_find(s, ACCESS_WRITE, (key >> PG_SHIFT) & s->tlb_set_mask, 0, key);
+    assert(i >= 0);
+    tlb_invalidate(s, ACCESS_WRITE, &s->tlb[ACCESS_WRITE][i]);
+}
+
+/* number of pages above which the list of the RAM range is used
+   instead of the hash table */
+#define TLB_RMAP_PAGES_MAX 16
+
 static void glue(riscv_cpu_flush_tlb_write_range_ram,
                  MAX_XLEN)(RISCVCPUState *s,
                            uint8_t *ram_ptr, size_t ram_size)
 {
-    uint8_t *ptr, *ram_end;
-    int i;
-    
-    ram_end = ram_ptr + ram_size;
-    for(i = 0; i < TLB_SIZE; i++) {
-        if (s->tlb_write[i].vaddr != -1) {
-            ptr = (uint8_t *)(s->tlb_write[i].mem_addend +
-                              (uintptr_t)s->tlb_write[i].vaddr);
-            if (ptr >= ram_ptr && ptr < ram_end) {
-                s->tlb_write[i].vaddr = -1;
+    PhysMemoryMap *map = s->mem_map;
+    PhysMemoryRange *pr;
+    TLBRmapEntry *r;
+    uintptr_t start, end, page;
+    int i, next;
+
+    start = (uintptr_t)ram_ptr;
+    end = start + ram_size;
+    if (ram_size <= (TLB_RMAP_PAGES_MAX << PG_SHIFT)) {
+        for(page = start; page < end; page += 1 << PG_SHIFT) {
+            for(i = *tlb_rmap_bucket(s, page); i >= 0; i = next) {
+                r = &s->tlb_rmap[i];
+                next = r->hash_next;
+                if (r->host_page == page)
+                    tlb_rmap_flush(s, i);
             }
         }
+    } else {
+        for(i = 0; i < map->n_phys_mem_range; i++) {
+            pr = &map->phys_mem_range[i];
+            if (pr->is_ram && start >= (uintptr_t)pr->phys_mem &&
+                start < (uintptr_t)pr->phys_mem + pr->org_size)
+                break;
+        }
+        if (i == map->n_phys_mem_range)
+            return;
+        for(i = s->tlb_rmap_range[i]; i >= 0; i = next) {
+            r = &s->tlb_rmap[i];
+            next = r->range_next;
+            if (r->host_page >= start && r->host_page < end)
+                tlb_rmap_flush(s, i);
+        }
     }
 }
 
+static int glue(riscv_cpu_set_tlb_size, MAX_XLEN)(RISCVCPUState *s,
+                                                  int size, int ways)
+{
+    return tlb_alloc(s, size ? size : TLB_SIZE, ways ? ways : TLB_WAYS);
+}
+
+static void glue(riscv_cpu_dump_tlb_stats, MAX_XLEN)(RISCVCPUState *s)
+{
+    TLBStats *st = &s->tlb_stats;
+    fprintf(stderr, "TLB: 3 x %d entries, %d way(s), %d victim entries\n",
+            s->tlb_count - TLB_VICTIM_SIZE, s->tlb_ways, TLB_VICTIM_SIZE);
+    fprintf(stderr, "  insns=%" PRId64 " miss=%" PRId64 " way_hit=%" PRId64
+            " victim_hit=%" PRId64 " large_hit=%" PRId64 "\n",
+            s->insn_counter, st->miss, st->way_hit, st->victim_hit,
+            st->large_hit);
+    fprintf(stderr, "  walk=%" PRId64 " ptw_hit=%" PRId64 " ptw_miss=%" PRId64
+            " evict=%" PRId64 " flush=%" PRId64 "\n",
+            st->walk, st->ptw_hit, st->ptw_miss, st->evict, st->flush);
+}
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+/* return the decoded instructions of the page at 'mem_ptr' */
+static no_inline DecodedPage *dc_get_page(RISCVCPUState *s, uint8_t *mem_ptr,
+                                          int xlen)
+{
+    DecodedPage *p;
+    uint32_t h;
+
+    p = dc_find_page(s, mem_ptr);
+    if (p) {
+        if (unlikely(p->xlen != xlen) && !p->disabled) {
+            memset(p->insn, 0, sizeof(p->insn));
+            p->xlen = xlen;
+#ifdef USE_JIT
+            jit_invalidate_page(p);
+#endif
+        }
+        return p;
+    }
+    if (s->dc_page_count >= DC_PAGE_COUNT_MAX)
+        dc_flush_all(s);
+    if (s->dc_page_count >= s->dc_page_alloc) {
+        p = malloc(sizeof(DecodedPage));
+        if (!p) {
+            fprintf(stderr, "Could not allocate decode cache page\n");
+            exit(1);
+        }
+#ifdef USE_JIT
+        p->jit_entry = NULL;
+#endif
+        s->dc_pages[s->dc_page_alloc++] = p;
+    }
+    p = s->dc_pages[s->dc_page_count++];
+    memset(p->insn, 0, sizeof(p->insn));
+#ifdef USE_JIT
+    jit_invalidate_page(p);
+#endif
+    p->mem_ptr = mem_ptr;
+    p->xlen = xlen;
+    p->disabled = FALSE;
+    p->write_count = 0;
+    h = dc_hash_func(mem_ptr);
+    p->hash_next = s->dc_hash[h];
+    s->dc_hash[h] = p;
+    /* the writes to the page must now go through target_write_slow()
+       so that the decoded instructions are invalidated */
+    glue(riscv_cpu_flush_tlb_write_range_ram, MAX_XLEN)(s, mem_ptr,
+                                                        1 << PG_SHIFT);
+    return p;
+}
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+
 
 #define SSTATUS_MASK0 (MSTATUS_UIE | MSTATUS_SIE |       \
                       MSTATUS_UPIE | MSTATUS_SPIE |     \
@@ -645,7 +1619,62 @@ static void glue(riscv_cpu_flush_tlb_write_range_ram,
                       MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)
 
 /* cycle and insn counters */
-#define COUNTEREN_MASK ((1 << 0) | (1 << 2))
+#define COUNTEREN_MASK ((1 << 0) | (1 << 1) | (1 << 2))
+#define COUNTEREN_TM (1 << 1)
+
+/* writable bits of menvcfg: Sstc needs the 'time' CSR */
+static uint64_t get_menvcfg_mask(RISCVCPUState *s)
+{
+    if (s->get_time)
+        return MENVCFG_STCE | ENVCFG_CBO_MASK;
+    else
+        return ENVCFG_CBO_MASK;
+}
+
+/* cache block operation fields of menvcfg and senvcfg. The reserved
+   CBIE value is replaced by 0 (cbo.inval is illegal). */
+static uint32_t envcfg_cbo_legalize(target_ulong val)
+{
+    val &= ENVCFG_CBO_MASK;
+    if ((val & ENVCFG_CBIE_MASK) == (2 << ENVCFG_CBIE_SHIFT))
+        val &= ~ENVCFG_CBIE_MASK;
+    return val;
+}
+
+/* mip is also modified by the devices and the other harts, which may
+   run in other threads */
+static inline void mip_set(RISCVCPUState *s, uint32_t mask)
+{
+    __atomic_fetch_or(&s->mip, mask, __ATOMIC_SEQ_CST);
+}
+
+static inline void mip_reset(RISCVCPUState *s, uint32_t mask)
+{
+    __atomic_fetch_and(&s->mip, ~mask, __ATOMIC_SEQ_CST);
+}
+
+/* write the bits 'mask' of mip with 'val' */
+static inline void mip_write(RISCVCPUState *s, target_ulong val, uint32_t mask)
+{
+    mip_reset(s, mask & ~val);
+    mip_set(s, mask & val);
+}
+
+/* with Sstc, STIP is set when 'time' >= stimecmp. The comparison is
+   done when stimecmp or menvcfg are written and when entering
+   riscv_cpu_interp(). */
+static void update_stip(RISCVCPUState *s)
+{
+    if (!(s->menvcfg & MENVCFG_STCE))
+        return;
+    if (s->get_time(s->get_time_opaque) >= s->stimecmp) {
+        mip_set(s, MIP_STIP);
+        if (s->power_down_flag && (s->mip & s->mie) != 0)
+            s->power_down_flag = FALSE;
+    } else {
+        mip_reset(s, MIP_STIP);
+    }
+}
 
 /* return the complete mstatus with the SD bit */
 static target_ulong get_mstatus(RISCVCPUState *s, target_ulong mask)
@@ -673,14 +1702,8 @@ static int get_base_from_xlen(int xlen)
 
 static void set_mstatus(RISCVCPUState *s, target_ulong val)
 {
-    target_ulong mod, mask;
+    target_ulong mask;
     
-    /* flush the TLBs if change of MMU config */
-    mod = s->mstatus ^ val;
-    if ((mod & (MSTATUS_MPRV | MSTATUS_SUM | MSTATUS_MXR)) != 0 ||
-        ((s->mstatus & MSTATUS_MPRV) && (mod & MSTATUS_MPP) != 0)) {
-        tlb_flush_all(s);
-    }
     s->fs = (val >> MSTATUS_FS_SHIFT) & 3;
 
     mask = MSTATUS_MASK & ~MSTATUS_FS;
@@ -696,6 +1719,8 @@ static void set_mstatus(RISCVCPUState *s, target_ulong val)
     }
 #endif
     s->mstatus = (s->mstatus & ~mask) | (val & mask);
+    /* change of MMU config */
+    tlb_update_ctx(s);
 }
 
 /* return -1 if invalid CSR. 0 if OK. 'will_write' indicate that the
@@ -729,7 +1754,10 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
         break;
 #endif
     case 0xc00: /* ucycle */
+    case 0xc01: /* utime */
     case 0xc02: /* uinstret */
+        if (csr == 0xc01 && !s->get_time)
+            goto invalid_csr;
         {
             uint32_t counteren;
             if (s->priv < PRV_M) {
@@ -741,12 +1769,18 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
                     goto invalid_csr;
             }
         }
-        val = (int64_t)s->insn_counter;
+        if (csr == 0xc01)
+            val = (int64_t)s->get_time(s->get_time_opaque);
+        else
+            val = (int64_t)s->insn_counter;
         break;
     case 0xc80: /* mcycleh */
+    case 0xc81: /* utimeh */
     case 0xc82: /* minstreth */
         if (s->cur_xlen != 32)
             goto invalid_csr;
+        if (csr == 0xc81 && !s->get_time)
+            goto invalid_csr;
         {
             uint32_t counteren;
             if (s->priv < PRV_M) {
@@ -758,7 +1792,10 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
                     goto invalid_csr;
             }
         }
-        val = s->insn_counter >> 32;
+        if (csr == 0xc81)
+            val = s->get_time(s->get_time_opaque) >> 32;
+        else
+            val = s->insn_counter >> 32;
         break;
         
     case 0x100:
@@ -773,6 +1810,9 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     case 0x106:
         val = s->scounteren;
         break;
+    case 0x10a: /* senvcfg */
+        val = s->senvcfg;
+        break;
     case 0x140:
         val = s->sscratch;
         break;
@@ -788,6 +1828,22 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     case 0x144: /* sip */
         val = s->mip & s->mideleg;
         break;
+    case 0x14d: /* stimecmp */
+    case 0x15d: /* stimecmph */
+        if (!s->get_time)
+            goto invalid_csr;
+        if (s->priv < PRV_M &&
+            (!(s->menvcfg & MENVCFG_STCE) ||
+             !(s->mcounteren & COUNTEREN_TM)))
+            goto invalid_csr;
+        if (csr == 0x15d) {
+            if (s->cur_xlen != 32)
+                goto invalid_csr;
+            val = s->stimecmp >> 32;
+        } else {
+            val = s->stimecmp;
+        }
+        break;
     case 0x180:
         val = s->satp;
         break;
@@ -813,6 +1869,14 @@ static int csr_read(RISCVCPUState *s, target_ulong *pval, uint32_t csr,
     case 0x306:
         val = s->mcounteren;
         break;
+    case 0x30a: /* menvcfg */
+        val = s->menvcfg;
+        break;
+    case 0x31a: /* menvcfgh */
+        if (s->cur_xlen != 32)
+            goto invalid_csr;
+        val = s->menvcfg >> 32;
+        break;
     case 0x340:
         val = s->mscratch;
         break;
@@ -916,6 +1980,9 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
     case 0x106:
         s->scounteren = val & COUNTEREN_MASK;
         break;
+    case 0x10a: /* senvcfg */
+        s->senvcfg = envcfg_cbo_legalize(val);
+        break;
     case 0x140:
         s->sscratch = val;
         break;
@@ -930,29 +1997,51 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         break;
     case 0x144: /* sip */
         mask = s->mideleg;
-        s->mip = (s->mip & ~mask) | (val & mask);
+        if (s->menvcfg & MENVCFG_STCE)
+            mask &= ~MIP_STIP;
+        mip_write(s, val, mask);
+        break;
+    case 0x14d: /* stimecmp */
+        if (s->cur_xlen == 32)
+            s->stimecmp = (s->stimecmp & ~(uint64_t)0xffffffff) | (uint32_t)val;
+        else
+            s->stimecmp = val;
+        update_stip(s);
+        break;
+    case 0x15d: /* stimecmph */
+        s->stimecmp = (s->stimecmp & 0xffffffff) | ((uint64_t)(uint32_t)val << 32);
+        update_stip(s);
         break;
     case 0x180:
-        /* no ASID implemented */
-#if MAX_XLEN == 32
+        /* the TLB entries are tagged with the ASID: a new ASID only
+           selects another TLB context (see tlb_update_ctx()) */
         {
+            target_ulong old_satp = s->satp;
+#if MAX_XLEN == 32
             int new_mode;
             new_mode = (val >> 31) & 1;
-            s->satp = (val & (((target_ulong)1 << 22) - 1)) |
+            s->satp = (val & (((target_ulong)1 << 31) - 1)) |
                 (new_mode << 31);
-        }
 #else
-        {
             int mode, new_mode;
             mode = s->satp >> 60;
             new_mode = (val >> 60) & 0xf;
             if (new_mode == 0 || (new_mode >= 8 && new_mode <= 9))
                 mode = new_mode;
-            s->satp = (val & (((uint64_t)1 << 44) - 1)) |
+            s->satp = (val & (((uint64_t)1 << 60) - 1)) |
                 ((uint64_t)mode << 60);
-        }
 #endif
-        tlb_flush_all(s);
+            if (((old_satp ^ s->satp) >> (SATP_ASID_SHIFT + SATP_ASID_BITS)) != 0) {
+                /* change of translation mode */
+                tlb_flush_all(s);
+            } else if (((old_satp ^ s->satp) >> SATP_ASID_SHIFT) == 0 &&
+                       old_satp != s->satp) {
+                /* new page table with the same ASID: needed for the
+                   software which does not use the ASIDs */
+                tlb_flush_asid(s, get_satp_asid(s));
+            }
+            tlb_update_ctx(s);
+        }
         return 2;
         
     case 0x300:
@@ -968,7 +2057,7 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
                    = 2^(mxl + 4) */
                 if (s->mxl != new_mxl) {
                     s->mxl = new_mxl;
-                    s->cur_xlen = 1 << (new_mxl + 4);
+                    set_xlen(s, 1 << (new_mxl + 4));
                     return 1;
                 }
             }
@@ -993,6 +2082,24 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
     case 0x306:
         s->mcounteren = val & COUNTEREN_MASK;
         break;
+    case 0x30a: /* menvcfg */
+        {
+            uint64_t mask64 = get_menvcfg_mask(s);
+            if (s->cur_xlen == 32)
+                mask64 &= 0xffffffff;
+            val = (val & ~ENVCFG_CBO_MASK) | envcfg_cbo_legalize(val);
+            s->menvcfg = (s->menvcfg & ~mask64) | ((uint64_t)val & mask64);
+            update_stip(s);
+        }
+        break;
+    case 0x31a: /* menvcfgh */
+        {
+            uint64_t mask64 = get_menvcfg_mask(s) & ~(uint64_t)0xffffffff;
+            s->menvcfg = (s->menvcfg & ~mask64) |
+                (((uint64_t)(uint32_t)val << 32) & mask64);
+            update_stip(s);
+        }
+        break;
     case 0x340:
         s->mscratch = val;
         break;
@@ -1007,7 +2114,9 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
         break;
     case 0x344:
         mask = MIP_SSIP | MIP_STIP;
-        s->mip = (s->mip & ~mask) | (val & mask);
+        if (s->menvcfg & MENVCFG_STCE)
+            mask &= ~MIP_STIP;
+        mip_write(s, val, mask);
         break;
     default:
 #ifdef DUMP_INVALID_CSR
@@ -1021,22 +2130,27 @@ static int csr_write(RISCVCPUState *s, uint32_t csr, target_ulong val)
 static void set_priv(RISCVCPUState *s, int priv)
 {
     if (s->priv != priv) {
-        tlb_flush_all(s);
 #if MAX_XLEN >= 64
         /* change the current xlen */
         {
-            int mxl;
+            int mxl, xlen;
             if (priv == PRV_S)
                 mxl = (s->mstatus >> MSTATUS_SXL_SHIFT) & 3;
             else if (priv == PRV_U)
                 mxl = (s->mstatus >> MSTATUS_UXL_SHIFT) & 3;
             else
                 mxl = s->mxl;
-            s->cur_xlen = 1 << (4 + mxl);
+            xlen = 1 << (4 + mxl);
+            /* the virtual addresses are truncated differently */
+            if (xlen != s->cur_xlen)
+                tlb_flush_all(s);
+            set_xlen(s, xlen);
         }
 #endif
         s->priv = priv;
     }
+    /* MPP may also have been modified */
+    tlb_update_ctx(s);
 }
 
 static void raise_exception2(RISCVCPUState *s, uint32_t cause,
@@ -1124,6 +2238,27 @@ static void raise_exception(RISCVCPUState *s, uint32_t cause)
     raise_exception2(s, cause, 0);
 }
 
+/* ecall from S mode handled by the emulator */
+static void handle_sbi_call(RISCVCPUState *s)
+{
+    uint64_t a[8];
+    int i;
+
+    for(i = 0; i < 8; i++) {
+        if (s->cur_xlen == 32)
+            a[i] = (uint32_t)get_reg(s, 10 + i);
+        else
+            a[i] = get_reg(s, 10 + i);
+    }
+    s->sbi_call(s->sbi_call_opaque, s->cur_xlen, a);
+    for(i = 0; i < 2; i++) {
+        if (s->cur_xlen == 32)
+            set_reg(s, 10 + i, (int32_t)a[i]);
+        else
+            set_reg(s, 10 + i, (int64_t)a[i]);
+    }
+}
+
 static void handle_sret(RISCVCPUState *s)
 {
     int spp, spie;
@@ -1213,6 +2348,45 @@ static inline uint32_t get_field1(uint32_t val, int src_pos,
         return (val >> (src_pos - dst_pos)) & mask;
 }
 
+#ifdef CONFIG_EXT_C
+/* 32 bit instruction encoding, used to expand the compressed
+   instructions */
+static inline uint32_t insn_r(uint32_t opcode, int funct3, int funct7,
+                              int rd, int rs1, int rs2)
+{
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+        (rs2 << 20) | (funct7 << 25);
+}
+
+static inline uint32_t insn_i(uint32_t opcode, int funct3, int rd, int rs1,
+                              int32_t imm)
+{
+    return opcode | (rd << 7) | (funct3 << 12) | (rs1 << 15) |
+        ((uint32_t)imm << 20);
+}
+
+static inline uint32_t insn_s(uint32_t opcode, int funct3, int rs1, int rs2,
+                              int32_t imm)
+{
+    return opcode | ((imm & 0x1f) << 7) | (funct3 << 12) | (rs1 << 15) |
+        (rs2 << 20) | ((uint32_t)(imm >> 5) << 25);
+}
+
+static inline uint32_t insn_b(int funct3, int rs1, int rs2, int32_t imm)
+{
+    return 0x63 | get_field1(imm, 11, 7, 7) | get_field1(imm, 1, 8, 11) |
+        (funct3 << 12) | (rs1 << 15) | (rs2 << 20) |
+        get_field1(imm, 5, 25, 30) | get_field1(imm, 12, 31, 31);
+}
+
+static inline uint32_t insn_j(int rd, int32_t imm)
+{
+    return 0x6f | (rd << 7) | get_field1(imm, 12, 12, 19) |
+        get_field1(imm, 11, 20, 20) | get_field1(imm, 1, 21, 30) |
+        get_field1(imm, 20, 31, 31);
+}
+#endif
+
 #define XLEN 32
 #include "riscv_cpu_template.h"
 
@@ -1233,6 +2407,7 @@ static void glue(riscv_cpu_interp, MAX_XLEN)(RISCVCPUState *s, int n_cycles)
 #endif
     uint64_t timeout;
 
+    update_stip(s);
     timeout = s->insn_counter + n_cycles;
     while (!s->power_down_flag &&
            (int)(timeout - s->insn_counter) > 0) {
@@ -1265,7 +2440,7 @@ static uint64_t glue(riscv_cpu_get_cycles, MAX_XLEN)(RISCVCPUState *s)
 
 static void glue(riscv_cpu_set_mip, MAX_XLEN)(RISCVCPUState *s, uint32_t mask)
 {
-    s->mip |= mask;
+    mip_set(s, mask);
     /* exit from power down if an interrupt is pending */
     if (s->power_down_flag && (s->mip & s->mie) != 0)
         s->power_down_flag = FALSE;
@@ -1273,7 +2448,7 @@ static void glue(riscv_cpu_set_mip, MAX_XLEN)(RISCVCPUState *s, uint32_t mask)
 
 static void glue(riscv_cpu_reset_mip, MAX_XLEN)(RISCVCPUState *s, uint32_t mask)
 {
-    s->mip &= ~mask;
+    mip_reset(s, mask);
 }
 
 static uint32_t glue(riscv_cpu_get_mip, MAX_XLEN)(RISCVCPUState *s)
@@ -1303,6 +2478,10 @@ static RISCVCPUState *glue(riscv_cpu_init, MAX_XLEN)(PhysMemoryMap *mem_map)
     s->mxl = get_base_from_xlen(MAX_XLEN);
     s->mstatus = ((uint64_t)s->mxl << MSTATUS_UXL_SHIFT) |
         ((uint64_t)s->mxl << MSTATUS_SXL_SHIFT);
+    s->stimecmp = UINT64_MAX;
+    /* the cache block operations are enabled in S mode for the
+       firmwares which do not know menvcfg */
+    s->menvcfg = ENVCFG_CBO_MASK;
     s->misa |= MCPUID_SUPER | MCPUID_USER | MCPUID_I | MCPUID_M | MCPUID_A;
 #if FLEN >= 32
     s->misa |= MCPUID_F;
@@ -1316,12 +2495,24 @@ static RISCVCPUState *glue(riscv_cpu_init, MAX_XLEN)(PhysMemoryMap *mem_map)
 #ifdef CONFIG_EXT_C
     s->misa |= MCPUID_C;
 #endif
-    tlb_init(s);
+    tlb_alloc(s, TLB_SIZE, TLB_WAYS);
     return s;
 }
 
 static void glue(riscv_cpu_end, MAX_XLEN)(RISCVCPUState *s)
 {
+#ifdef CONFIG_RISCV_DECODE_CACHE
+    int i;
+#ifdef USE_JIT
+    jit_end(s);
+#endif
+    for(i = 0; i < s->dc_page_alloc; i++)
+        free(s->dc_pages[i]);
+#endif
+    free(s->tlb_buf);
+    free(s->tlb_tag[0]);
+    free(s->tlb_rmap);
+    free(s->tlb_rmap_hash);
 #ifdef USE_GLOBAL_STATE
     free(s);
 #endif
@@ -1332,6 +2523,149 @@ static uint32_t glue(riscv_cpu_get_misa, MAX_XLEN)(RISCVCPUState *s)
     return s->misa;
 }
 
+static void glue(riscv_cpu_set_rdtime, MAX_XLEN)(RISCVCPUState *s,
+                                                 uint64_t (*get_time)(void *opaque),
+                                                 void *opaque)
+{
+    s->get_time = get_time;
+    s->get_time_opaque = opaque;
+}
+
+static uint64_t glue(riscv_cpu_get_stimecmp, MAX_XLEN)(RISCVCPUState *s)
+{
+    if (!(s->menvcfg & MENVCFG_STCE))
+        return UINT64_MAX;
+    return s->stimecmp;
+}
+
+static void glue(riscv_cpu_set_stimecmp, MAX_XLEN)(RISCVCPUState *s,
+                                                   uint64_t val)
+{
+    s->stimecmp = val;
+    update_stip(s);
+}
+
+static void glue(riscv_cpu_set_sbi_handler, MAX_XLEN)(RISCVCPUState *s,
+                                                      RISCVSBIFunc *sbi_call,
+                                                      void *opaque)
+{
+    s->sbi_call = sbi_call;
+    s->sbi_call_opaque = opaque;
+}
+
+static void glue(riscv_cpu_set_smp, MAX_XLEN)(RISCVCPUState *s, int hartid,
+                                              void (*io_lock)(void *opaque, BOOL lock),
+                                              void *opaque)
+{
+    s->mhartid = hartid;
+    s->io_lock = io_lock;
+    s->io_lock_opaque = opaque;
+}
+
+static void glue(riscv_cpu_flush_tlb, MAX_XLEN)(RISCVCPUState *s)
+{
+    tlb_flush_all(s);
+}
+
+static void glue(riscv_cpu_flush_icache, MAX_XLEN)(RISCVCPUState *s)
+{
+#ifdef CONFIG_RISCV_DECODE_CACHE
+    dc_flush_all(s);
+#endif
+}
+
+static int glue(riscv_cpu_enable_jit, MAX_XLEN)(RISCVCPUState *s)
+{
+#ifdef USE_JIT
+    if (!s->jit_code_buf && jit_init(s) < 0)
+        return -1;
+    s->jit_enabled = TRUE;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void glue(riscv_cpu_snapshot, MAX_XLEN)(RISCVCPUState *s,
+                                               SnapshotFile *sf)
+{
+    snapshot_section(sf, "cpu");
+    snapshot_field(sf, s->pc);
+    snapshot_field(sf, s->reg);
+#if MAX_XLEN == 128
+    snapshot_field(sf, s->reg64);
+#endif
+#if FLEN > 0
+    snapshot_field(sf, s->fp_reg);
+    snapshot_field(sf, s->fflags);
+    snapshot_field(sf, s->frm);
+#endif
+    snapshot_field(sf, s->cur_xlen);
+    snapshot_field(sf, s->priv);
+    snapshot_field(sf, s->fs);
+    snapshot_field(sf, s->mxl);
+    snapshot_field(sf, s->insn_counter);
+    snapshot_field(sf, s->power_down_flag);
+
+    snapshot_field(sf, s->mstatus);
+    snapshot_field(sf, s->mtvec);
+    snapshot_field(sf, s->mscratch);
+    snapshot_field(sf, s->mepc);
+    snapshot_field(sf, s->mcause);
+    snapshot_field(sf, s->mtval);
+    snapshot_field(sf, s->misa);
+    snapshot_field(sf, s->mie);
+    snapshot_field(sf, s->mip);
+    snapshot_field(sf, s->medeleg);
+    snapshot_field(sf, s->mideleg);
+    snapshot_field(sf, s->mcounteren);
+    snapshot_field(sf, s->stvec);
+    snapshot_field(sf, s->sscratch);
+    snapshot_field(sf, s->sepc);
+    snapshot_field(sf, s->scause);
+    snapshot_field(sf, s->stval);
+    snapshot_field(sf, s->satp);
+    snapshot_field(sf, s->scounteren);
+    snapshot_field(sf, s->senvcfg);
+    snapshot_field(sf, s->menvcfg);
+    snapshot_field(sf, s->stimecmp);
+    snapshot_field(sf, s->load_res);
+    snapshot_field(sf, s->load_res_val);
+
+    if (snapshot_is_load(sf)) {
+        tlb_flush_all(s);
+#ifdef CONFIG_RISCV_DECODE_CACHE
+        dc_flush_all(s);
+#endif
+        update_stip(s);
+    }
+}
+
+static uint32_t glue(riscv_cpu_expand_compressed, MAX_XLEN)(RISCVCPUState *s,
+                                                           int xlen,
+                                                           uint32_t insn)
+{
+#ifdef CONFIG_EXT_C
+    insn &= 0xffff;
+    switch(xlen) {
+    case 32:
+        return rvc_expand32(insn);
+#if MAX_XLEN >= 64
+    case 64:
+        return rvc_expand64(insn);
+#endif
+#if MAX_XLEN >= 128
+    case 128:
+        return rvc_expand128(insn);
+#endif
+    default:
+        return 0;
+    }
+#else
+    return 0;
+#endif
+}
+
 const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_init, MAX_XLEN),
     glue(riscv_cpu_end, MAX_XLEN),
@@ -1343,6 +2677,18 @@ const RISCVCPUClass glue(riscv_cpu_class, MAX_XLEN) = {
     glue(riscv_cpu_get_power_down, MAX_XLEN),
     glue(riscv_cpu_get_misa, MAX_XLEN),
     glue(riscv_cpu_flush_tlb_write_range_ram, MAX_XLEN),
+    glue(riscv_cpu_enable_jit, MAX_XLEN),
+    glue(riscv_cpu_set_tlb_size, MAX_XLEN),
+    glue(riscv_cpu_dump_tlb_stats, MAX_XLEN),
+    glue(riscv_cpu_set_rdtime, MAX_XLEN),
+    glue(riscv_cpu_get_stimecmp, MAX_XLEN),
+    glue(riscv_cpu_set_stimecmp, MAX_XLEN),
+    glue(riscv_cpu_set_sbi_handler, MAX_XLEN),
+    glue(riscv_cpu_flush_tlb, MAX_XLEN),
+    glue(riscv_cpu_flush_icache, MAX_XLEN),
+    glue(riscv_cpu_set_smp, MAX_XLEN),
+    glue(riscv_cpu_snapshot, MAX_XLEN),
+    glue(riscv_cpu_expand_compressed, MAX_XLEN),
 };
 
 #if CONFIG_RISCV_MAX_XLEN == MAX_XLEN
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include "cutils.h"
 #include "iomem.h"
+#include "snapshot.h"
 
 #define MIP_USIP (1 << 0)
 #define MIP_SSIP (1 << 1)
@@ -41,8 +42,16 @@
 #define MIP_HEIP (1 << 10)
 #define MIP_MEIP (1 << 11)
 
+/* cache block size of the Zicbom, Zicbop and Zicboz extensions */
+#define CBO_BLOCK_SIZE_LOG2 6
+#define CBO_BLOCK_SIZE (1 << CBO_BLOCK_SIZE_LOG2)
+
 typedef struct RISCVCPUState RISCVCPUState;
 
+/* 'a' contains the registers a0 to a7 zero extended from 'xlen' bits.
+   a0 and a1 are written back. */
+typedef void RISCVSBIFunc(void *opaque, int xlen, uint64_t *a);
+
 typedef struct {
     RISCVCPUState *(*riscv_cpu_init)(PhysMemoryMap *mem_map);
     void (*riscv_cpu_end)(RISCVCPUState *s);
@@ -55,6 +64,24 @@ typedef struct {
     uint32_t (*riscv_cpu_get_misa)(RISCVCPUState *s);
     void (*riscv_cpu_flush_tlb_write_range_ram)(RISCVCPUState *s,
                                                 uint8_t *ram_ptr, size_t ram_size);
+    int (*riscv_cpu_enable_jit)(RISCVCPUState *s);
+    int (*riscv_cpu_set_tlb_size)(RISCVCPUState *s, int size, int ways);
+    void (*riscv_cpu_dump_tlb_stats)(RISCVCPUState *s);
+    void (*riscv_cpu_set_rdtime)(RISCVCPUState *s,
+                                 uint64_t (*get_time)(void *opaque),
+                                 void *opaque);
+    uint64_t (*riscv_cpu_get_stimecmp)(RISCVCPUState *s);
+    void (*riscv_cpu_set_stimecmp)(RISCVCPUState *s, uint64_t val);
+    void (*riscv_cpu_set_sbi_handler)(RISCVCPUState *s,
+                                      RISCVSBIFunc *sbi_call, void *opaque);
+    void (*riscv_cpu_flush_tlb)(RISCVCPUState *s);
+    void (*riscv_cpu_flush_icache)(RISCVCPUState *s);
+    void (*riscv_cpu_set_smp)(RISCVCPUState *s, int hartid,
+                              void (*io_lock)(void *opaque, BOOL lock),
+                              void *opaque);
+    void (*riscv_cpu_snapshot)(RISCVCPUState *s, SnapshotFile *sf);
+    uint32_t (*riscv_cpu_expand_compressed)(RISCVCPUState *s, int xlen,
+                                            uint32_t insn);
 } RISCVCPUClass;
 
 typedef struct {
@@ -114,5 +141,93 @@ static inline void riscv_cpu_flush_tlb_write_range_ram(RISCVCPUState *s,
     const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
     c->riscv_cpu_flush_tlb_write_range_ram(s, ram_ptr, ram_size);
 }
+/* use the dynamic translator. Return -1 if not supported. */
+static inline int riscv_cpu_enable_jit(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_enable_jit(s);
+}
+/* set the number of TLB entries and the associativity (1, 2 or 4), 0
+   selects the default value. Return -1 if not supported. */
+static inline int riscv_cpu_set_tlb_size(RISCVCPUState *s, int size, int ways)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_set_tlb_size(s, size, ways);
+}
+/* print the TLB statistics on stderr */
+static inline void riscv_cpu_dump_tlb_stats(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_dump_tlb_stats(s);
+}
+/* 'get_time' returns the value of the 'time' CSR. If it is not set,
+   reading 'time' is an illegal instruction so that it can be emulated
+   by the firmware. */
+static inline void riscv_cpu_set_rdtime(RISCVCPUState *s,
+                                        uint64_t (*get_time)(void *opaque),
+                                        void *opaque)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_rdtime(s, get_time, opaque);
+}
+/* 'time' value at which the Sstc supervisor timer interrupt is raised,
+   UINT64_MAX if the supervisor timer is not enabled in menvcfg */
+static inline uint64_t riscv_cpu_get_stimecmp(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_get_stimecmp(s);
+}
+/* set stimecmp and update STIP as if it was written by the guest */
+static inline void riscv_cpu_set_stimecmp(RISCVCPUState *s, uint64_t val)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_stimecmp(s, val);
+}
+/* the ecall instructions executed in S mode call 'sbi_call' instead of
+   raising an exception (no M mode firmware). NULL disables it. */
+static inline void riscv_cpu_set_sbi_handler(RISCVCPUState *s,
+                                             RISCVSBIFunc *sbi_call,
+                                             void *opaque)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_sbi_handler(s, sbi_call, opaque);
+}
+/* same effect as sfence.vma with no arguments */
+static inline void riscv_cpu_flush_tlb(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_flush_tlb(s);
+}
+/* same effect as fence.i */
+static inline void riscv_cpu_flush_icache(RISCVCPUState *s)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_flush_icache(s);
+}
+/* set mhartid. If 'io_lock' is not NULL, the CPU runs in its own
+   thread: it is called around the device accesses and the atomic
+   instructions use host atomics. */
+static inline void riscv_cpu_set_smp(RISCVCPUState *s, int hartid,
+                                     void (*io_lock)(void *opaque, BOOL lock),
+                                     void *opaque)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_set_smp(s, hartid, io_lock, opaque);
+}
+/* save or load the architectural state. The TLBs and the decoded
+   instructions are flushed when loading. */
+static inline void riscv_cpu_snapshot(RISCVCPUState *s, SnapshotFile *sf)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    c->riscv_cpu_snapshot(s, sf);
+}
+/* return the 32 bit equivalent of the compressed instruction 'insn'
+   when the current XLEN is 'xlen', or 0 if it is illegal */
+static inline uint32_t riscv_cpu_expand_compressed(RISCVCPUState *s, int xlen,
+                                                   uint32_t insn)
+{
+    const RISCVCPUClass *c = ((RISCVCPUCommonState *)s)->class_ptr;
+    return c->riscv_cpu_expand_compressed(s, xlen, insn);
+}
 
 #endif /* RISCV_CPU_H */
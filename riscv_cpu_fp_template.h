@@ -154,7 +154,7 @@
                     goto illegal_insn;
                 }
                 if (rd != 0)
-                    s->reg[rd] = val;
+                    s->XREG[rd] = val;
                 break;
             case (0x14 << 2) | OPID:
                 switch(rm) {
@@ -174,7 +174,7 @@
                     goto illegal_insn;
                 }
                 if (rd != 0)
-                    s->reg[rd] = val;
+                    s->XREG[rd] = val;
                 break;
             case (0x1a << 2) | OPID:
                 rm = get_insn_rm(s, rm);
@@ -182,31 +182,31 @@
                     goto illegal_insn;
                 switch(rs2) {
                 case 0: /* fcvt.[sdq].w */
-                    s->fp_reg[rd] = glue(cvt_i32_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_i32_sf, F_SIZE)(s->XREG[rs1], rm,
                                                        &s->fflags) | F_HIGH;
                     break;
                 case 1: /* fcvt.[sdq].wu */
-                    s->fp_reg[rd] = glue(cvt_u32_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_u32_sf, F_SIZE)(s->XREG[rs1], rm,
                                                        &s->fflags) | F_HIGH;
                     break;
 #if XLEN >= 64
                 case 2: /* fcvt.[sdq].l */
-                    s->fp_reg[rd] = glue(cvt_i64_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_i64_sf, F_SIZE)(s->XREG[rs1], rm,
                                                        &s->fflags) | F_HIGH;
                     break;
                 case 3: /* fcvt.[sdq].lu */
-                    s->fp_reg[rd] = glue(cvt_u64_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_u64_sf, F_SIZE)(s->XREG[rs1], rm,
                                                             &s->fflags) | F_HIGH;
                     break;
 #endif
 #if XLEN >= 128
                 /* XXX: the index is not defined in the spec */
                 case 4: /* fcvt.[sdq].t */
-                    s->fp_reg[rd] = glue(cvt_i128_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_i128_sf, F_SIZE)(s->XREG[rs1], rm,
                                                        &s->fflags) | F_HIGH;
                     break;
                 case 5: /* fcvt.[sdq].tu */
-                    s->fp_reg[rd] = glue(cvt_u128_sf, F_SIZE)(s->reg[rs1], rm,
+                    s->fp_reg[rd] = glue(cvt_u128_sf, F_SIZE)(s->XREG[rs1], rm,
                                                             &s->fflags) | F_HIGH;
                     break;
 #endif
@@ -278,7 +278,7 @@
                     goto illegal_insn;
                 }
                 if (rd != 0)
-                    s->reg[rd] = val;
+                    s->XREG[rd] = val;
                 break;
 
 #if F_SIZE <= XLEN
@@ -286,11 +286,11 @@
                 if (rs2 != 0 || rm != 0)
                     goto illegal_insn;
 #if F_SIZE == 32
-                s->fp_reg[rd] = (int32_t)s->reg[rs1];
+                s->fp_reg[rd] = (int32_t)s->XREG[rs1];
 #elif F_SIZE == 64
-                s->fp_reg[rd] = (int64_t)s->reg[rs1];
+                s->fp_reg[rd] = (int64_t)s->XREG[rs1];
 #else
-                s->fp_reg[rd] = (int128_t)s->reg[rs1];
+                s->fp_reg[rd] = (int128_t)s->XREG[rs1];
 #endif
                 s->fs = 3;
                 break;
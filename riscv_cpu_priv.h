@@ -39,6 +39,18 @@
 
 #define CONFIG_EXT_C /* compressed instructions */
 
+/* the dynamic translator works on the decoded instructions */
+#if defined(CONFIG_RISCV_JIT) && defined(CONFIG_RISCV_DECODE_CACHE) && \
+    defined(__x86_64__) && !defined(EMSCRIPTEN) && MAX_XLEN <= 64
+#define USE_JIT
+#endif
+
+/* emscripten only supports the single loop form of the interpreter */
+#if defined(CONFIG_RISCV_COMPUTED_GOTO) && defined(__GNUC__) && \
+    !defined(EMSCRIPTEN)
+#define USE_COMPUTED_GOTO
+#endif
+
 #if defined(EMSCRIPTEN)
 #define USE_GLOBAL_STATE
 /* use local variables slows down the generated JS code */
@@ -98,7 +110,14 @@ typedef uint128_t mem_uint_t;
 #unsupported MLEN
 #endif
 
-#define TLB_SIZE 256
+/* default TLB geometry (for each access type) */
+#define TLB_SIZE 1024
+#define TLB_WAYS 2
+#define TLB_SIZE_MAX (1 << 16)
+#define TLB_VICTIM_SIZE 8 /* fully associative victim buffer */
+#define TLB_SUPERPAGE_MAX 8
+#define TLB_LARGE_SIZE 16 /* fully associative superpage TLB */
+#define PTW_CACHE_SIZE 64 /* page table walk cache (direct mapped) */
 
 #define CAUSE_MISALIGNED_FETCH    0x0
 #define CAUSE_FAULT_FETCH         0x1
@@ -167,19 +186,220 @@ typedef uint128_t mem_uint_t;
 #define MSTATUS_UXL_MASK ((uint64_t)3 << MSTATUS_UXL_SHIFT)
 #define MSTATUS_SXL_MASK ((uint64_t)3 << MSTATUS_SXL_SHIFT)
 
+/* menvcfg and senvcfg CSRs */
+#define ENVCFG_CBIE_SHIFT 4 /* cbo.inval enable (2 bits) */
+#define ENVCFG_CBIE_MASK (3 << ENVCFG_CBIE_SHIFT)
+#define ENVCFG_CBCFE (1 << 6) /* cbo.clean and cbo.flush enable */
+#define ENVCFG_CBZE (1 << 7) /* cbo.zero enable */
+#define ENVCFG_CBO_MASK (ENVCFG_CBIE_MASK | ENVCFG_CBCFE | ENVCFG_CBZE)
+#define MENVCFG_STCE ((uint64_t)1 << 63) /* Sstc enable */
+
 #define PG_SHIFT 12
 #define PG_MASK ((1 << PG_SHIFT) - 1)
 
+#define ACCESS_READ  0
+#define ACCESS_WRITE 1
+#define ACCESS_CODE  2
+
+/* Virtual address as stored in the TLBs. With RV128, only the
+   addresses which are the sign extension of their low 64 bits are put
+   in the TLBs (it includes all the translated addresses), so that the
+   RV32 and RV64 code does not pay for 128 bit tags. */
+#if MAX_XLEN == 128
+typedef uint64_t tlb_addr_t;
+#define TLB_ADDR_OK(addr) ((addr) == (target_ulong)(int64_t)(addr))
+#else
+typedef target_ulong tlb_addr_t;
+#define TLB_ADDR_OK(addr) 1
+#endif
+
+#define TLB_ENTRY_ALIGN 16
+
+/* Entry layout of the read, write and code TLBs. 'vaddr' is the page
+   address ORed with the MMU context identifier (see tlb_update_ctx())
+   or -1 if the entry is free. The size is a power of two so that an
+   entry never crosses a cache line. */
 typedef struct {
-    target_ulong vaddr;
+    tlb_addr_t vaddr;
     uintptr_t mem_addend;
-} TLBEntry;
+} __attribute__((aligned(TLB_ENTRY_ALIGN))) TLBEntry;
+
+/* Kept apart from TLBEntry so that the fast path only touches
+   'vaddr' and 'mem_addend'. */
+typedef struct {
+    uint16_t asid;
+    uint8_t flags; /* TLB_TAG_x */
+} TLBTag;
+
+typedef struct {
+    uint64_t miss; /* accesses not handled by the inline lookup */
+    uint64_t way_hit; /* found in another way of the set */
+    uint64_t victim_hit; /* found in the victim buffer */
+    uint64_t large_hit; /* translated by the superpage TLB */
+    uint64_t walk; /* page table walks */
+    uint64_t ptw_hit; /* walks started from a cached page table */
+    uint64_t ptw_miss; /* walks started from the root page table */
+    uint64_t evict; /* entries dropped from the victim buffer */
+    uint64_t flush; /* full flushes */
+} TLBStats;
+
+/* Superpage translation, consulted before walking the page table.
+   'vaddr' has the same format as TLBEntry.vaddr. It only gives the
+   physical address so that the slow path still handles the dirty bits
+   and the decoded pages. */
+typedef struct {
+    target_ulong vaddr;
+    target_ulong paddr;
+    TLBTag tag;
+} TLBLargeEntry;
+
+/* Non-leaf part of a page table walk: 'vpn' (-1 if the entry is free)
+   is 'vaddr >> shift', the part of the virtual address translated by
+   the page tables above the one at 'pte_addr'. */
+typedef struct {
+    target_ulong vpn;
+    target_ulong satp;
+    target_ulong pte_addr;
+    uint8_t shift;
+    uint8_t global; /* a non-leaf PTE had the G bit */
+} PTWCacheEntry;
+
+/* Reverse map of the write TLB: there is one entry for each valid
+   write TLB entry, linked by host page and by RAM range so that
+   riscv_cpu_flush_tlb_write_range_ram() only looks at the entries it
+   must invalidate. The TLB entry is found again with its key since it
+   moves inside its set. */
+typedef struct {
+    tlb_addr_t key; /* TLBEntry.vaddr */
+    uintptr_t host_page; /* host address of the start of the page */
+    int hash_next; /* next entry of the hash bucket or of the free list */
+    int range_prev, range_next;
+    int range; /* index in phys_mem_range[] of the PhysMemoryMap */
+} TLBRmapEntry;
+
+#define TLB_TAG_GLOBAL     (1 << 7) /* G bit or no translation */
+#define TLB_TAG_SHIFT_MASK 0x3f /* log2 of the size of the mapped page */
+
+#define TLB_CTX_PHYS 0xff /* no translation */
+
+/* The MMU contexts (ASID, privilege, SUM and MXR) get an identifier
+   stored in the bits of TLBEntry.vaddr which are ignored by the
+   lookup, so the entries of the other contexts never match. */
+#define TLB_CTX_SHIFT 4
+#define TLB_CTX_MAX (1 << (PG_SHIFT - TLB_CTX_SHIFT))
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+/* Pre-decoded instruction cache: each RAM page containing executed
+   code gets one DecodedInsn per 16 bit parcel. The pages are indexed
+   by host address, so all the virtual mappings of a physical page
+   share the same decoded instructions. */
+#define DC_HASH_SIZE 1024 /* must be a power of two */
+#define DC_PAGE_COUNT_MAX 1024 /* the whole cache is flushed when full */
+#define DC_WRITE_COUNT_MAX 64 /* writes before a page is no longer cached */
+
+enum {
+    DOP_NONE, /* not decoded yet: must be zero */
+    DOP_LEGACY, /* use the generic interpreter */
+    DOP_NOP,
+    DOP_LI,
+    DOP_AUIPC,
+    DOP_JAL,
+    DOP_JALR,
+    DOP_CJALR, /* c.jr/c.jalr */
+    DOP_BEQ,
+    DOP_BNE,
+    DOP_BLT,
+    DOP_BGE,
+    DOP_BLTU,
+    DOP_BGEU,
+    DOP_LB,
+    DOP_LH,
+    DOP_LW,
+    DOP_LBU,
+    DOP_LHU,
+    DOP_LD,
+    DOP_LWU,
+    DOP_SB,
+    DOP_SH,
+    DOP_SW,
+    DOP_SD,
+    DOP_ADDI,
+    DOP_SLTI,
+    DOP_SLTIU,
+    DOP_XORI,
+    DOP_ORI,
+    DOP_ANDI,
+    DOP_SLLI,
+    DOP_SRLI,
+    DOP_SRAI,
+    DOP_ADD,
+    DOP_SUB,
+    DOP_SLL,
+    DOP_SLT,
+    DOP_SLTU,
+    DOP_XOR,
+    DOP_SRL,
+    DOP_SRA,
+    DOP_OR,
+    DOP_AND,
+    DOP_MUL,
+    DOP_ADDIW,
+    DOP_SLLIW,
+    DOP_SRLIW,
+    DOP_SRAIW,
+    DOP_ADDW,
+    DOP_SUBW,
+    DOP_SLLW,
+    DOP_SRLW,
+    DOP_SRAW,
+    DOP_MULW,
+};
+
+/* the instruction length is in the low bit of DecodedInsn.op so that
+   the next instruction address does not depend on a memory load */
+#define DC_OP(op, len) (((op) << 1) | ((len) == 2))
+
+typedef struct {
+    uint8_t op; /* DC_OP(DOP_x, len) */
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int32_t imm;
+} DecodedInsn;
+
+typedef struct DecodedPage {
+    struct DecodedPage *hash_next;
+    uint8_t *mem_ptr; /* host address of the start of the page */
+    uint8_t xlen; /* XLEN used to decode the instructions */
+    BOOL disabled; /* TRUE if all the instructions are DOP_LEGACY */
+    int write_count;
+#ifdef USE_JIT
+    /* offset of the translated code of each instruction in
+       jit_code_buf, 0 if not translated, JIT_ENTRY_INTERP if it must
+       be interpreted. NULL if no instruction was translated. */
+    uint32_t *jit_entry;
+#endif
+    DecodedInsn insn[(1 << PG_SHIFT) / 2];
+} DecodedPage;
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+
+#ifdef USE_JIT
+#define JIT_CODE_SIZE (16 << 20) /* all the code is flushed when full */
+#define JIT_CODE_ALIGN 16
+#define JIT_ENTRY_INTERP 1
+#define JIT_BLOCK_INSN_MAX 64
+#endif
 
 struct RISCVCPUState {
     RISCVCPUCommonState common; /* must be first */
     
     target_ulong pc;
     target_ulong reg[32];
+#if MAX_XLEN == 128
+    /* integer registers when XLEN <= 64. 'reg' is only up to date
+       when XLEN = 128, see set_xlen(). */
+    uint64_t reg64[32];
+#endif
 
 #ifdef USE_GLOBAL_VARIABLES
     /* faster to use global variables with emscripten */
@@ -230,14 +450,72 @@ struct RISCVCPUState {
     uint64_t satp; /* currently 64 bit physical addresses max */
 #endif
     uint32_t scounteren;
+    uint32_t senvcfg;
+    uint64_t menvcfg;
+    uint64_t stimecmp; /* Sstc */
+
+    /* value of the 'time' CSR, NULL if it is not implemented */
+    uint64_t (*get_time)(void *opaque);
+    void *get_time_opaque;
+    /* handler of the ecalls from S mode, NULL if they raise an exception */
+    RISCVSBIFunc *sbi_call;
+    void *sbi_call_opaque;
 
     target_ulong load_res; /* for atomic LR/SC */
+    target_ulong load_res_val; /* value read by LR, compared by SC */
+
+    /* taken around the device accesses when other harts run in
+       parallel, NULL otherwise */
+    void (*io_lock)(void *opaque, BOOL lock);
+    void *io_lock_opaque;
 
     PhysMemoryMap *mem_map;
 
-    TLBEntry tlb_read[TLB_SIZE];
-    TLBEntry tlb_write[TLB_SIZE];
-    TLBEntry tlb_code[TLB_SIZE];
+    /* set associative TLBs indexed by ACCESS_x: the entry of way 'w'
+       of set 'i' is at index w * (tlb_set_mask + 1) + i, followed by
+       the victim buffer. Only way 0 is checked by the inline lookup. */
+    TLBEntry *tlb[3];
+    TLBTag *tlb_tag[3];
+    uint32_t tlb_set_mask; /* number of sets - 1 */
+    int tlb_ways;
+    int tlb_count; /* number of entries including the victim buffer */
+    int tlb_victim_idx; /* next victim buffer entry to replace */
+    void *tlb_buf; /* allocated memory for 'tlb' */
+    TLBStats tlb_stats;
+    /* identifiers of the current read/write and code contexts, shifted
+       by TLB_CTX_SHIFT */
+    tlb_addr_t tlb_data_ctx;
+    tlb_addr_t tlb_code_ctx;
+    uint32_t tlb_data_key; /* ASID and context, see tlb_update_ctx() */
+    uint32_t tlb_code_key;
+    uint16_t tlb_asid; /* current ASID */
+    int tlb_ctx_count; /* number of allocated context identifiers */
+    uint32_t tlb_ctx_keys[TLB_CTX_MAX];
+    /* superpages having entries in the TLBs, used to limit the search
+       done by sfence.vma. tlb_superpage_count > TLB_SUPERPAGE_MAX if
+       there are too many of them. */
+    int tlb_superpage_count;
+    target_ulong tlb_superpage[TLB_SUPERPAGE_MAX]; /* address | log2(size) */
+    TLBLargeEntry tlb_large[3][TLB_LARGE_SIZE];
+    int tlb_large_idx; /* next superpage TLB entry to replace */
+    PTWCacheEntry ptw_cache[PTW_CACHE_SIZE];
+    TLBRmapEntry *tlb_rmap; /* tlb_count entries */
+    int *tlb_rmap_hash; /* indexed by host page number */
+    uint32_t tlb_rmap_hash_mask;
+    int tlb_rmap_free; /* first free entry of tlb_rmap */
+    int tlb_rmap_range[PHYS_MEM_RANGE_MAX]; /* first entry of each range */
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+    DecodedPage *dc_hash[DC_HASH_SIZE];
+    DecodedPage *dc_pages[DC_PAGE_COUNT_MAX];
+    int dc_page_count; /* number of pages in use */
+    int dc_page_alloc; /* number of allocated pages */
+#endif
+#ifdef USE_JIT
+    BOOL jit_enabled;
+    uint8_t *jit_code_buf; /* translated code, NULL if not allocated */
+    uint32_t jit_code_size; /* used size of jit_code_buf */
+#endif
 };
 
 #define target_read_slow glue(glue(riscv, MAX_XLEN), _read_slow)
@@ -252,10 +530,11 @@ DLL_PUBLIC int target_write_slow(RISCVCPUState *s, target_ulong addr,
 #define TARGET_READ_WRITE(size, uint_type, size_log2)                   \
 static inline __exception int target_read_u ## size(RISCVCPUState *s, uint_type *pval, target_ulong addr)                              \
 {\
-    uint32_t tlb_idx;\
-    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);\
-    if (likely(s->tlb_read[tlb_idx].vaddr == (addr & ~(PG_MASK & ~((size / 8) - 1))))) { \
-        *pval = *(uint_type *)(s->tlb_read[tlb_idx].mem_addend + (uintptr_t)addr);\
+    TLBEntry *e;\
+    e = &s->tlb[ACCESS_READ][(addr >> PG_SHIFT) & s->tlb_set_mask];\
+    if (likely(e->vaddr == (((tlb_addr_t)addr & ~(PG_MASK & ~((size / 8) - 1))) | s->tlb_data_ctx) && \
+               TLB_ADDR_OK(addr))) {                                   \
+        *pval = *(uint_type *)(e->mem_addend + (uintptr_t)addr);\
     } else {\
         mem_uint_t val;\
         int ret;\
@@ -270,10 +549,11 @@ static inline __exception int target_read_u ## size(RISCVCPUState *s, uint_type
 static inline __exception int target_write_u ## size(RISCVCPUState *s, target_ulong addr,\
                                           uint_type val)                \
 {\
-    uint32_t tlb_idx;\
-    tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);\
-    if (likely(s->tlb_write[tlb_idx].vaddr == (addr & ~(PG_MASK & ~((size / 8) - 1))))) { \
-        *(uint_type *)(s->tlb_write[tlb_idx].mem_addend + (uintptr_t)addr) = val;\
+    TLBEntry *e;\
+    e = &s->tlb[ACCESS_WRITE][(addr >> PG_SHIFT) & s->tlb_set_mask];\
+    if (likely(e->vaddr == (((tlb_addr_t)addr & ~(PG_MASK & ~((size / 8) - 1))) | s->tlb_data_ctx) && \
+               TLB_ADDR_OK(addr))) {                                   \
+        *(uint_type *)(e->mem_addend + (uintptr_t)addr) = val;\
         return 0;\
     } else {\
         return target_write_slow(s, addr, val, size_log2);\
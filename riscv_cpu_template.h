@@ -34,6 +34,19 @@
 #error unsupported XLEN
 #endif
 
+/* In the RV128 build, the RV32 and RV64 code uses the 64 bit register
+   file 'reg64' and 64 bit values (see set_xlen()). The addresses and
+   PC values are sign extended when stored in the other fields. */
+#if MAX_XLEN == 128 && XLEN <= 64
+#define XREG reg64
+#define ureg_t uint64_t
+#define sreg_t int64_t
+#else
+#define XREG reg
+#define ureg_t target_ulong
+#define sreg_t target_long
+#endif
+
 static inline intx_t glue(div, XLEN)(intx_t a, intx_t b)
 {
     if (b == 0) {
@@ -185,7 +198,20 @@ static inline uintx_t glue(mulhsu, XLEN)(intx_t a, uintx_t b)
     case n+(24 << 2): case n+(25 << 2): case n+(26 << 2): case n+(27 << 2): \
     case n+(28 << 2): case n+(29 << 2): case n+(30 << 2): case n+(31 << 2): 
 
-#define GET_PC() (target_ulong)((uintptr_t)code_ptr + code_to_pc_addend)
+#ifdef USE_COMPUTED_GOTO
+/* The switch statements are kept for their 'break' statements but the
+   dispatch jumps directly to a label added to each case. */
+#define OP_LABEL(name) name:
+#define OP_DISPATCH(table, n) goto *table[n]
+#define C_QUADRANT_ENTRY0(n) [(n) << 2] = &&op_c0,
+#define C_QUADRANT_ENTRY1(n) [((n) << 2) | 1] = &&op_c1,
+#define C_QUADRANT_ENTRY2(n) [((n) << 2) | 2] = &&op_c2,
+#else
+#define OP_LABEL(name)
+#define OP_DISPATCH(table, n) do { } while (0)
+#endif
+
+#define GET_PC() (target_ulong)(sreg_t)((uintptr_t)code_ptr + code_to_pc_addend)
 #define GET_INSN_COUNTER() (insn_counter_addend - s->n_cycles)
 
 #define C_NEXT_INSN code_ptr += 2; break
@@ -197,21 +223,803 @@ static inline uintx_t glue(mulhsu, XLEN)(intx_t a, uintx_t b)
         goto jump_insn;            \
     } while (0)
 
+#if defined(USE_JIT) && XLEN == MAX_XLEN
+/* the translated blocks are only looked up at the start of a block */
+#define SAME_PAGE_JUMP_OK (!s->jit_enabled)
+#else
+#define SAME_PAGE_JUMP_OK 1
+#endif
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+/* 'dc_page' is not updated when a block starts with an instruction at
+   the end of a page, so it may belong to another page */
+#define SAME_PAGE_DC_OK \
+    (dc_page && dc_page->mem_ptr == code_end - (PG_MASK - 1))
+#else
+#define SAME_PAGE_DC_OK 1
+#endif
+
+/* jump to s->pc, see 'branch_insn' */
+#define BRANCH_INSN goto branch_insn
+
+#ifdef CONFIG_EXT_C
+
+/* return the 32 bit equivalent of a 16 bit instruction, 0 if illegal */
+static uint32_t glue(rvc_expand, XLEN)(uint32_t insn)
+{
+    uint32_t funct3, rd, rs1, rs2;
+    int32_t imm;
+
+    funct3 = (insn >> 13) & 7;
+    rd = (insn >> 7) & 0x1f;
+    rs2 = (insn >> 2) & 0x1f;
+    switch(insn & 3) {
+    case 0:
+        rd = ((insn >> 2) & 7) | 8;
+        rs1 = ((insn >> 7) & 7) | 8;
+        switch(funct3) {
+        case 0: /* c.addi4spn */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 7, 6, 9) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 3, 3);
+            if (imm == 0)
+                return 0;
+            return insn_i(0x13, 0, rd, 2, imm);
+#if XLEN >= 128
+        case 1: /* c.lq */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 10, 8, 8) |
+                get_field1(insn, 5, 6, 7);
+            return insn_i(0x0f, 2, rd, rs1, imm);
+#elif FLEN >= 64
+        case 1: /* c.fld */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return insn_i(0x07, 3, rd, rs1, imm);
+#endif
+        case 2: /* c.lw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return insn_i(0x03, 2, rd, rs1, imm);
+#if XLEN >= 64
+        case 3: /* c.ld */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return insn_i(0x03, 3, rd, rs1, imm);
+#elif FLEN >= 32
+        case 3: /* c.flw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return insn_i(0x07, 2, rd, rs1, imm);
+#endif
+#if XLEN >= 128
+        case 5: /* c.sq */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 10, 8, 8) |
+                get_field1(insn, 5, 6, 7);
+            return insn_s(0x23, 4, rs1, rd, imm);
+#elif FLEN >= 64
+        case 5: /* c.fsd */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return insn_s(0x27, 3, rs1, rd, imm);
+#endif
+        case 6: /* c.sw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return insn_s(0x23, 2, rs1, rd, imm);
+#if XLEN >= 64
+        case 7: /* c.sd */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 5, 6, 7);
+            return insn_s(0x23, 3, rs1, rd, imm);
+#elif FLEN >= 32
+        case 7: /* c.fsw */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 6, 2, 2) |
+                get_field1(insn, 5, 6, 6);
+            return insn_s(0x27, 2, rs1, rd, imm);
+#endif
+        }
+        break;
+    case 1:
+        switch(funct3) {
+        case 0: /* c.addi/c.nop */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return insn_i(0x13, 0, rd, rd, imm);
+#if XLEN == 32
+        case 1: /* c.jal */
+            imm = sext(get_field1(insn, 12, 11, 11) |
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            return insn_j(1, imm);
+#else
+        case 1: /* c.addiw */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return insn_i(0x1b, 0, rd, rd, imm);
+#endif
+        case 2: /* c.li */
+            imm = sext(get_field1(insn, 12, 5, 5) |
+                       get_field1(insn, 2, 0, 4), 6);
+            return insn_i(0x13, 0, rd, 0, imm);
+        case 3:
+            if (rd == 2) {
+                /* c.addi16sp */
+                imm = sext(get_field1(insn, 12, 9, 9) |
+                           get_field1(insn, 6, 4, 4) |
+                           get_field1(insn, 5, 6, 6) |
+                           get_field1(insn, 3, 7, 8) |
+                           get_field1(insn, 2, 5, 5), 10);
+                if (imm == 0)
+                    return 0;
+                return insn_i(0x13, 0, 2, 2, imm);
+            } else {
+                /* c.lui */
+                imm = sext(get_field1(insn, 12, 17, 17) |
+                           get_field1(insn, 2, 12, 16), 18);
+                return 0x37 | (rd << 7) | (imm & 0xfffff000);
+            }
+        case 4:
+            funct3 = (insn >> 10) & 3;
+            rd = ((insn >> 7) & 7) | 8;
+            switch(funct3) {
+            case 0: /* c.srli */
+            case 1: /* c.srai */
+                imm = get_field1(insn, 12, 5, 5) | rs2;
+#if XLEN == 32
+                if (imm & 0x20)
+                    return 0;
+#elif XLEN == 128
+                /* the shift amount is sign extended */
+                if (imm == 0)
+                    imm = 64;
+                else if (imm >= 32)
+                    imm += 64;
+#endif
+                return insn_i(0x13, 5, rd, rd, imm | (funct3 << 10));
+            case 2: /* c.andi */
+                imm = sext(get_field1(insn, 12, 5, 5) | rs2, 6);
+                return insn_i(0x13, 7, rd, rd, imm);
+            case 3:
+                rs2 = ((insn >> 2) & 7) | 8;
+                funct3 = ((insn >> 5) & 3) | ((insn >> (12 - 2)) & 4);
+                switch(funct3) {
+                case 0: /* c.sub */
+                    return insn_r(0x33, 0, 0x20, rd, rd, rs2);
+                case 1: /* c.xor */
+                    return insn_r(0x33, 4, 0, rd, rd, rs2);
+                case 2: /* c.or */
+                    return insn_r(0x33, 6, 0, rd, rd, rs2);
+                case 3: /* c.and */
+                    return insn_r(0x33, 7, 0, rd, rd, rs2);
+#if XLEN >= 64
+                case 4: /* c.subw */
+                    return insn_r(0x3b, 0, 0x20, rd, rd, rs2);
+                case 5: /* c.addw */
+                    return insn_r(0x3b, 0, 0, rd, rd, rs2);
+#endif
+                }
+                break;
+            }
+            break;
+        case 5: /* c.j */
+            imm = sext(get_field1(insn, 12, 11, 11) |
+                       get_field1(insn, 11, 4, 4) |
+                       get_field1(insn, 9, 8, 9) |
+                       get_field1(insn, 8, 10, 10) |
+                       get_field1(insn, 7, 6, 6) |
+                       get_field1(insn, 6, 7, 7) |
+                       get_field1(insn, 3, 1, 3) |
+                       get_field1(insn, 2, 5, 5), 12);
+            return insn_j(0, imm);
+        case 6: /* c.beqz */
+        case 7: /* c.bnez */
+            rs1 = ((insn >> 7) & 7) | 8;
+            imm = sext(get_field1(insn, 12, 8, 8) |
+                       get_field1(insn, 10, 3, 4) |
+                       get_field1(insn, 5, 6, 7) |
+                       get_field1(insn, 3, 1, 2) |
+                       get_field1(insn, 2, 5, 5), 9);
+            return insn_b(funct3 & 1, rs1, 0, imm);
+        }
+        break;
+    case 2:
+        switch(funct3) {
+        case 0: /* c.slli */
+            imm = get_field1(insn, 12, 5, 5) | rs2;
+#if XLEN == 32
+            if (imm & 0x20)
+                return 0;
+#elif XLEN == 128
+            if (imm == 0)
+                imm = 64;
+#endif
+            return insn_i(0x13, 1, rd, rd, imm);
+#if XLEN >= 128
+        case 1: /* c.lqsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (1 << 4)) |
+                get_field1(insn, 2, 6, 9);
+            return insn_i(0x0f, 2, rd, 2, imm);
+#elif FLEN >= 64
+        case 1: /* c.fldsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (3 << 3)) |
+                get_field1(insn, 2, 6, 8);
+            return insn_i(0x07, 3, rd, 2, imm);
+#endif
+        case 2: /* c.lwsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (7 << 2)) |
+                get_field1(insn, 2, 6, 7);
+            return insn_i(0x03, 2, rd, 2, imm);
+#if XLEN >= 64
+        case 3: /* c.ldsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (3 << 3)) |
+                get_field1(insn, 2, 6, 8);
+            return insn_i(0x03, 3, rd, 2, imm);
+#elif FLEN >= 32
+        case 3: /* c.flwsp */
+            imm = get_field1(insn, 12, 5, 5) |
+                (rs2 & (7 << 2)) |
+                get_field1(insn, 2, 6, 7);
+            return insn_i(0x07, 2, rd, 2, imm);
+#endif
+        case 4:
+            if (((insn >> 12) & 1) == 0) {
+                if (rs2 == 0) {
+                    /* c.jr */
+                    if (rd == 0)
+                        return 0;
+                    return insn_i(0x67, 0, 0, rd, 0);
+                } else {
+                    /* c.mv */
+                    return insn_r(0x33, 0, 0, rd, 0, rs2);
+                }
+            } else {
+                if (rs2 == 0) {
+                    if (rd == 0) {
+                        /* c.ebreak */
+                        return 0x00100073;
+                    } else {
+                        /* c.jalr */
+                        return insn_i(0x67, 0, 1, rd, 0);
+                    }
+                } else {
+                    /* c.add */
+                    return insn_r(0x33, 0, 0, rd, rd, rs2);
+                }
+            }
+#if XLEN >= 128
+        case 5: /* c.sqsp */
+            imm = get_field1(insn, 11, 4, 5) |
+                get_field1(insn, 7, 6, 9);
+            return insn_s(0x23, 4, 2, rs2, imm);
+#elif FLEN >= 64
+        case 5: /* c.fsdsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            return insn_s(0x27, 3, 2, rs2, imm);
+#endif
+        case 6: /* c.swsp */
+            imm = get_field1(insn, 9, 2, 5) |
+                get_field1(insn, 7, 6, 7);
+            return insn_s(0x23, 2, 2, rs2, imm);
+#if XLEN >= 64
+        case 7: /* c.sdsp */
+            imm = get_field1(insn, 10, 3, 5) |
+                get_field1(insn, 7, 6, 8);
+            return insn_s(0x23, 3, 2, rs2, imm);
+#elif FLEN >= 32
+        case 7: /* c.fswsp */
+            imm = get_field1(insn, 9, 2, 5) |
+                get_field1(insn, 7, 6, 7);
+            return insn_s(0x27, 2, 2, rs2, imm);
+#endif
+        }
+        break;
+    }
+    return 0;
+}
+
+#endif /* CONFIG_EXT_C */
+
+#ifdef CONFIG_RISCV_DECODE_CACHE
+
+/* Decode one instruction. Only the frequent instructions which cannot
+   raise an illegal instruction exception are handled, the other ones
+   are marked as DOP_LEGACY. The compressed instructions are decoded
+   from their 32 bit equivalent. Return TRUE if the instruction ends
+   the block. */
+static int glue(dc_decode_insn, XLEN)(DecodedInsn *d, uint32_t insn)
+{
+    uint32_t opcode, rd, rs1, rs2, funct3;
+    int32_t imm;
+    int op, len;
+
+    op = DOP_LEGACY;
+    imm = 0;
+    len = 4;
+#ifdef CONFIG_EXT_C
+    if ((insn & 3) != 3) {
+        len = 2;
+        insn = glue(rvc_expand, XLEN)(insn & 0xffff);
+    }
+#endif
+    opcode = insn & 0x7f;
+    rd = (insn >> 7) & 0x1f;
+    rs1 = (insn >> 15) & 0x1f;
+    rs2 = (insn >> 20) & 0x1f;
+    switch(opcode) {
+    case 0x37: /* lui */
+        imm = insn & 0xfffff000;
+        op = (rd != 0) ? DOP_LI : DOP_NOP;
+        break;
+    case 0x17: /* auipc */
+        imm = insn & 0xfffff000;
+        op = (rd != 0) ? DOP_AUIPC : DOP_NOP;
+        break;
+    case 0x6f: /* jal */
+        imm = ((insn >> (31 - 20)) & (1 << 20)) |
+            ((insn >> (21 - 1)) & 0x7fe) |
+            ((insn >> (20 - 11)) & (1 << 11)) |
+            (insn & 0xff000);
+        imm = (imm << 11) >> 11;
+        op = DOP_JAL;
+        break;
+    case 0x67: /* jalr */
+        imm = (int32_t)insn >> 20;
+        /* c.jr/c.jalr have a zero offset */
+        op = (len == 2) ? DOP_CJALR : DOP_JALR;
+        break;
+    case 0x63:
+        funct3 = (insn >> 12) & 7;
+        imm = ((insn >> (31 - 12)) & (1 << 12)) |
+            ((insn >> (25 - 5)) & 0x7e0) |
+            ((insn >> (8 - 1)) & 0x1e) |
+            ((insn << (11 - 7)) & (1 << 11));
+        imm = (imm << 19) >> 19;
+        switch(funct3) {
+        case 0:
+            op = DOP_BEQ;
+            break;
+        case 1:
+            op = DOP_BNE;
+            break;
+        case 4:
+            op = DOP_BLT;
+            break;
+        case 5:
+            op = DOP_BGE;
+            break;
+        case 6:
+            op = DOP_BLTU;
+            break;
+        case 7:
+            op = DOP_BGEU;
+            break;
+        }
+        break;
+    case 0x03: /* load */
+        funct3 = (insn >> 12) & 7;
+        imm = (int32_t)insn >> 20;
+        /* a load to x0 must still do the memory access */
+        if (rd == 0)
+            break;
+        switch(funct3) {
+        case 0:
+            op = DOP_LB;
+            break;
+        case 1:
+            op = DOP_LH;
+            break;
+        case 2:
+            op = DOP_LW;
+            break;
+        case 4:
+            op = DOP_LBU;
+            break;
+        case 5:
+            op = DOP_LHU;
+            break;
+#if XLEN >= 64
+        case 3:
+            op = DOP_LD;
+            break;
+        case 6:
+            op = DOP_LWU;
+            break;
+#endif
+        }
+        break;
+    case 0x23: /* store */
+        funct3 = (insn >> 12) & 7;
+        imm = rd | ((insn >> (25 - 5)) & 0xfe0);
+        imm = (imm << 20) >> 20;
+        switch(funct3) {
+        case 0:
+            op = DOP_SB;
+            break;
+        case 1:
+            op = DOP_SH;
+            break;
+        case 2:
+            op = DOP_SW;
+            break;
+#if XLEN >= 64
+        case 3:
+            op = DOP_SD;
+            break;
+#endif
+        }
+        break;
+    case 0x13:
+        funct3 = (insn >> 12) & 7;
+        imm = (int32_t)insn >> 20;
+        switch(funct3) {
+        case 0:
+            op = (rs1 == 0) ? DOP_LI : DOP_ADDI;
+            break;
+        case 1:
+            if ((imm & ~(XLEN - 1)) == 0)
+                op = DOP_SLLI;
+            break;
+        case 2:
+            op = DOP_SLTI;
+            break;
+        case 3:
+            op = DOP_SLTIU;
+            break;
+        case 4:
+            op = DOP_XORI;
+            break;
+        case 5:
+            if ((imm & ~((XLEN - 1) | 0x400)) == 0) {
+                op = (imm & 0x400) ? DOP_SRAI : DOP_SRLI;
+                imm &= XLEN - 1;
+            }
+            break;
+        case 6:
+            op = DOP_ORI;
+            break;
+        case 7:
+            op = DOP_ANDI;
+            break;
+        }
+        if (op != DOP_LEGACY && rd == 0)
+            op = DOP_NOP;
+        break;
+#if XLEN >= 64
+    case 0x1b: /* OP-IMM-32 */
+        funct3 = (insn >> 12) & 7;
+        imm = (int32_t)insn >> 20;
+        switch(funct3) {
+        case 0:
+            op = DOP_ADDIW;
+            break;
+        case 1:
+            if ((imm & ~31) == 0)
+                op = DOP_SLLIW;
+            break;
+        case 5:
+            if ((imm & ~(31 | 0x400)) == 0) {
+                op = (imm & 0x400) ? DOP_SRAIW : DOP_SRLIW;
+                imm &= 31;
+            }
+            break;
+        }
+        if (op != DOP_LEGACY && rd == 0)
+            op = DOP_NOP;
+        break;
+#endif
+    case 0x33:
+        imm = insn >> 25;
+        if (imm == 1) {
+            funct3 = (insn >> 12) & 7;
+            if (funct3 == 0)
+                op = DOP_MUL;
+        } else if ((imm & ~0x20) == 0) {
+            funct3 = ((insn >> 12) & 7) | ((insn >> (30 - 3)) & (1 << 3));
+            switch(funct3) {
+            case 0:
+                op = DOP_ADD;
+                break;
+            case 0 | 8:
+                op = DOP_SUB;
+                break;
+            case 1:
+                op = DOP_SLL;
+                break;
+            case 2:
+                op = DOP_SLT;
+                break;
+            case 3:
+                op = DOP_SLTU;
+                break;
+            case 4:
+                op = DOP_XOR;
+                break;
+            case 5:
+                op = DOP_SRL;
+                break;
+            case 5 | 8:
+                op = DOP_SRA;
+                break;
+            case 6:
+                op = DOP_OR;
+                break;
+            case 7:
+                op = DOP_AND;
+                break;
+            }
+        }
+        imm = 0;
+        if (op != DOP_LEGACY && rd == 0)
+            op = DOP_NOP;
+        break;
+#if XLEN >= 64
+    case 0x3b: /* OP-32 */
+        imm = insn >> 25;
+        if (imm == 1) {
+            funct3 = (insn >> 12) & 7;
+            if (funct3 == 0)
+                op = DOP_MULW;
+        } else if ((imm & ~0x20) == 0) {
+            funct3 = ((insn >> 12) & 7) | ((insn >> (30 - 3)) & (1 << 3));
+            switch(funct3) {
+            case 0:
+                op = DOP_ADDW;
+                break;
+            case 0 | 8:
+                op = DOP_SUBW;
+                break;
+            case 1:
+                op = DOP_SLLW;
+                break;
+            case 5:
+                op = DOP_SRLW;
+                break;
+            case 5 | 8:
+                op = DOP_SRAW;
+                break;
+            }
+        }
+        imm = 0;
+        if (op != DOP_LEGACY && rd == 0)
+            op = DOP_NOP;
+        break;
+#endif
+    }
+    d->op = DC_OP(op, len);
+    d->rd = rd;
+    d->rs1 = rs1;
+    d->rs2 = rs2;
+    d->imm = imm;
+    return (op == DOP_JAL || op == DOP_JALR || op == DOP_CJALR ||
+            opcode == 0x73);
+}
+
+/* decode the instructions from 'code_ptr' up to the end of the basic
+   block or an already decoded instruction */
+static no_inline void glue(dc_decode_block, XLEN)(DecodedPage *p,
+                                                  uint8_t *code_ptr)
+{
+    DecodedInsn *d;
+    int offset;
+
+    offset = code_ptr - p->mem_ptr;
+    /* an instruction at the last 16 bit parcel of the page is always
+       executed by the generic interpreter */
+    while (offset < PG_MASK - 1) {
+        d = &p->insn[offset >> 1];
+        if (d->op != DOP_NONE)
+            break;
+        if (glue(dc_decode_insn, XLEN)(d, get_insn32(p->mem_ptr + offset)))
+            break;
+        offset += (d->op & 1) ? 2 : 4;
+    }
+}
+
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+
 static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                                                    int n_cycles1)
 {
     uint32_t opcode, insn, rd, rs1, rs2, funct3;
     int32_t imm, cond, err;
-    target_ulong addr, val, val2;
+    target_ulong addr, csr_val;
+    ureg_t val, val2;
 #ifndef USE_GLOBAL_VARIABLES
     uint8_t *code_ptr, *code_end;
-    target_ulong code_to_pc_addend;
+    ureg_t code_to_pc_addend;
 #endif
     uint64_t insn_counter_addend;
+    uint8_t *new_code_ptr;
 #if FLEN > 0
     uint32_t rs3;
     int32_t rm;
 #endif
+#ifdef CONFIG_RISCV_DECODE_CACHE
+    DecodedPage *dc_page = NULL;
+    DecodedInsn *d;
+#endif
+#ifdef USE_COMPUTED_GOTO
+    static const void * const opcode_table[128] = {
+        [0 ... 127] = &&illegal_insn,
+#ifdef CONFIG_EXT_C
+        DUP32(C_QUADRANT_ENTRY0, 0)
+        DUP32(C_QUADRANT_ENTRY1, 0)
+        DUP32(C_QUADRANT_ENTRY2, 0)
+#endif
+        [0x37] = &&op_37,
+        [0x17] = &&op_17,
+        [0x6f] = &&op_6f,
+        [0x67] = &&op_67,
+        [0x63] = &&op_63,
+        [0x03] = &&op_03,
+        [0x23] = &&op_23,
+        [0x13] = &&op_13,
+        [0x33] = &&op_33,
+#if XLEN >= 64
+        [0x1b] = &&op_1b,
+        [0x3b] = &&op_3b,
+#endif
+#if XLEN >= 128
+        [0x5b] = &&op_5b,
+        [0x7b] = &&op_7b,
+#endif
+        [0x73] = &&op_73,
+        [0x0f] = &&op_0f,
+        [0x2f] = &&op_2f,
+#if FLEN > 0
+        [0x07] = &&op_07,
+        [0x27] = &&op_27,
+        [0x43] = &&op_43,
+        [0x47] = &&op_47,
+        [0x4b] = &&op_4b,
+        [0x4f] = &&op_4f,
+        [0x53] = &&op_53,
+#endif
+    };
+#ifdef CONFIG_EXT_C
+    static const void * const c0_table[8] = {
+        &&c0_0,
+#if XLEN >= 128 || FLEN >= 64
+        &&c0_1,
+#else
+        &&illegal_insn,
+#endif
+        &&c0_2,
+#if XLEN >= 64 || FLEN >= 32
+        &&c0_3,
+#else
+        &&illegal_insn,
+#endif
+        &&illegal_insn,
+#if XLEN >= 128 || FLEN >= 64
+        &&c0_5,
+#else
+        &&illegal_insn,
+#endif
+        &&c0_6,
+#if XLEN >= 64 || FLEN >= 32
+        &&c0_7,
+#else
+        &&illegal_insn,
+#endif
+    };
+    static const void * const c1_table[8] = {
+        &&c1_0, &&c1_1, &&c1_2, &&c1_3, &&c1_4, &&c1_5, &&c1_6, &&c1_7,
+    };
+    static const void * const c2_table[8] = {
+        &&c2_0,
+#if XLEN >= 128 || FLEN >= 64
+        &&c2_1,
+#else
+        &&illegal_insn,
+#endif
+        &&c2_2,
+#if XLEN >= 64 || FLEN >= 32
+        &&c2_3,
+#else
+        &&illegal_insn,
+#endif
+        &&c2_4,
+#if XLEN >= 128 || FLEN >= 64
+        &&c2_5,
+#else
+        &&illegal_insn,
+#endif
+        &&c2_6,
+#if XLEN >= 64 || FLEN >= 32
+        &&c2_7,
+#else
+        &&illegal_insn,
+#endif
+    };
+#endif /* CONFIG_EXT_C */
+#ifdef CONFIG_RISCV_DECODE_CACHE
+#define DC_ENTRY(op, len) [DC_OP(op, len)] = &&dc_ ## op ## _ ## len,
+#define DC_ENTRIES(op) DC_ENTRY(op, 4) DC_ENTRY(op, 2)
+    static const void * const dc_table[256] = {
+        [0 ... 255] = &&dc_legacy,
+        [DC_OP(DOP_NONE, 4)] = &&dc_none,
+        DC_ENTRIES(DOP_NOP)
+        DC_ENTRIES(DOP_LI)
+        DC_ENTRY(DOP_AUIPC, 4)
+        DC_ENTRIES(DOP_JAL)
+        DC_ENTRY(DOP_JALR, 4)
+        DC_ENTRY(DOP_CJALR, 2)
+        DC_ENTRIES(DOP_BEQ)
+        DC_ENTRIES(DOP_BNE)
+        DC_ENTRIES(DOP_BLT)
+        DC_ENTRIES(DOP_BGE)
+        DC_ENTRIES(DOP_BLTU)
+        DC_ENTRIES(DOP_BGEU)
+        DC_ENTRIES(DOP_LB)
+        DC_ENTRIES(DOP_LH)
+        DC_ENTRIES(DOP_LW)
+        DC_ENTRIES(DOP_LBU)
+        DC_ENTRIES(DOP_LHU)
+        DC_ENTRIES(DOP_SB)
+        DC_ENTRIES(DOP_SH)
+        DC_ENTRIES(DOP_SW)
+        DC_ENTRIES(DOP_ADDI)
+        DC_ENTRIES(DOP_SLTI)
+        DC_ENTRIES(DOP_SLTIU)
+        DC_ENTRIES(DOP_XORI)
+        DC_ENTRIES(DOP_ORI)
+        DC_ENTRIES(DOP_ANDI)
+        DC_ENTRIES(DOP_SLLI)
+        DC_ENTRIES(DOP_SRLI)
+        DC_ENTRIES(DOP_SRAI)
+        DC_ENTRIES(DOP_ADD)
+        DC_ENTRIES(DOP_SUB)
+        DC_ENTRIES(DOP_SLL)
+        DC_ENTRIES(DOP_SLT)
+        DC_ENTRIES(DOP_SLTU)
+        DC_ENTRIES(DOP_XOR)
+        DC_ENTRIES(DOP_SRL)
+        DC_ENTRIES(DOP_SRA)
+        DC_ENTRIES(DOP_OR)
+        DC_ENTRIES(DOP_AND)
+        DC_ENTRIES(DOP_MUL)
+#if XLEN >= 64
+        DC_ENTRIES(DOP_LD)
+        DC_ENTRIES(DOP_LWU)
+        DC_ENTRIES(DOP_SD)
+        DC_ENTRIES(DOP_ADDIW)
+        DC_ENTRIES(DOP_SLLIW)
+        DC_ENTRIES(DOP_SRLIW)
+        DC_ENTRIES(DOP_SRAIW)
+        DC_ENTRIES(DOP_ADDW)
+        DC_ENTRIES(DOP_SUBW)
+        DC_ENTRIES(DOP_SLLW)
+        DC_ENTRIES(DOP_SRLW)
+        DC_ENTRIES(DOP_SRAW)
+        DC_ENTRIES(DOP_MULW)
+#endif
+    };
+#undef DC_ENTRY
+#undef DC_ENTRIES
+    d = NULL;
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+    /* the indirect jumps confuse the GCC uninitialized variable
+       analysis */
+    insn = rd = rs1 = rs2 = 0;
+#endif /* USE_COMPUTED_GOTO */
 
     if (n_cycles1 == 0)
         return;
@@ -236,7 +1044,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
        for emscripten */
     for(;;) {
         if (unlikely(code_ptr >= code_end)) {
-            uint32_t tlb_idx;
+            TLBEntry *e;
             uint16_t insn_high;
             target_ulong addr;
             uint8_t *ptr;
@@ -256,12 +1064,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
             }
     
-            addr = s->pc;
-            tlb_idx = (addr >> PG_SHIFT) & (TLB_SIZE - 1);
-            if (likely(s->tlb_code[tlb_idx].vaddr == (addr & ~PG_MASK))) {
+            /* the upper bits of PC are ignored if XLEN < MAX_XLEN */
+            addr = (intx_t)s->pc;
+            e = &s->tlb[ACCESS_CODE][(addr >> PG_SHIFT) & s->tlb_set_mask];
+            if (likely(e->vaddr ==
+                       (((tlb_addr_t)addr & ~PG_MASK) | s->tlb_code_ctx) &&
+                       TLB_ADDR_OK(addr))) {
                 /* TLB match */ 
-                ptr = (uint8_t *)(s->tlb_code[tlb_idx].mem_addend +
-                                  (uintptr_t)addr);
+                ptr = (uint8_t *)(e->mem_addend + (uintptr_t)addr);
             } else {
                 if (unlikely(target_read_insn_slow(s, &ptr, addr)))
                     goto mmu_exception;
@@ -279,14 +1089,184 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                         goto mmu_exception;
                     insn |= insn_high << 16;
                 }
-            } else {
-                insn = get_insn32(code_ptr);
+                s->n_cycles--;
+                goto decode_insn;
             }
-        } else {
-            /* fast path */
-            insn = get_insn32(code_ptr);
+#ifdef CONFIG_RISCV_DECODE_CACHE
+            ptr = code_ptr - (addr & PG_MASK);
+            if (!dc_page || dc_page->mem_ptr != ptr)
+                dc_page = dc_get_page(s, ptr, XLEN);
+#if defined(USE_JIT) && XLEN == MAX_XLEN
+            if (s->jit_enabled) {
+                JITBlockFunc *fn;
+                fn = jit_get_block(s, dc_page, code_ptr);
+                if (fn) {
+                    err = fn(s);
+                    code_ptr = NULL;
+                    code_end = NULL;
+                    code_to_pc_addend = s->pc;
+                    if (unlikely(err))
+                        goto mmu_exception;
+                    continue;
+                }
+            }
+#endif
+#endif
         }
         s->n_cycles--;
+#ifdef CONFIG_RISCV_DECODE_CACHE
+        /* fast path for the pre-decoded instructions */
+        d = &dc_page->insn[(code_ptr - dc_page->mem_ptr) >> 1];
+    dc_dispatch:
+        OP_DISPATCH(dc_table, d->op);
+        switch(d->op) {
+        case DC_OP(DOP_NONE, 4): OP_LABEL(dc_none)
+            glue(dc_decode_block, XLEN)(dc_page, code_ptr);
+            goto dc_dispatch;
+#ifdef USE_COMPUTED_GOTO
+        /* the dispatch is duplicated in each handler to help the
+           host branch prediction */
+#define DC_NEXT(len)                                            \
+            code_ptr += len;                                    \
+            if (likely(code_ptr < code_end)) {                  \
+                s->n_cycles--;                                  \
+                d = &dc_page->insn[(code_ptr - dc_page->mem_ptr) >> 1]; \
+                goto *dc_table[d->op];                          \
+            }                                                   \
+            continue;
+#else
+#define DC_NEXT(len)                                            \
+            code_ptr += len;                                    \
+            continue;
+#endif
+#define DC_CASE(op, len, body)                                  \
+        case DC_OP(op, len): OP_LABEL(dc_ ## op ## _ ## len)    \
+            body                                                \
+            DC_NEXT(len)
+#define DC_CASES(op, body)                                      \
+        DC_CASE(op, 4, body)                                    \
+        DC_CASE(op, 2, body)
+        DC_CASES(DOP_NOP, )
+        DC_CASES(DOP_LI, s->XREG[d->rd] = d->imm;)
+        DC_CASE(DOP_AUIPC, 4, s->XREG[d->rd] = (intx_t)(GET_PC() + d->imm);)
+#define DC_JAL(len)                                             \
+        case DC_OP(DOP_JAL, len): OP_LABEL(dc_DOP_JAL_ ## len)  \
+            if (d->rd != 0)                                     \
+                s->XREG[d->rd] = GET_PC() + len;                 \
+            s->pc = (intx_t)(GET_PC() + d->imm);                \
+            BRANCH_INSN;
+        DC_JAL(4)
+        DC_JAL(2)
+        case DC_OP(DOP_JALR, 4): OP_LABEL(dc_DOP_JALR_4)
+            val = GET_PC() + 4;
+            s->pc = (intx_t)(s->XREG[d->rs1] + d->imm) & ~1;
+            if (d->rd != 0)
+                s->XREG[d->rd] = val;
+            BRANCH_INSN;
+        case DC_OP(DOP_CJALR, 2): OP_LABEL(dc_DOP_CJALR_2)
+            val = GET_PC() + 2;
+            s->pc = (intx_t)s->XREG[d->rs1] & ~1;
+            if (d->rd != 0)
+                s->XREG[d->rd] = val;
+            BRANCH_INSN;
+#define DC_BRANCH(op, cond)                                     \
+        DC_CASES(op,                                            \
+            if (cond) {                                         \
+                s->pc = (intx_t)(GET_PC() + d->imm);            \
+                BRANCH_INSN;                                    \
+            })
+        DC_BRANCH(DOP_BEQ, s->XREG[d->rs1] == s->XREG[d->rs2])
+        DC_BRANCH(DOP_BNE, s->XREG[d->rs1] != s->XREG[d->rs2])
+        DC_BRANCH(DOP_BLT, (sreg_t)s->XREG[d->rs1] < (sreg_t)s->XREG[d->rs2])
+        DC_BRANCH(DOP_BGE, (sreg_t)s->XREG[d->rs1] >= (sreg_t)s->XREG[d->rs2])
+        DC_BRANCH(DOP_BLTU, s->XREG[d->rs1] < s->XREG[d->rs2])
+        DC_BRANCH(DOP_BGEU, s->XREG[d->rs1] >= s->XREG[d->rs2])
+#define DC_LOAD(op, size, cast)                                         \
+        DC_CASES(op,                                                    \
+            {                                                           \
+                uint ## size ## _t rval;                                \
+                addr = (intx_t)(s->XREG[d->rs1] + d->imm);              \
+                if (target_read_u ## size(s, &rval, addr))              \
+                    goto mmu_exception;                                 \
+                s->XREG[d->rd] = cast rval;                              \
+            })
+        DC_LOAD(DOP_LB, 8, (int8_t))
+        DC_LOAD(DOP_LH, 16, (int16_t))
+        DC_LOAD(DOP_LW, 32, (int32_t))
+        DC_LOAD(DOP_LBU, 8, )
+        DC_LOAD(DOP_LHU, 16, )
+#if XLEN >= 64
+        DC_LOAD(DOP_LD, 64, (int64_t))
+        DC_LOAD(DOP_LWU, 32, )
+#endif
+#define DC_STORE(op, size)                                              \
+        DC_CASES(op,                                                    \
+            addr = (intx_t)(s->XREG[d->rs1] + d->imm);                  \
+            if (target_write_u ## size(s, addr, s->XREG[d->rs2]))        \
+                goto mmu_exception;)
+        DC_STORE(DOP_SB, 8)
+        DC_STORE(DOP_SH, 16)
+        DC_STORE(DOP_SW, 32)
+#if XLEN >= 64
+        DC_STORE(DOP_SD, 64)
+#endif
+#define DC_ALU(op, expr)                                        \
+        DC_CASES(op,                                            \
+            val = s->XREG[d->rs1];                               \
+            val2 = s->XREG[d->rs2];                              \
+            s->XREG[d->rd] = expr;)
+#define DC_ALU_IMM(op, expr)                                    \
+        DC_CASES(op,                                            \
+            val = s->XREG[d->rs1];                               \
+            s->XREG[d->rd] = expr;)
+        DC_ALU_IMM(DOP_ADDI, (intx_t)(val + d->imm))
+        DC_ALU_IMM(DOP_SLTI, (sreg_t)val < (sreg_t)d->imm)
+        DC_ALU_IMM(DOP_SLTIU, val < (ureg_t)d->imm)
+        DC_ALU_IMM(DOP_XORI, val ^ d->imm)
+        DC_ALU_IMM(DOP_ORI, val | d->imm)
+        DC_ALU_IMM(DOP_ANDI, val & d->imm)
+        DC_ALU_IMM(DOP_SLLI, (intx_t)(val << d->imm))
+        DC_ALU_IMM(DOP_SRLI, (intx_t)((uintx_t)val >> d->imm))
+        DC_ALU_IMM(DOP_SRAI, (intx_t)val >> d->imm)
+        DC_ALU(DOP_ADD, (intx_t)(val + val2))
+        DC_ALU(DOP_SUB, (intx_t)(val - val2))
+        DC_ALU(DOP_SLL, (intx_t)(val << (val2 & (XLEN - 1))))
+        DC_ALU(DOP_SLT, (sreg_t)val < (sreg_t)val2)
+        DC_ALU(DOP_SLTU, val < val2)
+        DC_ALU(DOP_XOR, val ^ val2)
+        DC_ALU(DOP_SRL, (intx_t)((uintx_t)val >> (val2 & (XLEN - 1))))
+        DC_ALU(DOP_SRA, (intx_t)val >> (val2 & (XLEN - 1)))
+        DC_ALU(DOP_OR, val | val2)
+        DC_ALU(DOP_AND, val & val2)
+        DC_ALU(DOP_MUL, (intx_t)((intx_t)val * (intx_t)val2))
+#if XLEN >= 64
+        DC_ALU_IMM(DOP_ADDIW, (int32_t)(val + d->imm))
+        DC_ALU_IMM(DOP_SLLIW, (int32_t)(val << d->imm))
+        DC_ALU_IMM(DOP_SRLIW, (int32_t)((uint32_t)val >> d->imm))
+        DC_ALU_IMM(DOP_SRAIW, (int32_t)val >> d->imm)
+        DC_ALU(DOP_ADDW, (int32_t)(val + val2))
+        DC_ALU(DOP_SUBW, (int32_t)(val - val2))
+        DC_ALU(DOP_SLLW, (int32_t)((uint32_t)val << (val2 & 31)))
+        DC_ALU(DOP_SRLW, (int32_t)((uint32_t)val >> (val2 & 31)))
+        DC_ALU(DOP_SRAW, (int32_t)val >> (val2 & 31))
+        DC_ALU(DOP_MULW, (int32_t)((int32_t)val * (int32_t)val2))
+#endif
+#undef DC_NEXT
+#undef DC_CASE
+#undef DC_CASES
+#undef DC_JAL
+#undef DC_BRANCH
+#undef DC_LOAD
+#undef DC_STORE
+#undef DC_ALU
+#undef DC_ALU_IMM
+        default: /* DOP_LEGACY */
+            break;
+        }
+        OP_LABEL(dc_legacy)
+#endif /* CONFIG_RISCV_DECODE_CACHE */
+        insn = get_insn32(code_ptr);
+    decode_insn:
 #if 0
         if (1) {
 #ifdef CONFIG_LOGFILE
@@ -302,34 +1282,36 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
         rd = (insn >> 7) & 0x1f;
         rs1 = (insn >> 15) & 0x1f;
         rs2 = (insn >> 20) & 0x1f;
+        OP_DISPATCH(opcode_table, opcode);
         switch(opcode) {
 #ifdef CONFIG_EXT_C
-        C_QUADRANT(0)
+        C_QUADRANT(0) OP_LABEL(op_c0)
             funct3 = (insn >> 13) & 7;
             rd = ((insn >> 2) & 7) | 8;
+            OP_DISPATCH(c0_table, funct3);
             switch(funct3) {
-            case 0: /* c.addi4spn */
+            case 0: OP_LABEL(c0_0) /* c.addi4spn */
                 imm = get_field1(insn, 11, 4, 5) |
                     get_field1(insn, 7, 6, 9) |
                     get_field1(insn, 6, 2, 2) |
                     get_field1(insn, 5, 3, 3);
                 if (imm == 0)
                     goto illegal_insn;
-                s->reg[rd] = (intx_t)(s->reg[2] + imm);
+                s->XREG[rd] = (intx_t)(s->XREG[2] + imm);
                 break;
 #if XLEN >= 128
-            case 1: /* c.lq */
+            case 1: OP_LABEL(c0_1) /* c.lq */
                 imm = get_field1(insn, 11, 4, 5) |
                     get_field1(insn, 10, 8, 8) |
                     get_field1(insn, 5, 6, 7);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
+                addr = (intx_t)(s->XREG[rs1] + imm);
                 if (target_read_u128(s, &val, addr))
                     goto mmu_exception;
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
                 break;
 #elif FLEN >= 64
-            case 1: /* c.fld */
+            case 1: OP_LABEL(c0_1) /* c.fld */
                 {
                     uint64_t rval;
                     if (s->fs == 0)
@@ -337,7 +1319,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     imm = get_field1(insn, 10, 3, 5) |
                         get_field1(insn, 5, 6, 7);
                     rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
+                    addr = (intx_t)(s->XREG[rs1] + imm);
                     if (target_read_u64(s, &rval, addr))
                         goto mmu_exception;
                     s->fp_reg[rd] = rval | F64_HIGH;
@@ -345,34 +1327,34 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
                 break;
 #endif
-            case 2: /* c.lw */
+            case 2: OP_LABEL(c0_2) /* c.lw */
                 {
                     uint32_t rval;
                     imm = get_field1(insn, 10, 3, 5) |
                         get_field1(insn, 6, 2, 2) |
                         get_field1(insn, 5, 6, 6);
                     rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
+                    addr = (intx_t)(s->XREG[rs1] + imm);
                     if (target_read_u32(s, &rval, addr))
                         goto mmu_exception;
-                    s->reg[rd] = (int32_t)rval;
+                    s->XREG[rd] = (int32_t)rval;
                 }
                 break;
 #if XLEN >= 64
-            case 3: /* c.ld */
+            case 3: OP_LABEL(c0_3) /* c.ld */
                 {
                     uint64_t rval;
                     imm = get_field1(insn, 10, 3, 5) |
                         get_field1(insn, 5, 6, 7);
                     rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
+                    addr = (intx_t)(s->XREG[rs1] + imm);
                     if (target_read_u64(s, &rval, addr))
                         goto mmu_exception;
-                    s->reg[rd] = (int64_t)rval;
+                    s->XREG[rd] = (int64_t)rval;
                 }
                 break;
 #elif FLEN >= 32
-            case 3: /* c.flw */
+            case 3: OP_LABEL(c0_3) /* c.flw */
                 {
                     uint32_t rval;
                     if (s->fs == 0)
@@ -381,7 +1363,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                         get_field1(insn, 6, 2, 2) |
                         get_field1(insn, 5, 6, 6);
                     rs1 = ((insn >> 7) & 7) | 8;
-                    addr = (intx_t)(s->reg[rs1] + imm);
+                    addr = (intx_t)(s->XREG[rs1] + imm);
                     if (target_read_u32(s, &rval, addr))
                         goto mmu_exception;
                     s->fp_reg[rd] = rval | F32_HIGH;
@@ -390,57 +1372,57 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 break;
 #endif
 #if XLEN >= 128
-            case 5: /* c.sq */
+            case 5: OP_LABEL(c0_5) /* c.sq */
                 imm = get_field1(insn, 11, 4, 5) |
                     get_field1(insn, 10, 8, 8) |
                     get_field1(insn, 5, 6, 7);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
+                addr = (intx_t)(s->XREG[rs1] + imm);
+                val = s->XREG[rd];
                 if (target_write_u128(s, addr, val))
                     goto mmu_exception;
                 break;
 #elif FLEN >= 64
-            case 5: /* c.fsd */
+            case 5: OP_LABEL(c0_5) /* c.fsd */
                 if (s->fs == 0)
                     goto illegal_insn;
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 5, 6, 7);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
+                addr = (intx_t)(s->XREG[rs1] + imm);
                 if (target_write_u64(s, addr, s->fp_reg[rd]))
                     goto mmu_exception;
                 break;
 #endif
-            case 6: /* c.sw */
+            case 6: OP_LABEL(c0_6) /* c.sw */
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 6, 2, 2) |
                     get_field1(insn, 5, 6, 6);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
+                addr = (intx_t)(s->XREG[rs1] + imm);
+                val = s->XREG[rd];
                 if (target_write_u32(s, addr, val))
                     goto mmu_exception;
                 break;
 #if XLEN >= 64
-            case 7: /* c.sd */
+            case 7: OP_LABEL(c0_7) /* c.sd */
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 5, 6, 7);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
-                val = s->reg[rd];
+                addr = (intx_t)(s->XREG[rs1] + imm);
+                val = s->XREG[rd];
                 if (target_write_u64(s, addr, val))
                     goto mmu_exception;
                 break;
 #elif FLEN >= 32
-            case 7: /* c.fsw */
+            case 7: OP_LABEL(c0_7) /* c.fsw */
                 if (s->fs == 0)
                     goto illegal_insn;
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 6, 2, 2) |
                     get_field1(insn, 5, 6, 6);
                 rs1 = ((insn >> 7) & 7) | 8;
-                addr = (intx_t)(s->reg[rs1] + imm);
+                addr = (intx_t)(s->XREG[rs1] + imm);
                 if (target_write_u32(s, addr, s->fp_reg[rd]))
                     goto mmu_exception;
                 break;
@@ -449,18 +1431,19 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             C_NEXT_INSN;
-        C_QUADRANT(1)
+        C_QUADRANT(1) OP_LABEL(op_c1)
             funct3 = (insn >> 13) & 7;
+            OP_DISPATCH(c1_table, funct3);
             switch(funct3) {
-            case 0: /* c.addi/c.nop */
+            case 0: OP_LABEL(c1_0) /* c.addi/c.nop */
                 if (rd != 0) {
                     imm = sext(get_field1(insn, 12, 5, 5) |
                                get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = (intx_t)(s->reg[rd] + imm);
+                    s->XREG[rd] = (intx_t)(s->XREG[rd] + imm);
                 }
                 break;
 #if XLEN == 32
-            case 1: /* c.jal */
+            case 1: OP_LABEL(c1_1) /* c.jal */
                 imm = sext(get_field1(insn, 12, 11, 11) | 
                            get_field1(insn, 11, 4, 4) |
                            get_field1(insn, 9, 8, 9) |
@@ -469,26 +1452,26 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                            get_field1(insn, 6, 7, 7) |
                            get_field1(insn, 3, 1, 3) |
                            get_field1(insn, 2, 5, 5), 12);
-                s->reg[1] = GET_PC() + 2;
+                s->XREG[1] = GET_PC() + 2;
                 s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
+                BRANCH_INSN;
 #else
-            case 1: /* c.addiw */
+            case 1: OP_LABEL(c1_1) /* c.addiw */
                 if (rd != 0) {
                     imm = sext(get_field1(insn, 12, 5, 5) |
                                get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = (int32_t)(s->reg[rd] + imm);
+                    s->XREG[rd] = (int32_t)(s->XREG[rd] + imm);
                 }
                 break;
 #endif
-            case 2: /* c.li */
+            case 2: OP_LABEL(c1_2) /* c.li */
                 if (rd != 0) {
                     imm = sext(get_field1(insn, 12, 5, 5) |
                                get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] = imm;
+                    s->XREG[rd] = imm;
                 }
                 break;
-            case 3:
+            case 3: OP_LABEL(c1_3)
                 if (rd == 2) {
                     /* c.addi16sp */
                     imm = sext(get_field1(insn, 12, 9, 9) |
@@ -498,15 +1481,15 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                                get_field1(insn, 2, 5, 5), 10);
                     if (imm == 0)
                         goto illegal_insn;
-                    s->reg[2] = (intx_t)(s->reg[2] + imm);
+                    s->XREG[2] = (intx_t)(s->XREG[2] + imm);
                 } else if (rd != 0) {
                     /* c.lui */
                     imm = sext(get_field1(insn, 12, 17, 17) |
                                get_field1(insn, 2, 12, 16), 18);
-                    s->reg[rd] = imm;
+                    s->XREG[rd] = imm;
                 }
                 break;
-            case 4: 
+            case 4: OP_LABEL(c1_4) 
                 funct3 = (insn >> 10) & 3;
                 rd = ((insn >> 7) & 7) | 8;
                 switch(funct3) {
@@ -518,44 +1501,45 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     if (imm & 0x20)
                         goto illegal_insn;
 #elif XLEN == 128
+                    /* the shift amount is sign extended */
                     if (imm == 0)
                         imm = 64;
                     else if (imm >= 32)
-                        imm = 128 - imm;
+                        imm += 64;
 #endif
                     if (funct3 == 0)
-                        s->reg[rd] = (intx_t)((uintx_t)s->reg[rd] >> imm);
+                        s->XREG[rd] = (intx_t)((uintx_t)s->XREG[rd] >> imm);
                     else
-                        s->reg[rd] = (intx_t)s->reg[rd] >> imm;
+                        s->XREG[rd] = (intx_t)s->XREG[rd] >> imm;
                     
                     break;
                 case 2: /* c.andi */
                     imm = sext(get_field1(insn, 12, 5, 5) |
                                get_field1(insn, 2, 0, 4), 6);
-                    s->reg[rd] &= imm;
+                    s->XREG[rd] &= imm;
                     break;
                 case 3: 
                     rs2 = ((insn >> 2) & 7) | 8;
                     funct3 = ((insn >> 5) & 3) | ((insn >> (12 - 2)) & 4);
                     switch(funct3) {
                     case 0: /* c.sub */
-                        s->reg[rd] = (intx_t)(s->reg[rd] - s->reg[rs2]);
+                        s->XREG[rd] = (intx_t)(s->XREG[rd] - s->XREG[rs2]);
                         break;
                     case 1: /* c.xor */
-                        s->reg[rd] = s->reg[rd] ^ s->reg[rs2];
+                        s->XREG[rd] = s->XREG[rd] ^ s->XREG[rs2];
                         break;
                     case 2: /* c.or */
-                        s->reg[rd] = s->reg[rd] | s->reg[rs2];
+                        s->XREG[rd] = s->XREG[rd] | s->XREG[rs2];
                         break;
                     case 3: /* c.and */
-                        s->reg[rd] = s->reg[rd] & s->reg[rs2];
+                        s->XREG[rd] = s->XREG[rd] & s->XREG[rs2];
                         break;
 #if XLEN >= 64
                     case 4: /* c.subw */
-                        s->reg[rd] = (int32_t)(s->reg[rd] - s->reg[rs2]);
+                        s->XREG[rd] = (int32_t)(s->XREG[rd] - s->XREG[rs2]);
                         break;
                     case 5: /* c.addw */
-                        s->reg[rd] = (int32_t)(s->reg[rd] + s->reg[rs2]);
+                        s->XREG[rd] = (int32_t)(s->XREG[rd] + s->XREG[rs2]);
                         break;
 #endif
                     default:
@@ -564,7 +1548,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     break;
                 }
                 break;
-            case 5: /* c.j */
+            case 5: OP_LABEL(c1_5) /* c.j */
                 imm = sext(get_field1(insn, 12, 11, 11) | 
                            get_field1(insn, 11, 4, 4) |
                            get_field1(insn, 9, 8, 9) |
@@ -574,40 +1558,41 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                            get_field1(insn, 3, 1, 3) |
                            get_field1(insn, 2, 5, 5), 12);
                 s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
-            case 6: /* c.beqz */
+                BRANCH_INSN;
+            case 6: OP_LABEL(c1_6) /* c.beqz */
                 rs1 = ((insn >> 7) & 7) | 8;
                 imm = sext(get_field1(insn, 12, 8, 8) | 
                            get_field1(insn, 10, 3, 4) |
                            get_field1(insn, 5, 6, 7) |
                            get_field1(insn, 3, 1, 2) |
                            get_field1(insn, 2, 5, 5), 9);
-                if (s->reg[rs1] == 0) {
+                if (s->XREG[rs1] == 0) {
                     s->pc = (intx_t)(GET_PC() + imm);
-                    JUMP_INSN;
+                    BRANCH_INSN;
                 }
                 break;
-            case 7: /* c.bnez */
+            case 7: OP_LABEL(c1_7) /* c.bnez */
                 rs1 = ((insn >> 7) & 7) | 8;
                 imm = sext(get_field1(insn, 12, 8, 8) | 
                            get_field1(insn, 10, 3, 4) |
                            get_field1(insn, 5, 6, 7) |
                            get_field1(insn, 3, 1, 2) |
                            get_field1(insn, 2, 5, 5), 9);
-                if (s->reg[rs1] != 0) {
+                if (s->XREG[rs1] != 0) {
                     s->pc = (intx_t)(GET_PC() + imm);
-                    JUMP_INSN;
+                    BRANCH_INSN;
                 }
                 break;
             default:
                 goto illegal_insn;
             }
             C_NEXT_INSN;
-        C_QUADRANT(2)
+        C_QUADRANT(2) OP_LABEL(op_c2)
             funct3 = (insn >> 13) & 7;
             rs2 = (insn >> 2) & 0x1f;
+            OP_DISPATCH(c2_table, funct3);
             switch(funct3) {
-            case 0: /* c.slli */
+            case 0: OP_LABEL(c2_0) /* c.slli */
                 imm = get_field1(insn, 12, 5, 5) | rs2;
 #if XLEN == 32
                 if (imm & 0x20)
@@ -617,21 +1602,21 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     imm = 64;
 #endif
                 if (rd != 0)
-                    s->reg[rd] = (intx_t)(s->reg[rd] << imm);
+                    s->XREG[rd] = (intx_t)(s->XREG[rd] << imm);
                 break;
 #if XLEN == 128
-            case 1: /* c.lqsp */
+            case 1: OP_LABEL(c2_1) /* c.lqsp */
                 imm = get_field1(insn, 12, 5, 5) |
                     (rs2 & (1 << 4)) |
                     get_field1(insn, 2, 6, 9);
-                addr = (intx_t)(s->reg[2] + imm);
+                addr = (intx_t)(s->XREG[2] + imm);
                 if (target_read_u128(s, &val, addr))
                     goto mmu_exception;
                 if (rd != 0)
-                    s->reg[rd] = val;
+                    s->XREG[rd] = val;
                 break;
 #elif FLEN >= 64
-            case 1: /* c.fldsp */
+            case 1: OP_LABEL(c2_1) /* c.fldsp */
                 {
                     uint64_t rval;
                     if (s->fs == 0)
@@ -639,7 +1624,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     imm = get_field1(insn, 12, 5, 5) |
                         (rs2 & (3 << 3)) |
                         get_field1(insn, 2, 6, 8);
-                    addr = (intx_t)(s->reg[2] + imm);
+                    addr = (intx_t)(s->XREG[2] + imm);
                     if (target_read_u64(s, &rval, addr))
                         goto mmu_exception;
                     s->fp_reg[rd] = rval | F64_HIGH;
@@ -647,35 +1632,35 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
                 break;
 #endif
-            case 2: /* c.lwsp */
+            case 2: OP_LABEL(c2_2) /* c.lwsp */
                 {
                     uint32_t rval;
                     imm = get_field1(insn, 12, 5, 5) |
                         (rs2 & (7 << 2)) |
                         get_field1(insn, 2, 6, 7);
-                    addr = (intx_t)(s->reg[2] + imm);
+                    addr = (intx_t)(s->XREG[2] + imm);
                     if (target_read_u32(s, &rval, addr))
                         goto mmu_exception;
                     if (rd != 0)
-                        s->reg[rd] = (int32_t)rval;
+                        s->XREG[rd] = (int32_t)rval;
                 }
                 break;
 #if XLEN >= 64
-            case 3: /* c.ldsp */
+            case 3: OP_LABEL(c2_3) /* c.ldsp */
                 {
                     uint64_t rval;
                     imm = get_field1(insn, 12, 5, 5) |
                         (rs2 & (3 << 3)) |
                         get_field1(insn, 2, 6, 8);
-                    addr = (intx_t)(s->reg[2] + imm);
+                    addr = (intx_t)(s->XREG[2] + imm);
                     if (target_read_u64(s, &rval, addr))
                         goto mmu_exception;
                     if (rd != 0)
-                        s->reg[rd] = (int64_t)rval;
+                        s->XREG[rd] = (int64_t)rval;
                 }
                 break;
 #elif FLEN >= 32
-            case 3: /* c.flwsp */
+            case 3: OP_LABEL(c2_3) /* c.flwsp */
                 {
                     uint32_t rval;
                     if (s->fs == 0)
@@ -683,7 +1668,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     imm = get_field1(insn, 12, 5, 5) |
                         (rs2 & (7 << 2)) |
                         get_field1(insn, 2, 6, 7);
-                    addr = (intx_t)(s->reg[2] + imm);
+                    addr = (intx_t)(s->XREG[2] + imm);
                     if (target_read_u32(s, &rval, addr))
                         goto mmu_exception;
                     s->fp_reg[rd] = rval | F32_HIGH;
@@ -691,18 +1676,18 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
                 break;
 #endif
-            case 4:
+            case 4: OP_LABEL(c2_4)
                 if (((insn >> 12) & 1) == 0) {
                     if (rs2 == 0) {
                         /* c.jr */
                         if (rd == 0)
                             goto illegal_insn;
-                        s->pc = s->reg[rd] & ~1;
-                        JUMP_INSN;
+                        s->pc = (intx_t)s->XREG[rd] & ~1;
+                        BRANCH_INSN;
                     } else {
                         /* c.mv */
                         if (rd != 0)
-                            s->reg[rd] = s->reg[rs2];
+                            s->XREG[rd] = s->XREG[rs2];
                     }
                 } else {
                     if (rs2 == 0) {
@@ -713,58 +1698,58 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                         } else {
                             /* c.jalr */
                             val = GET_PC() + 2;
-                            s->pc = s->reg[rd] & ~1;
-                            s->reg[1] = val;
-                            JUMP_INSN;
+                            s->pc = (intx_t)s->XREG[rd] & ~1;
+                            s->XREG[1] = val;
+                            BRANCH_INSN;
                         }
                     } else {
                         if (rd != 0) {
-                            s->reg[rd] = (intx_t)(s->reg[rd] + s->reg[rs2]);
+                            s->XREG[rd] = (intx_t)(s->XREG[rd] + s->XREG[rs2]);
                         }
                     }
                 }
                 break;
 #if XLEN == 128
-            case 5: /* c.sqsp */
-                imm = get_field1(insn, 10, 3, 5) |
-                    get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u128(s, addr, s->reg[rs2]))
+            case 5: OP_LABEL(c2_5) /* c.sqsp */
+                imm = get_field1(insn, 11, 4, 5) |
+                    get_field1(insn, 7, 6, 9);
+                addr = (intx_t)(s->XREG[2] + imm);
+                if (target_write_u128(s, addr, s->XREG[rs2]))
                     goto mmu_exception;
                 break;
 #elif FLEN >= 64
-            case 5: /* c.fsdsp */
+            case 5: OP_LABEL(c2_5) /* c.fsdsp */
                 if (s->fs == 0)
                     goto illegal_insn;
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
+                addr = (intx_t)(s->XREG[2] + imm);
                 if (target_write_u64(s, addr, s->fp_reg[rs2]))
                     goto mmu_exception;
                 break;
 #endif 
-            case 6: /* c.swsp */
+            case 6: OP_LABEL(c2_6) /* c.swsp */
                 imm = get_field1(insn, 9, 2, 5) |
                     get_field1(insn, 7, 6, 7);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u32(s, addr, s->reg[rs2]))
+                addr = (intx_t)(s->XREG[2] + imm);
+                if (target_write_u32(s, addr, s->XREG[rs2]))
                     goto mmu_exception;
                 break;
 #if XLEN >= 64
-            case 7: /* c.sdsp */
+            case 7: OP_LABEL(c2_7) /* c.sdsp */
                 imm = get_field1(insn, 10, 3, 5) |
                     get_field1(insn, 7, 6, 8);
-                addr = (intx_t)(s->reg[2] + imm);
-                if (target_write_u64(s, addr, s->reg[rs2]))
+                addr = (intx_t)(s->XREG[2] + imm);
+                if (target_write_u64(s, addr, s->XREG[rs2]))
                     goto mmu_exception;
                 break;
 #elif FLEN >= 32
-            case 7: /* c.swsp */
+            case 7: OP_LABEL(c2_7) /* c.fswsp */
                 if (s->fs == 0)
                     goto illegal_insn;
                 imm = get_field1(insn, 9, 2, 5) |
                     get_field1(insn, 7, 6, 7);
-                addr = (intx_t)(s->reg[2] + imm);
+                addr = (intx_t)(s->XREG[2] + imm);
                 if (target_write_u32(s, addr, s->fp_reg[rs2]))
                     goto mmu_exception;
                 break;
@@ -775,42 +1760,42 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             C_NEXT_INSN;
 #endif /* CONFIG_EXT_C */
 
-        case 0x37: /* lui */
+        case 0x37: OP_LABEL(op_37) /* lui */
             if (rd != 0)
-                s->reg[rd] = (int32_t)(insn & 0xfffff000);
+                s->XREG[rd] = (int32_t)(insn & 0xfffff000);
             NEXT_INSN;
-        case 0x17: /* auipc */
+        case 0x17: OP_LABEL(op_17) /* auipc */
             if (rd != 0)
-                s->reg[rd] = (intx_t)(GET_PC() + (int32_t)(insn & 0xfffff000));
+                s->XREG[rd] = (intx_t)(GET_PC() + (int32_t)(insn & 0xfffff000));
             NEXT_INSN;
-        case 0x6f: /* jal */
+        case 0x6f: OP_LABEL(op_6f) /* jal */
             imm = ((insn >> (31 - 20)) & (1 << 20)) |
                 ((insn >> (21 - 1)) & 0x7fe) |
                 ((insn >> (20 - 11)) & (1 << 11)) |
                 (insn & 0xff000);
             imm = (imm << 11) >> 11;
             if (rd != 0)
-                s->reg[rd] = GET_PC() + 4;
+                s->XREG[rd] = GET_PC() + 4;
             s->pc = (intx_t)(GET_PC() + imm);
-            JUMP_INSN;
-        case 0x67: /* jalr */
+            BRANCH_INSN;
+        case 0x67: OP_LABEL(op_67) /* jalr */
             imm = (int32_t)insn >> 20;
             val = GET_PC() + 4;
-            s->pc = (intx_t)(s->reg[rs1] + imm) & ~1;
+            s->pc = (intx_t)(s->XREG[rs1] + imm) & ~1;
             if (rd != 0)
-                s->reg[rd] = val;
-            JUMP_INSN;
-        case 0x63:
+                s->XREG[rd] = val;
+            BRANCH_INSN;
+        case 0x63: OP_LABEL(op_63)
             funct3 = (insn >> 12) & 7;
             switch(funct3 >> 1) {
             case 0: /* beq/bne */
-                cond = (s->reg[rs1] == s->reg[rs2]);
+                cond = (s->XREG[rs1] == s->XREG[rs2]);
                 break;
             case 2: /* blt/bge */
-                cond = ((target_long)s->reg[rs1] < (target_long)s->reg[rs2]);
+                cond = ((sreg_t)s->XREG[rs1] < (sreg_t)s->XREG[rs2]);
                 break;
             case 3: /* bltu/bgeu */
-                cond = (s->reg[rs1] < s->reg[rs2]);
+                cond = (s->XREG[rs1] < s->XREG[rs2]);
                 break;
             default:
                 goto illegal_insn;
@@ -823,13 +1808,13 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     ((insn << (11 - 7)) & (1 << 11));
                 imm = (imm << 19) >> 19;
                 s->pc = (intx_t)(GET_PC() + imm);
-                JUMP_INSN;
+                BRANCH_INSN;
             }
             NEXT_INSN;
-        case 0x03: /* load */
+        case 0x03: OP_LABEL(op_03) /* load */
             funct3 = (insn >> 12) & 7;
             imm = (int32_t)insn >> 20;
-            addr = s->reg[rs1] + imm;
+            addr = (intx_t)(s->XREG[rs1] + imm);
             switch(funct3) {
             case 0: /* lb */
                 {
@@ -903,14 +1888,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
-        case 0x23: /* store */
+        case 0x23: OP_LABEL(op_23) /* store */
             funct3 = (insn >> 12) & 7;
             imm = rd | ((insn >> (25 - 5)) & 0xfe0);
             imm = (imm << 20) >> 20;
-            addr = s->reg[rs1] + imm;
-            val = s->reg[rs2];
+            addr = (intx_t)(s->XREG[rs1] + imm);
+            val = s->XREG[rs2];
             switch(funct3) {
             case 0: /* sb */
                 if (target_write_u8(s, addr, val))
@@ -940,51 +1925,51 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x13:
+        case 0x13: OP_LABEL(op_13)
             funct3 = (insn >> 12) & 7;
             imm = (int32_t)insn >> 20;
             switch(funct3) {
             case 0: /* addi */
-                val = (intx_t)(s->reg[rs1] + imm);
+                val = (intx_t)(s->XREG[rs1] + imm);
                 break;
             case 1: /* slli */
                 if ((imm & ~(XLEN - 1)) != 0)
                     goto illegal_insn;
-                val = (intx_t)(s->reg[rs1] << (imm & (XLEN - 1)));
+                val = (intx_t)(s->XREG[rs1] << (imm & (XLEN - 1)));
                 break;
             case 2: /* slti */
-                val = (target_long)s->reg[rs1] < (target_long)imm;
+                val = (sreg_t)s->XREG[rs1] < (sreg_t)imm;
                 break;
             case 3: /* sltiu */
-                val = s->reg[rs1] < (target_ulong)imm;
+                val = s->XREG[rs1] < (ureg_t)imm;
                 break;
             case 4: /* xori */
-                val = s->reg[rs1] ^ imm;
+                val = s->XREG[rs1] ^ imm;
                 break;
             case 5: /* srli/srai */
                 if ((imm & ~((XLEN - 1) | 0x400)) != 0)
                     goto illegal_insn;
                 if (imm & 0x400)
-                    val = (intx_t)s->reg[rs1] >> (imm & (XLEN - 1));
+                    val = (intx_t)s->XREG[rs1] >> (imm & (XLEN - 1));
                 else
-                    val = (intx_t)((uintx_t)s->reg[rs1] >> (imm & (XLEN - 1)));
+                    val = (intx_t)((uintx_t)s->XREG[rs1] >> (imm & (XLEN - 1)));
                 break;
             case 6: /* ori */
-                val = s->reg[rs1] | imm;
+                val = s->XREG[rs1] | imm;
                 break;
             default:
             case 7: /* andi */
-                val = s->reg[rs1] & imm;
+                val = s->XREG[rs1] & imm;
                 break;
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #if XLEN >= 64
-        case 0x1b:/* OP-IMM-32 */
+        case 0x1b: OP_LABEL(op_1b) /* OP-IMM-32 */
             funct3 = (insn >> 12) & 7;
             imm = (int32_t)insn >> 20;
-            val = s->reg[rs1];
+            val = s->XREG[rs1];
             switch(funct3) {
             case 0: /* addiw */
                 val = (int32_t)(val + imm);
@@ -1006,14 +1991,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #endif
 #if XLEN >= 128
-        case 0x5b: /* OP-IMM-64 */
+        case 0x5b: OP_LABEL(op_5b) /* OP-IMM-64 */
             funct3 = (insn >> 12) & 7;
             imm = (int32_t)insn >> 20;
-            val = s->reg[rs1];
+            val = s->XREG[rs1];
             switch(funct3) {
             case 0: /* addid */
                 val = (int64_t)(val + imm);
@@ -1035,13 +2020,13 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #endif
-        case 0x33:
+        case 0x33: OP_LABEL(op_33)
             imm = insn >> 25;
-            val = s->reg[rs1];
-            val2 = s->reg[rs2];
+            val = s->XREG[rs1];
+            val2 = s->XREG[rs2];
             if (imm == 1) {
                 funct3 = (insn >> 12) & 7;
                 switch(funct3) {
@@ -1087,7 +2072,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                     val = (intx_t)(val << (val2 & (XLEN - 1)));
                     break;
                 case 2: /* slt */
-                    val = (target_long)val < (target_long)val2;
+                    val = (sreg_t)val < (sreg_t)val2;
                     break;
                 case 3: /* sltu */
                     val = val < val2;
@@ -1112,13 +2097,13 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #if XLEN >= 64
-        case 0x3b: /* OP-32 */
+        case 0x3b: OP_LABEL(op_3b) /* OP-32 */
             imm = insn >> 25;
-            val = s->reg[rs1];
-            val2 = s->reg[rs2];
+            val = s->XREG[rs1];
+            val2 = s->XREG[rs2];
             if (imm == 1) {
                 funct3 = (insn >> 12) & 7;
                 switch(funct3) {
@@ -1165,14 +2150,14 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #endif
 #if XLEN >= 128
-        case 0x7b: /* OP-64 */
+        case 0x7b: OP_LABEL(op_7b) /* OP-64 */
             imm = insn >> 25;
-            val = s->reg[rs1];
-            val2 = s->reg[rs2];
+            val = s->XREG[rs1];
+            val2 = s->XREG[rs2];
             if (imm == 1) {
                 funct3 = (insn >> 12) & 7;
                 switch(funct3) {
@@ -1219,28 +2204,28 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 }
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #endif
-        case 0x73:
+        case 0x73: OP_LABEL(op_73)
             funct3 = (insn >> 12) & 7;
             imm = insn >> 20;
             if (funct3 & 4)
                 val = rs1;
             else
-                val = s->reg[rs1];
+                val = s->XREG[rs1];
             funct3 &= 3;
             switch(funct3) {
             case 1: /* csrrw */
                 s->insn_counter = GET_INSN_COUNTER();
-                if (csr_read(s, &val2, imm, TRUE))
+                if (csr_read(s, &csr_val, imm, TRUE))
                     goto illegal_insn;
-                val2 = (intx_t)val2;
-                err = csr_write(s, imm, val);
+                val2 = (intx_t)csr_val;
+                err = csr_write(s, imm, (sreg_t)val);
                 if (err < 0)
                     goto illegal_insn;
                 if (rd != 0)
-                    s->reg[rd] = val2;
+                    s->XREG[rd] = val2;
                 if (err > 0) {
                     s->pc = GET_PC() + 4;
                     if (err == 2)
@@ -1252,22 +2237,22 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             case 2: /* csrrs */
             case 3: /* csrrc */
                 s->insn_counter = GET_INSN_COUNTER();
-                if (csr_read(s, &val2, imm, (rs1 != 0)))
+                if (csr_read(s, &csr_val, imm, (rs1 != 0)))
                     goto illegal_insn;
-                val2 = (intx_t)val2;
+                val2 = (intx_t)csr_val;
                 if (rs1 != 0) {
                     if (funct3 == 2)
                         val = val2 | val;
                     else
                         val = val2 & ~val;
-                    err = csr_write(s, imm, val);
+                    err = csr_write(s, imm, (sreg_t)val);
                     if (err < 0)
                         goto illegal_insn;
                 } else {
                     err = 0;
                 }
                 if (rd != 0)
-                    s->reg[rd] = val2;
+                    s->XREG[rd] = val2;
                 if (err > 0) {
                     s->pc = GET_PC() + 4;
                     if (err == 2)
@@ -1281,6 +2266,17 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 case 0x000: /* ecall */
                     if (insn & 0x000fff80)
                         goto illegal_insn;
+                    if (s->priv == PRV_S && s->sbi_call) {
+                        s->insn_counter = GET_INSN_COUNTER();
+                        handle_sbi_call(s);
+#ifdef CONFIG_RISCV_DECODE_CACHE
+                        /* the decoded pages may have been flushed */
+                        dc_page = NULL;
+#endif
+                        /* the current code TLB may have been flushed */
+                        s->pc = GET_PC() + 4;
+                        JUMP_INSN;
+                    }
                     s->pending_exception = CAUSE_USER_ECALL + s->priv;
                     goto exception;
                 case 0x001: /* ebreak */
@@ -1330,10 +2326,17 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                             goto illegal_insn;
                         if (s->priv == PRV_U)
                             goto illegal_insn;
-                        if (rs1 == 0) {
-                            tlb_flush_all(s);
-                        } else {
-                            tlb_flush_vaddr(s, s->reg[rs1]);
+                        {
+                            int asid;
+                            /* rs2 selects the ASID, the global
+                               mappings are kept in this case */
+                            asid = rs2 ? (s->XREG[rs2] & SATP_ASID_MASK) : -1;
+                            if (rs1 != 0)
+                                tlb_flush_vaddr(s, s->XREG[rs1], asid);
+                            else if (asid >= 0)
+                                tlb_flush_asid(s, asid);
+                            else
+                                tlb_flush_all(s);
                         }
                         /* the current code TLB may have been flushed */
                         s->pc = GET_PC() + 4;
@@ -1348,7 +2351,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x0f: /* misc-mem */
+        case 0x0f: OP_LABEL(op_0f) /* misc-mem */
             funct3 = (insn >> 12) & 7;
             switch(funct3) {
             case 0: /* fence */
@@ -1358,28 +2361,62 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             case 1: /* fence.i */
                 if (insn != 0x0000100f)
                     goto illegal_insn;
+#ifdef CONFIG_RISCV_DECODE_CACHE
+                /* the RAM may have been modified without going
+                   through target_write_slow() (e.g. DMA) */
+                dc_flush_all(s);
+                dc_page = NULL;
+                s->pc = GET_PC() + 4;
+                JUMP_INSN;
+#else
                 break;
-#if XLEN >= 128
+#endif
+#if XLEN <= 64
+            case 2: /* Zicbom and Zicboz */
+                if (rd != 0)
+                    goto illegal_insn;
+                switch(insn >> 20) {
+                case 0: /* cbo.inval */
+                    if (!cbo_enabled(s, ENVCFG_CBIE_MASK))
+                        goto illegal_insn;
+                    break;
+                case 1: /* cbo.clean */
+                case 2: /* cbo.flush */
+                    /* no data cache: nothing to do */
+                    if (!cbo_enabled(s, ENVCFG_CBCFE))
+                        goto illegal_insn;
+                    break;
+                case 4: /* cbo.zero */
+                    if (!cbo_enabled(s, ENVCFG_CBZE))
+                        goto illegal_insn;
+                    if (target_zero_block(s, (intx_t)s->XREG[rs1]))
+                        goto mmu_exception;
+                    break;
+                default:
+                    goto illegal_insn;
+                }
+                break;
+#else
             case 2: /* lq */
                 imm = (int32_t)insn >> 20;
-                addr = s->reg[rs1] + imm;
+                addr = (intx_t)(s->XREG[rs1] + imm);
                 if (target_read_u128(s, &val, addr))
                     goto mmu_exception;
                 if (rd != 0)
-                    s->reg[rd] = val;
+                    s->XREG[rd] = val;
                 break;
 #endif
             default:
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x2f:
+        case 0x2f: OP_LABEL(op_2f)
             funct3 = (insn >> 12) & 7;
 #define OP_A(size)                                                      \
             {                                                           \
                 uint ## size ##_t rval;                                 \
                                                                         \
-                addr = s->reg[rs1];                                     \
+                addr = (intx_t)s->XREG[rs1];                            \
                 funct3 = insn >> 27;                                    \
                 switch(funct3) {                                        \
                 case 2: /* lr.w */                                      \
@@ -1389,10 +2426,24 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                         goto mmu_exception;                             \
                     val = (int## size ## _t)rval;                       \
                     s->load_res = addr;                                 \
+                    s->load_res_val = rval;                             \
                     break;                                              \
                 case 3: /* sc.w */                                      \
                     if (s->load_res == addr) {                          \
-                        if (target_write_u ## size(s, addr, s->reg[rs2])) \
+                        if (s->io_lock) {                               \
+                            /* other harts may have written the value */ \
+                            uint ## size ##_t cur;                      \
+                            int ret;                                    \
+                            ret = target_cas_u ## size(s, addr,         \
+                                        s->load_res_val, s->XREG[rs2], &cur); \
+                            if (ret < 0)                                \
+                                goto mmu_exception;                     \
+                            if (ret == 0) {                             \
+                                val = (cur != (uint ## size ##_t)s->load_res_val); \
+                                break;                                  \
+                            }                                           \
+                        }                                               \
+                        if (target_write_u ## size(s, addr, s->XREG[rs2])) \
                             goto mmu_exception;                         \
                         val = 0;                                        \
                     } else {                                            \
@@ -1410,44 +2461,61 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 case 0x1c: /* amomaxu.w */                              \
                     if (target_read_u ## size(s, &rval, addr))          \
                         goto mmu_exception;                             \
-                    val = (int## size ## _t)rval;                       \
-                    val2 = s->reg[rs2];                                 \
-                    switch(funct3) {                                    \
-                    case 1: /* amiswap.w */                             \
-                        break;                                          \
-                    case 0: /* amoadd.w */                              \
-                        val2 = (int## size ## _t)(val + val2);          \
-                        break;                                          \
-                    case 4: /* amoxor.w */                              \
-                        val2 = (int## size ## _t)(val ^ val2);          \
-                        break;                                          \
-                    case 0xc: /* amoand.w */                            \
-                        val2 = (int## size ## _t)(val & val2);          \
-                        break;                                          \
-                    case 0x8: /* amoor.w */                             \
-                        val2 = (int## size ## _t)(val | val2);          \
-                        break;                                          \
-                    case 0x10: /* amomin.w */                           \
-                        if ((int## size ## _t)val < (int## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x14: /* amomax.w */                           \
-                        if ((int## size ## _t)val > (int## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x18: /* amominu.w */                          \
-                        if ((uint## size ## _t)val < (uint## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
-                        break;                                          \
-                    case 0x1c: /* amomaxu.w */                          \
-                        if ((uint## size ## _t)val > (uint## size ## _t)val2) \
-                            val2 = (int## size ## _t)val;               \
+                    for(;;) {                                           \
+                        val = (int## size ## _t)rval;                   \
+                        val2 = s->XREG[rs2];                             \
+                        switch(funct3) {                                \
+                        case 1: /* amiswap.w */                         \
+                            break;                                      \
+                        case 0: /* amoadd.w */                          \
+                            val2 = (int## size ## _t)(val + val2);      \
+                            break;                                      \
+                        case 4: /* amoxor.w */                          \
+                            val2 = (int## size ## _t)(val ^ val2);      \
+                            break;                                      \
+                        case 0xc: /* amoand.w */                        \
+                            val2 = (int## size ## _t)(val & val2);      \
+                            break;                                      \
+                        case 0x8: /* amoor.w */                         \
+                            val2 = (int## size ## _t)(val | val2);      \
+                            break;                                      \
+                        case 0x10: /* amomin.w */                       \
+                            if ((int## size ## _t)val < (int## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x14: /* amomax.w */                       \
+                            if ((int## size ## _t)val > (int## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x18: /* amominu.w */                      \
+                            if ((uint## size ## _t)val < (uint## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        case 0x1c: /* amomaxu.w */                      \
+                            if ((uint## size ## _t)val > (uint## size ## _t)val2) \
+                                val2 = (int## size ## _t)val;           \
+                            break;                                      \
+                        default:                                        \
+                            goto illegal_insn;                          \
+                        }                                               \
+                        if (s->io_lock) {                               \
+                            /* retry if another hart modified the value */ \
+                            uint ## size ##_t cur;                      \
+                            int ret;                                    \
+                            ret = target_cas_u ## size(s, addr, rval, val2, &cur); \
+                            if (ret < 0)                                \
+                                goto mmu_exception;                     \
+                            if (ret == 0) {                             \
+                                if (cur == rval)                        \
+                                    break;                              \
+                                rval = cur;                             \
+                                continue;                               \
+                            }                                           \
+                        }                                               \
+                        if (target_write_u ## size(s, addr, val2))      \
+                            goto mmu_exception;                         \
                         break;                                          \
-                    default:                                            \
-                        goto illegal_insn;                              \
                     }                                                   \
-                    if (target_write_u ## size(s, addr, val2))          \
-                        goto mmu_exception;                             \
                     break;                                              \
                 default:                                                \
                     goto illegal_insn;                                  \
@@ -1472,16 +2540,16 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             if (rd != 0)
-                s->reg[rd] = val;
+                s->XREG[rd] = val;
             NEXT_INSN;
 #if FLEN > 0
             /* FPU */
-        case 0x07: /* fp load */
+        case 0x07: OP_LABEL(op_07) /* fp load */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 12) & 7;
             imm = (int32_t)insn >> 20;
-            addr = s->reg[rs1] + imm;
+            addr = (intx_t)(s->XREG[rs1] + imm);
             switch(funct3) {
             case 2: /* flw */
                 {
@@ -1516,13 +2584,13 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x27: /* fp store */
+        case 0x27: OP_LABEL(op_27) /* fp store */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 12) & 7;
             imm = rd | ((insn >> (25 - 5)) & 0xfe0);
             imm = (imm << 20) >> 20;
-            addr = s->reg[rs1] + imm;
+            addr = (intx_t)(s->XREG[rs1] + imm);
             switch(funct3) {
             case 2: /* fsw */
                 if (target_write_u32(s, addr, s->fp_reg[rs2]))
@@ -1544,7 +2612,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
                 goto illegal_insn;
             }
             NEXT_INSN;
-        case 0x43: /* fmadd */
+        case 0x43: OP_LABEL(op_43) /* fmadd */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1574,7 +2642,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x47: /* fmsub */
+        case 0x47: OP_LABEL(op_47) /* fmsub */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1610,7 +2678,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x4b: /* fnmsub */
+        case 0x4b: OP_LABEL(op_4b) /* fnmsub */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1646,7 +2714,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x4f: /* fnmadd */
+        case 0x4f: OP_LABEL(op_4f) /* fnmadd */
             if (s->fs == 0)
                 goto illegal_insn;
             funct3 = (insn >> 25) & 3;
@@ -1682,7 +2750,7 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
             }
             s->fs = 3;
             NEXT_INSN;
-        case 0x53:
+        case 0x53: OP_LABEL(op_53)
             if (s->fs == 0)
                 goto illegal_insn;
             imm = insn >> 25;
@@ -1708,11 +2776,30 @@ static void no_inline glue(riscv_cpu_interp_x, XLEN)(RISCVCPUState *s,
         default:
             goto illegal_insn;
         }
+        continue;
+    branch_insn:
+        /* the code TLB is not looked up again if the target is in the
+           current page. The cycle count and the pending interrupts
+           are tested as at the start of a block. */
+        new_code_ptr = (uint8_t *)(uintptr_t)(s->pc - code_to_pc_addend);
+        if (likely((uintptr_t)(new_code_ptr - (code_end - (PG_MASK - 1))) <
+                   PG_MASK - 1 && s->n_cycles > 0 &&
+                   (s->mip & s->mie) == 0 && SAME_PAGE_JUMP_OK &&
+                   SAME_PAGE_DC_OK)) {
+            code_ptr = new_code_ptr;
+        } else {
+            code_ptr = NULL;
+            code_end = NULL;
+            code_to_pc_addend = s->pc;
+        }
         /* update PC for next instruction */
     jump_insn: ;
     } /* end of main loop */
  illegal_insn:
     s->pending_exception = CAUSE_ILLEGAL_INSTRUCTION;
+    /* only report the 16 bits of a compressed instruction */
+    if ((insn & 3) != 3)
+        insn &= 0xffff;
     s->pending_tval = insn;
  mmu_exception:
  exception:
@@ -1737,3 +2824,8 @@ the_end:
 #undef intx_t
 #undef XLEN
 #undef OP_A
+#undef SAME_PAGE_JUMP_OK
+#undef SAME_PAGE_DC_OK
+#undef XREG
+#undef ureg_t
+#undef sreg_t
@@ -0,0 +1,842 @@
+/*
+ * RISCV dynamic translator for x86-64 hosts
+ *
+ * Copyright (c) 2026 Fernando Lemos
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/*
+ * This file is included by riscv_cpu.c when MAX_XLEN <= 64. The
+ * translation units are the pre-decoded instructions of the decode
+ * cache: a block starts at a jump target and ends at the first jump,
+ * at the first DOP_LEGACY instruction or at the end of the page. The
+ * taken conditional branches leave the block. The generated code only
+ * runs when XLEN == MAX_XLEN.
+ *
+ * Host register usage: rbx contains the CPU state, rax, rcx and rdx
+ * are scratch registers. The RISC-V registers stay in
+ * RISCVCPUState.reg[]. The blocks do not depend on their virtual
+ * address: s->pc contains the address of the start of the block when
+ * it is called and the PC relative values are computed from it, so
+ * that all the virtual mappings of a page share the same code.
+ *
+ * A block returns 0 with s->pc set to the next instruction, or != 0
+ * if an exception is pending, in which case s->pc is the address of
+ * the faulting instruction. In both cases s->n_cycles is decremented
+ * by the number of executed instructions, as the interpreter does.
+ */
+#include <sys/mman.h>
+
+#define JIT_REXW (MAX_XLEN == 64) /* guest register width */
+
+#define OFS_PC offsetof(RISCVCPUState, pc)
+#define OFS_REG(r) (offsetof(RISCVCPUState, reg) + (r) * sizeof(target_ulong))
+#define OFS_N_CYCLES offsetof(RISCVCPUState, n_cycles)
+#define OFS_TLB(access) (offsetof(RISCVCPUState, tlb) + \
+                         (access) * sizeof(TLBEntry *))
+#define OFS_TLB_SET_MASK offsetof(RISCVCPUState, tlb_set_mask)
+#define OFS_TLB_DATA_CTX offsetof(RISCVCPUState, tlb_data_ctx)
+
+enum {
+    R_EAX,
+    R_ECX,
+    R_EDX,
+    R_EBX,
+    R_ESP,
+    R_EBP,
+    R_ESI,
+    R_EDI,
+};
+
+/* ALU opcodes (/r form, register destination) */
+#define OPC_ADD 0x03
+#define OPC_OR 0x0b
+#define OPC_AND 0x23
+#define OPC_SUB 0x2b
+#define OPC_XOR 0x33
+#define OPC_CMP 0x3b
+#define OPC_MOV_LOAD 0x8b
+#define OPC_MOV_STORE 0x89
+#define OPC_IMUL 0x0faf
+
+/* group 1 (immediate) and group 2 (shift) extensions */
+#define EXT_ADD 0
+#define EXT_OR 1
+#define EXT_AND 4
+#define EXT_SUB 5
+#define EXT_XOR 6
+#define EXT_CMP 7
+#define EXT_SHL 4
+#define EXT_SHR 5
+#define EXT_SAR 7
+
+/* condition codes */
+#define CC_B 0x2
+#define CC_AE 0x3
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_L 0xc
+#define CC_GE 0xd
+
+/* worst case size of the code generated for one instruction */
+#define JIT_INSN_SIZE_MAX 256
+#define JIT_BLOCK_SIZE_MAX (JIT_BLOCK_INSN_MAX * JIT_INSN_SIZE_MAX + 64)
+
+typedef int JITBlockFunc(RISCVCPUState *s);
+
+typedef struct {
+    uint8_t *ptr;
+} JITBuf;
+
+static inline void jit_emit8(JITBuf *b, int v)
+{
+    *b->ptr++ = v;
+}
+
+static inline void jit_emit32(JITBuf *b, uint32_t v)
+{
+    put_le32(b->ptr, v);
+    b->ptr += 4;
+}
+
+static inline void jit_emit64(JITBuf *b, uint64_t v)
+{
+    put_le32(b->ptr, v);
+    put_le32(b->ptr + 4, v >> 32);
+    b->ptr += 8;
+}
+
+static inline BOOL is_int8(int32_t v)
+{
+    return v == (int8_t)v;
+}
+
+static void jit_opc(JITBuf *b, BOOL rexw, int opc)
+{
+    if (rexw)
+        jit_emit8(b, 0x48);
+    if (opc > 0xff)
+        jit_emit8(b, opc >> 8);
+    jit_emit8(b, opc);
+}
+
+/* ModRM for [rbx + disp] */
+static void jit_modrm_state(JITBuf *b, int reg, int disp)
+{
+    if (is_int8(disp)) {
+        jit_emit8(b, 0x40 | (reg << 3) | R_EBX);
+        jit_emit8(b, disp);
+    } else {
+        jit_emit8(b, 0x80 | (reg << 3) | R_EBX);
+        jit_emit32(b, disp);
+    }
+}
+
+/* opc reg, [rbx + disp] */
+static void jit_op_state(JITBuf *b, BOOL rexw, int opc, int reg, int disp)
+{
+    jit_opc(b, rexw, opc);
+    jit_modrm_state(b, reg, disp);
+}
+
+/* opc reg, [rcx + disp] (TLB entries) */
+static void jit_op_tlb(JITBuf *b, BOOL rexw, int opc, int reg, int disp)
+{
+    jit_opc(b, rexw, opc);
+    jit_emit8(b, 0x40 | (reg << 3) | R_ECX);
+    jit_emit8(b, disp);
+}
+
+/* opc reg, rm */
+static void jit_op_rr(JITBuf *b, BOOL rexw, int opc, int reg, int rm)
+{
+    jit_opc(b, rexw, opc);
+    jit_emit8(b, 0xc0 | (reg << 3) | rm);
+}
+
+/* group 1 operation with an immediate on a register */
+static void jit_op_imm(JITBuf *b, BOOL rexw, int ext, int reg, int32_t imm)
+{
+    if (is_int8(imm)) {
+        jit_op_rr(b, rexw, 0x83, ext, reg);
+        jit_emit8(b, imm);
+    } else {
+        jit_op_rr(b, rexw, 0x81, ext, reg);
+        jit_emit32(b, imm);
+    }
+}
+
+/* group 1 operation with an immediate on [rbx + disp] */
+static void jit_op_state_imm(JITBuf *b, BOOL rexw, int ext, int disp,
+                             int32_t imm)
+{
+    if (is_int8(imm)) {
+        jit_op_state(b, rexw, 0x83, ext, disp);
+        jit_emit8(b, imm);
+    } else {
+        jit_op_state(b, rexw, 0x81, ext, disp);
+        jit_emit32(b, imm);
+    }
+}
+
+static void jit_shift_imm(JITBuf *b, BOOL rexw, int ext, int reg, int n)
+{
+    jit_op_rr(b, rexw, 0xc1, ext, reg);
+    jit_emit8(b, n);
+}
+
+/* shift by cl */
+static void jit_shift_cl(JITBuf *b, BOOL rexw, int ext, int reg)
+{
+    jit_op_rr(b, rexw, 0xd3, ext, reg);
+}
+
+static void jit_mov_imm(JITBuf *b, int reg, uint32_t imm)
+{
+    jit_emit8(b, 0xb8 + reg);
+    jit_emit32(b, imm);
+}
+
+/* sign extend eax to rax */
+static void jit_movsxd_eax(JITBuf *b)
+{
+    jit_op_rr(b, TRUE, 0x63, R_EAX, R_EAX);
+}
+
+/* set eax to 0 or 1 according to the condition */
+static void jit_setcc_eax(JITBuf *b, int cc)
+{
+    jit_emit8(b, 0x0f);
+    jit_emit8(b, 0x90 | cc);
+    jit_emit8(b, 0xc0);
+    jit_op_rr(b, FALSE, 0x0fb6, R_EAX, R_EAX);
+}
+
+/* emit a jump with a 32 bit displacement and return its address so
+   that it can be patched with jit_set_label() */
+static uint8_t *jit_jcc(JITBuf *b, int cc)
+{
+    jit_emit8(b, 0x0f);
+    jit_emit8(b, 0x80 | cc);
+    jit_emit32(b, 0);
+    return b->ptr - 4;
+}
+
+static uint8_t *jit_jmp(JITBuf *b)
+{
+    jit_emit8(b, 0xe9);
+    jit_emit32(b, 0);
+    return b->ptr - 4;
+}
+
+static void jit_set_label(JITBuf *b, uint8_t *p)
+{
+    put_le32(p, b->ptr - (p + 4));
+}
+
+static void jit_call(JITBuf *b, void *func)
+{
+    jit_emit8(b, 0x48); /* mov rax, func */
+    jit_emit8(b, 0xb8);
+    jit_emit64(b, (uintptr_t)func);
+    jit_emit8(b, 0xff); /* call rax */
+    jit_emit8(b, 0xd0);
+}
+
+static void jit_load_reg(JITBuf *b, int reg, int r)
+{
+    /* reg[0] is always zero in memory */
+    jit_op_state(b, JIT_REXW, OPC_MOV_LOAD, reg, OFS_REG(r));
+}
+
+static void jit_store_reg(JITBuf *b, int r, int reg)
+{
+    if (r != 0)
+        jit_op_state(b, JIT_REXW, OPC_MOV_STORE, reg, OFS_REG(r));
+}
+
+/* reg += val (guest width) */
+static void jit_add_imm(JITBuf *b, int reg, int64_t val)
+{
+    if (val == (int32_t)val) {
+        if (val != 0)
+            jit_op_imm(b, JIT_REXW, EXT_ADD, reg, val);
+    } else {
+        jit_op_imm(b, JIT_REXW, EXT_ADD, reg, (int32_t)(val >> 1));
+        jit_op_imm(b, JIT_REXW, EXT_ADD, reg, val - (int32_t)(val >> 1));
+    }
+}
+
+/* leave the block with s->pc += pc_delta, after 'n_insn' instructions */
+static void jit_exit(JITBuf *b, int64_t pc_delta, int n_insn, int ret)
+{
+    if (pc_delta != 0) {
+        if (pc_delta == (int32_t)pc_delta) {
+            jit_op_state_imm(b, JIT_REXW, EXT_ADD, OFS_PC, pc_delta);
+        } else {
+            jit_op_state(b, JIT_REXW, OPC_MOV_LOAD, R_EAX, OFS_PC);
+            jit_add_imm(b, R_EAX, pc_delta);
+            jit_op_state(b, JIT_REXW, OPC_MOV_STORE, R_EAX, OFS_PC);
+        }
+    }
+    jit_op_state_imm(b, FALSE, EXT_SUB, OFS_N_CYCLES, n_insn);
+    if (ret)
+        jit_mov_imm(b, R_EAX, ret);
+    else
+        jit_op_rr(b, FALSE, OPC_XOR, R_EAX, R_EAX);
+    jit_emit8(b, 0x5b); /* pop rbx */
+    jit_emit8(b, 0xc3); /* ret */
+}
+
+/* leave the block with s->pc = rax */
+static void jit_exit_indirect(JITBuf *b, int n_insn)
+{
+    jit_op_state(b, JIT_REXW, OPC_MOV_STORE, R_EAX, OFS_PC);
+    jit_exit(b, 0, n_insn, 0);
+}
+
+/* compare the virtual address in rax and the current context with
+   the way 0 entry of the TLB 'access'. Return the jump to patch for the TLB miss
+   case. Otherwise rcx is the address of the entry. */
+static uint8_t *jit_tlb_lookup(JITBuf *b, int access, int size_log2)
+{
+    jit_op_rr(b, FALSE, OPC_MOV_STORE, R_EAX, R_ECX);
+    jit_shift_imm(b, FALSE, EXT_SHR, R_ECX, PG_SHIFT);
+    jit_op_state(b, FALSE, OPC_AND, R_ECX, OFS_TLB_SET_MASK);
+    jit_shift_imm(b, FALSE, EXT_SHL, R_ECX, ctz32(sizeof(TLBEntry)));
+    jit_op_state(b, TRUE, OPC_ADD, R_ECX, OFS_TLB(access));
+    jit_op_rr(b, JIT_REXW, OPC_MOV_STORE, R_EAX, R_EDX);
+    jit_op_imm(b, JIT_REXW, EXT_AND, R_EDX,
+               ~(PG_MASK & ~((1 << size_log2) - 1)));
+    jit_op_state(b, JIT_REXW, OPC_OR, R_EDX, OFS_TLB_DATA_CTX);
+    jit_op_tlb(b, JIT_REXW, OPC_CMP, R_EDX, offsetof(TLBEntry, vaddr));
+    return jit_jcc(b, CC_NE);
+}
+
+/* rax = host address of the access */
+static void jit_tlb_addend(JITBuf *b)
+{
+    jit_op_tlb(b, TRUE, OPC_ADD, R_EAX, offsetof(TLBEntry, mem_addend));
+}
+
+static int jit_load_size_log2(int op)
+{
+    switch(op) {
+    case DOP_LB:
+    case DOP_LBU:
+        return 0;
+    case DOP_LH:
+    case DOP_LHU:
+        return 1;
+    case DOP_LW:
+    case DOP_LWU:
+        return 2;
+    default:
+        return 3;
+    }
+}
+
+/* slow path of the loads. 'info' contains the DOP_x value and the
+   destination register */
+static int jit_read_slow(RISCVCPUState *s, target_ulong addr, uint32_t info)
+{
+    mem_uint_t val;
+    int op, rd;
+
+    op = info >> 8;
+    rd = info & 0x1f;
+    if (target_read_slow(s, &val, addr, jit_load_size_log2(op)))
+        return -1;
+    switch(op) {
+    case DOP_LB:
+        s->reg[rd] = (int8_t)val;
+        break;
+    case DOP_LH:
+        s->reg[rd] = (int16_t)val;
+        break;
+    case DOP_LW:
+        s->reg[rd] = (int32_t)val;
+        break;
+    case DOP_LBU:
+        s->reg[rd] = (uint8_t)val;
+        break;
+    case DOP_LHU:
+        s->reg[rd] = (uint16_t)val;
+        break;
+#if MAX_XLEN >= 64
+    case DOP_LWU:
+        s->reg[rd] = (uint32_t)val;
+        break;
+    case DOP_LD:
+        s->reg[rd] = (uint64_t)val;
+        break;
+#endif
+    default:
+        abort();
+    }
+    return 0;
+}
+
+static void jit_gen_load(JITBuf *b, DecodedInsn *d, int op,
+                         int pc_delta, int n_insn)
+{
+    uint8_t *label_slow, *label_done, *label_ok;
+    int size_log2;
+
+    size_log2 = jit_load_size_log2(op);
+    jit_load_reg(b, R_EAX, d->rs1);
+    jit_add_imm(b, R_EAX, d->imm);
+    label_slow = jit_tlb_lookup(b, ACCESS_READ, size_log2);
+    jit_tlb_addend(b);
+    switch(op) {
+    case DOP_LB:
+        jit_opc(b, JIT_REXW, 0x0fbe);
+        break;
+    case DOP_LH:
+        jit_opc(b, JIT_REXW, 0x0fbf);
+        break;
+    case DOP_LW:
+        if (MAX_XLEN == 64)
+            jit_opc(b, TRUE, 0x63);
+        else
+            jit_opc(b, FALSE, OPC_MOV_LOAD);
+        break;
+    case DOP_LBU:
+        jit_opc(b, FALSE, 0x0fb6);
+        break;
+    case DOP_LHU:
+        jit_opc(b, FALSE, 0x0fb7);
+        break;
+    case DOP_LWU:
+        jit_opc(b, FALSE, OPC_MOV_LOAD);
+        break;
+    default:
+        jit_opc(b, TRUE, OPC_MOV_LOAD);
+        break;
+    }
+    jit_emit8(b, (R_EAX << 3) | R_EAX); /* [rax] */
+    jit_store_reg(b, d->rd, R_EAX);
+    label_done = jit_jmp(b);
+
+    jit_set_label(b, label_slow);
+    jit_op_rr(b, TRUE, OPC_MOV_STORE, R_EBX, R_EDI);
+    jit_op_rr(b, TRUE, OPC_MOV_STORE, R_EAX, R_ESI);
+    jit_mov_imm(b, R_EDX, (op << 8) | d->rd);
+    jit_call(b, jit_read_slow);
+    jit_op_rr(b, FALSE, 0x85, R_EAX, R_EAX); /* test eax, eax */
+    label_ok = jit_jcc(b, CC_E);
+    jit_exit(b, pc_delta, n_insn, 1);
+    jit_set_label(b, label_ok);
+    jit_set_label(b, label_done);
+}
+
+/* A store which does not hit the TLB ends the block: it may have
+   modified the code of the current page or an interrupt may now be
+   pending. */
+static void jit_gen_store(JITBuf *b, DecodedInsn *d, int size_log2,
+                          int pc_delta, int len, int n_insn)
+{
+    uint8_t *label_slow, *label_done, *label_ok;
+
+    jit_load_reg(b, R_EAX, d->rs1);
+    jit_add_imm(b, R_EAX, d->imm);
+    label_slow = jit_tlb_lookup(b, ACCESS_WRITE, size_log2);
+    jit_tlb_addend(b);
+    jit_load_reg(b, R_EDX, d->rs2);
+    if (size_log2 == 1)
+        jit_emit8(b, 0x66);
+    jit_opc(b, size_log2 == 3, size_log2 == 0 ? 0x88 : OPC_MOV_STORE);
+    jit_emit8(b, (R_EDX << 3) | R_EAX); /* [rax] */
+    label_done = jit_jmp(b);
+
+    jit_set_label(b, label_slow);
+    jit_load_reg(b, R_EDX, d->rs2);
+    jit_op_rr(b, TRUE, OPC_MOV_STORE, R_EBX, R_EDI);
+    jit_op_rr(b, TRUE, OPC_MOV_STORE, R_EAX, R_ESI);
+    jit_mov_imm(b, R_ECX, size_log2);
+    jit_call(b, target_write_slow);
+    jit_op_rr(b, FALSE, 0x85, R_EAX, R_EAX); /* test eax, eax */
+    label_ok = jit_jcc(b, CC_E);
+    jit_exit(b, pc_delta, n_insn, 1);
+    jit_set_label(b, label_ok);
+    jit_exit(b, pc_delta + len, n_insn, 0);
+    jit_set_label(b, label_done);
+}
+
+/* rd = rs1 op rs2 */
+static void jit_gen_alu(JITBuf *b, DecodedInsn *d, BOOL rexw, int opc)
+{
+    jit_load_reg(b, R_EAX, d->rs1);
+    jit_op_state(b, rexw, opc, R_EAX, OFS_REG(d->rs2));
+    if (!rexw && JIT_REXW)
+        jit_movsxd_eax(b);
+    jit_store_reg(b, d->rd, R_EAX);
+}
+
+/* rd = rs1 shift rs2 */
+static void jit_gen_shift(JITBuf *b, DecodedInsn *d, BOOL rexw, int ext)
+{
+    jit_load_reg(b, R_ECX, d->rs2);
+    jit_load_reg(b, R_EAX, d->rs1);
+    jit_shift_cl(b, rexw, ext, R_EAX);
+    if (!rexw && JIT_REXW)
+        jit_movsxd_eax(b);
+    jit_store_reg(b, d->rd, R_EAX);
+}
+
+/* rd = rs1 op imm */
+static void jit_gen_alu_imm(JITBuf *b, DecodedInsn *d, BOOL rexw, int ext)
+{
+    jit_load_reg(b, R_EAX, d->rs1);
+    jit_op_imm(b, rexw, ext, R_EAX, d->imm);
+    if (!rexw && JIT_REXW)
+        jit_movsxd_eax(b);
+    jit_store_reg(b, d->rd, R_EAX);
+}
+
+/* rd = rs1 shift imm */
+static void jit_gen_shift_imm(JITBuf *b, DecodedInsn *d, BOOL rexw, int ext)
+{
+    jit_load_reg(b, R_EAX, d->rs1);
+    if (d->imm != 0)
+        jit_shift_imm(b, rexw, ext, R_EAX, d->imm);
+    if (!rexw && JIT_REXW)
+        jit_movsxd_eax(b);
+    jit_store_reg(b, d->rd, R_EAX);
+}
+
+/* rd = pc + delta */
+static void jit_gen_pc_rel(JITBuf *b, int rd, int64_t delta)
+{
+    if (rd != 0) {
+        jit_op_state(b, JIT_REXW, OPC_MOV_LOAD, R_ECX, OFS_PC);
+        jit_add_imm(b, R_ECX, delta);
+        jit_store_reg(b, rd, R_ECX);
+    }
+}
+
+
+/* generate the code of one instruction. 'pc_delta' is its offset
+   from the start of the block and 'n_insn' the number of executed
+   instructions including this one. Return TRUE if it ends the
+   block. */
+static BOOL jit_gen_insn(JITBuf *b, DecodedInsn *d, int pc_delta, int n_insn)
+{
+    int op, len, cc;
+    uint8_t *label;
+
+    op = d->op >> 1;
+    len = (d->op & 1) ? 2 : 4;
+    switch(op) {
+    case DOP_NOP:
+        break;
+    case DOP_LI:
+        if (d->rd != 0) {
+            /* mov [rbx + reg], imm (sign extended) */
+            jit_op_state(b, JIT_REXW, 0xc7, 0, OFS_REG(d->rd));
+            jit_emit32(b, d->imm);
+        }
+        break;
+    case DOP_AUIPC:
+        jit_gen_pc_rel(b, d->rd, (int64_t)pc_delta + d->imm);
+        break;
+    case DOP_JAL:
+        jit_gen_pc_rel(b, d->rd, pc_delta + len);
+        jit_exit(b, (int64_t)pc_delta + d->imm, n_insn, 0);
+        return TRUE;
+    case DOP_JALR:
+    case DOP_CJALR:
+        jit_load_reg(b, R_EAX, d->rs1);
+        if (op == DOP_JALR)
+            jit_add_imm(b, R_EAX, d->imm);
+        jit_op_imm(b, JIT_REXW, EXT_AND, R_EAX, ~1);
+        jit_gen_pc_rel(b, d->rd, pc_delta + len);
+        jit_exit_indirect(b, n_insn);
+        return TRUE;
+    case DOP_BEQ:
+    case DOP_BNE:
+    case DOP_BLT:
+    case DOP_BGE:
+    case DOP_BLTU:
+    case DOP_BGEU:
+        switch(op) {
+        case DOP_BEQ:
+            cc = CC_E;
+            break;
+        case DOP_BNE:
+            cc = CC_NE;
+            break;
+        case DOP_BLT:
+            cc = CC_L;
+            break;
+        case DOP_BGE:
+            cc = CC_GE;
+            break;
+        case DOP_BLTU:
+            cc = CC_B;
+            break;
+        default:
+            cc = CC_AE;
+            break;
+        }
+        jit_load_reg(b, R_EAX, d->rs1);
+        jit_op_state(b, JIT_REXW, OPC_CMP, R_EAX, OFS_REG(d->rs2));
+        /* the inverted condition skips the exit */
+        label = jit_jcc(b, cc ^ 1);
+        jit_exit(b, (int64_t)pc_delta + d->imm, n_insn, 0);
+        jit_set_label(b, label);
+        break;
+    case DOP_LB:
+    case DOP_LH:
+    case DOP_LW:
+    case DOP_LBU:
+    case DOP_LHU:
+#if MAX_XLEN >= 64
+    case DOP_LD:
+    case DOP_LWU:
+#endif
+        jit_gen_load(b, d, op, pc_delta, n_insn);
+        break;
+    case DOP_SB:
+        jit_gen_store(b, d, 0, pc_delta, len, n_insn);
+        break;
+    case DOP_SH:
+        jit_gen_store(b, d, 1, pc_delta, len, n_insn);
+        break;
+    case DOP_SW:
+        jit_gen_store(b, d, 2, pc_delta, len, n_insn);
+        break;
+#if MAX_XLEN >= 64
+    case DOP_SD:
+        jit_gen_store(b, d, 3, pc_delta, len, n_insn);
+        break;
+#endif
+    case DOP_ADDI:
+        jit_load_reg(b, R_EAX, d->rs1);
+        jit_add_imm(b, R_EAX, d->imm);
+        jit_store_reg(b, d->rd, R_EAX);
+        break;
+    case DOP_SLTI:
+    case DOP_SLTIU:
+        jit_load_reg(b, R_EAX, d->rs1);
+        jit_op_imm(b, JIT_REXW, EXT_CMP, R_EAX, d->imm);
+        jit_setcc_eax(b, op == DOP_SLTI ? CC_L : CC_B);
+        jit_store_reg(b, d->rd, R_EAX);
+        break;
+    case DOP_XORI:
+        jit_gen_alu_imm(b, d, JIT_REXW, EXT_XOR);
+        break;
+    case DOP_ORI:
+        jit_gen_alu_imm(b, d, JIT_REXW, EXT_OR);
+        break;
+    case DOP_ANDI:
+        jit_gen_alu_imm(b, d, JIT_REXW, EXT_AND);
+        break;
+    case DOP_SLLI:
+        jit_gen_shift_imm(b, d, JIT_REXW, EXT_SHL);
+        break;
+    case DOP_SRLI:
+        jit_gen_shift_imm(b, d, JIT_REXW, EXT_SHR);
+        break;
+    case DOP_SRAI:
+        jit_gen_shift_imm(b, d, JIT_REXW, EXT_SAR);
+        break;
+    case DOP_ADD:
+        jit_gen_alu(b, d, JIT_REXW, OPC_ADD);
+        break;
+    case DOP_SUB:
+        jit_gen_alu(b, d, JIT_REXW, OPC_SUB);
+        break;
+    case DOP_SLL:
+        jit_gen_shift(b, d, JIT_REXW, EXT_SHL);
+        break;
+    case DOP_SLT:
+    case DOP_SLTU:
+        jit_load_reg(b, R_EAX, d->rs1);
+        jit_op_state(b, JIT_REXW, OPC_CMP, R_EAX, OFS_REG(d->rs2));
+        jit_setcc_eax(b, op == DOP_SLT ? CC_L : CC_B);
+        jit_store_reg(b, d->rd, R_EAX);
+        break;
+    case DOP_XOR:
+        jit_gen_alu(b, d, JIT_REXW, OPC_XOR);
+        break;
+    case DOP_SRL:
+        jit_gen_shift(b, d, JIT_REXW, EXT_SHR);
+        break;
+    case DOP_SRA:
+        jit_gen_shift(b, d, JIT_REXW, EXT_SAR);
+        break;
+    case DOP_OR:
+        jit_gen_alu(b, d, JIT_REXW, OPC_OR);
+        break;
+    case DOP_AND:
+        jit_gen_alu(b, d, JIT_REXW, OPC_AND);
+        break;
+    case DOP_MUL:
+        jit_gen_alu(b, d, JIT_REXW, OPC_IMUL);
+        break;
+#if MAX_XLEN >= 64
+    case DOP_ADDIW:
+        jit_gen_alu_imm(b, d, FALSE, EXT_ADD);
+        break;
+    case DOP_SLLIW:
+        jit_gen_shift_imm(b, d, FALSE, EXT_SHL);
+        break;
+    case DOP_SRLIW:
+        jit_gen_shift_imm(b, d, FALSE, EXT_SHR);
+        break;
+    case DOP_SRAIW:
+        jit_gen_shift_imm(b, d, FALSE, EXT_SAR);
+        break;
+    case DOP_ADDW:
+        jit_gen_alu(b, d, FALSE, OPC_ADD);
+        break;
+    case DOP_SUBW:
+        jit_gen_alu(b, d, FALSE, OPC_SUB);
+        break;
+    case DOP_SLLW:
+        jit_gen_shift(b, d, FALSE, EXT_SHL);
+        break;
+    case DOP_SRLW:
+        jit_gen_shift(b, d, FALSE, EXT_SHR);
+        break;
+    case DOP_SRAW:
+        jit_gen_shift(b, d, FALSE, EXT_SAR);
+        break;
+    case DOP_MULW:
+        jit_gen_alu(b, d, FALSE, OPC_IMUL);
+        break;
+#endif
+    default:
+        abort();
+    }
+    return FALSE;
+}
+
+static void jit_invalidate_page(DecodedPage *p)
+{
+    if (p->jit_entry)
+        memset(p->jit_entry, 0, sizeof(p->jit_entry[0]) << (PG_SHIFT - 1));
+}
+
+static void jit_flush_all(RISCVCPUState *s)
+{
+    int i;
+    for(i = 0; i < s->dc_page_alloc; i++)
+        jit_invalidate_page(s->dc_pages[i]);
+    s->jit_code_size = JIT_CODE_ALIGN;
+}
+
+static void glue(dc_decode_block, MAX_XLEN)(DecodedPage *p, uint8_t *code_ptr);
+
+/* translate the block starting at 'code_ptr'. Return NULL if its
+   first instruction must be executed by the interpreter. */
+static no_inline JITBlockFunc *jit_compile(RISCVCPUState *s, DecodedPage *p,
+                                           uint8_t *code_ptr)
+{
+    JITBuf b_s, *b = &b_s;
+    DecodedInsn *d;
+    int start, offset, n_insn;
+    uint8_t *code_start;
+
+    start = code_ptr - p->mem_ptr;
+    if (!p->jit_entry) {
+        p->jit_entry = mallocz(sizeof(p->jit_entry[0]) << (PG_SHIFT - 1));
+    }
+    d = &p->insn[start >> 1];
+    if (d->op == DOP_NONE)
+        glue(dc_decode_block, MAX_XLEN)(p, code_ptr);
+    if ((d->op >> 1) == DOP_LEGACY) {
+        p->jit_entry[start >> 1] = JIT_ENTRY_INTERP;
+        return NULL;
+    }
+
+    if (s->jit_code_size + JIT_BLOCK_SIZE_MAX > JIT_CODE_SIZE)
+        jit_flush_all(s);
+    code_start = s->jit_code_buf + s->jit_code_size;
+    b->ptr = code_start;
+    jit_emit8(b, 0x53); /* push rbx */
+    jit_op_rr(b, TRUE, OPC_MOV_STORE, R_EDI, R_EBX);
+
+    offset = start;
+    n_insn = 0;
+    for(;;) {
+        /* an instruction at the last 16 bit parcel of the page is
+           always executed by the interpreter */
+        if (offset >= PG_MASK - 1 || n_insn >= JIT_BLOCK_INSN_MAX) {
+            jit_exit(b, offset - start, n_insn, 0);
+            break;
+        }
+        d = &p->insn[offset >> 1];
+        if (d->op == DOP_NONE)
+            glue(dc_decode_block, MAX_XLEN)(p, p->mem_ptr + offset);
+        if ((d->op >> 1) == DOP_LEGACY) {
+            jit_exit(b, offset - start, n_insn, 0);
+            break;
+        }
+        n_insn++;
+        if (jit_gen_insn(b, d, offset - start, n_insn))
+            break;
+        offset += (d->op & 1) ? 2 : 4;
+    }
+
+    s->jit_code_size = (b->ptr - s->jit_code_buf + JIT_CODE_ALIGN - 1) &
+        ~(JIT_CODE_ALIGN - 1);
+    p->jit_entry[start >> 1] = code_start - s->jit_code_buf;
+    return (JITBlockFunc *)code_start;
+}
+
+/* return the translated block starting at 'code_ptr' or NULL if the
+   interpreter must be used */
+static inline JITBlockFunc *jit_get_block(RISCVCPUState *s, DecodedPage *p,
+                                          uint8_t *code_ptr)
+{
+    uint32_t ofs;
+    if (likely(p->jit_entry != NULL)) {
+        ofs = p->jit_entry[(code_ptr - p->mem_ptr) >> 1];
+        if (likely(ofs >= JIT_CODE_ALIGN))
+            return (JITBlockFunc *)(s->jit_code_buf + ofs);
+        if (ofs == JIT_ENTRY_INTERP)
+            return NULL;
+    }
+    return jit_compile(s, p, code_ptr);
+}
+
+static int jit_init(RISCVCPUState *s)
+{
+    void *ptr;
+
+    ptr = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+        return -1;
+    s->jit_code_buf = ptr;
+    jit_flush_all(s);
+    return 0;
+}
+
+static void jit_end(RISCVCPUState *s)
+{
+    int i;
+    for(i = 0; i < s->dc_page_alloc; i++)
+        free(s->dc_pages[i]->jit_entry);
+    if (s->jit_code_buf)
+        munmap(s->jit_code_buf, JIT_CODE_SIZE);
+}
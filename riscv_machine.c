@@ -31,6 +31,10 @@
 #include <errno.h>
 #include <unistd.h>
 #include <time.h>
+#ifdef CONFIG_RISCV_SMP
+#include <pthread.h>
+#include <sched.h>
+#endif
 
 #include "cutils.h"
 #include "iomem.h"
@@ -42,27 +46,70 @@
 
 /* RISCV machine */
 
-typedef struct RISCVMachine {
+#define RISCV_HART_MAX 16
+#define VIRTIO_DEV_MAX 16
+
+/* requests sent to a hart by the other ones */
+#define HART_FLUSH_TLB    (1 << 0)
+#define HART_FLUSH_ICACHE (1 << 1)
+
+#define PLIC_NUM_SOURCES 1024 /* source 0 is not used */
+#define PLIC_CONTEXT_MAX (2 * RISCV_HART_MAX)
+#define PLIC_PRIORITY_MASK 7
+
+typedef struct RISCVMachine RISCVMachine;
+
+typedef struct {
+    RISCVMachine *machine;
+    RISCVCPUState *cpu_state;
+    int hartid;
+    uint64_t timecmp;
+    BOOL stopped; /* waiting for the SBI hart_start call */
+#ifdef CONFIG_RISCV_SMP
+    pthread_t thread;
+    pthread_mutex_t wait_lock;
+    pthread_cond_t wait_cond; /* signaled when the hart must wake up */
+    int flush_request; /* HART_FLUSH_x */
+#endif
+} RISCVHart;
+
+struct RISCVMachine {
     VirtMachine common;
     PhysMemoryMap *mem_map;
     int max_xlen;
-    RISCVCPUState *cpu_state;
+    /* with several harts, each one runs in its own thread */
+    int hart_count;
+    RISCVHart hart[RISCV_HART_MAX];
+#ifdef CONFIG_RISCV_SMP
+    pthread_mutex_t io_lock; /* devices and console */
+    BOOL exit_request;
+#endif
     uint64_t ram_size;
+    PhysMemoryRange *ram_range;
     /* RTC */
     BOOL rtc_real_time;
     uint64_t rtc_start_time;
-    uint64_t timecmp;
+    uint64_t rtc_fork_time; /* RTC time in virt_machine_fork_prepare() */
+    BOOL rtc_warp;
+    uint64_t rtc_warp_time; /* idle time skipped by the warp mode */
     /* PLIC */
-    uint32_t plic_pending_irq, plic_served_irq;
-    IRQSignal plic_irq[32]; /* IRQ 0 is not used */
+    uint32_t plic_pending[PLIC_NUM_SOURCES / 32]; /* level of the sources */
+    uint32_t plic_claimed[PLIC_NUM_SOURCES / 32]; /* claimed, not completed */
+    uint32_t plic_enable[PLIC_CONTEXT_MAX][PLIC_NUM_SOURCES / 32];
+    uint8_t plic_priority[PLIC_NUM_SOURCES];
+    uint8_t plic_threshold[PLIC_CONTEXT_MAX];
+    IRQSignal plic_irq[PLIC_NUM_SOURCES]; /* IRQ 0 is not used */
     /* HTIF */
     uint64_t htif_tohost, htif_fromhost;
+    BOOL tlb_stats;
+    BOOL host_sbi; /* SBI implemented by riscv_sbi_call() */
 
     VIRTIODevice *keyboard_dev;
     VIRTIODevice *mouse_dev;
 
     int virtio_count;
-} RISCVMachine;
+    VIRTIODevice *virtio_dev[VIRTIO_DEV_MAX];
+};
 
 #define LOW_RAM_SIZE   0x00010000 /* 64KB */
 #define RAM_BASE_ADDR  0x80000000
@@ -75,6 +122,12 @@ typedef struct RISCVMachine {
 #define PLIC_BASE_ADDR 0x40100000
 #define PLIC_SIZE      0x00400000
 #define FRAMEBUFFER_BASE_ADDR 0x41000000
+/* host SBI: start address and opaque value of each hart (16 bytes) */
+#define HART_START_ADDR 0x400
+
+/* HTIF device of the fork server (device 0 is the syscall proxy and
+   device 1 the console) */
+#define HTIF_DEV_FORK 2
 
 #define RTC_FREQ 10000000
 #define RTC_FREQ_DIV 16 /* arbitrary, relative to CPU freq to have a
@@ -94,12 +147,100 @@ static uint64_t rtc_get_time(RISCVMachine *m)
     if (m->rtc_real_time) {
         val = rtc_get_real_time(m) - m->rtc_start_time;
     } else {
-        val = riscv_cpu_get_cycles(m->cpu_state) / RTC_FREQ_DIV;
+        val = riscv_cpu_get_cycles(m->hart[0].cpu_state) / RTC_FREQ_DIV +
+            m->rtc_warp_time;
     }
     //    printf("rtc_time=%" PRId64 "\n", val);
     return val;
 }
 
+/* value of the 'time' CSR */
+static uint64_t riscv_rdtime(void *opaque)
+{
+    RISCVMachine *m = opaque;
+    return rtc_get_time(m);
+}
+
+/* taken around the device and console accesses when several harts
+   run in parallel */
+static void riscv_io_lock(void *opaque, BOOL lock)
+{
+#ifdef CONFIG_RISCV_SMP
+    RISCVMachine *m = opaque;
+    if (m->hart_count > 1) {
+        if (lock)
+            pthread_mutex_lock(&m->io_lock);
+        else
+            pthread_mutex_unlock(&m->io_lock);
+    }
+#endif
+}
+
+/* wake up the thread of the hart so that it handles a new interrupt,
+   a flush request or a timer change */
+static void riscv_hart_kick(RISCVHart *h)
+{
+#ifdef CONFIG_RISCV_SMP
+    if (h->machine->hart_count > 1) {
+        pthread_mutex_lock(&h->wait_lock);
+        pthread_cond_signal(&h->wait_cond);
+        pthread_mutex_unlock(&h->wait_lock);
+    }
+#endif
+}
+
+static void riscv_hart_set_mip(RISCVHart *h, uint32_t mask)
+{
+    riscv_cpu_set_mip(h->cpu_state, mask);
+    riscv_hart_kick(h);
+}
+
+/* Flush the TLB or the instruction cache of 'h1' as requested by 'h',
+   which can be the same hart. The flush is done when the function
+   returns. */
+static void riscv_hart_flush(RISCVHart *h, RISCVHart *h1, int flags)
+{
+    if (h1 == h) {
+        if (flags & HART_FLUSH_TLB)
+            riscv_cpu_flush_tlb(h->cpu_state);
+        if (flags & HART_FLUSH_ICACHE)
+            riscv_cpu_flush_icache(h->cpu_state);
+    }
+#ifdef CONFIG_RISCV_SMP
+    else {
+        __atomic_fetch_or(&h1->flush_request, flags, __ATOMIC_SEQ_CST);
+        riscv_hart_kick(h1);
+    }
+#endif
+}
+
+#ifdef CONFIG_RISCV_SMP
+/* handle the flushes requested by the other harts */
+static void riscv_hart_handle_flush(RISCVHart *h)
+{
+    int flags;
+
+    flags = __atomic_load_n(&h->flush_request, __ATOMIC_SEQ_CST);
+    if (flags) {
+        riscv_hart_flush(h, h, flags);
+        /* the requesting harts wait until the bits are cleared */
+        __atomic_fetch_and(&h->flush_request, ~flags, __ATOMIC_SEQ_CST);
+    }
+}
+
+/* wait until the flushes requested to 'h1' by riscv_hart_flush() are
+   done */
+static void riscv_hart_flush_wait(RISCVHart *h, RISCVHart *h1, int flags)
+{
+    while (h1 != h && !h->machine->exit_request &&
+           (__atomic_load_n(&h1->flush_request, __ATOMIC_SEQ_CST) & flags)) {
+        /* 'h1' may be waiting for a flush of 'h' */
+        riscv_hart_handle_flush(h);
+        sched_yield();
+    }
+}
+#endif
+
 static uint32_t htif_read(void *opaque, uint32_t offset,
                           int size_log2)
 {
@@ -127,6 +268,24 @@ static uint32_t htif_read(void *opaque, uint32_t offset,
     return val;
 }
 
+static void riscv_power_off(RISCVMachine *s)
+{
+    int i;
+
+    printf("\nPower off.\n");
+    if (s->tlb_stats) {
+        for(i = 0; i < s->hart_count; i++) {
+            if (s->hart_count > 1)
+                fprintf(stderr, "hart %d:\n", i);
+            riscv_cpu_dump_tlb_stats(s->hart[i].cpu_state);
+        }
+        fprintf(stderr, "RAM: resident=%" PRIu64 " KB configured=%" PRIu64
+                " KB\n", phys_mem_get_resident_size(s->ram_range) >> 10,
+                s->ram_size >> 10);
+    }
+    exit(0);
+}
+
 static void htif_handle_cmd(RISCVMachine *s)
 {
     uint32_t device, cmd;
@@ -135,8 +294,7 @@ static void htif_handle_cmd(RISCVMachine *s)
     cmd = (s->htif_tohost >> 48) & 0xff;
     if (s->htif_tohost == 1) {
         /* shuthost */
-        printf("\nPower off.\n");
-        exit(0);
+        riscv_power_off(s);
     } else if (device == 1 && cmd == 1) {
         uint8_t buf[1];
         buf[0] = s->htif_tohost & 0xff;
@@ -146,6 +304,11 @@ static void htif_handle_cmd(RISCVMachine *s)
     } else if (device == 1 && cmd == 0) {
         /* request keyboard interrupt */
         s->htif_tohost = 0;
+    } else if (device == HTIF_DEV_FORK && cmd == 0) {
+        /* the guest is ready to be cloned. It then waits until
+           'fromhost' is set to the clone number (0 if not cloned). */
+        s->htif_tohost = 0;
+        s->common.fork_ready = TRUE;
     } else {
         printf("HTIF: unsupported tohost=0x%016" PRIx64 "\n", s->htif_tohost);
     }
@@ -193,28 +356,298 @@ static void htif_poll(RISCVMachine *s)
 }
 #endif
 
+/* SBI (v0.3 base, TIME, IPI, RFENCE, HSM, SRST and legacy extensions)
+   for the kernels booted without firmware. The timer uses Sstc. */
+
+#define SBI_EXT_0_1_SET_TIMER              0x0
+#define SBI_EXT_0_1_CONSOLE_PUTCHAR        0x1
+#define SBI_EXT_0_1_CONSOLE_GETCHAR        0x2
+#define SBI_EXT_0_1_CLEAR_IPI              0x3
+#define SBI_EXT_0_1_SEND_IPI               0x4
+#define SBI_EXT_0_1_REMOTE_FENCE_I         0x5
+#define SBI_EXT_0_1_REMOTE_SFENCE_VMA      0x6
+#define SBI_EXT_0_1_REMOTE_SFENCE_VMA_ASID 0x7
+#define SBI_EXT_0_1_SHUTDOWN               0x8
+#define SBI_EXT_BASE                       0x10
+#define SBI_EXT_TIME                       0x54494d45
+#define SBI_EXT_IPI                        0x735049
+#define SBI_EXT_RFENCE                     0x52464e43
+#define SBI_EXT_HSM                        0x48534d
+#define SBI_EXT_SRST                       0x53525354
+
+#define SBI_SUCCESS                0
+#define SBI_ERR_FAILED             -1
+#define SBI_ERR_NOT_SUPPORTED      -2
+#define SBI_ERR_INVALID_PARAM      -3
+#define SBI_ERR_ALREADY_AVAILABLE  -6
+
+#define SBI_SPEC_VERSION  ((0 << 24) | 3)
+#define SBI_IMPL_ID       0x54454d55 /* not registered */
+#define SBI_IMPL_VERSION  1
+
+static BOOL sbi_probe_extension(uint64_t eid)
+{
+    switch(eid) {
+    case SBI_EXT_0_1_SET_TIMER ... SBI_EXT_0_1_SHUTDOWN:
+    case SBI_EXT_BASE:
+    case SBI_EXT_TIME:
+    case SBI_EXT_IPI:
+    case SBI_EXT_RFENCE:
+    case SBI_EXT_HSM:
+    case SBI_EXT_SRST:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* return TRUE if 'hartid' is selected by the hart mask */
+static BOOL sbi_hart_selected(int xlen, uint64_t hart_mask,
+                              uint64_t hart_mask_base, int hartid)
+{
+    if (hart_mask_base == (UINT64_MAX >> (64 - xlen)))
+        return TRUE; /* all the harts */
+    return hartid >= hart_mask_base && hartid - hart_mask_base < xlen &&
+        ((hart_mask >> (hartid - hart_mask_base)) & 1);
+}
+
+static void sbi_send_ipi(RISCVHart *h, int xlen, uint64_t hart_mask,
+                         uint64_t hart_mask_base)
+{
+    RISCVMachine *m = h->machine;
+    int i;
+
+    for(i = 0; i < m->hart_count; i++) {
+        if (sbi_hart_selected(xlen, hart_mask, hart_mask_base, i))
+            riscv_hart_set_mip(&m->hart[i], MIP_SSIP);
+    }
+}
+
+/* the whole TLB is flushed whatever the range */
+static void sbi_remote_flush(RISCVHart *h, int xlen, uint64_t hart_mask,
+                             uint64_t hart_mask_base, int flags)
+{
+    RISCVMachine *m = h->machine;
+    int i;
+
+    for(i = 0; i < m->hart_count; i++) {
+        if (sbi_hart_selected(xlen, hart_mask, hart_mask_base, i))
+            riscv_hart_flush(h, &m->hart[i], flags);
+    }
+#ifdef CONFIG_RISCV_SMP
+    for(i = 0; i < m->hart_count; i++) {
+        if (sbi_hart_selected(xlen, hart_mask, hart_mask_base, i))
+            riscv_hart_flush_wait(h, &m->hart[i], flags);
+    }
+#endif
+}
+
+/* the hart executes the boot ROM which jumps to 'start_addr' */
+static int sbi_hart_start(RISCVHart *h, uint64_t start_addr, uint64_t opaque)
+{
+    int err;
+
+    err = SBI_ERR_ALREADY_AVAILABLE;
+#ifdef CONFIG_RISCV_SMP
+    pthread_mutex_lock(&h->wait_lock);
+    if (h->stopped) {
+        uint64_t *tab;
+        tab = (uint64_t *)phys_mem_get_ram_ptr(h->machine->mem_map,
+                                               HART_START_ADDR + h->hartid * 16,
+                                               TRUE);
+        tab[0] = start_addr;
+        tab[1] = opaque;
+        h->stopped = FALSE;
+        pthread_cond_signal(&h->wait_cond);
+        err = SBI_SUCCESS;
+    }
+    pthread_mutex_unlock(&h->wait_lock);
+#endif
+    return err;
+}
+
+static void riscv_sbi_call(void *opaque, int xlen, uint64_t *a)
+{
+    RISCVHart *h = opaque;
+    RISCVMachine *m = h->machine;
+    RISCVCPUState *s = h->cpu_state;
+    uint64_t eid = a[7], fid = a[6], all_harts;
+    int64_t err;
+    uint64_t val;
+    uint8_t buf[1];
+
+    if (xlen > 64)
+        xlen = 64;
+    all_harts = UINT64_MAX >> (64 - xlen);
+    err = SBI_SUCCESS;
+    val = 0;
+    switch(eid) {
+    /* legacy extensions: the result is in a0 */
+    case SBI_EXT_0_1_SET_TIMER:
+        if (xlen == 32)
+            riscv_cpu_set_stimecmp(s, a[0] | (a[1] << 32));
+        else
+            riscv_cpu_set_stimecmp(s, a[0]);
+        a[0] = 0;
+        return;
+    case SBI_EXT_0_1_CONSOLE_PUTCHAR:
+        buf[0] = a[0];
+        riscv_io_lock(m, TRUE);
+        m->common.console->write_data(m->common.console->opaque, buf, 1);
+        riscv_io_lock(m, FALSE);
+        a[0] = 0;
+        return;
+    case SBI_EXT_0_1_CONSOLE_GETCHAR:
+        riscv_io_lock(m, TRUE);
+        if (m->common.console->read_data(m->common.console->opaque,
+                                         buf, 1) == 1)
+            a[0] = buf[0];
+        else
+            a[0] = -1;
+        riscv_io_lock(m, FALSE);
+        return;
+    case SBI_EXT_0_1_CLEAR_IPI:
+        riscv_cpu_reset_mip(s, MIP_SSIP);
+        a[0] = 0;
+        return;
+    /* the hart masks of the legacy calls are in guest virtual memory:
+       all the harts are selected */
+    case SBI_EXT_0_1_SEND_IPI:
+        sbi_send_ipi(h, xlen, 0, all_harts);
+        a[0] = 0;
+        return;
+    case SBI_EXT_0_1_REMOTE_FENCE_I:
+        sbi_remote_flush(h, xlen, 0, all_harts, HART_FLUSH_ICACHE);
+        a[0] = 0;
+        return;
+    case SBI_EXT_0_1_REMOTE_SFENCE_VMA:
+    case SBI_EXT_0_1_REMOTE_SFENCE_VMA_ASID:
+        sbi_remote_flush(h, xlen, 0, all_harts, HART_FLUSH_TLB);
+        a[0] = 0;
+        return;
+    case SBI_EXT_0_1_SHUTDOWN:
+        riscv_power_off(m);
+        return;
+
+    case SBI_EXT_BASE:
+        switch(fid) {
+        case 0: /* get_spec_version */
+            val = SBI_SPEC_VERSION;
+            break;
+        case 1: /* get_impl_id */
+            val = SBI_IMPL_ID;
+            break;
+        case 2: /* get_impl_version */
+            val = SBI_IMPL_VERSION;
+            break;
+        case 3: /* probe_extension */
+            val = sbi_probe_extension(a[0]);
+            break;
+        case 4: /* get_mvendorid */
+        case 5: /* get_marchid */
+        case 6: /* get_mimpid */
+            val = 0;
+            break;
+        default:
+            err = SBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+        break;
+    case SBI_EXT_TIME:
+        if (fid == 0) { /* set_timer */
+            if (xlen == 32)
+                riscv_cpu_set_stimecmp(s, a[0] | (a[1] << 32));
+            else
+                riscv_cpu_set_stimecmp(s, a[0]);
+        } else {
+            err = SBI_ERR_NOT_SUPPORTED;
+        }
+        break;
+    case SBI_EXT_IPI:
+        if (fid == 0) { /* send_ipi */
+            sbi_send_ipi(h, xlen, a[0], a[1]);
+        } else {
+            err = SBI_ERR_NOT_SUPPORTED;
+        }
+        break;
+    case SBI_EXT_RFENCE:
+        switch(fid) {
+        case 0: /* remote_fence_i */
+            sbi_remote_flush(h, xlen, a[0], a[1], HART_FLUSH_ICACHE);
+            break;
+        case 1: /* remote_sfence_vma */
+        case 2: /* remote_sfence_vma_asid */
+            sbi_remote_flush(h, xlen, a[0], a[1], HART_FLUSH_TLB);
+            break;
+        default:
+            /* no hypervisor extension */
+            err = SBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+        break;
+    case SBI_EXT_HSM:
+        switch(fid) {
+        case 0: /* hart_start */
+            if (a[0] >= m->hart_count)
+                err = SBI_ERR_INVALID_PARAM;
+            else
+                err = sbi_hart_start(&m->hart[a[0]], a[1], a[2]);
+            break;
+        case 1: /* hart_stop */
+            err = SBI_ERR_FAILED; /* the harts are never stopped again */
+            break;
+        case 2: /* hart_get_status */
+            if (a[0] >= m->hart_count)
+                err = SBI_ERR_INVALID_PARAM;
+            else
+                val = m->hart[a[0]].stopped; /* 0 = started, 1 = stopped */
+            break;
+        default:
+            err = SBI_ERR_NOT_SUPPORTED;
+            break;
+        }
+        break;
+    case SBI_EXT_SRST:
+        if (fid == 0) { /* system_reset */
+            if (a[0] > 2) /* shutdown, cold reboot or warm reboot */
+                err = SBI_ERR_INVALID_PARAM;
+            else
+                riscv_power_off(m); /* no reboot */
+        } else {
+            err = SBI_ERR_NOT_SUPPORTED;
+        }
+        break;
+    default:
+        err = SBI_ERR_NOT_SUPPORTED;
+        break;
+    }
+    a[0] = err;
+    a[1] = val;
+}
+
+/* CLINT: msip of hart 'h' at 4 * h, mtimecmp at 0x4000 + 8 * h */
 static uint32_t clint_read(void *opaque, uint32_t offset, int size_log2)
 {
     RISCVMachine *m = opaque;
+    RISCVHart *h;
     uint32_t val;
 
     assert(size_log2 == 2);
-    switch(offset) {
-    case 0xbff8:
+    if (offset < 4 * m->hart_count) {
+        h = &m->hart[offset >> 2];
+        val = (riscv_cpu_get_mip(h->cpu_state) & MIP_MSIP) != 0;
+    } else if (offset >= 0x4000 && offset < 0x4000 + 8 * m->hart_count) {
+        h = &m->hart[(offset - 0x4000) >> 3];
+        if (offset & 4)
+            val = h->timecmp >> 32;
+        else
+            val = h->timecmp;
+    } else if (offset == 0xbff8) {
         val = rtc_get_time(m);
-        break;
-    case 0xbffc:
+    } else if (offset == 0xbffc) {
         val = rtc_get_time(m) >> 32;
-        break;
-    case 0x4000:
-        val = m->timecmp;
-        break;
-    case 0x4004:
-        val = m->timecmp >> 32;
-        break;
-    default:
+    } else {
         val = 0;
-        break;
     }
     return val;
 }
@@ -223,61 +656,117 @@ static void clint_write(void *opaque, uint32_t offset, uint32_t val,
                       int size_log2)
 {
     RISCVMachine *m = opaque;
+    RISCVHart *h;
 
     assert(size_log2 == 2);
-    switch(offset) {
-    case 0x4000:
-        m->timecmp = (m->timecmp & ~0xffffffff) | val;
-        riscv_cpu_reset_mip(m->cpu_state, MIP_MTIP);
-        break;
-    case 0x4004:
-        m->timecmp = (m->timecmp & 0xffffffff) | ((uint64_t)val << 32);
-        riscv_cpu_reset_mip(m->cpu_state, MIP_MTIP);
-        break;
-    default:
-        break;
+    if (offset < 4 * m->hart_count) {
+        h = &m->hart[offset >> 2];
+        if (val & 1)
+            riscv_hart_set_mip(h, MIP_MSIP);
+        else
+            riscv_cpu_reset_mip(h->cpu_state, MIP_MSIP);
+    } else if (offset >= 0x4000 && offset < 0x4000 + 8 * m->hart_count) {
+        h = &m->hart[(offset - 0x4000) >> 3];
+        if (offset & 4)
+            h->timecmp = (h->timecmp & 0xffffffff) | ((uint64_t)val << 32);
+        else
+            h->timecmp = (h->timecmp & ~(uint64_t)0xffffffff) | val;
+        riscv_cpu_reset_mip(h->cpu_state, MIP_MTIP);
+        /* the hart recomputes its next timer deadline */
+        riscv_hart_kick(h);
     }
 }
 
-static void plic_update_mip(RISCVMachine *s)
+/* PLIC: the context 2 * h is the S mode of hart 'h', 2 * h + 1 its M
+   mode. The sources are level triggered. */
+#define PLIC_PRIORITY_BASE 0x000000
+#define PLIC_PENDING_BASE  0x001000
+#define PLIC_ENABLE_BASE   0x002000
+#define PLIC_ENABLE_SIZE   0x80
+#define PLIC_HART_BASE     0x200000
+#define PLIC_HART_SIZE     0x1000
+
+/* return the pending enabled source of highest priority above the
+   threshold of the context, 0 if none */
+static int plic_get_irq(RISCVMachine *s, int ctx)
 {
-    RISCVCPUState *cpu = s->cpu_state;
     uint32_t mask;
-    mask = s->plic_pending_irq & ~s->plic_served_irq;
-    if (mask) {
-        riscv_cpu_set_mip(cpu, MIP_MEIP | MIP_SEIP);
-    } else {
-        riscv_cpu_reset_mip(cpu, MIP_MEIP | MIP_SEIP);
+    int i, irq, irq_max, prio_max;
+
+    irq_max = 0;
+    prio_max = s->plic_threshold[ctx];
+    for(i = 0; i < PLIC_NUM_SOURCES / 32; i++) {
+        mask = s->plic_pending[i] & ~s->plic_claimed[i] &
+            s->plic_enable[ctx][i];
+        while (mask != 0) {
+            irq = i * 32 + ctz32(mask);
+            if (s->plic_priority[irq] > prio_max) {
+                prio_max = s->plic_priority[irq];
+                irq_max = irq;
+            }
+            mask &= mask - 1;
+        }
     }
+    return irq_max;
 }
 
-#define PLIC_HART_BASE 0x200000
-#define PLIC_HART_SIZE 0x1000
+static void plic_update_mip(RISCVMachine *s)
+{
+    RISCVHart *h;
+    int i;
+
+    for(i = 0; i < s->hart_count; i++) {
+        h = &s->hart[i];
+        if (plic_get_irq(s, 2 * i))
+            riscv_hart_set_mip(h, MIP_SEIP);
+        else
+            riscv_cpu_reset_mip(h->cpu_state, MIP_SEIP);
+        if (plic_get_irq(s, 2 * i + 1))
+            riscv_hart_set_mip(h, MIP_MEIP);
+        else
+            riscv_cpu_reset_mip(h->cpu_state, MIP_MEIP);
+    }
+}
 
 static uint32_t plic_read(void *opaque, uint32_t offset, int size_log2)
 {
     RISCVMachine *s = opaque;
-    uint32_t val, mask;
-    int i;
+    uint32_t val;
+    int ctx, irq, context_count;
+
     assert(size_log2 == 2);
-    switch(offset) {
-    case PLIC_HART_BASE:
-        val = 0;
-        break;
-    case PLIC_HART_BASE + 4:
-        mask = s->plic_pending_irq & ~s->plic_served_irq;
-        if (mask != 0) {
-            i = ctz32(mask);
-            s->plic_served_irq |= 1 << i;
-            plic_update_mip(s);
-            val = i + 1;
-        } else {
+    context_count = 2 * s->hart_count;
+    if (offset < PLIC_PENDING_BASE) {
+        val = s->plic_priority[offset >> 2];
+    } else if (offset < PLIC_PENDING_BASE + PLIC_NUM_SOURCES / 8) {
+        irq = (offset - PLIC_PENDING_BASE) >> 2;
+        val = s->plic_pending[irq] & ~s->plic_claimed[irq];
+    } else if (offset >= PLIC_ENABLE_BASE &&
+               offset < PLIC_ENABLE_BASE + context_count * PLIC_ENABLE_SIZE) {
+        ctx = (offset - PLIC_ENABLE_BASE) / PLIC_ENABLE_SIZE;
+        irq = (offset & (PLIC_ENABLE_SIZE - 1)) >> 2;
+        val = s->plic_enable[ctx][irq];
+    } else if (offset >= PLIC_HART_BASE &&
+               offset < PLIC_HART_BASE + context_count * PLIC_HART_SIZE) {
+        ctx = (offset - PLIC_HART_BASE) / PLIC_HART_SIZE;
+        switch(offset & (PLIC_HART_SIZE - 1)) {
+        case 0:
+            val = s->plic_threshold[ctx];
+            break;
+        case 4: /* claim */
+            irq = plic_get_irq(s, ctx);
+            if (irq != 0) {
+                s->plic_claimed[irq >> 5] |= 1 << (irq & 31);
+                plic_update_mip(s);
+            }
+            val = irq;
+            break;
+        default:
             val = 0;
+            break;
         }
-        break;
-    default:
+    } else {
         val = 0;
-        break;
     }
     return val;
 }
@@ -286,18 +775,41 @@ static void plic_write(void *opaque, uint32_t offset, uint32_t val,
                        int size_log2)
 {
     RISCVMachine *s = opaque;
+    int ctx, irq, context_count;
     
     assert(size_log2 == 2);
-    switch(offset) {
-    case PLIC_HART_BASE + 4:
-        val--;
-        if (val < 32) {
-            s->plic_served_irq &= ~(1 << val);
+    context_count = 2 * s->hart_count;
+    if (offset < PLIC_PENDING_BASE) {
+        irq = offset >> 2;
+        if (irq != 0) {
+            s->plic_priority[irq] = val & PLIC_PRIORITY_MASK;
             plic_update_mip(s);
         }
-        break;
-    default:
-        break;
+    } else if (offset >= PLIC_ENABLE_BASE &&
+               offset < PLIC_ENABLE_BASE + context_count * PLIC_ENABLE_SIZE) {
+        ctx = (offset - PLIC_ENABLE_BASE) / PLIC_ENABLE_SIZE;
+        irq = (offset & (PLIC_ENABLE_SIZE - 1)) >> 2;
+        if (irq == 0)
+            val &= ~1; /* source 0 does not exist */
+        s->plic_enable[ctx][irq] = val;
+        plic_update_mip(s);
+    } else if (offset >= PLIC_HART_BASE &&
+               offset < PLIC_HART_BASE + context_count * PLIC_HART_SIZE) {
+        ctx = (offset - PLIC_HART_BASE) / PLIC_HART_SIZE;
+        switch(offset & (PLIC_HART_SIZE - 1)) {
+        case 0:
+            s->plic_threshold[ctx] = val & PLIC_PRIORITY_MASK;
+            plic_update_mip(s);
+            break;
+        case 4: /* complete */
+            if (val < PLIC_NUM_SOURCES) {
+                s->plic_claimed[val >> 5] &= ~(1 << (val & 31));
+                plic_update_mip(s);
+            }
+            break;
+        default:
+            break;
+        }
     }
 }
 
@@ -306,11 +818,11 @@ static void plic_set_irq(void *opaque, int irq_num, int state)
     RISCVMachine *s = opaque;
     uint32_t mask;
 
-    mask = 1 << (irq_num - 1);
+    mask = 1 << (irq_num & 31);
     if (state) 
-        s->plic_pending_irq |= mask;
+        s->plic_pending[irq_num >> 5] |= mask;
     else
-        s->plic_pending_irq &= ~mask;
+        s->plic_pending[irq_num >> 5] &= ~mask;
     plic_update_mip(s);
 }
 
@@ -591,10 +1103,11 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
                            uint64_t initrd_start, uint64_t initrd_size)
 {
     FDTState *s;
-    int size, max_xlen, i, cur_phandle, intc_phandle, plic_phandle;
+    int size, max_xlen, i, h, cur_phandle, plic_phandle;
+    int intc_phandle[RISCV_HART_MAX];
     char isa_string[128], *q;
     uint32_t misa;
-    uint32_t tab[4];
+    uint32_t tab[4 * RISCV_HART_MAX];
     FBDevice *fb_dev;
     
     s = fdt_init();
@@ -613,15 +1126,8 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_prop_u32(s, "#size-cells", 0);
     fdt_prop_u32(s, "timebase-frequency", RTC_FREQ);
 
-    /* cpu */
-    fdt_begin_node_num(s, "cpu", 0);
-    fdt_prop_str(s, "device_type", "cpu");
-    fdt_prop_u32(s, "reg", 0);
-    fdt_prop_str(s, "status", "okay");
-    fdt_prop_str(s, "compatible", "riscv");
-
     max_xlen = m->max_xlen;
-    misa = riscv_cpu_get_misa(m->cpu_state);
+    misa = riscv_cpu_get_misa(m->hart[0].cpu_state);
     q = isa_string;
     q += snprintf(isa_string, sizeof(isa_string), "rv%d", max_xlen);
     for(i = 0; i < 26; i++) {
@@ -629,20 +1135,33 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
             *q++ = 'a' + i;
     }
     *q = '\0';
-    fdt_prop_str(s, "riscv,isa", isa_string);
-    
-    fdt_prop_str(s, "mmu-type", max_xlen <= 32 ? "riscv,sv32" : "riscv,sv48");
-    fdt_prop_u32(s, "clock-frequency", 2000000000);
-
-    fdt_begin_node(s, "interrupt-controller");
-    fdt_prop_u32(s, "#interrupt-cells", 1);
-    fdt_prop(s, "interrupt-controller", NULL, 0);
-    fdt_prop_str(s, "compatible", "riscv,cpu-intc");
-    intc_phandle = cur_phandle++;
-    fdt_prop_u32(s, "phandle", intc_phandle);
-    fdt_end_node(s); /* interrupt-controller */
+    /* the 'time' CSR is always implemented, hence Sstc */
+    pstrcat(isa_string, sizeof(isa_string), "_zicbom_zicbop_zicboz_sstc");
+
+    for(h = 0; h < m->hart_count; h++) {
+        fdt_begin_node_num(s, "cpu", h);
+        fdt_prop_str(s, "device_type", "cpu");
+        fdt_prop_u32(s, "reg", h);
+        fdt_prop_str(s, "status", "okay");
+        fdt_prop_str(s, "compatible", "riscv");
+        fdt_prop_str(s, "riscv,isa", isa_string);
+        fdt_prop_str(s, "mmu-type",
+                     max_xlen <= 32 ? "riscv,sv32" : "riscv,sv48");
+        fdt_prop_u32(s, "clock-frequency", 2000000000);
+        fdt_prop_u32(s, "riscv,cbom-block-size", CBO_BLOCK_SIZE);
+        fdt_prop_u32(s, "riscv,cbop-block-size", CBO_BLOCK_SIZE);
+        fdt_prop_u32(s, "riscv,cboz-block-size", CBO_BLOCK_SIZE);
+
+        fdt_begin_node(s, "interrupt-controller");
+        fdt_prop_u32(s, "#interrupt-cells", 1);
+        fdt_prop(s, "interrupt-controller", NULL, 0);
+        fdt_prop_str(s, "compatible", "riscv,cpu-intc");
+        intc_phandle[h] = cur_phandle++;
+        fdt_prop_u32(s, "phandle", intc_phandle[h]);
+        fdt_end_node(s); /* interrupt-controller */
     
-    fdt_end_node(s); /* cpu */
+        fdt_end_node(s); /* cpu */
+    }
     
     fdt_end_node(s); /* cpus */
 
@@ -670,11 +1189,13 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_begin_node_num(s, "clint", CLINT_BASE_ADDR);
     fdt_prop_str(s, "compatible", "riscv,clint0");
 
-    tab[0] = intc_phandle;
-    tab[1] = 3; /* M IPI irq */
-    tab[2] = intc_phandle;
-    tab[3] = 7; /* M timer irq */
-    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4);
+    for(h = 0; h < m->hart_count; h++) {
+        tab[4 * h] = intc_phandle[h];
+        tab[4 * h + 1] = 3; /* M IPI irq */
+        tab[4 * h + 2] = intc_phandle[h];
+        tab[4 * h + 3] = 7; /* M timer irq */
+    }
+    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4 * m->hart_count);
 
     fdt_prop_tab_u64_2(s, "reg", CLINT_BASE_ADDR, CLINT_SIZE);
     
@@ -684,14 +1205,16 @@ static int riscv_build_fdt(RISCVMachine *m, uint8_t *dst,
     fdt_prop_u32(s, "#interrupt-cells", 1);
     fdt_prop(s, "interrupt-controller", NULL, 0);
     fdt_prop_str(s, "compatible", "riscv,plic0");
-    fdt_prop_u32(s, "riscv,ndev", 31);
+    fdt_prop_u32(s, "riscv,ndev", PLIC_NUM_SOURCES - 1);
     fdt_prop_tab_u64_2(s, "reg", PLIC_BASE_ADDR, PLIC_SIZE);
 
-    tab[0] = intc_phandle;
-    tab[1] = 9; /* S ext irq */
-    tab[2] = intc_phandle;
-    tab[3] = 11; /* M ext irq */
-    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4);
+    for(h = 0; h < m->hart_count; h++) {
+        tab[4 * h] = intc_phandle[h];
+        tab[4 * h + 1] = 9; /* S ext irq */
+        tab[4 * h + 2] = intc_phandle[h];
+        tab[4 * h + 3] = 11; /* M ext irq */
+    }
+    fdt_prop_tab_u32(s, "interrupts-extended", tab, 4 * m->hart_count);
 
     plic_phandle = cur_phandle++;
     fdt_prop_u32(s, "phandle", plic_phandle);
@@ -761,12 +1284,17 @@ static void copy_bios(RISCVMachine *s, const uint8_t *buf, int buf_len,
     uint64_t image_start, image_len;
     uint8_t *ram_ptr;
     uint32_t *q;
-    int res;
+    int res, i;
 
     ram_ptr = get_ram_ptr(s, RAM_BASE_ADDR, TRUE);
 
     /* copy the bios */
-    if (elf_detect_magic(buf, buf_len)) {
+    if (s->host_sbi) {
+        /* no firmware: the kernel is at the start of the RAM */
+        buf_len = 0;
+        bios_base = 0;
+        bios_size = 0;
+    } else if (elf_detect_magic(buf, buf_len)) {
         if (elf_load(buf, buf_len, ram_ptr, s->ram_size,
                      &image_start, &image_len) == -1) {
             vm_error("Failed to load ELF BIOS\n");
@@ -847,7 +1375,10 @@ static void copy_bios(RISCVMachine *s, const uint8_t *buf, int buf_len,
 
     ram_ptr = get_ram_ptr(s, 0, TRUE);
     
-    fdt_addr = 0x1000 + 8 * 8;
+    if (s->host_sbi)
+        fdt_addr = 0x1000 + 32 * 4;
+    else
+        fdt_addr = 0x1000 + 8 * 8;
 
     riscv_build_fdt(s, ram_ptr + fdt_addr,
                     RAM_BASE_ADDR + kernel_base,
@@ -855,21 +1386,192 @@ static void copy_bios(RISCVMachine *s, const uint8_t *buf, int buf_len,
                     RAM_BASE_ADDR + initrd_base,
                     initrd_size);
 
-    /* jump_addr = 0x80000000 */
-    
     q = (uint32_t *)(ram_ptr + 0x1000);
-    q[0] = 0x297 + 0x80000000 - 0x1000; /* auipc t0, jump_addr */
-    q[1] = 0x597; /* auipc a1, dtb */
-    q[2] = 0x58593 + ((fdt_addr - 4) << 20); /* addi a1, a1, dtb */
-    q[3] = 0xf1402573; /* csrr a0, mhartid */
-    q[4] = 0x00028067; /* jalr zero, t0, jump_addr */
+    if (s->host_sbi) {
+        uint64_t *tab;
+        /* hart 0 starts the kernel, the other harts are started with
+           the SBI hart_start call */
+        tab = (uint64_t *)(ram_ptr + HART_START_ADDR);
+        tab[0] = RAM_BASE_ADDR;
+        tab[1] = fdt_addr;
+
+        /* enter the kernel in S mode with the delegation done by
+           the SBI firmwares */
+        i = 0;
+        q[i++] = 0xf1402573; /* csrr a0, mhartid */
+        q[i++] = 0x00451293; /* slli t0, a0, 4 */
+        q[i++] = 0x40028293; /* addi t0, t0, HART_START_ADDR */
+        if (s->max_xlen == 32) {
+            q[i++] = 0x0002a303; /* lw t1, 0(t0) */
+            q[i++] = 0x0082a583; /* lw a1, 8(t0) */
+        } else {
+            q[i++] = 0x0002b303; /* ld t1, 0(t0) */
+            q[i++] = 0x0082b583; /* ld a1, 8(t0) */
+        }
+        q[i++] = 0x34131073; /* csrw mepc, t1 */
+        q[i++] = 0x00100313; /* li t1, 1 */
+        q[i++] = 0x00b31313; /* slli t1, t1, 11 */
+        q[i++] = 0x30031073; /* csrw mstatus, t1 (MPP = S) */
+        q[i++] = 0x0000b337; /* lui t1, 0xb */
+        q[i++] = 0x1ff30313; /* addi t1, t1, 0x1ff */
+        q[i++] = 0x30231073; /* csrw medeleg, t1 */
+        q[i++] = 0x22200313; /* li t1, 0x222 */
+        q[i++] = 0x30331073; /* csrw mideleg, t1 */
+        q[i++] = 0x00700313; /* li t1, 7 */
+        q[i++] = 0x30631073; /* csrw mcounteren, t1 */
+        /* enable Sstc and the cache block operations */
+        if (s->max_xlen == 32) {
+            q[i++] = 0x80000337; /* lui t1, 0x80000 */
+            q[i++] = 0x31a31073; /* csrw menvcfgh, t1 */
+            q[i++] = 0x0f000313; /* li t1, 0xf0 */
+            q[i++] = 0x30a31073; /* csrw menvcfg, t1 */
+        } else {
+            q[i++] = 0xfff00313; /* li t1, -1 */
+            q[i++] = 0x03f31313; /* slli t1, t1, 63 */
+            q[i++] = 0x0f036313; /* ori t1, t1, 0xf0 */
+            q[i++] = 0x30a31073; /* csrw menvcfg, t1 */
+        }
+        q[i++] = 0x30200073; /* mret */
+    } else {
+        /* jump_addr = 0x80000000 */
+        q[0] = 0x297 + 0x80000000 - 0x1000; /* auipc t0, jump_addr */
+        q[1] = 0x597; /* auipc a1, dtb */
+        q[2] = 0x58593 + ((fdt_addr - 4) << 20); /* addi a1, a1, dtb */
+        q[3] = 0xf1402573; /* csrr a0, mhartid */
+        q[4] = 0x00028067; /* jalr zero, t0, jump_addr */
+    }
 }
 
+/* Raise the timer interrupts of the hart which are due. Return the
+   delay in RTC ticks before the next one, INT64_MAX if none. */
+static int64_t riscv_hart_update_timers(RISCVHart *h)
+{
+    RISCVMachine *m = h->machine;
+    RISCVCPUState *s = h->cpu_state;
+    int64_t delay, delay1;
+    uint64_t stimecmp, now;
+
+    delay = INT64_MAX;
+    if (!(riscv_cpu_get_mip(s) & MIP_MTIP)) {
+        delay1 = h->timecmp - rtc_get_time(m);
+        if (delay1 <= 0) {
+            riscv_hart_set_mip(h, MIP_MTIP);
+            delay = 0;
+        } else {
+            delay = delay1;
+        }
+    }
+    stimecmp = riscv_cpu_get_stimecmp(s);
+    if (stimecmp != UINT64_MAX && !(riscv_cpu_get_mip(s) & MIP_STIP)) {
+        /* unsigned comparison because a disabled timer is set far in
+           the future */
+        now = rtc_get_time(m);
+        if (now >= stimecmp) {
+            riscv_hart_set_mip(h, MIP_STIP);
+            delay = 0;
+        } else if (stimecmp - now < delay) {
+            delay = stimecmp - now;
+        }
+    }
+    return delay;
+}
+
+#ifdef CONFIG_RISCV_SMP
+
+#define HART_EXEC_CYCLE 10000
+#define HART_MAX_SLEEP (RTC_FREQ / 100) /* in RTC ticks */
+
+/* wait at most 'delay' RTC ticks for an interrupt or a request */
+static void riscv_hart_wait(RISCVHart *h, int64_t delay)
+{
+    struct timespec ts;
+
+    if (delay > HART_MAX_SLEEP)
+        delay = HART_MAX_SLEEP;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_nsec += delay * (1000000000 / RTC_FREQ);
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_mutex_lock(&h->wait_lock);
+    /* exit from power down if an interrupt is pending */
+    riscv_cpu_set_mip(h->cpu_state, 0);
+    if ((h->stopped || riscv_cpu_get_power_down(h->cpu_state)) &&
+        !__atomic_load_n(&h->flush_request, __ATOMIC_SEQ_CST) &&
+        !h->machine->exit_request) {
+        pthread_cond_timedwait(&h->wait_cond, &h->wait_lock, &ts);
+    }
+    pthread_mutex_unlock(&h->wait_lock);
+}
+
+static void *riscv_hart_thread(void *opaque)
+{
+    RISCVHart *h = opaque;
+    RISCVMachine *m = h->machine;
+    int64_t delay;
+
+    while (!m->exit_request) {
+        riscv_hart_handle_flush(h);
+        delay = riscv_hart_update_timers(h);
+        if (h->stopped || riscv_cpu_get_power_down(h->cpu_state))
+            riscv_hart_wait(h, delay);
+        else
+            riscv_cpu_interp(h->cpu_state, HART_EXEC_CYCLE);
+    }
+    return NULL;
+}
+
+static void riscv_harts_start(RISCVMachine *m)
+{
+    pthread_condattr_t attr;
+    RISCVHart *h;
+    int i;
+
+    pthread_mutex_init(&m->io_lock, NULL);
+    /* the main loop owns the devices except while it waits */
+    pthread_mutex_lock(&m->io_lock);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for(i = 0; i < m->hart_count; i++) {
+        h = &m->hart[i];
+        pthread_mutex_init(&h->wait_lock, NULL);
+        pthread_cond_init(&h->wait_cond, &attr);
+        riscv_cpu_set_smp(h->cpu_state, i, riscv_io_lock, m);
+    }
+    pthread_condattr_destroy(&attr);
+    for(i = 0; i < m->hart_count; i++) {
+        h = &m->hart[i];
+        if (pthread_create(&h->thread, NULL, riscv_hart_thread, h)) {
+            vm_error("could not create the thread of hart %d\n", i);
+            exit(1);
+        }
+    }
+}
+
+static void riscv_harts_stop(RISCVMachine *m)
+{
+    int i;
+
+    m->exit_request = TRUE;
+    for(i = 0; i < m->hart_count; i++)
+        riscv_hart_kick(&m->hart[i]);
+    pthread_mutex_unlock(&m->io_lock);
+    for(i = 0; i < m->hart_count; i++)
+        pthread_join(m->hart[i].thread, NULL);
+}
+
+#endif /* CONFIG_RISCV_SMP */
+
 static void riscv_flush_tlb_write_range(void *opaque, uint8_t *ram_addr,
                                         size_t ram_size)
 {
     RISCVMachine *s = opaque;
-    riscv_cpu_flush_tlb_write_range_ram(s->cpu_state, ram_addr, ram_size);
+    /* with several harts, the TLBs have no writable entries for
+       the RAM with dirty bits */
+    if (s->hart_count == 1)
+        riscv_cpu_flush_tlb_write_range_ram(s->hart[0].cpu_state,
+                                            ram_addr, ram_size);
 }
 
 static void riscv_machine_set_defaults(VirtMachineParams *p)
@@ -879,6 +1581,7 @@ static void riscv_machine_set_defaults(VirtMachineParams *p)
 static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
 {
     RISCVMachine *s;
+    RISCVHart *h;
     VIRTIODevice *blk_dev;
     int irq_num, i, max_xlen, ram_flags;
     VIRTIOBusDef vbus_s, *vbus = &vbus_s;
@@ -894,6 +1597,26 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         vm_error("unsupported machine: %s\n", p->machine_name);
         return NULL;
     }
+    if (p->cpu_count < 1 || p->cpu_count > RISCV_HART_MAX) {
+        vm_error("cpu_count must be between 1 and %d\n", RISCV_HART_MAX);
+        return NULL;
+    }
+    if (p->cpu_count > 1) {
+#ifndef CONFIG_RISCV_SMP
+        vm_error("SMP support is not compiled in\n");
+        return NULL;
+#endif
+        /* the atomic instructions use the host atomics */
+        if (max_xlen > 64) {
+            vm_error("%s: SMP is not supported\n", p->machine_name);
+            return NULL;
+        }
+        /* the harts do not share the instruction counter */
+        if (!p->rtc_real_time) {
+            vm_error("SMP requires the real time RTC\n");
+            return NULL;
+        }
+    }
     
     s = mallocz(sizeof(*s));
     s->common.vmc = p->vmc;
@@ -904,12 +1627,27 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
     s->mem_map->opaque = s;
     s->mem_map->flush_tlb_write_range = riscv_flush_tlb_write_range;
 
-    s->cpu_state = riscv_cpu_init(s->mem_map, max_xlen);
-    if (!s->cpu_state) {
-        vm_error("unsupported max_xlen=%d\n", max_xlen);
-        /* XXX: should free resources */
-        return NULL;
+    s->hart_count = p->cpu_count;
+    for(i = 0; i < s->hart_count; i++) {
+        h = &s->hart[i];
+        h->machine = s;
+        h->hartid = i;
+        h->cpu_state = riscv_cpu_init(s->mem_map, max_xlen);
+        if (!h->cpu_state) {
+            vm_error("unsupported max_xlen=%d\n", max_xlen);
+            /* XXX: should free resources */
+            return NULL;
+        }
+        if (p->jit_enable && riscv_cpu_enable_jit(h->cpu_state) < 0 &&
+            i == 0)
+            vm_error("JIT not supported, using the interpreter\n");
+        if (p->tlb_size || p->tlb_ways) {
+            if (riscv_cpu_set_tlb_size(h->cpu_state, p->tlb_size,
+                                       p->tlb_ways) < 0 && i == 0)
+                vm_error("unsupported TLB geometry, using the default\n");
+        }
     }
+    s->tlb_stats = p->tlb_stats;
 
     /* HTIF */
     uint64_t htif_start = DEFAULT_HTIF_BASE_ADDR;
@@ -926,19 +1664,31 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
                         s, htif_read, htif_write, DEVIO_SIZE32);
 
     /* RAM */
-    ram_flags = 0;
-    cpu_register_ram(s->mem_map, RAM_BASE_ADDR, p->ram_size, ram_flags);
+    ram_flags = p->ram_flags;
+    s->ram_range = cpu_register_ram(s->mem_map, RAM_BASE_ADDR, p->ram_size,
+                                    ram_flags);
     cpu_register_ram(s->mem_map, 0x00000000, LOW_RAM_SIZE, 0);
+    s->host_sbi = p->host_sbi;
     s->rtc_real_time = p->rtc_real_time;
+    s->rtc_warp = p->rtc_warp && !p->rtc_real_time;
     if (p->rtc_real_time) {
         s->rtc_start_time = rtc_get_real_time(s);
     }
+    for(i = 0; i < s->hart_count; i++) {
+        h = &s->hart[i];
+        if (s->host_sbi) {
+            riscv_cpu_set_sbi_handler(h->cpu_state, riscv_sbi_call, h);
+            /* the kernel starts the other harts */
+            h->stopped = (i != 0);
+        }
+        riscv_cpu_set_rdtime(h->cpu_state, riscv_rdtime, s);
+    }
     
     cpu_register_device(s->mem_map, CLINT_BASE_ADDR, CLINT_SIZE, s,
                         clint_read, clint_write, DEVIO_SIZE32);
     cpu_register_device(s->mem_map, PLIC_BASE_ADDR, PLIC_SIZE, s,
                         plic_read, plic_write, DEVIO_SIZE32);
-    for(i = 1; i < 32; i++) {
+    for(i = 1; i < PLIC_NUM_SOURCES; i++) {
         irq_init(&s->plic_irq[i], plic_set_irq, s, i);
     }
 
@@ -955,27 +1705,26 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         s->common.console_dev = virtio_console_init(vbus, p->console);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = s->common.console_dev;
     }
     
     /* virtio net device */
     for(i = 0; i < p->eth_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
-        virtio_net_init(vbus, p->tab_eth[i].net);
+        s->virtio_dev[s->virtio_count++] =
+            virtio_net_init(vbus, p->tab_eth[i].net);
         s->common.net = p->tab_eth[i].net;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
     }
 
     /* virtio block device */
     for(i = 0; i < p->drive_count; i++) {
         vbus->irq = &s->plic_irq[irq_num];
         blk_dev = virtio_block_init(vbus, p->tab_drive[i].block_dev);
-        (void)blk_dev;
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = blk_dev;
     }
 
     /* virtio filesystem */
@@ -984,11 +1733,10 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
         vbus->irq = &s->plic_irq[irq_num];
         fs_dev = virtio_9p_init(vbus, p->tab_fs[i].fs_dev,
                                 p->tab_fs[i].tag);
-        (void)fs_dev;
         //        virtio_set_debug(fs_dev, VIRTIO_DEBUG_9P);
         vbus->addr += VIRTIO_SIZE;
         irq_num++;
-        s->virtio_count++;
+        s->virtio_dev[s->virtio_count++] = fs_dev;
     }
 
     if (p->display_device) {
@@ -1014,21 +1762,26 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
                                                 VIRTIO_INPUT_TYPE_KEYBOARD);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->keyboard_dev;
 
             vbus->irq = &s->plic_irq[irq_num];
             s->mouse_dev = virtio_input_init(vbus,
                                              VIRTIO_INPUT_TYPE_TABLET);
             vbus->addr += VIRTIO_SIZE;
             irq_num++;
-            s->virtio_count++;
+            s->virtio_dev[s->virtio_count++] = s->mouse_dev;
         } else {
             vm_error("unsupported input device: %s\n", p->input_device);
             exit(1);
         }
     }
     
-    if (!p->files[VM_FILE_BIOS].buf) {
+    if (s->host_sbi) {
+        if (!p->files[VM_FILE_KERNEL].buf) {
+            vm_error("host_sbi: no kernel found\n");
+            exit(1);
+        }
+    } else if (!p->files[VM_FILE_BIOS].buf) {
         vm_error("No bios found");
     }
 
@@ -1036,15 +1789,25 @@ static VirtMachine *riscv_machine_init(const VirtMachineParams *p)
               p->files[VM_FILE_KERNEL].buf, p->files[VM_FILE_KERNEL].len,
               p->cmdline,
               p->files[VM_FILE_INITRD].buf, p->files[VM_FILE_INITRD].len);
-    
+
+#ifdef CONFIG_RISCV_SMP
+    if (s->hart_count > 1)
+        riscv_harts_start(s);
+#endif
     return (VirtMachine *)s;
 }
 
 static void riscv_machine_end(VirtMachine *s1)
 {
     RISCVMachine *s = (RISCVMachine *)s1;
-    /* XXX: stop all */
-    riscv_cpu_end(s->cpu_state);
+    int i;
+
+#ifdef CONFIG_RISCV_SMP
+    if (s->hart_count > 1)
+        riscv_harts_stop(s);
+#endif
+    for(i = 0; i < s->hart_count; i++)
+        riscv_cpu_end(s->hart[i].cpu_state);
     phys_mem_map_end(s->mem_map);
     free(s);
 }
@@ -1053,22 +1816,26 @@ static void riscv_machine_end(VirtMachine *s1)
 static int riscv_machine_get_sleep_duration(VirtMachine *s1, int delay)
 {
     RISCVMachine *m = (RISCVMachine *)s1;
-    RISCVCPUState *s = m->cpu_state;
+    RISCVCPUState *s = m->hart[0].cpu_state;
     int64_t delay1;
     
-    /* wait for an event: the only asynchronous event is the RTC timer */
-    if (!(riscv_cpu_get_mip(s) & MIP_MTIP)) {
-        delay1 = m->timecmp - rtc_get_time(m);
-        if (delay1 <= 0) {
-            riscv_cpu_set_mip(s, MIP_MTIP);
-            delay = 0;
-        } else {
-            /* convert delay to ms */
-            delay1 = delay1 / (RTC_FREQ / 1000);
-            if (delay1 < delay)
-                delay = delay1;
-        }
+    /* the harts wait for their timers in their own threads */
+    if (m->hart_count > 1)
+        return delay;
+
+    /* wait for an event: the only asynchronous events are the RTC
+       timer and the supervisor timer (Sstc) */
+    delay1 = riscv_hart_update_timers(&m->hart[0]);
+    if (m->rtc_warp && riscv_cpu_get_power_down(s) &&
+        delay1 > 0 && delay1 != INT64_MAX) {
+        /* nothing to execute until the next timer: jump to it */
+        m->rtc_warp_time += delay1;
+        delay1 = riscv_hart_update_timers(&m->hart[0]);
     }
+    /* convert delay to ms */
+    delay1 = delay1 / (RTC_FREQ / 1000);
+    if (delay1 < delay)
+        delay = delay1;
     if (!riscv_cpu_get_power_down(s))
         delay = 0;
     return delay;
@@ -1077,7 +1844,107 @@ static int riscv_machine_get_sleep_duration(VirtMachine *s1, int delay)
 static void riscv_machine_interp(VirtMachine *s1, int max_exec_cycle)
 {
     RISCVMachine *s = (RISCVMachine *)s1;
-    riscv_cpu_interp(s->cpu_state, max_exec_cycle);
+    if (s->hart_count == 1)
+        riscv_cpu_interp(s->hart[0].cpu_state, max_exec_cycle);
+}
+
+static void riscv_machine_snapshot(VirtMachine *s1, SnapshotFile *sf)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+    RISCVHart *h;
+    uint64_t rtc_time;
+    int i, max_xlen, hart_count, virtio_count;
+
+#ifdef CONFIG_RISCV_SMP
+    /* the main loop holds the I/O lock, so the harts cannot be in
+       a device access */
+    if (s->hart_count > 1) {
+        riscv_harts_stop(s);
+        s->exit_request = FALSE;
+    }
+#endif
+    snapshot_section(sf, "machine");
+    max_xlen = s->max_xlen;
+    hart_count = s->hart_count;
+    virtio_count = s->virtio_count;
+    snapshot_field(sf, max_xlen);
+    snapshot_field(sf, hart_count);
+    snapshot_field(sf, virtio_count);
+    if (max_xlen != s->max_xlen || hart_count != s->hart_count ||
+        virtio_count != s->virtio_count) {
+        snapshot_error(sf, "the machine configuration is different\n");
+        goto done;
+    }
+    for(i = 0; i < s->hart_count; i++) {
+        h = &s->hart[i];
+        snapshot_field(sf, h->timecmp);
+        snapshot_field(sf, h->stopped);
+    }
+    snapshot_field(sf, s->plic_pending);
+    snapshot_field(sf, s->plic_claimed);
+    snapshot_field(sf, s->plic_enable);
+    snapshot_field(sf, s->plic_priority);
+    snapshot_field(sf, s->plic_threshold);
+    snapshot_field(sf, s->htif_tohost);
+    snapshot_field(sf, s->htif_fromhost);
+    /* with a real time RTC, the time continues from the saved value */
+    rtc_time = rtc_get_time(s);
+    snapshot_field(sf, rtc_time);
+    snapshot_field(sf, s->rtc_warp_time);
+
+    for(i = 0; i < s->hart_count; i++)
+        riscv_cpu_snapshot(s->hart[i].cpu_state, sf);
+    if (snapshot_is_load(sf) && s->rtc_real_time)
+        s->rtc_start_time = rtc_get_real_time(s) - rtc_time;
+    for(i = 0; i < s->virtio_count; i++)
+        virtio_snapshot(s->virtio_dev[i], sf);
+    snapshot_ram(sf, s->mem_map);
+ done: ;
+#ifdef CONFIG_RISCV_SMP
+    if (s->hart_count > 1)
+        riscv_harts_start(s);
+#endif
+}
+
+static void riscv_machine_fork_prepare(VirtMachine *s1)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+
+#ifdef CONFIG_RISCV_SMP
+    /* only the calling thread exists in the child process */
+    if (s->hart_count > 1) {
+        riscv_harts_stop(s);
+        s->exit_request = FALSE;
+    }
+#endif
+    s->rtc_fork_time = rtc_get_time(s);
+}
+
+static void riscv_machine_fork_resume(VirtMachine *s1, int clone_id)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+
+    /* the time spent waiting for the clone requests is not seen by
+       the guest */
+    if (s->rtc_real_time)
+        s->rtc_start_time = rtc_get_real_time(s) - s->rtc_fork_time;
+    s->common.fork_ready = FALSE;
+    s->htif_fromhost = ((uint64_t)HTIF_DEV_FORK << 56) | clone_id;
+#ifdef CONFIG_RISCV_SMP
+    if (s->hart_count > 1)
+        riscv_harts_start(s);
+#endif
+}
+
+static uint64_t riscv_machine_get_icount(VirtMachine *s1)
+{
+    RISCVMachine *s = (RISCVMachine *)s1;
+    return riscv_cpu_get_cycles(s->hart[0].cpu_state);
+}
+
+static void riscv_machine_io_lock(VirtMachine *s1, BOOL lock)
+{
+    riscv_io_lock(s1, lock);
 }
 
 static void riscv_vm_send_key_event(VirtMachine *s1, BOOL is_down,
@@ -1113,4 +1980,9 @@ const VirtMachineClass riscv_machine_class = {
     riscv_vm_mouse_is_absolute,
     riscv_vm_send_mouse_event,
     riscv_vm_send_key_event,
+    riscv_machine_io_lock,
+    riscv_machine_snapshot,
+    riscv_machine_fork_prepare,
+    riscv_machine_fork_resume,
+    riscv_machine_get_icount,
 };
@@ -0,0 +1,246 @@
+/*
+ * Machine snapshots
+ *
+ * Copyright (c) 2026 Fernando Lemos
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#include "cutils.h"
+#include "iomem.h"
+#include "snapshot.h"
+
+#define SNAPSHOT_MAGIC "TEMUSNAP"
+#define SNAPSHOT_VERSION 2
+/* alignment of the RAM in the file, multiple of the host page size */
+#define SNAPSHOT_RAM_ALIGN (64 * 1024)
+/* granularity of the zero page detection */
+#define SNAPSHOT_PAGE_SIZE 4096
+
+struct SnapshotFile {
+    FILE *f;
+    char *filename;
+    char *tmp_filename; /* renamed to 'filename' when the save is done */
+    BOOL is_load;
+    BOOL error;
+};
+
+SnapshotFile *snapshot_open(const char *filename, BOOL is_load)
+{
+    SnapshotFile *sf;
+    char magic[8];
+    uint32_t version;
+    size_t len;
+
+    sf = mallocz(sizeof(*sf));
+    sf->filename = strdup(filename);
+    sf->is_load = is_load;
+    if (is_load) {
+        sf->f = fopen(filename, "rb");
+    } else {
+        /* a snapshot being loaded may be mapped from 'filename' */
+        len = strlen(filename) + 5;
+        sf->tmp_filename = malloc(len);
+        snprintf(sf->tmp_filename, len, "%s.tmp", filename);
+        sf->f = fopen(sf->tmp_filename, "wb");
+    }
+    if (!sf->f) {
+        perror(is_load ? sf->filename : sf->tmp_filename);
+        free(sf->tmp_filename);
+        free(sf->filename);
+        free(sf);
+        return NULL;
+    }
+
+    memcpy(magic, SNAPSHOT_MAGIC, sizeof(magic));
+    version = SNAPSHOT_VERSION;
+    snapshot_field(sf, magic);
+    snapshot_field(sf, version);
+    if (memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+        snapshot_error(sf, "not a snapshot file\n");
+    else if (version != SNAPSHOT_VERSION)
+        snapshot_error(sf, "unsupported snapshot version %u\n", version);
+    return sf;
+}
+
+int snapshot_close(SnapshotFile *sf)
+{
+    int ret;
+
+    if (fclose(sf->f) != 0)
+        snapshot_error(sf, "write error\n");
+    if (sf->tmp_filename) {
+        if (!sf->error && rename(sf->tmp_filename, sf->filename) < 0) {
+            perror(sf->filename);
+            sf->error = TRUE;
+        }
+        if (sf->error)
+            unlink(sf->tmp_filename);
+        free(sf->tmp_filename);
+    }
+    ret = sf->error ? -1 : 0;
+    free(sf->filename);
+    free(sf);
+    return ret;
+}
+
+BOOL snapshot_is_load(SnapshotFile *sf)
+{
+    return sf->is_load;
+}
+
+BOOL snapshot_has_error(SnapshotFile *sf)
+{
+    return sf->error;
+}
+
+/* only the first error is printed */
+void snapshot_error(SnapshotFile *sf, const char *fmt, ...)
+{
+    va_list ap;
+
+    if (sf->error)
+        return;
+    sf->error = TRUE;
+    fprintf(stderr, "%s: ", sf->filename);
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+}
+
+void snapshot_data(SnapshotFile *sf, void *buf, size_t len)
+{
+    if (sf->is_load) {
+        if (sf->error || fread(buf, 1, len, sf->f) != len) {
+            snapshot_error(sf, "truncated snapshot\n");
+            memset(buf, 0, len);
+        }
+    } else {
+        if (!sf->error && fwrite(buf, 1, len, sf->f) != len)
+            snapshot_error(sf, "write error\n");
+    }
+}
+
+void snapshot_section(SnapshotFile *sf, const char *name)
+{
+    char buf[16];
+
+    memset(buf, 0, sizeof(buf));
+    pstrcpy(buf, sizeof(buf), name);
+    snapshot_field(sf, buf);
+    if (sf->is_load && strcmp(buf, name) != 0) {
+        snapshot_error(sf, "'%s' expected instead of '%.16s': the machine "
+                       "configuration is different\n", name, buf);
+    }
+}
+
+static uint64_t ram_align(uint64_t val)
+{
+    return (val + SNAPSHOT_RAM_ALIGN - 1) & ~(uint64_t)(SNAPSHOT_RAM_ALIGN - 1);
+}
+
+static BOOL is_zero_page(const uint8_t *buf)
+{
+    const uint64_t *p = (const uint64_t *)buf;
+    int i;
+
+    for(i = 0; i < SNAPSHOT_PAGE_SIZE / 8; i++) {
+        if (p[i] != 0)
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* write the non zero pages of 'pr' at 'offset' in the file */
+static void save_ram_range(SnapshotFile *sf, PhysMemoryRange *pr,
+                           uint64_t offset)
+{
+    uint64_t pos;
+
+    for(pos = 0; pos < pr->org_size && !sf->error;
+        pos += SNAPSHOT_PAGE_SIZE) {
+        if (is_zero_page(pr->phys_mem + pos))
+            continue;
+        if (fseeko(sf->f, offset + pos, SEEK_SET) < 0 ||
+            fwrite(pr->phys_mem + pos, 1, SNAPSHOT_PAGE_SIZE, sf->f) !=
+            SNAPSHOT_PAGE_SIZE) {
+            snapshot_error(sf, "write error\n");
+        }
+    }
+}
+
+void snapshot_ram(SnapshotFile *sf, PhysMemoryMap *map)
+{
+    PhysMemoryRange *pr;
+    uint64_t offset[PHYS_MEM_RANGE_MAX], data_offset, size;
+    int i, n;
+
+    snapshot_section(sf, "ram");
+    n = 0;
+    for(i = 0; i < map->n_phys_mem_range; i++) {
+        if (map->phys_mem_range[i].is_ram)
+            n++;
+    }
+    data_offset = ram_align(ftello(sf->f) + n * 2 * sizeof(uint64_t));
+
+    /* directory: size and file offset of each range */
+    for(i = 0; i < map->n_phys_mem_range; i++) {
+        pr = &map->phys_mem_range[i];
+        if (!pr->is_ram)
+            continue;
+        size = pr->org_size;
+        offset[i] = data_offset;
+        snapshot_field(sf, size);
+        snapshot_field(sf, offset[i]);
+        if (size != pr->org_size) {
+            snapshot_error(sf, "RAM size mismatch at 0x%08" PRIx64 "\n",
+                           pr->addr);
+        }
+        data_offset = ram_align(offset[i] + size);
+    }
+    if (sf->error)
+        return;
+
+    for(i = 0; i < map->n_phys_mem_range; i++) {
+        pr = &map->phys_mem_range[i];
+        if (!pr->is_ram)
+            continue;
+        if (sf->is_load) {
+            if (phys_mem_map_file(pr, fileno(sf->f), offset[i]) < 0) {
+                snapshot_error(sf, "could not map the RAM\n");
+                break;
+            }
+            /* the devices must see all the pages as modified */
+            if (pr->dirty_bits)
+                memset(pr->dirty_bits, 0xff, pr->dirty_bits_size);
+        } else {
+            save_ram_range(sf, pr, offset[i]);
+        }
+    }
+    /* the zero pages at the end are holes too */
+    if (!sf->is_load && !sf->error &&
+        (fflush(sf->f) != 0 || ftruncate(fileno(sf->f), data_offset) < 0))
+        snapshot_error(sf, "write error\n");
+}
@@ -0,0 +1,56 @@
+/*
+ * Machine snapshots
+ *
+ * Copyright (c) 2026 Fernando Lemos
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <stdio.h>
+
+#include "iomem.h"
+
+/* A snapshot is restored on a machine built from the same
+   configuration by the same executable: the state is stored in host
+   byte order and the same code is used to save and to load it (see
+   snapshot_data()). The RAM is stored at the end of the file, page
+   aligned, with holes instead of the zero pages. */
+typedef struct SnapshotFile SnapshotFile;
+
+SnapshotFile *snapshot_open(const char *filename, BOOL is_load);
+/* return -1 if there was an error */
+int snapshot_close(SnapshotFile *sf);
+BOOL snapshot_is_load(SnapshotFile *sf);
+BOOL snapshot_has_error(SnapshotFile *sf);
+void __attribute__((format(printf, 2, 3))) snapshot_error(SnapshotFile *sf,
+                                                          const char *fmt, ...);
+
+/* save or load 'len' bytes at 'buf' */
+void snapshot_data(SnapshotFile *sf, void *buf, size_t len);
+/* tag checked when loading to detect a different machine */
+void snapshot_section(SnapshotFile *sf, const char *name);
+/* save or load the RAM of 'map'. When loading, the RAM is mapped
+   from the file so that it is read on demand. */
+void snapshot_ram(SnapshotFile *sf, PhysMemoryMap *map);
+
+#define snapshot_field(sf, field) snapshot_data(sf, &(field), sizeof(field))
+
+#endif /* SNAPSHOT_H */
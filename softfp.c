@@ -25,10 +25,18 @@
 #include <stdio.h>
 #include <assert.h>
 #include <string.h>
+#include <math.h>
 
 #include "cutils.h"
 #include "softfp.h"
 
+/* the 32 and 64 bit operations use the host FPU when the result is
+   the same. The intermediate results must not have more precision. */
+#if defined(CONFIG_SOFTFP_HOST_FPU) && \
+    defined(__FLT_EVAL_METHOD__) && __FLT_EVAL_METHOD__ == 0
+#define USE_HOST_FPU
+#endif
+
 static inline int clz32(uint32_t a)
 {
     int r;
@@ -78,6 +86,8 @@ static inline int clz128(uint128_t a)
 #define F_SIZE 64
 #include "softfp_template.h"
 
+#undef USE_HOST_FPU
+
 #ifdef HAVE_INT128
 
 #define F_SIZE 128
@@ -230,6 +230,63 @@ BOOL isnan_sf(F_UINT a)
     return (a_exp == EXP_MASK && a_mant != 0);
 }
 
+#ifdef USE_HOST_FPU
+
+/* The host FPU gives the same results with round to nearest even for
+   the zero or normal operands, except for the tiny results whose
+   underflow flag is not computed. As the inexact flag is already set
+   in most programs, only the overflow needs to be detected. */
+#if F_SIZE == 32
+#define F_HOST float
+#define F_HOST_MIN __FLT_MIN__
+#define host_sqrt sqrtf
+#define host_fma fmaf
+#else
+#define F_HOST double
+#define F_HOST_MIN __DBL_MIN__
+#define host_sqrt sqrt
+#define host_fma fma
+#endif
+
+typedef union {
+    F_UINT u;
+    F_HOST f;
+} glue(HostFloat, F_SIZE);
+
+#define HostFloat glue(HostFloat, F_SIZE)
+#define host_fpu_ok glue(host_fpu_ok, F_SIZE)
+#define host_result_ok glue(host_result_ok, F_SIZE)
+#define iszero_sf glue(iszero_sf, F_SIZE)
+#define iszero_or_normal_sf glue(iszero_or_normal_sf, F_SIZE)
+
+static inline BOOL host_fpu_ok(RoundingModeEnum rm, uint32_t fflags)
+{
+    return rm == RM_RNE && (fflags & FFLAG_INEXACT);
+}
+
+static inline BOOL iszero_sf(F_UINT a)
+{
+    return (a & ~SIGN_MASK) == 0;
+}
+
+static inline BOOL iszero_or_normal_sf(F_UINT a)
+{
+    uint32_t a_exp;
+    a_exp = (a >> MANT_SIZE) & EXP_MASK;
+    return (a_exp != 0 && a_exp != EXP_MASK) || iszero_sf(a);
+}
+
+/* return FALSE if the soft float path must be used */
+static inline BOOL host_result_ok(F_HOST r, uint32_t *pfflags)
+{
+    if (__builtin_isinf(r)) {
+        *pfflags |= FFLAG_OVERFLOW | FFLAG_INEXACT;
+        return TRUE;
+    }
+    return __builtin_fabs(r) > F_HOST_MIN;
+}
+
+#endif /* USE_HOST_FPU */
 
 F_UINT add_sf(F_UINT a, F_UINT b, RoundingModeEnum rm,
               uint32_t *pfflags)
@@ -237,6 +294,19 @@ F_UINT add_sf(F_UINT a, F_UINT b, RoundingModeEnum rm,
     uint32_t a_sign, b_sign, a_exp, b_exp;
     F_UINT tmp, a_mant, b_mant;
 
+#ifdef USE_HOST_FPU
+    if (host_fpu_ok(rm, *pfflags) &&
+        iszero_or_normal_sf(a) && iszero_or_normal_sf(b)) {
+        HostFloat ha, hb, hr;
+        ha.u = a;
+        hb.u = b;
+        hr.f = ha.f + hb.f;
+        /* the sum of two zeros is exact */
+        if (host_result_ok(hr.f, pfflags) || (iszero_sf(a) && iszero_sf(b)))
+            return hr.u;
+    }
+#endif
+
     /* swap so that  abs(a) >= abs(b) */
     if ((a & ~SIGN_MASK) < (b & ~SIGN_MASK)) {
         tmp = a;
@@ -353,6 +423,18 @@ F_UINT mul_sf(F_UINT a, F_UINT b, RoundingModeEnum rm,
     int32_t a_exp, b_exp, r_exp;
     F_UINT a_mant, b_mant, r_mant, r_mant_low;
 
+#ifdef USE_HOST_FPU
+    if (host_fpu_ok(rm, *pfflags) &&
+        iszero_or_normal_sf(a) && iszero_or_normal_sf(b)) {
+        HostFloat ha, hb, hr;
+        ha.u = a;
+        hb.u = b;
+        hr.f = ha.f * hb.f;
+        if (host_result_ok(hr.f, pfflags) || iszero_sf(a) || iszero_sf(b))
+            return hr.u;
+    }
+#endif
+
     a_sign = a >> (F_SIZE - 1);
     b_sign = b >> (F_SIZE - 1);
     r_sign = a_sign ^ b_sign;
@@ -406,6 +488,20 @@ F_UINT fma_sf(F_UINT a, F_UINT b, F_UINT c, RoundingModeEnum rm,
     int32_t a_exp, b_exp, c_exp, r_exp, shift;
     F_UINT a_mant, b_mant, c_mant, r_mant1, r_mant0, c_mant1, c_mant0, mask;
 
+#ifdef USE_HOST_FPU
+    if (host_fpu_ok(rm, *pfflags) && iszero_or_normal_sf(a) &&
+        iszero_or_normal_sf(b) && iszero_or_normal_sf(c)) {
+        HostFloat ha, hb, hc, hr;
+        ha.u = a;
+        hb.u = b;
+        hc.u = c;
+        hr.f = host_fma(ha.f, hb.f, hc.f);
+        if (host_result_ok(hr.f, pfflags) ||
+            ((iszero_sf(a) || iszero_sf(b)) && iszero_sf(c)))
+            return hr.u;
+    }
+#endif
+
     a_sign = a >> (F_SIZE - 1);
     b_sign = b >> (F_SIZE - 1);
     c_sign = c >> (F_SIZE - 1);
@@ -593,6 +689,19 @@ F_UINT div_sf(F_UINT a, F_UINT b, RoundingModeEnum rm,
     int32_t a_exp, b_exp, r_exp;
     F_UINT a_mant, b_mant, r_mant, r;
 
+#ifdef USE_HOST_FPU
+    /* the division by zero is handled by the soft path */
+    if (host_fpu_ok(rm, *pfflags) &&
+        iszero_or_normal_sf(a) && iszero_or_normal_sf(b) && !iszero_sf(b)) {
+        HostFloat ha, hb, hr;
+        ha.u = a;
+        hb.u = b;
+        hr.f = ha.f / hb.f;
+        if (host_result_ok(hr.f, pfflags) || iszero_sf(a))
+            return hr.u;
+    }
+#endif
+
     a_sign = a >> (F_SIZE - 1);
     b_sign = b >> (F_SIZE - 1);
     r_sign = a_sign ^ b_sign;
@@ -724,6 +833,17 @@ F_UINT sqrt_sf(F_UINT a, RoundingModeEnum rm,
     int32_t a_exp;
     F_UINT a_mant;
 
+#ifdef USE_HOST_FPU
+    /* no overflow nor underflow. The negative numbers are invalid. */
+    if (host_fpu_ok(rm, *pfflags) && iszero_or_normal_sf(a) &&
+        (!(a & SIGN_MASK) || iszero_sf(a))) {
+        HostFloat ha, hr;
+        ha.u = a;
+        hr.f = host_sqrt(ha.f);
+        return hr.u;
+    }
+#endif
+
     a_sign = a >> (F_SIZE - 1);
     a_exp = (a >> MANT_SIZE) & EXP_MASK;
     a_mant = a & MANT_MASK;
@@ -1124,3 +1244,15 @@ uint64_t glue(glue(cvt_sf, F_SIZE), _sf64)(F_UINT a, RoundingModeEnum rm,
 #undef mul_u
 #undef cvt_sf32_sf
 #undef cvt_sf64_sf
+
+#ifdef USE_HOST_FPU
+#undef F_HOST
+#undef F_HOST_MIN
+#undef host_sqrt
+#undef host_fma
+#undef HostFloat
+#undef host_fpu_ok
+#undef host_result_ok
+#undef iszero_sf
+#undef iszero_or_normal_sf
+#endif
@@ -35,6 +35,8 @@
 #ifndef _WIN32
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #endif
 #if !defined(_WIN32) && !defined(__APPLE__)
 #include <net/if.h>
@@ -58,6 +60,9 @@
 #include "slirp/libslirp.h"
 #endif
 
+/* set by C-a s or SIGUSR1, handled by the main loop */
+static volatile sig_atomic_t snapshot_request;
+
 #ifndef _WIN32
 
 typedef struct {
@@ -133,10 +138,14 @@ static int console_read(void *opaque, uint8_t *buf, int len)
             case 'x':
                 printf("Terminated\n");
                 exit(0);
+            case 's':
+                snapshot_request = 1;
+                break;
             case 'h':
                 printf("\n"
                        "C-a h   print this help\n"
                        "C-a x   exit emulator\n"
+                       "C-a s   save a snapshot (-save-snapshot option)\n"
                        "C-a C-a send C-a\n"
                        );
                 break;
@@ -225,6 +234,7 @@ typedef enum {
 
 typedef struct BlockDeviceFile {
     FILE *f;
+    char *filename;
     int64_t nb_sectors;
     BlockDeviceModeEnum mode;
     uint8_t **sector_table;
@@ -342,6 +352,7 @@ static BlockDevice *block_device_init(const char *filename,
     bf->mode = mode;
     bf->nb_sectors = file_size / 512;
     bf->f = f;
+    bf->filename = strdup(filename);
 
     if (mode == BF_MODE_SNAPSHOT) {
         bf->sector_table = mallocz(sizeof(bf->sector_table[0]) *
@@ -355,6 +366,21 @@ static BlockDevice *block_device_init(const char *filename,
     return bs;
 }
 
+/* the file offset is shared with the processes forked from this one */
+static void block_device_reopen(BlockDevice *bs)
+{
+    BlockDeviceFile *bf = bs->opaque;
+    FILE *f;
+
+    f = fopen(bf->filename, bf->mode == BF_MODE_RW ? "r+b" : "rb");
+    if (!f) {
+        perror(bf->filename);
+        exit(1);
+    }
+    fclose(bf->f);
+    bf->f = f;
+}
+
 #if !defined(_WIN32) && !defined(__APPLE__)
 
 typedef struct {
@@ -503,9 +529,8 @@ static void slirp_select_poll1(EthernetDevice *net,
     slirp_select_poll(slirp_state, rfds, wfds, efds, (select_ret <= 0));
 }
 
-static EthernetDevice *slirp_open(void)
+static Slirp *slirp_new(EthernetDevice *net)
 {
-    EthernetDevice *net;
     struct in_addr net_addr  = { .s_addr = htonl(0x0a000200) }; /* 10.0.2.0 */
     struct in_addr mask = { .s_addr = htonl(0xffffff00) }; /* 255.255.255.0 */
     struct in_addr host = { .s_addr = htonl(0x0a000202) }; /* 10.0.2.2 */
@@ -514,15 +539,22 @@ static EthernetDevice *slirp_open(void)
     const char *bootfile = NULL;
     const char *vhostname = NULL;
     int restricted = 0;
-    
+
+    return slirp_init(restricted, net_addr, mask, host, vhostname,
+                      "", bootfile, dhcp, dns, net);
+}
+
+static EthernetDevice *slirp_open(void)
+{
+    EthernetDevice *net;
+
     if (slirp_state) {
         fprintf(stderr, "Only a single slirp instance is allowed\n");
         return NULL;
     }
     net = mallocz(sizeof(*net));
 
-    slirp_state = slirp_init(restricted, net_addr, mask, host, vhostname,
-                             "", bootfile, dhcp, dns, net);
+    slirp_state = slirp_new(net);
     
     net->mac_addr[0] = 0x02;
     net->mac_addr[1] = 0x00;
@@ -538,8 +570,320 @@ static EthernetDevice *slirp_open(void)
     return net;
 }
 
+/* the host sockets of the connections are shared with the processes
+   forked from this one, so a clone starts with no connection */
+static void slirp_reopen(EthernetDevice *net)
+{
+    slirp_cleanup(slirp_state);
+    slirp_state = slirp_new(net);
+    net->opaque = slirp_state;
+}
+
 #endif /* CONFIG_SLIRP */
 
+/*******************************************************/
+/* fork server */
+
+#ifndef _WIN32
+
+static int fork_server_fd = -1;
+static int fork_clone_count;
+/* backends re-opened by each clone */
+static BlockDevice *fork_drives[MAX_DRIVE_DEVICE];
+static int fork_drive_count;
+static EthernetDevice *fork_slirp_net;
+
+static int fork_server_open(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "%s: socket path too long\n", path);
+        return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    pstrcpy(addr.sun_path, sizeof(addr.sun_path), path);
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, 16) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    fork_server_fd = fd;
+    return 0;
+}
+
+/* Accept the clone requests and fork() for each one. Only returns in
+   the clones, with the clone number: the connection becomes the
+   console of the clone and the guest RAM is shared copy-on-write with
+   the server. */
+static int fork_server_run(void)
+{
+    struct sigaction sig;
+    pid_t pid;
+    int fd, i;
+
+    /* the clones do not become zombies */
+    sig.sa_handler = SIG_DFL;
+    sigemptyset(&sig.sa_mask);
+    sig.sa_flags = SA_NOCLDWAIT;
+    sigaction(SIGCHLD, &sig, NULL);
+
+    fprintf(stderr, "\nfork server: ready\n");
+    for(;;) {
+        fd = accept(fork_server_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("accept");
+            exit(1);
+        }
+        fork_clone_count++;
+        fflush(NULL);
+        pid = fork();
+        if (pid == 0)
+            break;
+        if (pid < 0) {
+            perror("fork");
+        } else {
+            fprintf(stderr, "fork server: clone %d: pid %d\n",
+                    fork_clone_count, (int)pid);
+        }
+        close(fd);
+    }
+
+    close(fork_server_fd);
+    fork_server_fd = -1;
+    dup2(fd, 0);
+    dup2(fd, 1);
+    close(fd);
+    fcntl(0, F_SETFL, O_NONBLOCK);
+    for(i = 0; i < fork_drive_count; i++)
+        block_device_reopen(fork_drives[i]);
+#ifdef CONFIG_SLIRP
+    if (fork_slirp_net)
+        slirp_reopen(fork_slirp_net);
+#endif
+    return fork_clone_count;
+}
+
+#endif /* !_WIN32 */
+
+/*******************************************************/
+/* icount mode */
+
+/* The RTC is derived from the instruction count and the host inputs
+   are only delivered between two calls to virt_machine_interp(), so
+   the execution only depends on the instruction count at which each
+   input is delivered. The inputs can be recorded and replayed to
+   execute the same instruction stream again. */
+
+typedef enum {
+    ICOUNT_EVENT_CONSOLE,
+    ICOUNT_EVENT_RESIZE,
+    ICOUNT_EVENT_NET,
+} IcountEventTypeEnum;
+
+typedef struct {
+    uint64_t insn_count;
+    uint32_t type; /* ICOUNT_EVENT_x */
+    uint32_t len; /* length of the data following the header */
+} IcountEvent;
+
+typedef struct IcountPacket {
+    struct IcountPacket *next;
+    int len;
+    uint8_t buf[];
+} IcountPacket;
+
+#define ICOUNT_NET_QUEUE_MAX 64
+
+static BOOL icount_enabled;
+static FILE *icount_record_file;
+static FILE *icount_replay_file; /* NULL when the replay is done */
+static IcountEvent icount_replay_event; /* next replayed event */
+/* packets from the network backend, delivered by icount_net_deliver() */
+static IcountPacket *icount_net_queue, **icount_net_queue_tail;
+static int icount_net_queue_len;
+static BOOL (*icount_device_can_write_packet)(EthernetDevice *net);
+static void (*icount_device_write_packet)(EthernetDevice *net,
+                                          const uint8_t *buf, int len);
+
+static void icount_read_event(void)
+{
+    if (fread(&icount_replay_event, sizeof(icount_replay_event), 1,
+              icount_replay_file) != 1) {
+        fclose(icount_replay_file);
+        icount_replay_file = NULL;
+        fprintf(stderr, "\nicount: end of the replay\n");
+    }
+}
+
+static void icount_record_event(VirtMachine *m, int type,
+                                const void *buf, int len)
+{
+    IcountEvent ev;
+
+    if (!icount_record_file)
+        return;
+    ev.insn_count = virt_machine_get_icount(m);
+    ev.type = type;
+    ev.len = len;
+    fwrite(&ev, 1, sizeof(ev), icount_record_file);
+    fwrite(buf, 1, len, icount_record_file);
+    fflush(icount_record_file);
+}
+
+/* the live inputs are ignored during a replay */
+static BOOL icount_net_can_write_packet(EthernetDevice *net)
+{
+    return icount_net_queue_len < ICOUNT_NET_QUEUE_MAX;
+}
+
+static void icount_net_write_packet(EthernetDevice *net,
+                                    const uint8_t *buf, int len)
+{
+    IcountPacket *pkt;
+
+    if (icount_replay_file)
+        return;
+    pkt = malloc(sizeof(*pkt) + len);
+    pkt->next = NULL;
+    pkt->len = len;
+    memcpy(pkt->buf, buf, len);
+    *icount_net_queue_tail = pkt;
+    icount_net_queue_tail = &pkt->next;
+    icount_net_queue_len++;
+}
+
+static void icount_net_deliver(VirtMachine *m)
+{
+    IcountPacket *pkt;
+
+    while (icount_net_queue) {
+        pkt = icount_net_queue;
+        icount_net_queue = pkt->next;
+        /* dropped if the guest has no receive buffer */
+        if (icount_device_can_write_packet(m->net)) {
+            icount_record_event(m, ICOUNT_EVENT_NET, pkt->buf, pkt->len);
+            icount_device_write_packet(m->net, pkt->buf, pkt->len);
+        }
+        free(pkt);
+    }
+    icount_net_queue_tail = &icount_net_queue;
+    icount_net_queue_len = 0;
+}
+
+/* deliver the recorded events of the current instruction count */
+static void icount_replay(VirtMachine *m)
+{
+    uint64_t insn_count;
+    uint8_t *buf;
+    int32_t size[2];
+
+    insn_count = virt_machine_get_icount(m);
+    while (icount_replay_file &&
+           icount_replay_event.insn_count <= insn_count) {
+        if (icount_replay_event.insn_count < insn_count) {
+            fprintf(stderr, "\nicount: the replay diverged at instruction "
+                    "%" PRIu64 "\n", insn_count);
+            exit(1);
+        }
+        buf = malloc(icount_replay_event.len);
+        if (fread(buf, 1, icount_replay_event.len, icount_replay_file) !=
+            icount_replay_event.len) {
+            fprintf(stderr, "\nicount: truncated replay file\n");
+            exit(1);
+        }
+        switch(icount_replay_event.type) {
+        case ICOUNT_EVENT_CONSOLE:
+            if (!m->console_dev)
+                goto invalid;
+            virtio_console_write_data(m->console_dev, buf,
+                                      icount_replay_event.len);
+            break;
+        case ICOUNT_EVENT_RESIZE:
+            if (!m->console_dev || icount_replay_event.len != sizeof(size))
+                goto invalid;
+            memcpy(size, buf, sizeof(size));
+            virtio_console_resize_event(m->console_dev, size[0], size[1]);
+            break;
+        case ICOUNT_EVENT_NET:
+            if (!m->net)
+                goto invalid;
+            icount_device_write_packet(m->net, buf, icount_replay_event.len);
+            break;
+        default:
+        invalid:
+            fprintf(stderr, "\nicount: invalid replay file\n");
+            exit(1);
+        }
+        free(buf);
+        icount_read_event();
+    }
+}
+
+static int icount_init(VirtMachine *m, const char *record_filename,
+                       const char *replay_filename)
+{
+    if (!m->vmc->virt_machine_get_icount) {
+        fprintf(stderr, "The icount mode is not supported by this machine\n");
+        return -1;
+    }
+    if (record_filename) {
+        icount_record_file = fopen(record_filename, "wb");
+        if (!icount_record_file) {
+            perror(record_filename);
+            return -1;
+        }
+    }
+    if (replay_filename) {
+        icount_replay_file = fopen(replay_filename, "rb");
+        if (!icount_replay_file) {
+            perror(replay_filename);
+            return -1;
+        }
+        icount_read_event();
+    }
+    if (m->net) {
+        icount_device_can_write_packet = m->net->device_can_write_packet;
+        icount_device_write_packet = m->net->device_write_packet;
+        m->net->device_can_write_packet = icount_net_can_write_packet;
+        m->net->device_write_packet = icount_net_write_packet;
+        icount_net_queue_tail = &icount_net_queue;
+    }
+    icount_enabled = TRUE;
+    return 0;
+}
+
+static void vm_console_write_data(VirtMachine *m, const uint8_t *buf, int len)
+{
+    if (icount_replay_file)
+        return;
+    icount_record_event(m, ICOUNT_EVENT_CONSOLE, buf, len);
+    virtio_console_write_data(m->console_dev, buf, len);
+}
+
+static void vm_console_resize_event(VirtMachine *m, int width, int height)
+{
+    int32_t size[2];
+
+    if (icount_replay_file)
+        return;
+    size[0] = width;
+    size[1] = height;
+    icount_record_event(m, ICOUNT_EVENT_RESIZE, size, sizeof(size));
+    virtio_console_resize_event(m->console_dev, width, height);
+}
+
 #define MAX_EXEC_CYCLE 500000
 #define MAX_SLEEP_TIME 10 /* in ms */
 
@@ -553,6 +897,10 @@ void virt_machine_run(VirtMachine *m)
 #endif
     
     delay = virt_machine_get_sleep_duration(m, MAX_SLEEP_TIME);
+    /* do not wait if a replayed event is due */
+    if (icount_replay_file &&
+        icount_replay_event.insn_count <= virt_machine_get_icount(m))
+        delay = 0;
     
     /* wait for an event */
     FD_ZERO(&rfds);
@@ -569,7 +917,7 @@ void virt_machine_run(VirtMachine *m)
         if (s->resize_pending) {
             int width, height;
             console_get_size(s, &width, &height);
-            virtio_console_resize_event(m->console_dev, width, height);
+            vm_console_resize_event(m, width, height);
             s->resize_pending = FALSE;
         }
     }
@@ -582,7 +930,9 @@ void virt_machine_run(VirtMachine *m)
 #endif
     tv.tv_sec = delay / 1000;
     tv.tv_usec = (delay % 1000) * 1000;
+    virt_machine_io_lock(m, FALSE);
     ret = select(fd_max + 1, &rfds, &wfds, &efds, &tv);
+    virt_machine_io_lock(m, TRUE);
     if (m->net) {
         m->net->select_poll(m->net, &rfds, &wfds, &efds, ret);
     }
@@ -595,7 +945,7 @@ void virt_machine_run(VirtMachine *m)
             len = min_int(len, sizeof(buf));
             ret = m->console->read_data(m->console->opaque, buf, len);
             if (ret > 0) {
-                virtio_console_write_data(m->console_dev, buf, ret);
+                vm_console_write_data(m, buf, ret);
             }
         }
 #endif
@@ -604,6 +954,11 @@ void virt_machine_run(VirtMachine *m)
 #ifdef CONFIG_SDL
     sdl_refresh(m);
 #endif
+    if (icount_enabled) {
+        if (m->net)
+            icount_net_deliver(m);
+        icount_replay(m);
+    }
     
     virt_machine_interp(m, MAX_EXEC_CYCLE);
 }
@@ -618,6 +973,14 @@ static struct option options[] = {
     { "append", required_argument },
     { "no-accel", no_argument },
     { "build-preload", required_argument },
+    { "jit", no_argument },
+    { "save-snapshot", required_argument },
+    { "load-snapshot", required_argument },
+    { "fork-server", required_argument },
+    { "rtc-warp", no_argument },
+    { "icount", no_argument },
+    { "icount-record", required_argument },
+    { "icount-replay", required_argument },
     { NULL },
 };
 
@@ -632,6 +995,25 @@ void help(void)
            "                  emulated software\n"
            "-append cmdline   append cmdline to the kernel command line\n"
            "-no-accel         disable VM acceleration (KVM, x86 machine only)\n"
+           "-jit              enable the dynamic translator (RISC-V machine on\n"
+           "                  x86-64 hosts only)\n"
+           "-save-snapshot file\n"
+           "                  save the machine state to 'file' when C-a s is\n"
+           "                  pressed or SIGUSR1 is received (RISC-V machine only)\n"
+           "-load-snapshot file\n"
+           "                  start from a snapshot made with the same configuration\n"
+           "-rtc-warp         the time is derived from the instruction count and skips\n"
+           "                  the periods where the CPU is idle (RISC-V machine only)\n"
+           "-icount           deterministic execution: the time is derived from the\n"
+           "                  instruction count as with -rtc-warp and the inputs are\n"
+           "                  delivered between the execution slices (RISC-V machine only)\n"
+           "-icount-record file\n"
+           "                  icount mode, record the console and network inputs\n"
+           "-icount-replay file\n"
+           "                  icount mode, replay the recorded inputs\n"
+           "-fork-server path\n"
+           "                  when the guest is ready, fork a clone for each connection\n"
+           "                  to the local socket 'path' (RISC-V machine only)\n"
            "\n"
            "Console keys:\n"
            "Press C-a x to exit the emulator, C-a h to get some help.\n");
@@ -653,6 +1035,13 @@ static BOOL net_poll_cb(void *arg)
 
 #endif
 
+#ifndef _WIN32
+static void snapshot_signal_handler(int sig)
+{
+    snapshot_request = 1;
+}
+#endif
+
 #if defined(__APPLE__) && TARGET_OS_IPHONE
 int temu_main(int argc, char **argv)
 #else
@@ -661,8 +1050,10 @@ int main(int argc, char **argv)
 {
     VirtMachine *s;
     const char *path, *cmdline, *build_preload_file;
-    int c, option_index, i, ram_size, accel_enable;
-    BOOL allow_ctrlc;
+    const char *save_snapshot_file, *load_snapshot_file, *fork_server_path;
+    const char *icount_record, *icount_replay;
+    int c, option_index, i, ram_size, accel_enable, jit_enable;
+    BOOL allow_ctrlc, rtc_warp, icount;
     BlockDeviceModeEnum drive_mode;
     VirtMachineParams p_s, *p = &p_s;
 
@@ -671,8 +1062,16 @@ int main(int argc, char **argv)
     (void)allow_ctrlc;
     drive_mode = BF_MODE_SNAPSHOT;
     accel_enable = -1;
+    jit_enable = -1;
     cmdline = NULL;
     build_preload_file = NULL;
+    save_snapshot_file = NULL;
+    load_snapshot_file = NULL;
+    fork_server_path = NULL;
+    rtc_warp = FALSE;
+    icount = FALSE;
+    icount_record = NULL;
+    icount_replay = NULL;
     for(;;) {
         c = getopt_long_only(argc, argv, "hm:", options, &option_index);
         if (c == -1)
@@ -698,6 +1097,32 @@ int main(int argc, char **argv)
             case 6: /* build-preload */
                 build_preload_file = optarg;
                 break;
+            case 7: /* jit */
+                jit_enable = TRUE;
+                break;
+            case 8: /* save-snapshot */
+                save_snapshot_file = optarg;
+                break;
+            case 9: /* load-snapshot */
+                load_snapshot_file = optarg;
+                break;
+            case 10: /* fork-server */
+                fork_server_path = optarg;
+                break;
+            case 11: /* rtc-warp */
+                rtc_warp = TRUE;
+                break;
+            case 12: /* icount */
+                icount = TRUE;
+                break;
+            case 13: /* icount-record */
+                icount = TRUE;
+                icount_record = optarg;
+                break;
+            case 14: /* icount-replay */
+                icount = TRUE;
+                icount_replay = optarg;
+                break;
             default:
                 fprintf(stderr, "unknown option index: %d\n", option_index);
                 exit(1);
@@ -736,10 +1161,44 @@ int main(int argc, char **argv)
     }
     if (accel_enable != -1)
         p->accel_enable = accel_enable;
+    if (jit_enable != -1)
+        p->jit_enable = jit_enable;
+    if (rtc_warp || icount)
+        p->rtc_warp = TRUE;
+    if (icount) {
+        if (icount_record && icount_replay) {
+            fprintf(stderr, "-icount-record and -icount-replay cannot be "
+                    "used together\n");
+            exit(1);
+        }
+        if (p->display_device) {
+            fprintf(stderr, "The icount mode does not support the graphical "
+                    "display\n");
+            exit(1);
+        }
+    }
     if (cmdline) {
         vm_add_cmdline(p, cmdline);
     }
     
+    if (fork_server_path) {
+#ifdef _WIN32
+        fprintf(stderr, "The fork server is not supported\n");
+        exit(1);
+#else
+        /* the clones would modify the same disk image */
+        if (drive_mode == BF_MODE_RW && p->drive_count > 0) {
+            fprintf(stderr, "-rw cannot be used with the fork server\n");
+            exit(1);
+        }
+        if (p->display_device) {
+            fprintf(stderr, "The fork server does not support the "
+                    "graphical display\n");
+            exit(1);
+        }
+#endif
+    }
+
     /* open the files & devices */
     for(i = 0; i < p->drive_count; i++) {
         BlockDevice *drive;
@@ -747,6 +1206,17 @@ int main(int argc, char **argv)
         fname = get_file_path(p->cfg_filename, p->tab_drive[i].filename);
 #ifdef CONFIG_FS_NET
         if (is_url(fname)) {
+            if (fork_server_path) {
+                fprintf(stderr, "%s: remote disks are not supported by the "
+                        "fork server\n", fname);
+                exit(1);
+            }
+            /* the completions are asynchronous */
+            if (icount) {
+                fprintf(stderr, "%s: remote disks are not supported in "
+                        "icount mode\n", fname);
+                exit(1);
+            }
             net_completed = FALSE;
             drive = block_device_init_http(fname, 128 * 1024,
                                            net_start_cb, NULL);
@@ -756,6 +1226,9 @@ int main(int argc, char **argv)
 #endif
         {
             drive = block_device_init(fname, drive_mode);
+#ifndef _WIN32
+            fork_drives[fork_drive_count++] = drive;
+#endif
         }
         free(fname);
         p->tab_drive[i].block_dev = drive;
@@ -767,6 +1240,16 @@ int main(int argc, char **argv)
         path = p->tab_fs[i].filename;
 #ifdef CONFIG_FS_NET
         if (is_url(path)) {
+            if (fork_server_path) {
+                fprintf(stderr, "%s: remote filesystems are not supported "
+                        "by the fork server\n", path);
+                exit(1);
+            }
+            if (icount) {
+                fprintf(stderr, "%s: remote filesystems are not supported "
+                        "in icount mode\n", path);
+                exit(1);
+            }
             fs = fs_net_init(path, NULL, NULL);
             if (!fs)
                 exit(1);
@@ -799,10 +1282,17 @@ int main(int argc, char **argv)
             p->tab_eth[i].net = slirp_open();
             if (!p->tab_eth[i].net)
                 exit(1);
+            fork_slirp_net = p->tab_eth[i].net;
         } else
 #endif
 #if !defined(_WIN32) && !defined(__APPLE__)
         if (!strcmp(p->tab_eth[i].driver, "tap")) {
+            /* the clones cannot share the interface */
+            if (fork_server_path) {
+                fprintf(stderr, "tap network is not supported by the "
+                        "fork server\n");
+                exit(1);
+            }
             p->tab_eth[i].net = tun_open(p->tab_eth[i].ifname);
             if (!p->tab_eth[i].net)
                 exit(1);
@@ -829,7 +1319,12 @@ int main(int argc, char **argv)
         p->console = console_init(allow_ctrlc);
 #endif
     }
-    p->rtc_real_time = TRUE;
+    p->rtc_real_time = !p->rtc_warp;
+
+#ifndef _WIN32
+    if (fork_server_path && fork_server_open(fork_server_path) < 0)
+        exit(1);
+#endif
 
     s = virt_machine_init(p);
     if (!s)
@@ -837,12 +1332,49 @@ int main(int argc, char **argv)
     
     virt_machine_free_config(p);
 
+    if (icount && icount_init(s, icount_record, icount_replay) < 0)
+        exit(1);
+
+    if (load_snapshot_file) {
+        if (virt_machine_snapshot(s, load_snapshot_file, TRUE) < 0)
+            exit(1);
+    }
+#ifndef _WIN32
+    if (save_snapshot_file) {
+        struct sigaction sig;
+        sig.sa_handler = snapshot_signal_handler;
+        sigemptyset(&sig.sa_mask);
+        sig.sa_flags = 0;
+        sigaction(SIGUSR1, &sig, NULL);
+    }
+#endif
+
     if (s->net) {
         s->net->device_set_carrier(s->net, TRUE);
     }
     
     for(;;) {
         virt_machine_run(s);
+        if (s->fork_ready) {
+            int clone_id = 0;
+            virt_machine_fork_prepare(s);
+#ifndef _WIN32
+            if (fork_server_fd >= 0)
+                clone_id = fork_server_run();
+#endif
+            virt_machine_fork_resume(s, clone_id);
+        }
+        if (snapshot_request) {
+            snapshot_request = 0;
+            if (!save_snapshot_file) {
+                fprintf(stderr, "\nuse the -save-snapshot option to save "
+                        "a snapshot\n");
+            } else if (virt_machine_snapshot(s, save_snapshot_file,
+                                             FALSE) == 0) {
+                fprintf(stderr, "\nsnapshot saved to %s\n",
+                        save_snapshot_file);
+            }
+        }
     }
     virt_machine_end(s);
     return 0;
@@ -148,6 +148,8 @@ struct VIRTIODevice {
     VIRTIODeviceRecvFunc *device_recv;
     void (*config_write)(VIRTIODevice *s); /* called after the config
                                               is written */
+    /* save or load the device specific state, NULL if none */
+    void (*snapshot)(VIRTIODevice *s, SnapshotFile *sf);
     uint32_t config_space_size; /* in bytes, must be multiple of 4 */
     uint8_t config_space[MAX_CONFIG_SPACE_SIZE];
 };
@@ -295,6 +297,38 @@ static void virtio_init(VIRTIODevice *s, VIRTIOBusDef *bus,
     virtio_reset(s);
 }
 
+void virtio_snapshot(VIRTIODevice *s, SnapshotFile *sf)
+{
+    QueueState *qs;
+    uint32_t device_id;
+    int i;
+
+    snapshot_section(sf, "virtio");
+    device_id = s->device_id;
+    snapshot_field(sf, device_id);
+    if (device_id != s->device_id) {
+        snapshot_error(sf, "virtio device %d expected instead of %d\n",
+                       s->device_id, device_id);
+        return;
+    }
+    snapshot_field(sf, s->int_status);
+    snapshot_field(sf, s->status);
+    snapshot_field(sf, s->device_features_sel);
+    snapshot_field(sf, s->queue_sel);
+    for(i = 0; i < MAX_QUEUE; i++) {
+        qs = &s->queue[i];
+        snapshot_field(sf, qs->ready);
+        snapshot_field(sf, qs->num);
+        snapshot_field(sf, qs->last_avail_idx);
+        snapshot_field(sf, qs->desc_addr);
+        snapshot_field(sf, qs->avail_addr);
+        snapshot_field(sf, qs->used_addr);
+    }
+    snapshot_field(sf, s->config_space);
+    if (s->snapshot)
+        s->snapshot(s, sf);
+}
+
 static uint16_t virtio_read16(VIRTIODevice *s, virtio_phys_addr_t addr)
 {
     uint8_t *ptr;
@@ -1114,6 +1148,15 @@ static int virtio_block_recv_request(VIRTIODevice *s, int queue_idx,
     return 0;
 }
 
+static void virtio_block_snapshot(VIRTIODevice *s, SnapshotFile *sf)
+{
+    VIRTIOBlockDevice *s1 = (VIRTIOBlockDevice *)s;
+
+    /* the disk contents are not saved */
+    if (s1->req_in_progress)
+        snapshot_error(sf, "block request in progress\n");
+}
+
 VIRTIODevice *virtio_block_init(VIRTIOBusDef *bus, BlockDevice *bs)
 {
     VIRTIOBlockDevice *s;
@@ -1122,6 +1165,7 @@ VIRTIODevice *virtio_block_init(VIRTIOBusDef *bus, BlockDevice *bs)
     s = mallocz(sizeof(*s));
     virtio_init(&s->common, bus,
                 2, 8, virtio_block_recv_request);
+    s->common.snapshot = virtio_block_snapshot;
     s->bs = bs;
     
     nb_sectors = bs->get_sector_count(bs);
@@ -1629,6 +1673,12 @@ static void virtio_input_config_write(VIRTIODevice *s)
     }
 }
 
+static void virtio_input_snapshot(VIRTIODevice *s, SnapshotFile *sf)
+{
+    VIRTIOInputDevice *s1 = (VIRTIOInputDevice *)s;
+    snapshot_field(sf, s1->buttons_state);
+}
+
 VIRTIODevice *virtio_input_init(VIRTIOBusDef *bus, VirtioInputTypeEnum type)
 {
     VIRTIOInputDevice *s;
@@ -1639,6 +1689,7 @@ VIRTIODevice *virtio_input_init(VIRTIOBusDef *bus, VirtioInputTypeEnum type)
     s->common.queue[0].manual_recv = TRUE;
     s->common.device_features = 0;
     s->common.config_write = virtio_input_config_write;
+    s->common.snapshot = virtio_input_snapshot;
     s->type = type;
     return (VIRTIODevice *)s;
 }
@@ -2621,6 +2672,16 @@ static int virtio_9p_recv_request(VIRTIODevice *s1, int queue_idx,
     goto error;
 }
 
+/* the open files of the host cannot be saved, so it only works
+   before the guest attaches the file system */
+static void virtio_9p_snapshot(VIRTIODevice *s, SnapshotFile *sf)
+{
+    VIRTIO9PDevice *s1 = (VIRTIO9PDevice *)s;
+
+    if (!list_empty(&s1->fid_list) || s1->req_in_progress)
+        snapshot_error(sf, "9p file system in use\n");
+}
+
 VIRTIODevice *virtio_9p_init(VIRTIOBusDef *bus, FSDevice *fs,
                              const char *mount_tag)
 
@@ -2634,6 +2695,7 @@ VIRTIODevice *virtio_9p_init(VIRTIOBusDef *bus, FSDevice *fs,
     virtio_init(&s->common, bus,
                 9, 2 + len, virtio_9p_recv_request);
     s->common.device_features = 1 << 0;
+    s->common.snapshot = virtio_9p_snapshot;
 
     /* set the mount tag */
     cfg = s->common.config_space;
@@ -28,6 +28,7 @@
 
 #include "iomem.h"
 #include "pci.h"
+#include "snapshot.h"
 
 #define VIRTIO_PAGE_SIZE 4096
 
@@ -58,6 +59,9 @@ typedef struct VIRTIODevice VIRTIODevice;
 #define VIRTIO_DEBUG_9P (1 << 1)
 
 void virtio_set_debug(VIRTIODevice *s, int debug_flags);
+/* save or load the state of the transport and of the device. The
+   backends (disk images, network, host files) are not saved. */
+void virtio_snapshot(VIRTIODevice *s, SnapshotFile *sf);
 
 /* block device */
 
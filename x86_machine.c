@@ -1998,7 +1998,8 @@ static VirtMachine *pc_machine_init(const VirtMachineParams *p)
     }
 
     /* set the RAM mapping and leave the VGA addresses empty */
-    cpu_register_ram(s->mem_map, 0xc0000, p->ram_size - 0xc0000, 0);
+    cpu_register_ram(s->mem_map, 0xc0000, p->ram_size - 0xc0000,
+                     p->ram_flags);
     cpu_register_ram(s->mem_map, 0, 0xa0000, 0);
     
     /* devices */